@@ -0,0 +1,94 @@
+#include "npy_array/aligned_buffer.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <utility>
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+namespace npy_array {
+
+namespace {
+
+// The size of a transparent huge page on x86-64 and most AArch64 kernels.
+constexpr int64_t kHugePageSize = int64_t{2} << 20;
+
+uint8_t* Allocate(int64_t size_bytes, const AllocationOptions& options) {
+  assert(options.alignment > 0 &&
+         (options.alignment & (options.alignment - 1)) == 0);
+  const bool huge_pages = size_bytes >= options.huge_page_min_bytes;
+  const int64_t alignment =
+      huge_pages ? std::max(options.alignment, kHugePageSize)
+                 : std::max<int64_t>(options.alignment, alignof(void*));
+
+  // std::aligned_alloc requires the size to be a multiple of the alignment.
+  const int64_t padded_size =
+      (size_bytes + alignment - 1) / alignment * alignment;
+  void* p = std::aligned_alloc(alignment, padded_size);
+  if (p == nullptr) {
+    throw std::bad_alloc();
+  }
+
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+  if (huge_pages) {
+    // Advisory only: if transparent huge pages are disabled, this fails and
+    // the buffer uses regular pages.
+    madvise(p, padded_size, MADV_HUGEPAGE);
+  }
+#endif
+
+  return static_cast<uint8_t*>(p);
+}
+
+}  // namespace
+
+void AlignedBuffer::Free::operator()(uint8_t* p) const { std::free(p); }
+
+AlignedBuffer::AlignedBuffer(int64_t size_bytes,
+                             const AllocationOptions& options)
+    : size_(size_bytes), options_(options) {
+  if (size_bytes <= 0) {
+    size_ = 0;
+    return;
+  }
+  data_.reset(Allocate(size_bytes, options));
+  if (options.initialize) {
+    std::memset(data_.get(), 0, size_bytes);
+  }
+}
+
+AlignedBuffer::AlignedBuffer(const AlignedBuffer& other)
+    : size_(other.size_), options_(other.options_) {
+  if (size_ > 0) {
+    data_.reset(Allocate(size_, options_));
+    std::memcpy(data_.get(), other.data_.get(), size_);
+  }
+}
+
+AlignedBuffer& AlignedBuffer::operator=(const AlignedBuffer& other) {
+  if (this != &other) {
+    *this = AlignedBuffer(other);
+  }
+  return *this;
+}
+
+AlignedBuffer::AlignedBuffer(AlignedBuffer&& other) noexcept
+    : size_(std::exchange(other.size_, 0)),
+      options_(other.options_),
+      data_(std::move(other.data_)) {}
+
+AlignedBuffer& AlignedBuffer::operator=(AlignedBuffer&& other) noexcept {
+  if (this != &other) {
+    size_ = std::exchange(other.size_, 0);
+    options_ = other.options_;
+    data_ = std::move(other.data_);
+  }
+  return *this;
+}
+
+}  // namespace npy_array
@@ -0,0 +1,68 @@
+#ifndef NPY_ARRAY_ALIGNED_BUFFER_H_
+#define NPY_ARRAY_ALIGNED_BUFFER_H_
+
+#include <cstdint>
+#include <limits>
+#include <memory>
+
+namespace npy_array {
+
+struct AllocationOptions {
+  // If true, the buffer is zero-filled. Set this to false when every byte is
+  // about to be overwritten anyway (e.g., when decoding), to save a full pass
+  // over memory.
+  bool initialize = true;
+
+  // The alignment of the buffer in bytes. Must be a power of two. The default
+  // is a cache line, which is also enough for any SIMD load.
+  int64_t alignment = 64;
+
+  // Buffers of at least this many bytes are aligned to huge page boundaries
+  // and, on Linux, advised to use transparent huge pages (MADV_HUGEPAGE). This
+  // reduces TLB misses when streaming through very large arrays. The default
+  // disables huge pages.
+  int64_t huge_page_min_bytes = std::numeric_limits<int64_t>::max();
+};
+
+// A heap buffer with a guaranteed alignment.
+//
+// Unlike std::vector<uint8_t>, the contents can be left uninitialized. Copies
+// are deep and keep the alignment and huge page settings.
+class AlignedBuffer {
+ public:
+  // An empty buffer.
+  AlignedBuffer() = default;
+
+  // Allocates `size_bytes` bytes as specified by `options`.
+  explicit AlignedBuffer(int64_t size_bytes,
+                         const AllocationOptions& options = AllocationOptions());
+
+  AlignedBuffer(const AlignedBuffer& other);
+  AlignedBuffer& operator=(const AlignedBuffer& other);
+  // A moved-from buffer is empty.
+  AlignedBuffer(AlignedBuffer&& other) noexcept;
+  AlignedBuffer& operator=(AlignedBuffer&& other) noexcept;
+
+  // The number of bytes requested, not including any padding.
+  int64_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+  // May be nullptr if empty().
+  const uint8_t* data() const { return data_.get(); }
+  uint8_t* data() { return data_.get(); }
+
+  const AllocationOptions& options() const { return options_; }
+
+ private:
+  struct Free {
+    void operator()(uint8_t* p) const;
+  };
+
+  int64_t size_ = 0;
+  AllocationOptions options_;
+  std::unique_ptr<uint8_t[], Free> data_;
+};
+
+}  // namespace npy_array
+
+#endif  // NPY_ARRAY_ALIGNED_BUFFER_H_
@@ -0,0 +1,87 @@
+#include "npy_array/aligned_buffer.h"
+
+#include <cstdint>
+#include <cstring>
+#include <utility>
+
+#include "gtest/gtest.h"
+
+namespace npy_array {
+namespace {
+
+bool IsAligned(const void* p, int64_t alignment) {
+  return reinterpret_cast<uintptr_t>(p) % alignment == 0;
+}
+
+TEST(AlignedBufferTest, Empty) {
+  AlignedBuffer empty;
+  EXPECT_TRUE(empty.empty());
+  EXPECT_EQ(empty.size(), 0);
+
+  AlignedBuffer zero(0);
+  EXPECT_TRUE(zero.empty());
+}
+
+TEST(AlignedBufferTest, DefaultIsZeroFilledAndCacheLineAligned) {
+  AlignedBuffer buffer(1001);
+  EXPECT_EQ(buffer.size(), 1001);
+  EXPECT_TRUE(IsAligned(buffer.data(), 64));
+  for (int64_t i = 0; i < buffer.size(); ++i) {
+    ASSERT_EQ(buffer.data()[i], 0) << "i = " << i;
+  }
+}
+
+TEST(AlignedBufferTest, Alignment) {
+  for (int64_t alignment : {1, 8, 16, 128, 4096}) {
+    AlignedBuffer buffer(3, {.initialize = false, .alignment = alignment});
+    EXPECT_TRUE(IsAligned(buffer.data(), alignment))
+        << "alignment = " << alignment;
+  }
+}
+
+TEST(AlignedBufferTest, HugePages) {
+  const int64_t size = int64_t{3} << 20;
+  AlignedBuffer buffer(size, {.huge_page_min_bytes = size});
+  EXPECT_TRUE(IsAligned(buffer.data(), int64_t{2} << 20));
+  EXPECT_EQ(buffer.data()[size - 1], 0);
+}
+
+TEST(AlignedBufferTest, CopyIsDeep) {
+  AlignedBuffer a(100, {.alignment = 256});
+  std::memset(a.data(), 7, a.size());
+
+  AlignedBuffer b = a;
+  ASSERT_EQ(b.size(), 100);
+  EXPECT_NE(b.data(), a.data());
+  EXPECT_TRUE(IsAligned(b.data(), 256));
+  EXPECT_EQ(std::memcmp(a.data(), b.data(), a.size()), 0);
+
+  b.data()[0] = 1;
+  EXPECT_EQ(a.data()[0], 7);
+
+  AlignedBuffer c = std::move(b);
+  EXPECT_EQ(c.data()[0], 1);
+  EXPECT_EQ(c.size(), 100);
+}
+
+TEST(AlignedBufferTest, MovedFromIsEmpty) {
+  AlignedBuffer a(100);
+  const uint8_t* data = a.data();
+
+  AlignedBuffer b = std::move(a);
+  EXPECT_EQ(b.data(), data);
+  EXPECT_EQ(b.size(), 100);
+  EXPECT_EQ(a.size(), 0);  // NOLINT(bugprone-use-after-move)
+  EXPECT_TRUE(a.empty());
+  EXPECT_EQ(a.data(), nullptr);
+
+  AlignedBuffer c(10);
+  c = std::move(b);
+  EXPECT_EQ(c.data(), data);
+  EXPECT_EQ(c.size(), 100);
+  EXPECT_EQ(b.size(), 0);  // NOLINT(bugprone-use-after-move)
+  EXPECT_EQ(b.data(), nullptr);
+}
+
+}  // namespace
+}  // namespace npy_array
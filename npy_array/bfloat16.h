@@ -0,0 +1,67 @@
+#ifndef NPY_ARRAY_BFLOAT16_H_
+#define NPY_ARRAY_BFLOAT16_H_
+
+#include <bit>
+#include <cstdint>
+#include <ostream>
+
+namespace npy_array {
+
+// A brain floating point number: the upper 16 bits of a float (1 sign bit, 8
+// exponent bits and 7 mantissa bits), as used by ML frameworks and ml_dtypes.
+// It converts implicitly to float, in which arithmetic and comparisons are
+// done.
+struct bfloat16 {
+  uint16_t bits = 0;
+
+  bfloat16() = default;
+
+  // Rounds to nearest even. NaNs stay NaN.
+  explicit bfloat16(float f) : bits(FloatToBits(f)) {}
+
+  operator float() const {  // NOLINT: implicit, like half.
+    return std::bit_cast<float>(static_cast<uint32_t>(bits) << 16);
+  }
+
+  static constexpr bfloat16 FromBits(uint16_t bits) {
+    bfloat16 result;
+    result.bits = bits;
+    return result;
+  }
+
+  // Returns the bits of `f` rounded to nearest even. Branch-free, so loops over
+  // it vectorize.
+  static uint16_t FloatToBits(float f) {
+    const uint32_t u = std::bit_cast<uint32_t>(f);
+    const uint32_t rounded = u + 0x7fff + ((u >> 16) & 1);
+    // Quiet NaNs, so that rounding can't turn a NaN into infinity.
+    const bool is_nan = (u & 0x7fffffff) > 0x7f800000;
+    return static_cast<uint16_t>(is_nan ? (u >> 16) | 0x40 : rounded >> 16);
+  }
+};
+
+static_assert(sizeof(bfloat16) == 2, "sizeof(bfloat16) should be 2 bytes.");
+
+// operator<< overload for bfloat16.
+inline std::ostream& operator<<(std::ostream& out, bfloat16 arg) {
+  return out << static_cast<float>(arg);
+}
+
+// Converts `n` elements. These loops compile to vector code.
+inline void ConvertBfloat16ToFloat(const bfloat16* src, float* dst,
+                                   int64_t n) {
+  for (int64_t i = 0; i < n; ++i) {
+    dst[i] = static_cast<float>(src[i]);
+  }
+}
+
+inline void ConvertFloatToBfloat16(const float* src, bfloat16* dst,
+                                   int64_t n) {
+  for (int64_t i = 0; i < n; ++i) {
+    dst[i].bits = bfloat16::FloatToBits(src[i]);
+  }
+}
+
+}  // namespace npy_array
+
+#endif  // NPY_ARRAY_BFLOAT16_H_
@@ -0,0 +1,387 @@
+#include "npy_array/convert.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <limits>
+#include <memory>
+#include <type_traits>
+#include <utility>
+
+#include "absl/container/inlined_vector.h"
+#include "absl/strings/str_cat.h"
+#include "npy_array/aligned_buffer.h"
+#include "npy_array/bfloat16.h"
+#include "npy_array/compile_time_loop.h"
+#include "npy_array/half.h"
+#include "npy_array/strided_copy.h"
+
+namespace npy_array {
+
+namespace {
+
+// One loop of a conversion. Strides are in elements of the respective type.
+struct ConvertDim {
+  int64_t extent;
+  int64_t src_stride;
+  int64_t dst_stride;
+};
+
+using ConvertDims = absl::InlinedVector<ConvertDim, 8>;
+
+// Sets `fused` to the loops of a conversion, innermost first, after dropping
+// extent-1 dimensions, sorting by destination stride and fusing contiguous
+// dimensions. Returns false if the conversion has no elements.
+bool PlanConvertDims(absl::Span<const nda::dim<>> src_dims,
+                     absl::Span<const nda::dim<>> dst_dims,
+                     ConvertDims& fused) {
+  ConvertDims dims;
+  for (size_t d = 0; d < src_dims.size(); ++d) {
+    const int64_t extent = dst_dims[d].extent();
+    if (extent <= 0) {
+      return false;
+    }
+    if (extent == 1) {
+      continue;
+    }
+    dims.push_back({.extent = extent,
+                    .src_stride = src_dims[d].stride(),
+                    .dst_stride = dst_dims[d].stride()});
+  }
+
+  std::stable_sort(dims.begin(), dims.end(),
+                   [](const ConvertDim& a, const ConvertDim& b) {
+                     return std::abs(a.dst_stride) < std::abs(b.dst_stride);
+                   });
+
+  fused.clear();
+  for (const ConvertDim& dim : dims) {
+    if (!fused.empty()) {
+      ConvertDim& last = fused.back();
+      if (last.extent * last.src_stride == dim.src_stride &&
+          last.extent * last.dst_stride == dim.dst_stride) {
+        last.extent *= dim.extent;
+        continue;
+      }
+    }
+    fused.push_back(dim);
+  }
+
+  // A scalar (or an array of one element) is a single loop of extent 1.
+  if (fused.empty()) {
+    fused.push_back({.extent = 1, .src_stride = 1, .dst_stride = 1});
+  }
+  return true;
+}
+
+// Types whose values are all exactly representable as float.
+template <typename T>
+inline constexpr bool kFitsInFloat = sizeof(T) <= 2 || std::is_same_v<T, float>;
+
+// The type in which affine transforms and clamping to an integer range are
+// computed.
+template <typename Src, typename Dst>
+using WorkType =
+    std::conditional_t<kFitsInFloat<Src> && kFitsInFloat<Dst>, float, double>;
+
+// Converts `x` to the integer type Dst, clamping out-of-range values and
+// mapping NaN to 0.
+template <typename Dst, typename Work>
+Dst ClampToInteger(Work x) {
+  constexpr Work kMin = static_cast<Work>(std::numeric_limits<Dst>::min());
+  // One more than the maximum, which unlike the maximum itself is exactly
+  // representable (e.g., 2^31 for int32 in float).
+  constexpr Work kMaxPlusOne =
+      static_cast<Work>(uint64_t{1} << (std::numeric_limits<Dst>::digits - 1)) *
+      2;
+  return x != x            ? Dst{0}
+         : x <= kMin       ? std::numeric_limits<Dst>::min()
+         : x >= kMaxPlusOne ? std::numeric_limits<Dst>::max()
+                            : static_cast<Dst>(x);
+}
+
+// Converts the integer `x` to the integer type Dst, clamping out-of-range
+// values. The comparisons fold away when Dst can represent every Src.
+template <typename Dst, typename Src>
+Dst SaturateInteger(Src x) {
+  if (std::cmp_less(x, std::numeric_limits<Dst>::min())) {
+    return std::numeric_limits<Dst>::min();
+  }
+  if (std::cmp_greater(x, std::numeric_limits<Dst>::max())) {
+    return std::numeric_limits<Dst>::max();
+  }
+  return static_cast<Dst>(x);
+}
+
+template <typename Src, typename Dst, bool kAffine, RoundingMode kRounding,
+          bool kSaturate>
+Dst ConvertValue(Src x, WorkType<Src, Dst> scale, WorkType<Src, Dst> offset) {
+  using Work = WorkType<Src, Dst>;
+  if constexpr (std::is_same_v<Dst, bool>) {
+    // Like numpy, any nonzero value (including NaN) is true.
+    if constexpr (kAffine) {
+      return static_cast<Work>(x) * scale + offset != Work{0};
+    } else {
+      return x != Src{0};
+    }
+  } else if constexpr (std::is_integral_v<Dst> &&
+                       (kAffine || !std::is_integral_v<Src>)) {
+    Work y = static_cast<Work>(x);
+    if constexpr (kAffine) {
+      y = y * scale + offset;
+    }
+    if constexpr (kRounding == RoundingMode::kToNearestEven) {
+      y = std::nearbyint(y);
+    }
+    return ClampToInteger<Dst>(y);
+  } else if constexpr (kAffine) {
+    return static_cast<Dst>(static_cast<Work>(x) * scale + offset);
+  } else if constexpr (std::is_integral_v<Src> &&
+                       !std::is_same_v<Src, bool> && kSaturate) {
+    return SaturateInteger<Dst>(x);
+  } else {
+    return static_cast<Dst>(x);
+  }
+}
+
+// Converts `n` elements. Strides are in elements.
+using ConvertRowFn = void (*)(const void* src, int64_t src_stride, void* dst,
+                              int64_t dst_stride, int64_t n, double scale,
+                              double offset);
+
+template <typename Src, typename Dst, bool kAffine, RoundingMode kRounding,
+          bool kSaturate>
+void ConvertRow(const void* src_void, int64_t src_stride, void* dst_void,
+                int64_t dst_stride, int64_t n, double scale_double,
+                double offset_double) {
+  using Work = WorkType<Src, Dst>;
+  const Src* src = static_cast<const Src*>(src_void);
+  Dst* dst = static_cast<Dst*>(dst_void);
+  const Work scale = static_cast<Work>(scale_double);
+  const Work offset = static_cast<Work>(offset_double);
+
+  if (src_stride == 1 && dst_stride == 1) {
+    if constexpr (!kAffine && std::is_same_v<Src, bfloat16> &&
+                  std::is_same_v<Dst, float>) {
+      ConvertBfloat16ToFloat(src, dst, n);
+      return;
+    } else if constexpr (!kAffine && std::is_same_v<Src, float> &&
+                         std::is_same_v<Dst, bfloat16>) {
+      ConvertFloatToBfloat16(src, dst, n);
+      return;
+    }
+    // The common case, which the compiler vectorizes.
+    for (int64_t i = 0; i < n; ++i) {
+      dst[i] = ConvertValue<Src, Dst, kAffine, kRounding, kSaturate>(
+          src[i], scale, offset);
+    }
+  } else {
+    for (int64_t i = 0; i < n; ++i) {
+      dst[i * dst_stride] =
+          ConvertValue<Src, Dst, kAffine, kRounding, kSaturate>(
+              src[i * src_stride], scale, offset);
+    }
+  }
+}
+
+bool IsAffine(const ConvertOptions& options) {
+  return options.scale != 1.0 || options.offset != 0.0;
+}
+
+// Returns the row kernel for the given types and options. Only the variants
+// that behave differently are instantiated: e.g., rounding is irrelevant when
+// converting to a floating-point type.
+template <typename Src, typename Dst>
+ConvertRowFn SelectRowFn(const ConvertOptions& options) {
+  constexpr RoundingMode kZero = RoundingMode::kTowardZero;
+  constexpr RoundingMode kNearest = RoundingMode::kToNearestEven;
+  const bool nearest = options.rounding == kNearest;
+
+  if constexpr (std::is_integral_v<Dst>) {
+    if (IsAffine(options)) {
+      return nearest ? &ConvertRow<Src, Dst, true, kNearest, false>
+                     : &ConvertRow<Src, Dst, true, kZero, false>;
+    }
+    if constexpr (!std::is_integral_v<Src>) {
+      return nearest ? &ConvertRow<Src, Dst, false, kNearest, false>
+                     : &ConvertRow<Src, Dst, false, kZero, false>;
+    } else {
+      return options.saturate ? &ConvertRow<Src, Dst, false, kZero, true>
+                              : &ConvertRow<Src, Dst, false, kZero, false>;
+    }
+  } else {
+    return IsAffine(options) ? &ConvertRow<Src, Dst, true, kZero, false>
+                             : &ConvertRow<Src, Dst, false, kZero, false>;
+  }
+}
+
+ConvertRowFn GetRowFn(DataType src_type, DataType dst_type,
+                      const ConvertOptions& options) {
+  ConvertRowFn row_fn = nullptr;
+  ForTypes<int8_t, int16_t, int32_t, int64_t, uint8_t, uint16_t, uint32_t,
+           uint64_t, half, float, double, bfloat16, bool>([&]<typename Src>() {
+    if (src_type != DataTypeFor<Src>()) {
+      return;
+    }
+    ForTypes<int8_t, int16_t, int32_t, int64_t, uint8_t, uint16_t, uint32_t,
+             uint64_t, half, float, double, bfloat16,
+             bool>([&]<typename Dst>() {
+      if (dst_type == DataTypeFor<Dst>()) {
+        row_fn = SelectRowFn<Src, Dst>(options);
+      }
+    });
+  });
+  return row_fn;
+}
+
+// Converts rows [begin, end) of the conversion described by `dims`, where a
+// row is one iteration of all loops but the innermost.
+void ConvertRows(const uint8_t* src, int64_t src_element_size, uint8_t* dst,
+                 int64_t dst_element_size, const ConvertDims& dims,
+                 int64_t begin, int64_t end, ConvertRowFn row_fn,
+                 const ConvertOptions& options) {
+  const ConvertDim& inner = dims[0];
+  const size_t outer_rank = dims.size() - 1;
+
+  // Start the odometer at row `begin`.
+  absl::InlinedVector<int64_t, 8> index(outer_rank);
+  int64_t src_offset = 0;
+  int64_t dst_offset = 0;
+  int64_t row = begin;
+  for (size_t d = 0; d < outer_rank; ++d) {
+    const ConvertDim& dim = dims[d + 1];
+    index[d] = row % dim.extent;
+    row /= dim.extent;
+    src_offset += index[d] * dim.src_stride;
+    dst_offset += index[d] * dim.dst_stride;
+  }
+
+  for (int64_t r = begin; r < end; ++r) {
+    row_fn(src + src_offset * src_element_size, inner.src_stride,
+           dst + dst_offset * dst_element_size, inner.dst_stride, inner.extent,
+           options.scale, options.offset);
+
+    for (size_t d = 0; d < outer_rank; ++d) {
+      const ConvertDim& dim = dims[d + 1];
+      src_offset += dim.src_stride;
+      dst_offset += dim.dst_stride;
+      if (++index[d] < dim.extent) {
+        break;
+      }
+      src_offset -= dim.src_stride * dim.extent;
+      dst_offset -= dim.dst_stride * dim.extent;
+      index[d] = 0;
+    }
+  }
+}
+
+}  // namespace
+
+absl::Status ConvertInto(const DynamicArrayRef& src, DynamicArrayRef dst,
+                         const ConvertOptions& options) {
+  if (src.rank() != dst.rank()) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("ConvertInto: rank mismatch, src is ", src.rank(),
+                     ", dst is ", dst.rank(), "."));
+  }
+  for (int64_t d = 0; d < src.rank(); ++d) {
+    if (src.shape().extent(d) != dst.shape().extent(d)) {
+      return absl::InvalidArgumentError(absl::StrCat(
+          "ConvertInto: extent mismatch in dimension ", d, ", src is ",
+          src.shape().extent(d), ", dst is ", dst.shape().extent(d), "."));
+    }
+  }
+
+  const ConvertRowFn row_fn =
+      GetRowFn(src.data_type(), dst.data_type(), options);
+  if (row_fn == nullptr) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("ConvertInto: unsupported conversion from ",
+                     src.data_type(), " to ", dst.data_type(), "."));
+  }
+
+  // Nothing to convert: this is a copy.
+  if (src.data_type() == dst.data_type() && !IsAffine(options)) {
+    StridedCopyOptions copy_options;
+    copy_options.threading = options.threading;
+    StridedCopy(src.data(), src.shape().dims(), dst.data(), dst.shape().dims(),
+                src.ElementSizeBytes(), copy_options);
+    return absl::OkStatus();
+  }
+
+  ConvertDims dims;
+  if (!PlanConvertDims(src.shape().dims(), dst.shape().dims(), dims)) {
+    return absl::OkStatus();
+  }
+
+  const uint8_t* src_bytes = src.data();
+  uint8_t* dst_bytes = dst.data();
+  const int64_t src_element_size = src.ElementSizeBytes();
+  const int64_t dst_element_size = dst.ElementSizeBytes();
+  const ConvertDim& inner = dims[0];
+  int64_t num_rows = 1;
+  for (size_t d = 1; d < dims.size(); ++d) {
+    num_rows *= dims[d].extent;
+  }
+  const int64_t total_bytes = num_rows * inner.extent * dst_element_size;
+
+  // A single row (e.g., any conversion between compact arrays) is split into
+  // segments. Otherwise, each thread converts a contiguous range of rows.
+  const int num_threads = internal::ResolveThreads(
+      options.threading, total_bytes, num_rows == 1 ? inner.extent : num_rows);
+  if (num_threads == 1) {
+    ConvertRows(src_bytes, src_element_size, dst_bytes, dst_element_size, dims,
+                0, num_rows, row_fn, options);
+  } else if (num_rows == 1) {
+    internal::ResolveThreadPool(options.threading).ParallelFor(
+        num_threads, num_threads, [&](int64_t t) {
+          const int64_t begin = inner.extent * t / num_threads;
+          const int64_t end = inner.extent * (t + 1) / num_threads;
+          row_fn(src_bytes + begin * inner.src_stride * src_element_size,
+                 inner.src_stride,
+                 dst_bytes + begin * inner.dst_stride * dst_element_size,
+                 inner.dst_stride, end - begin, options.scale, options.offset);
+        });
+  } else {
+    internal::ResolveThreadPool(options.threading).ParallelFor(
+        num_threads, num_threads, [&](int64_t t) {
+          ConvertRows(src_bytes, src_element_size, dst_bytes,
+                      dst_element_size, dims, num_rows * t / num_threads,
+                      num_rows * (t + 1) / num_threads, row_fn, options);
+        });
+  }
+  return absl::OkStatus();
+}
+
+absl::StatusOr<DynamicArray> AsType(const DynamicArrayRef& src,
+                                    DataType data_type,
+                                    const ConvertOptions& options) {
+  if (data_type == DataType::kUndefined) {
+    return absl::InvalidArgumentError("AsType: undefined data type.");
+  }
+
+  absl::InlinedVector<int64_t, DynamicShape::kInlineRank> mins(src.rank());
+  absl::InlinedVector<int64_t, DynamicShape::kInlineRank> extents(src.rank());
+  for (int64_t d = 0; d < src.rank(); ++d) {
+    mins[d] = src.shape().min(d);
+    extents[d] = src.shape().extent(d);
+  }
+  const DynamicShape shape = DynamicShape(extents).Crop(mins, extents);
+
+  // Every element is written, so the buffer doesn't need to be initialized.
+  auto buffer = std::make_shared<AlignedBuffer>(
+      shape.NumElements() * ElementSize(data_type),
+      AllocationOptions{.initialize = false});
+  DynamicArray dst = DynamicArray::FromSharedBuffer(
+      data_type, shape, std::shared_ptr<uint8_t>(buffer, buffer->data()));
+
+  const absl::Status status = ConvertInto(src, dst.ref(), options);
+  if (!status.ok()) {
+    return status;
+  }
+  return dst;
+}
+
+}  // namespace npy_array
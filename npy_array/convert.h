@@ -0,0 +1,69 @@
+#ifndef NPY_ARRAY_CONVERT_H_
+#define NPY_ARRAY_CONVERT_H_
+
+#include <cstdint>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "npy_array/data_type.h"
+#include "npy_array/dynamic_array.h"
+#include "npy_array/thread_pool.h"
+
+namespace npy_array {
+
+// How non-integral values are converted to an integer type.
+enum class RoundingMode {
+  kTowardZero,     // Truncate, like static_cast.
+  kToNearestEven,  // Round half to even, like std::nearbyint.
+};
+
+struct ConvertOptions {
+  // Each value is converted as `value * scale + offset`. E.g., use
+  // scale = 1.0 / 255 to normalize uint8 pixels to [0, 1] floats, or
+  // scale = 255 with kToNearestEven to go back. The affine transform is
+  // computed in float when both types are float or at most 16 bits wide, and in
+  // double otherwise.
+  double scale = 1.0;
+  double offset = 0.0;
+
+  // Applies when converting a floating-point type to an integer type, or when
+  // `scale` or `offset` are set and the destination is an integer type.
+  RoundingMode rounding = RoundingMode::kTowardZero;
+
+  // Whether integer to integer conversions clamp out-of-range values to the
+  // range of the destination type. If false, they wrap, like static_cast
+  // (and numpy's astype). Conversions from floating-point values (including
+  // any conversion with a `scale` or `offset`) to an integer type always
+  // clamp, and map NaN to 0. Conversions to bool map nonzero values (including
+  // NaN) to true, like numpy.
+  bool saturate = false;
+
+  // Splits large conversions across threads. `min_bytes_per_thread` counts
+  // destination bytes.
+  ThreadingOptions threading;
+};
+
+// Converts the elements of `src` into `dst`, which must have the same rank and
+// extents (mins may differ) but may have a different data type. `src` and
+// `dst` may have any strides but must not overlap.
+//
+// The conversion is planned like StridedCopy(): loops are ordered by
+// destination stride and contiguous dimensions are fused, so the innermost loop
+// over compact arrays is a single vectorizable loop for every pair of data
+// types. Large conversions are split across threads.
+//
+// Returns an error if the shapes don't match or either data type is undefined
+// or complex.
+absl::Status ConvertInto(const DynamicArrayRef& src, DynamicArrayRef dst,
+                         const ConvertOptions& options = ConvertOptions());
+
+// Returns a newly allocated compact copy of `src` converted to `data_type`.
+// Mins are preserved. Returns an error if either data type is undefined or
+// complex.
+absl::StatusOr<DynamicArray> AsType(
+    const DynamicArrayRef& src, DataType data_type,
+    const ConvertOptions& options = ConvertOptions());
+
+}  // namespace npy_array
+
+#endif  // NPY_ARRAY_CONVERT_H_
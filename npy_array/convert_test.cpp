@@ -0,0 +1,251 @@
+#include "npy_array/convert.h"
+
+#include <cmath>
+#include <cstdint>
+#include <limits>
+
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "gtest/gtest.h"
+#include "npy_array/bfloat16.h"
+#include "npy_array/compile_time_loop.h"
+#include "npy_array/data_type.h"
+#include "npy_array/dynamic_array.h"
+#include "npy_array/gtest_half.h"
+#include "npy_array/half.h"
+#include "npy_array/thread_pool.h"
+
+namespace npy_array {
+namespace {
+
+template <typename T>
+DynamicArray Iota(absl::Span<const int64_t> extents) {
+  DynamicArray arr(DataTypeFor<T>(), extents);
+  T* data = arr.data<T>();
+  for (int64_t i = 0; i < arr.NumElements(); ++i) {
+    data[i] = static_cast<T>(i % 100);
+  }
+  return arr;
+}
+
+TEST(ConvertTest, AllPairs) {
+  // Small non-negative integers are exact in every type.
+  ForTypes<int8_t, int16_t, int32_t, int64_t, uint8_t, uint16_t, uint32_t,
+           uint64_t, half, float, double, bfloat16>([&]<typename Src>() {
+    const DynamicArray src = Iota<Src>({7, 5});
+    ForTypes<int8_t, int16_t, int32_t, int64_t, uint8_t, uint16_t, uint32_t,
+             uint64_t, half, float, double, bfloat16>([&]<typename Dst>() {
+      absl::StatusOr<DynamicArray> dst = AsType(src, DataTypeFor<Dst>());
+      ASSERT_TRUE(dst.ok()) << dst.status();
+      ASSERT_EQ(dst->data_type(), DataTypeFor<Dst>());
+      for (int64_t i = 0; i < src.NumElements(); ++i) {
+        EXPECT_EQ(dst->data<Dst>()[i], static_cast<Dst>(i % 100))
+            << absl::StrCat(src.data_type(), " to ", dst->data_type());
+      }
+    });
+  });
+}
+
+TEST(ConvertTest, FloatToIntegerRoundsAndClamps) {
+  DynamicArray src(DataType::kFloat32, {8});
+  const float values[] = {-1000.0f, -2.5f, -0.5f, 0.5f, 1.5f, 2.7f, 1e10f,
+                          std::numeric_limits<float>::quiet_NaN()};
+  for (int i = 0; i < 8; ++i) {
+    src.Set<float>({i}, values[i]);
+  }
+
+  absl::StatusOr<DynamicArray> truncated = AsType(src, DataType::kInt8);
+  ASSERT_TRUE(truncated.ok()) << truncated.status();
+  const int8_t expected_truncated[] = {-128, -2, 0, 0, 1, 2, 127, 0};
+  for (int i = 0; i < 8; ++i) {
+    EXPECT_EQ(truncated->At<int8_t>({i}), expected_truncated[i]) << i;
+  }
+
+  absl::StatusOr<DynamicArray> rounded =
+      AsType(src, DataType::kInt32,
+             {.rounding = RoundingMode::kToNearestEven});
+  ASSERT_TRUE(rounded.ok()) << rounded.status();
+  const int32_t expected_rounded[] = {
+      -1000, -2, 0, 0, 2, 3, std::numeric_limits<int32_t>::max(), 0};
+  for (int i = 0; i < 8; ++i) {
+    EXPECT_EQ(rounded->At<int32_t>({i}), expected_rounded[i]) << i;
+  }
+}
+
+TEST(ConvertTest, IntegerSaturation) {
+  DynamicArray src(DataType::kInt64, {4});
+  src.Set<int64_t>({0}, -1);
+  src.Set<int64_t>({1}, 70000);
+  src.Set<int64_t>({2}, 65535);
+  src.Set<int64_t>({3}, std::numeric_limits<int64_t>::max());
+
+  absl::StatusOr<DynamicArray> wrapped = AsType(src, DataType::kUint16);
+  ASSERT_TRUE(wrapped.ok()) << wrapped.status();
+  EXPECT_EQ(wrapped->At<uint16_t>({0}), 65535);
+  EXPECT_EQ(wrapped->At<uint16_t>({1}), 70000 - 65536);
+
+  absl::StatusOr<DynamicArray> saturated =
+      AsType(src, DataType::kUint16, {.saturate = true});
+  ASSERT_TRUE(saturated.ok()) << saturated.status();
+  EXPECT_EQ(saturated->At<uint16_t>({0}), 0);
+  EXPECT_EQ(saturated->At<uint16_t>({1}), 65535);
+  EXPECT_EQ(saturated->At<uint16_t>({2}), 65535);
+  EXPECT_EQ(saturated->At<uint16_t>({3}), 65535);
+
+  absl::StatusOr<DynamicArray> to_uint64 =
+      AsType(src, DataType::kUint64, {.saturate = true});
+  ASSERT_TRUE(to_uint64.ok()) << to_uint64.status();
+  EXPECT_EQ(to_uint64->At<uint64_t>({0}), 0);
+  EXPECT_EQ(to_uint64->At<uint64_t>({3}),
+            uint64_t{std::numeric_limits<int64_t>::max()});
+}
+
+TEST(ConvertTest, ScaleAndOffset) {
+  DynamicArray src(DataType::kUint8, {256});
+  for (int i = 0; i < 256; ++i) {
+    src.Set<uint8_t>({i}, i);
+  }
+
+  absl::StatusOr<DynamicArray> normalized =
+      AsType(src, DataType::kFloat32, {.scale = 1.0 / 255});
+  ASSERT_TRUE(normalized.ok()) << normalized.status();
+  EXPECT_EQ(normalized->At<float>({0}), 0.0f);
+  EXPECT_EQ(normalized->At<float>({255}), 1.0f);
+
+  absl::StatusOr<DynamicArray> back =
+      AsType(*normalized, DataType::kUint8,
+             {.scale = 255, .rounding = RoundingMode::kToNearestEven});
+  ASSERT_TRUE(back.ok()) << back.status();
+  for (int i = 0; i < 256; ++i) {
+    EXPECT_EQ(back->At<uint8_t>({i}), i);
+  }
+
+  absl::StatusOr<DynamicArray> centered =
+      AsType(src, DataType::kFloat16, {.scale = 2.0 / 255, .offset = -1.0});
+  ASSERT_TRUE(centered.ok()) << centered.status();
+  EXPECT_EQ(centered->At<half>({0}), half(-1.0f));
+  EXPECT_EQ(centered->At<half>({255}), half(1.0f));
+}
+
+TEST(ConvertTest, StridedViews) {
+  const DynamicArray src = Iota<uint16_t>({6, 4, 3});
+
+  // Convert a transposed crop into a compact array with different mins.
+  const DynamicArrayRef view =
+      src.cref().Crop({1, 1, 0}, {4, 3, 3}).Permute({2, 0, 1});
+  DynamicArray dst(DataType::kFloat64, {3, 4, 3});
+  ASSERT_TRUE(ConvertInto(view, dst).ok());
+  for (int64_t y = 0; y < 3; ++y) {
+    for (int64_t x = 0; x < 4; ++x) {
+      for (int64_t c = 0; c < 3; ++c) {
+        EXPECT_EQ(dst.At<double>({c, x, y}),
+                  src.At<uint16_t>({x + 1, y + 1, c}));
+      }
+    }
+  }
+
+  // AsType preserves mins.
+  absl::StatusOr<DynamicArray> crop = AsType(view, DataType::kInt32);
+  ASSERT_TRUE(crop.ok()) << crop.status();
+  EXPECT_EQ(crop->shape().min(1), 1);
+  EXPECT_EQ(crop->At<int32_t>({2, 4, 3}), src.At<uint16_t>({4, 3, 2}));
+}
+
+TEST(ConvertTest, Multithreaded) {
+  ThreadPool pool(3);
+  const DynamicArray src = Iota<int16_t>({1000, 300});
+  ConvertOptions options{.scale = 0.5,
+                         .threading = {.max_threads = 0,
+                                       .min_bytes_per_thread = 1024,
+                                       .thread_pool = &pool}};
+
+  // Compact arrays are a single row, which is split into segments.
+  absl::StatusOr<DynamicArray> dst = AsType(src, DataType::kFloat32, options);
+  ASSERT_TRUE(dst.ok()) << dst.status();
+  for (int64_t i = 0; i < src.NumElements(); ++i) {
+    ASSERT_EQ(dst->data<float>()[i], 0.5f * (i % 100));
+  }
+
+  // A crop is split into ranges of rows.
+  const DynamicArray crop = src.Crop({1, 0}, {998, 300});
+  dst = AsType(crop, DataType::kFloat32, options);
+  ASSERT_TRUE(dst.ok()) << dst.status();
+  for (int64_t y = 0; y < 300; ++y) {
+    for (int64_t x = 1; x < 999; ++x) {
+      ASSERT_EQ(dst->At<float>({x, y}), 0.5f * crop.At<int16_t>({x, y}));
+    }
+  }
+}
+
+TEST(ConvertTest, Bfloat16) {
+  // 1 + 2^-8 and 1 + 3 * 2^-8 are halfway between two bfloat16 values and round
+  // to even.
+  const float nan = std::numeric_limits<float>::quiet_NaN();
+  const float values[] = {1.0f, 1.0f + 0x1p-8f, 1.0f + 0x3p-8f, -0x1.fep127f,
+                          nan,  65280.0f};
+  const float expected[] = {1.0f, 1.0f, 1.0f + 0x4p-8f, -0x1.fep127f,
+                            nan,  65280.0f};
+  DynamicArray src(DataType::kFloat32, {6});
+  for (int i = 0; i < 6; ++i) {
+    src.data<float>()[i] = values[i];
+  }
+
+  absl::StatusOr<DynamicArray> bf16 = AsType(src, DataType::kBfloat16);
+  ASSERT_TRUE(bf16.ok()) << bf16.status();
+  absl::StatusOr<DynamicArray> back = AsType(*bf16, DataType::kFloat32);
+  ASSERT_TRUE(back.ok()) << back.status();
+  for (int i = 0; i < 6; ++i) {
+    if (std::isnan(expected[i])) {
+      EXPECT_TRUE(std::isnan(back->data<float>()[i]));
+    } else {
+      EXPECT_EQ(back->data<float>()[i], expected[i]) << i;
+    }
+  }
+  EXPECT_EQ(bf16->data<bfloat16>()[0].bits, 0x3f80);
+
+  // Scaling goes through float.
+  absl::StatusOr<DynamicArray> scaled =
+      AsType(*bf16, DataType::kUint8, {.scale = 100.0});
+  ASSERT_TRUE(scaled.ok()) << scaled.status();
+  EXPECT_EQ(scaled->data<uint8_t>()[0], 100);
+}
+
+TEST(ConvertTest, Bool) {
+  DynamicArray src(DataType::kFloat32, {4});
+  const float values[] = {-1.5f, 0.0f, std::numeric_limits<float>::quiet_NaN(),
+                          0.25f};
+  for (int i = 0; i < 4; ++i) {
+    src.data<float>()[i] = values[i];
+  }
+  absl::StatusOr<DynamicArray> b = AsType(src, DataType::kBool);
+  ASSERT_TRUE(b.ok()) << b.status();
+  EXPECT_EQ(b->data<bool>()[0], true);
+  EXPECT_EQ(b->data<bool>()[1], false);
+  EXPECT_EQ(b->data<bool>()[2], true);
+  EXPECT_EQ(b->data<bool>()[3], true);
+
+  absl::StatusOr<DynamicArray> i = AsType(
+      *b, DataType::kInt16, {.saturate = true});
+  ASSERT_TRUE(i.ok()) << i.status();
+  EXPECT_EQ(i->data<int16_t>()[0], 1);
+  EXPECT_EQ(i->data<int16_t>()[1], 0);
+}
+
+TEST(ConvertTest, Errors) {
+  DynamicArray src(DataType::kUint8, {4, 3});
+  DynamicArray wrong_extents(DataType::kFloat32, {3, 4});
+  EXPECT_EQ(ConvertInto(src, wrong_extents).code(),
+            absl::StatusCode::kInvalidArgument);
+
+  DynamicArray wrong_rank(DataType::kFloat32, {12});
+  EXPECT_EQ(ConvertInto(src, wrong_rank).code(),
+            absl::StatusCode::kInvalidArgument);
+
+  EXPECT_EQ(AsType(src, DataType::kUndefined).status().code(),
+            absl::StatusCode::kInvalidArgument);
+  EXPECT_EQ(AsType(src, DataType::kComplex64).status().code(),
+            absl::StatusCode::kInvalidArgument);
+}
+
+}  // namespace
+}  // namespace npy_array
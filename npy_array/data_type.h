@@ -1,8 +1,12 @@
 #ifndef NPY_ARRAY_DATA_TYPE_H_
 #define NPY_ARRAY_DATA_TYPE_H_
 
+#include <complex>
+#include <cstddef>
 #include <cstdint>
+#include <type_traits>
 
+#include "npy_array/bfloat16.h"
 #include "npy_array/half.h"
 
 namespace npy_array {
@@ -24,6 +28,12 @@ enum class DataType {
   kFloat16,
   kFloat32,
   kFloat64,
+  kBfloat16,
+
+  kBool,
+
+  kComplex64,
+  kComplex128,
 };
 
 template <typename Sink>
@@ -66,15 +76,161 @@ void AbslStringify(Sink& sink, DataType dt) {
     case DataType::kFloat64:
       sink.Append("kFloat64");
       break;
+    case DataType::kBfloat16:
+      sink.Append("kBfloat16");
+      break;
+    case DataType::kBool:
+      sink.Append("kBool");
+      break;
+    case DataType::kComplex64:
+      sink.Append("kComplex64");
+      break;
+    case DataType::kComplex128:
+      sink.Append("kComplex128");
+      break;
   }
 }
 
-// Returns the size of 1 element of type `dt`, in bytes.
-size_t ElementSize(DataType dt);
+// Compile-time properties of the C++ type of each DataType: its DataType and
+// the type character of its NPY descr string (e.g., 'f' in "<f4"). Size and
+// alignment are those of T. `kSupported` is false for other types, whose
+// DataType is kUndefined.
+//
+// Use DataTypeTraits in `if constexpr` and static_assert, and the DataType
+// functions below in a `switch` over a runtime DataType.
+template <typename T>
+struct DataTypeTraits {
+  static constexpr bool kSupported = false;
+  static constexpr DataType kDataType = DataType::kUndefined;
+  static constexpr char kNpyTypeChar = '\0';
+};
+
+#define NPY_ARRAY_DATA_TYPE_TRAITS(T, data_type, npy_type_char) \
+  template <>                                                   \
+  struct DataTypeTraits<T> {                                    \
+    static constexpr bool kSupported = true;                    \
+    static constexpr DataType kDataType = data_type;            \
+    static constexpr char kNpyTypeChar = npy_type_char;         \
+  }
+
+NPY_ARRAY_DATA_TYPE_TRAITS(int8_t, DataType::kInt8, 'i');
+NPY_ARRAY_DATA_TYPE_TRAITS(int16_t, DataType::kInt16, 'i');
+NPY_ARRAY_DATA_TYPE_TRAITS(int32_t, DataType::kInt32, 'i');
+NPY_ARRAY_DATA_TYPE_TRAITS(int64_t, DataType::kInt64, 'i');
+NPY_ARRAY_DATA_TYPE_TRAITS(uint8_t, DataType::kUint8, 'u');
+NPY_ARRAY_DATA_TYPE_TRAITS(uint16_t, DataType::kUint16, 'u');
+NPY_ARRAY_DATA_TYPE_TRAITS(uint32_t, DataType::kUint32, 'u');
+NPY_ARRAY_DATA_TYPE_TRAITS(uint64_t, DataType::kUint64, 'u');
+NPY_ARRAY_DATA_TYPE_TRAITS(half, DataType::kFloat16, 'f');
+NPY_ARRAY_DATA_TYPE_TRAITS(float, DataType::kFloat32, 'f');
+NPY_ARRAY_DATA_TYPE_TRAITS(double, DataType::kFloat64, 'f');
+// NumPy has no bfloat16: ml_dtypes describes it as raw 2-byte data.
+NPY_ARRAY_DATA_TYPE_TRAITS(bfloat16, DataType::kBfloat16, 'V');
+NPY_ARRAY_DATA_TYPE_TRAITS(bool, DataType::kBool, 'b');
+NPY_ARRAY_DATA_TYPE_TRAITS(std::complex<float>, DataType::kComplex64, 'c');
+NPY_ARRAY_DATA_TYPE_TRAITS(std::complex<double>, DataType::kComplex128, 'c');
+
+#undef NPY_ARRAY_DATA_TYPE_TRAITS
 
-// Maps T to a DataType.
+// Maps T to a DataType, or kUndefined if T has none.
 template <typename T>
-DataType DataTypeFor();
+constexpr DataType DataTypeFor() {
+  return DataTypeTraits<T>::kDataType;
+}
+
+// Calls `f.template operator()<T>()` with the C++ type T of `dt`, and returns
+// its result. Returns `f.template operator()<void>()` if `dt` is kUndefined.
+template <typename F>
+constexpr decltype(auto) DispatchDataType(DataType dt, F&& f) {
+  switch (dt) {
+    case DataType::kInt8:
+      return f.template operator()<int8_t>();
+    case DataType::kInt16:
+      return f.template operator()<int16_t>();
+    case DataType::kInt32:
+      return f.template operator()<int32_t>();
+    case DataType::kInt64:
+      return f.template operator()<int64_t>();
+    case DataType::kUint8:
+      return f.template operator()<uint8_t>();
+    case DataType::kUint16:
+      return f.template operator()<uint16_t>();
+    case DataType::kUint32:
+      return f.template operator()<uint32_t>();
+    case DataType::kUint64:
+      return f.template operator()<uint64_t>();
+    case DataType::kFloat16:
+      return f.template operator()<half>();
+    case DataType::kFloat32:
+      return f.template operator()<float>();
+    case DataType::kFloat64:
+      return f.template operator()<double>();
+    case DataType::kBfloat16:
+      return f.template operator()<bfloat16>();
+    case DataType::kBool:
+      return f.template operator()<bool>();
+    case DataType::kComplex64:
+      return f.template operator()<std::complex<float>>();
+    case DataType::kComplex128:
+      return f.template operator()<std::complex<double>>();
+    case DataType::kUndefined:
+      break;
+  }
+  return f.template operator()<void>();
+}
+
+// Returns the size of 1 element of type `dt`, in bytes. 0 if kUndefined.
+constexpr size_t ElementSize(DataType dt) {
+  return DispatchDataType(dt, []<typename T>() -> size_t {
+    if constexpr (std::is_void_v<T>) {
+      return 0;
+    } else {
+      return sizeof(T);
+    }
+  });
+}
+
+// Returns the alignment of an element of type `dt`, in bytes. 0 if
+// kUndefined.
+constexpr size_t ElementAlignment(DataType dt) {
+  return DispatchDataType(dt, []<typename T>() -> size_t {
+    if constexpr (std::is_void_v<T>) {
+      return 0;
+    } else {
+      return alignof(T);
+    }
+  });
+}
+
+// Returns the type character of the NPY descr string of `dt`, e.g., 'f' for
+// kFloat32. '\0' if kUndefined.
+constexpr char NpyTypeChar(DataType dt) {
+  return DispatchDataType(dt, []<typename T>() -> char {
+    if constexpr (std::is_void_v<T>) {
+      return '\0';
+    } else {
+      return DataTypeTraits<T>::kNpyTypeChar;
+    }
+  });
+}
+
+// Returns the DataType with NPY type character `npy_type_char` and size
+// `size_bytes`, e.g., kFloat32 for ('f', 4), or kUndefined if there is none.
+// ('V', 2) is kBfloat16, as ml_dtypes writes it. That only holds for the data
+// type of a whole array: a 'V2' field of a structured data type is raw bytes.
+constexpr DataType DataTypeFromNpy(char npy_type_char, size_t size_bytes) {
+  for (DataType dt :
+       {DataType::kInt8, DataType::kInt16, DataType::kInt32, DataType::kInt64,
+        DataType::kUint8, DataType::kUint16, DataType::kUint32,
+        DataType::kUint64, DataType::kFloat16, DataType::kFloat32,
+        DataType::kFloat64, DataType::kBfloat16, DataType::kBool,
+        DataType::kComplex64, DataType::kComplex128}) {
+    if (NpyTypeChar(dt) == npy_type_char && ElementSize(dt) == size_bytes) {
+      return dt;
+    }
+  }
+  return DataType::kUndefined;
+}
 
 }  // namespace npy_array
 
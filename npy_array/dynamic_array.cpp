@@ -1,8 +1,13 @@
 #include "npy_array/dynamic_array.h"
 
 #include <cassert>
+#include <cstring>
+#include <memory>
+#include <string>
 #include <utility>
 
+#include "absl/strings/str_cat.h"
+
 namespace npy_array {
 
 DynamicShape::DynamicShape(absl::Span<const int64_t> extents)
@@ -52,6 +57,106 @@ int64_t DynamicShape::FlatIndex(absl::Span<const int64_t> indices) const {
   return flat_index;
 }
 
+DynamicShape DynamicShape::Crop(absl::Span<const int64_t> mins,
+                                absl::Span<const int64_t> extents) const {
+  assert(mins.size() == rank());
+  assert(extents.size() == rank());
+
+  DynamicShape result = *this;
+  for (int64_t d = 0; d < rank(); ++d) {
+    result.dims_[d].set_min(mins[d]);
+    result.dims_[d].set_extent(extents[d]);
+  }
+  return result;
+}
+
+DynamicShape DynamicShape::Slice(int64_t d) const {
+  assert(d >= 0 && d < rank());
+
+  DynamicShape result = *this;
+  result.dims_.erase(result.dims_.begin() + d);
+  return result;
+}
+
+DynamicShape DynamicShape::Permute(absl::Span<const int64_t> order) const {
+  assert(order.size() == rank());
+
+  DynamicShape result = *this;
+  for (int64_t d = 0; d < rank(); ++d) {
+    assert(order[d] >= 0 && order[d] < rank());
+    result.dims_[d] = dims_[order[d]];
+  }
+  return result;
+}
+
+DynamicShape DynamicShape::Step(int64_t d, int64_t k) const {
+  assert(d >= 0 && d < rank());
+  assert(k > 0);
+
+  DynamicShape result = *this;
+  result.dims_[d].set_extent((extent(d) + k - 1) / k);
+  result.dims_[d].set_stride(stride(d) * k);
+  return result;
+}
+
+absl::StatusOr<DynamicShape> DynamicShape::Reshape(
+    absl::Span<const int64_t> extents) const {
+  DynamicShape result(extents);
+  if (result.NumElements() != NumElements()) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("Reshape: can't reshape ", NumElements(),
+                     " elements into ", result.NumElements(), "."));
+  }
+  if (result.empty()) {
+    return result;
+  }
+
+  // Dimensions of extent 1 don't constrain the layout.
+  absl::InlinedVector<nda::dim<>, kInlineRank> old_dims;
+  for (const nda::dim<>& dim : dims_) {
+    if (dim.extent() != 1) {
+      old_dims.push_back(dim);
+    }
+  }
+
+  // Match the smallest groups of old dims [oi, oj) and new dims [ni, nj) with
+  // the same number of elements. The old group must be contiguous, in which
+  // case the new group can be laid out within it.
+  const int64_t old_rank = old_dims.size();
+  int64_t oi = 0;
+  int64_t ni = 0;
+  while (oi < old_rank && ni < result.rank()) {
+    int64_t oj = oi + 1;
+    int64_t nj = ni + 1;
+    int64_t old_size = old_dims[oi].extent();
+    int64_t new_size = extents[ni];
+    while (old_size != new_size) {
+      if (new_size < old_size) {
+        new_size *= extents[nj++];
+      } else {
+        old_size *= old_dims[oj++].extent();
+      }
+    }
+
+    for (int64_t d = oi; d + 1 < oj; ++d) {
+      if (old_dims[d + 1].stride() !=
+          old_dims[d].stride() * old_dims[d].extent()) {
+        return absl::InvalidArgumentError(
+            "Reshape: the layout is not compatible with the new extents.");
+      }
+    }
+
+    int64_t stride = old_dims[oi].stride();
+    for (int64_t d = ni; d < nj; ++d) {
+      result.dims_[d].set_stride(stride);
+      stride *= extents[d];
+    }
+    oi = oj;
+    ni = nj;
+  }
+  return result;
+}
+
 DynamicArrayRef::DynamicArrayRef(uint8_t* data, DataType data_type,
                                  const DynamicShape& shape)
     : data_(data), data_type_(data_type), shape_(shape) {}
@@ -60,67 +165,189 @@ int64_t DynamicArrayRef::TotalSizeBytes() const {
   return NumElements() * ElementSizeBytes();
 }
 
+DynamicArrayRef DynamicArrayRef::Crop(absl::Span<const int64_t> mins,
+                                      absl::Span<const int64_t> extents) const {
+  const int64_t offset = shape_.FlatIndex(mins) * ElementSizeBytes();
+  return DynamicArrayRef(data_ + offset, data_type_,
+                         shape_.Crop(mins, extents));
+}
+
+DynamicArrayRef DynamicArrayRef::Slice(int64_t d, int64_t index) const {
+  const int64_t offset =
+      (index - shape_.min(d)) * shape_.stride(d) * ElementSizeBytes();
+  return DynamicArrayRef(data_ + offset, data_type_, shape_.Slice(d));
+}
+
+DynamicArrayRef DynamicArrayRef::Permute(
+    absl::Span<const int64_t> order) const {
+  return DynamicArrayRef(data_, data_type_, shape_.Permute(order));
+}
+
+DynamicArrayRef DynamicArrayRef::Step(int64_t d, int64_t k) const {
+  return DynamicArrayRef(data_, data_type_, shape_.Step(d, k));
+}
+
+absl::StatusOr<DynamicArrayRef> DynamicArrayRef::Reshape(
+    absl::Span<const int64_t> extents) const {
+  absl::StatusOr<DynamicShape> shape = shape_.Reshape(extents);
+  if (!shape.ok()) {
+    return shape.status();
+  }
+  return DynamicArrayRef(data_, data_type_, *shape);
+}
+
 DynamicArray::DynamicArray(DataType data_type,
-                           absl::Span<const int64_t> extents)
-    : data_type_(data_type), shape_(extents), data_(TotalSizeBytes()) {}
+                           absl::Span<const int64_t> extents,
+                           const AllocationOptions& options)
+    : data_type_(data_type), shape_(extents), allocation_options_(options) {
+  auto buffer = std::make_shared<AlignedBuffer>(TotalSizeBytes(), options);
+  // Share ownership of `buffer` but point at its data.
+  data_ = std::shared_ptr<uint8_t>(buffer, buffer->data());
+}
 
-DynamicArrayRef DynamicArray::ref() {
-  return DynamicArrayRef(data_.data(), data_type_, shape_);
+DynamicArray::DynamicArray(const DynamicArray& other)
+    : DynamicArray(other.Clone(other.allocation_options_)) {}
+
+DynamicArray& DynamicArray::operator=(const DynamicArray& other) {
+  if (this != &other) {
+    *this = other.Clone(other.allocation_options_);
+  }
+  return *this;
+}
+
+DynamicArray::DynamicArray(DataType data_type, const DynamicShape& shape,
+                           std::shared_ptr<uint8_t> data, bool writable)
+    : data_type_(data_type),
+      shape_(shape),
+      data_(std::move(data)),
+      writable_(writable) {}
+
+DynamicArray DynamicArray::FromSharedBuffer(DataType data_type,
+                                            const DynamicShape& shape,
+                                            std::shared_ptr<uint8_t> data,
+                                            bool writable) {
+  assert(reinterpret_cast<uintptr_t>(data.get()) %
+             ElementAlignment(data_type) ==
+         0);
+  return DynamicArray(data_type, shape, std::move(data), writable);
+}
+
+absl::StatusOr<DynamicArray> DynamicArray::FromString(
+    DataType data_type, absl::Span<const int64_t> extents, std::string buffer,
+    int64_t offset) {
+  if (data_type == DataType::kUndefined) {
+    return absl::InvalidArgumentError(
+        "DynamicArray::FromString: undefined data type.");
+  }
+  const DynamicShape shape(extents);
+  const int64_t size_bytes = shape.NumElements() * ElementSize(data_type);
+  if (offset < 0 || offset + size_bytes > static_cast<int64_t>(buffer.size())) {
+    return absl::InvalidArgumentError(absl::StrCat(
+        "DynamicArray::FromString: expected at least ", offset + size_bytes,
+        " bytes, got ", buffer.size(), "."));
+  }
+
+  // Move the string to its final location before taking a pointer into it:
+  // moving a short string copies its characters.
+  auto owner = std::make_shared<std::string>(std::move(buffer));
+  uint8_t* data = reinterpret_cast<uint8_t*>(owner->data()) + offset;
+  if (reinterpret_cast<uintptr_t>(data) % ElementAlignment(data_type) != 0) {
+    DynamicArray copy(data_type, extents, {.initialize = false});
+    std::memcpy(copy.data_.get(), data, size_bytes);
+    return copy;
+  }
+  return DynamicArray(data_type, shape, std::shared_ptr<uint8_t>(owner, data),
+                      /*writable=*/true);
 }
 
-template <typename T>
-T DynamicArrayRef::At(absl::Span<const int64_t> indices) const {
-  return *ElementPtr<T>(indices);
+DynamicArray DynamicArray::Clone(const AllocationOptions& options) const {
+  // A moved-from array has no buffer to copy.
+  if (data_ == nullptr) {
+    DynamicArray clone(data_type_, shape_, nullptr, writable_);
+    clone.allocation_options_ = options;
+    return clone;
+  }
+  absl::InlinedVector<int64_t, DynamicShape::kInlineRank> extents(rank());
+  for (int64_t d = 0; d < rank(); ++d) {
+    extents[d] = shape_.extent(d);
+  }
+
+  AllocationOptions clone_options = options;
+  clone_options.initialize = false;
+  DynamicArray clone(data_type_, extents, clone_options);
+  for (int64_t d = 0; d < rank(); ++d) {
+    clone.shape_.dims()[d].set_min(shape_.min(d));
+  }
+
+  StridedCopy(data(), shape_.dims(), clone.data_.get(), clone.shape_.dims(),
+              ElementSizeBytes());
+  return clone;
 }
 
-template <typename T>
-T& DynamicArrayRef::At(absl::Span<const int64_t> indices) {
-  return *ElementPtr<T>(indices);
+DynamicArray DynamicArray::View(const DynamicShape& shape,
+                                int64_t offset_bytes) const {
+  DynamicArray view(
+      data_type_, shape,
+      std::shared_ptr<uint8_t>(data_, data_.get() + offset_bytes), writable_);
+  view.allocation_options_ = allocation_options_;
+  return view;
 }
 
-template <typename T>
-const T* DynamicArrayRef::ElementPtr(absl::Span<const int64_t> indices) const {
-  assert(DataTypeFor<T>() == data_type_);
-  const int64_t element_index = shape_.FlatIndex(indices);
-  return data<T>() + element_index;
+DynamicArray DynamicArray::Share() const { return View(shape_, 0); }
+
+DynamicArray DynamicArray::Crop(absl::Span<const int64_t> mins,
+                                absl::Span<const int64_t> extents) const {
+  return View(shape_.Crop(mins, extents),
+              shape_.FlatIndex(mins) * ElementSizeBytes());
 }
 
-template <typename T>
-T* DynamicArrayRef::ElementPtr(absl::Span<const int64_t> indices) {
-  assert(DataTypeFor<T>() == data_type_);
-  const int64_t element_index = shape_.FlatIndex(indices);
-  return data<T>() + element_index;
+DynamicArray DynamicArray::Slice(int64_t d, int64_t index) const {
+  return View(shape_.Slice(d),
+              (index - shape_.min(d)) * shape_.stride(d) * ElementSizeBytes());
 }
 
-template int8_t DynamicArrayRef::At<int8_t>(absl::Span<const int64_t>) const;
-template int16_t DynamicArrayRef::At<int16_t>(absl::Span<const int64_t>) const;
-template int32_t DynamicArrayRef::At<int32_t>(absl::Span<const int64_t>) const;
-template int64_t DynamicArrayRef::At<int64_t>(absl::Span<const int64_t>) const;
+void DynamicArray::MakeUnique() {
+  if (IsShared() || !writable_) {
+    *this = Clone(allocation_options_);
+  }
+}
 
-template uint8_t DynamicArrayRef::At<uint8_t>(absl::Span<const int64_t>) const;
-template uint16_t DynamicArrayRef::At<uint16_t>(
-    absl::Span<const int64_t>) const;
-template uint32_t DynamicArrayRef::At<uint32_t>(
-    absl::Span<const int64_t>) const;
-template uint64_t DynamicArrayRef::At<uint64_t>(
-    absl::Span<const int64_t>) const;
+DynamicArrayRef DynamicArray::ref() {
+  return DynamicArrayRef(data(), data_type_, shape_);
+}
 
-template half DynamicArrayRef::At<half>(absl::Span<const int64_t>) const;
-template float DynamicArrayRef::At<float>(absl::Span<const int64_t>) const;
-template double DynamicArrayRef::At<double>(absl::Span<const int64_t>) const;
+DynamicArrayRef DynamicArray::cref() const {
+  return DynamicArrayRef(const_cast<uint8_t*>(data()), data_type_, shape_);
+}
 
-template int8_t& DynamicArrayRef::At<int8_t>(absl::Span<const int64_t>);
-template int16_t& DynamicArrayRef::At<int16_t>(absl::Span<const int64_t>);
-template int32_t& DynamicArrayRef::At<int32_t>(absl::Span<const int64_t>);
-template int64_t& DynamicArrayRef::At<int64_t>(absl::Span<const int64_t>);
+uint8_t* DynamicArray::data() {
+  MakeUnique();
+  return data_.get();
+}
 
-template uint8_t& DynamicArrayRef::At<uint8_t>(absl::Span<const int64_t>);
-template uint16_t& DynamicArrayRef::At<uint16_t>(absl::Span<const int64_t>);
-template uint32_t& DynamicArrayRef::At<uint32_t>(absl::Span<const int64_t>);
-template uint64_t& DynamicArrayRef::At<uint64_t>(absl::Span<const int64_t>);
+absl::Status Copy(const DynamicArrayRef& src, DynamicArrayRef dst,
+                  const StridedCopyOptions& options) {
+  if (src.data_type() != dst.data_type()) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("Copy: data type mismatch, src is ", src.data_type(),
+                     ", dst is ", dst.data_type(), "."));
+  }
+  if (src.rank() != dst.rank()) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("Copy: rank mismatch, src is ", src.rank(), ", dst is ",
+                     dst.rank(), "."));
+  }
+  for (int64_t d = 0; d < src.rank(); ++d) {
+    if (src.shape().extent(d) != dst.shape().extent(d)) {
+      return absl::InvalidArgumentError(absl::StrCat(
+          "Copy: extent mismatch in dimension ", d, ", src is ",
+          src.shape().extent(d), ", dst is ", dst.shape().extent(d), "."));
+    }
+  }
 
-template half& DynamicArrayRef::At<half>(absl::Span<const int64_t>);
-template float& DynamicArrayRef::At<float>(absl::Span<const int64_t>);
-template double& DynamicArrayRef::At<double>(absl::Span<const int64_t>);
+  StridedCopy(src.data(), src.shape().dims(), dst.data(), dst.shape().dims(),
+              src.ElementSizeBytes(), options);
+  return absl::OkStatus();
+}
 
 }  // namespace npy_array
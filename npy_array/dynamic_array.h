@@ -1,19 +1,31 @@
 #ifndef NPY_ARRAY_DYNAMIC_ARRAY_H_
 #define NPY_ARRAY_DYNAMIC_ARRAY_H_
 
+#include <cassert>
 #include <cstdint>
-#include <vector>
+#include <memory>
+#include <string>
 
+#include "absl/container/inlined_vector.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
 #include "absl/types/span.h"
 #include "array/array.h"
+#include "npy_array/aligned_buffer.h"
 #include "npy_array/compile_time_loop.h"
 #include "npy_array/data_type.h"
 #include "npy_array/half.h"
+#include "npy_array/strided_copy.h"
 
 namespace npy_array {
 
 class DynamicShape {
  public:
+  // Shapes up to this rank store their dims inline, so constructing or copying
+  // them (and the DynamicArrayRefs that hold them) doesn't allocate. Higher
+  // ranks fall back to the heap.
+  static constexpr size_t kInlineRank = 8;
+
   // DynamicShape intentionally lacks a default constructor because it would be
   // the same as a scalar, which is uncommnon and surprising. It also makes the
   // expression `DynamicShape({})` ambiguous (it should explicitly create a
@@ -46,7 +58,9 @@ class DynamicShape {
   // Returns a Span of all the dims in this shape.
   // TODO(jiawen): ABSL_LIFETIME_BOUND.
   absl::Span<nda::dim<>> dims() { return absl::MakeSpan(dims_); }
-  absl::Span<const nda::dim<>> dims() const { return dims_; }
+  absl::Span<const nda::dim<>> dims() const {
+    return absl::MakeConstSpan(dims_);
+  }
 
   // TODO(jiawen): assert.
   nda::dim<>& dim(int64_t d) { return dims_[d]; }
@@ -70,6 +84,42 @@ class DynamicShape {
   // For a scalar, `indices` is {} and evaluates to 0.
   int64_t FlatIndex(absl::Span<const int64_t> indices) const;
 
+  // View transformations. Each returns a new shape that addresses a subset or
+  // rearrangement of the same elements by only changing mins, extents, and
+  // strides. None of them allocate for ranks up to kInlineRank.
+  //
+  // Shapes don't carry a data pointer: DynamicArrayRef's methods of the same
+  // name also offset the data so that it points at the new mins.
+
+  // Returns the box [mins, mins + extents). Indices are unchanged: the element
+  // at `indices` in the crop is the element at `indices` in this shape.
+  // ! Not bounds checked.
+  DynamicShape Crop(absl::Span<const int64_t> mins,
+                    absl::Span<const int64_t> extents) const;
+
+  // Returns a shape of rank() - 1 with dimension `d` removed. The caller is
+  // responsible for offsetting the data to the selected index (see
+  // DynamicArrayRef::Slice()).
+  DynamicShape Slice(int64_t d) const;
+
+  // Reorders dimensions: dimension `i` of the result is dimension `order[i]` of
+  // this shape. E.g., Permute({1, 0}) transposes a matrix. `order` must be a
+  // permutation of [0, rank()).
+  DynamicShape Permute(absl::Span<const int64_t> order) const;
+
+  // Keeps every `k`-th element of dimension `d`, starting at its min. Index
+  // `i` of the result addresses index min + (i - min) * k of this shape. `k`
+  // must be positive.
+  DynamicShape Step(int64_t d, int64_t k) const;
+
+  // Returns a shape with the given extents and zero mins that visits the same
+  // elements in the same order (dimension 0 fastest) without moving any data.
+  // This is possible when each group of dimensions that is merged or split is
+  // contiguous in memory, e.g., always for a compact shape. Returns an error if
+  // the number of elements differs or the layout is not compatible; copy into a
+  // compact array first in that case.
+  absl::StatusOr<DynamicShape> Reshape(absl::Span<const int64_t> extents) const;
+
   // Some synonyms for commonly used dimensions and extents.
   // ! Not bounds checked.
   int64_t width() const { return extent(0); }
@@ -104,7 +154,7 @@ class DynamicShape {
   const nda::dim<>& k() const { return dims_[2]; }
 
  private:
-  std::vector<nda::dim<>> dims_;
+  absl::InlinedVector<nda::dim<>, kInlineRank> dims_;
 };
 
 // TODO(jiawen): `data` can be const? Make that a template.
@@ -179,11 +229,15 @@ class DynamicArrayRef {
 
   // Retrieves the element at the given indices.
   template <typename T>
-  T At(absl::Span<const int64_t> indices) const;
+  T At(absl::Span<const int64_t> indices) const {
+    return *ElementPtr<T>(indices);
+  }
 
   // Retrieves a mutable reference to the element at the given indices.
   template <typename T>
-  T& At(absl::Span<const int64_t> indices);
+  T& At(absl::Span<const int64_t> indices) {
+    return *ElementPtr<T>(indices);
+  }
 
   // Same as at<T>(indices) = value, but deduces `T` from `value` so the caller
   // can write `.set(indices, value)`.
@@ -194,11 +248,32 @@ class DynamicArrayRef {
 
   // Returns a pointer to the element at the given indices.
   template <typename T>
-  const T* ElementPtr(absl::Span<const int64_t> indices) const;
+  const T* ElementPtr(absl::Span<const int64_t> indices) const {
+    static_assert(DataTypeTraits<T>::kSupported);
+    assert(DataTypeFor<T>() == data_type_);
+    return data<T>() + shape_.FlatIndex(indices);
+  }
 
   // Returns a mutable pointer to the element at the given indices.
   template <typename T>
-  T* ElementPtr(absl::Span<const int64_t> indices);
+  T* ElementPtr(absl::Span<const int64_t> indices) {
+    static_assert(DataTypeTraits<T>::kSupported);
+    assert(DataTypeFor<T>() == data_type_);
+    return data<T>() + shape_.FlatIndex(indices);
+  }
+
+  // Zero-copy views of the same data; see the DynamicShape methods of the same
+  // name. They don't allocate for ranks up to DynamicShape::kInlineRank.
+  // ! Crop(), Slice(), Permute() and Step() are not bounds checked.
+  DynamicArrayRef Crop(absl::Span<const int64_t> mins,
+                       absl::Span<const int64_t> extents) const;
+  // Fixes dimension `d` at `index`, e.g., Slice(2, 0) selects the first
+  // channel of an (x, y, c) image.
+  DynamicArrayRef Slice(int64_t d, int64_t index) const;
+  DynamicArrayRef Permute(absl::Span<const int64_t> order) const;
+  DynamicArrayRef Step(int64_t d, int64_t k) const;
+  absl::StatusOr<DynamicArrayRef> Reshape(
+      absl::Span<const int64_t> extents) const;
 
   // Returns a pointer to the first element.
   const uint8_t* data() const { return data_; }
@@ -229,21 +304,99 @@ class DynamicArrayRef {
 // - data<T>() -> T*.
 class DynamicArray {
  public:
-  DynamicArray(DataType data_type, absl::Span<const int64_t> extents);
-  DynamicArray(const DynamicArray&) = default;
-  DynamicArray& operator=(const DynamicArray&) = default;
+  // Allocates a compact array with the given extents. By default, the data is
+  // zero-filled and 64-byte aligned; see AllocationOptions.
+  DynamicArray(DataType data_type, absl::Span<const int64_t> extents,
+               const AllocationOptions& options = AllocationOptions());
+
+  // Copies are deep, as with Clone(): the copy gets its own compact buffer,
+  // allocated with the AllocationOptions of this array. Use Share() to share
+  // the buffer instead.
+  DynamicArray(const DynamicArray& other);
+  DynamicArray& operator=(const DynamicArray& other);
 
   // TODO(jiawen): Test this - does it free memory? (Destructive move).
   DynamicArray(DynamicArray&&) = default;
   DynamicArray& operator=(DynamicArray&&) = default;
 
-  // TODO(jiawen): Non-const for now.
+  // Wraps an existing buffer without copying it. `data` points at the element
+  // at the mins of `shape` and owns (or shares ownership of) the memory, which
+  // must be suitably aligned for `data_type`. Use a custom deleter to adopt
+  // memory from an arena, or the std::shared_ptr aliasing constructor to point
+  // into an object that owns the memory, e.g., for a MappedFile `file`:
+  //   std::shared_ptr<uint8_t>(file, const_cast<uint8_t*>(file->data()))
+  //
+  // If `writable` is false, the buffer is never written to: the first mutable
+  // access copies it, as if it were shared.
+  static DynamicArray FromSharedBuffer(DataType data_type,
+                                       const DynamicShape& shape,
+                                       std::shared_ptr<uint8_t> data,
+                                       bool writable = true);
+
+  // Takes ownership of `buffer` and wraps the compact array that starts
+  // `offset` bytes into it, without copying. If the data is not aligned for
+  // `data_type`, it is copied into a new buffer instead. Returns an error if
+  // `data_type` is undefined or `buffer` is too small.
+  static absl::StatusOr<DynamicArray> FromString(
+      DataType data_type, absl::Span<const int64_t> extents,
+      std::string buffer, int64_t offset = 0);
+
+  // Returns a deep copy of this array in a newly allocated compact buffer.
+  // Mins are preserved.
+  DynamicArray Clone(
+      const AllocationOptions& options = AllocationOptions()) const;
+
+  // Returns an array that shares this array's buffer, which is reference
+  // counted, instead of copying it, e.g., to hand out cached arrays without a
+  // copy per request. The first mutable access (ref(), data(), At<T>() or
+  // Set()) to an array whose buffer is shared replaces it with a private copy
+  // (copy-on-write), allocated with the AllocationOptions of this array.
+  //
+  // ! Pointers and refs obtained from a mutable accessor before sharing still
+  // point into the shared buffer: writes through them are seen by every array
+  // that shares it.
+  // ! Sharing is not synchronized: don't share an array on one thread while
+  // mutating it on another.
+  DynamicArray Share() const;
+
+  // Returns a view of the sub-array in the box [mins, mins + extents), which
+  // shares (and keeps alive) this array's buffer. Indices into the view are the
+  // same as indices into this array.
+  // ! Not bounds checked.
+  DynamicArray Crop(absl::Span<const int64_t> mins,
+                    absl::Span<const int64_t> extents) const;
+
+  // Returns a view of rank() - 1 that fixes dimension `d` at `index`, which
+  // shares (and keeps alive) this array's buffer. E.g., Slice(2, 0) selects
+  // the first channel of an (x, y, c) image.
+  // ! Not bounds checked.
+  DynamicArray Slice(int64_t d, int64_t index) const;
+
+  // Returns true if the buffer is shared with another DynamicArray, from
+  // Share(), Crop() or Slice().
+  bool IsShared() const { return data_.use_count() > 1; }
+
+  // Returns false if the buffer is read-only (see FromSharedBuffer()), in which
+  // case the first mutable access copies it.
+  bool IsWritable() const { return writable_; }
+
   // TODO(jiawen): mark this class ABSl_OWNER. Does this still require
   // LIFETIME_BOUND?
+  // Returns a mutable view of this array, copying the buffer first if it is
+  // shared.
   DynamicArrayRef ref();
 
-  // Implicit conversion to a DynamicArrayRef.
-  operator DynamicArrayRef() { return ref(); }
+  // Returns a view of this array without copying a shared or read-only buffer.
+  // DynamicArrayRef has no read-only variant, so the view must only be read
+  // through, e.g., to pass a const array to a function that takes a
+  // DynamicArrayRef and doesn't write to it.
+  DynamicArrayRef cref() const;
+
+  // Implicit conversion to a DynamicArrayRef, as cref(): a shared or read-only
+  // buffer is not copied, so any array can be passed to functions that read a
+  // DynamicArrayRef. Use ref() to write to an array that may be shared or
+  // read-only.
+  operator DynamicArrayRef() const { return cref(); }
 
   // Returns true if the array has no elements. Note that a rank-zero array
   // is not empty because it has one element.
@@ -303,17 +456,19 @@ class DynamicArray {
   nda::dim<>& k() { return shape_.k(); }
   const nda::dim<>& k() const { return shape_.k(); }
 
-  // Retrieves the element at the given indices.
+  // Retrieves the element at the given indices. Element access doesn't
+  // construct a DynamicArrayRef, so it is cheap enough for per-element loops
+  // (but prefer Visit() for those).
   template <typename T>
   T At(absl::Span<const int64_t> indices) const {
-    // TODO(jiawen): Get rid of this const_cast by implementing cref().
-    return const_cast<DynamicArray&>(*this).ref().At<T>(indices);
+    // Read-only access, so no copy-on-write.
+    return *ElementPtr<T>(indices);
   }
 
   // Retrieves a mutable reference to the element at the given indices.
   template <typename T>
   T& At(absl::Span<const int64_t> indices) {
-    return ref().At<T>(indices);
+    return *ElementPtr<T>(indices);
   }
 
   // Same as at<T>(indices) = value, but deduces `T` from `value` so the
@@ -325,15 +480,26 @@ class DynamicArray {
 
   // Returns a pointer to the element at the given indices.
   template <typename T>
-  const T* ElementPtr(absl::Span<const int64_t> indices) const;
+  const T* ElementPtr(absl::Span<const int64_t> indices) const {
+    static_assert(DataTypeTraits<T>::kSupported);
+    assert(DataTypeFor<T>() == data_type_);
+    return data<T>() + shape_.FlatIndex(indices);
+  }
 
-  // Returns a mutable pointer to the element at the given indices.
+  // Returns a mutable pointer to the element at the given indices, copying the
+  // buffer first if it is shared.
   template <typename T>
-  T* ElementPtr(absl::Span<const int64_t> indices);
+  T* ElementPtr(absl::Span<const int64_t> indices) {
+    static_assert(DataTypeTraits<T>::kSupported);
+    assert(DataTypeFor<T>() == data_type_);
+    return data<T>() + shape_.FlatIndex(indices);
+  }
 
-  // Returns a pointer to the first element.
-  const uint8_t* data() const { return data_.data(); }
-  uint8_t* data() { return data_.data(); }
+  // Returns a pointer to the element at the mins. Views from Crop() and
+  // Slice() are not compact: use shape() to address their elements.
+  const uint8_t* data() const { return data_.get(); }
+  // Copies the buffer first if it is shared.
+  uint8_t* data();
 
   // Returns a pointer to the first element as a T*.
   template <typename T>
@@ -347,11 +513,33 @@ class DynamicArray {
   }
 
  private:
+  DynamicArray(DataType data_type, const DynamicShape& shape,
+               std::shared_ptr<uint8_t> data, bool writable);
+
+  // Replaces `data_` with a private copy if it is shared or read-only.
+  void MakeUnique();
+
+  // Returns a view of this array that shares `data_`, offset by
+  // `offset_bytes`.
+  DynamicArray View(const DynamicShape& shape, int64_t offset_bytes) const;
+
   DataType data_type_;
   DynamicShape shape_;
-  std::vector<uint8_t> data_;
+  // Points to the element at the mins of `shape_`. Owns (a share of) the whole
+  // buffer, which may be larger than this array if it is a view.
+  std::shared_ptr<uint8_t> data_;
+  bool writable_ = true;
+  // The options `data_` was allocated with, reused when it is copied. Arrays
+  // that wrap an existing buffer use the defaults.
+  AllocationOptions allocation_options_;
 };
 
+// Copies the elements of `src` into `dst`, which must have the same data type,
+// rank, and extents. Mins may differ. Returns an error (and does not copy) if
+// they don't match.
+absl::Status Copy(const DynamicArrayRef& src, DynamicArrayRef dst,
+                  const StridedCopyOptions& options = StridedCopyOptions());
+
 // Converts a static shape into a dynamic shape.
 template <size_t Rank>
 DynamicShape MakeDynamicShape(const nda::shape_of_rank<Rank>& shape);
@@ -363,7 +551,6 @@ nda::array_ref_of_rank<T, Rank> ArrayRefOf(const DynamicArrayRef& dar);
 
 // TODO(jiawen):
 // - Assert T is not const.
-// - Assert T is from a valid list and explicitly instantiate?
 // - Explicitly instantiate over Rank?
 // - Using nda::array_ref_of_rank<T, Rank> is annoying - they cannot be deduced.
 // But that's probably fine. Using a generic ArrayRefType is brittle too, until
@@ -374,6 +561,7 @@ DynamicArrayRef DynamicArrayRefOf(const nda::array_ref_of_rank<T, Rank>& ar);
 // ----- Implementation of template functions -----
 template <typename T, size_t Rank>
 nda::array_ref_of_rank<T, Rank> ArrayRefOf(const DynamicArrayRef& dar) {
+  static_assert(DataTypeTraits<std::remove_const_t<T>>::kSupported);
   if (dar.data_type() != DataTypeFor<std::remove_const_t<T>>()) {
     return {};
   }
@@ -385,11 +573,14 @@ nda::array_ref_of_rank<T, Rank> ArrayRefOf(const DynamicArrayRef& dar) {
   ForRange<0, Rank>(
       [&]<size_t D>() { shape.template dim<D>() = dar.shape().dims()[D]; });
 
-  return nda::make_array_ref(dar.data<T>(), shape);
+  // DynamicArrayRef is a view: its constness doesn't apply to the elements.
+  return nda::make_array_ref(
+      reinterpret_cast<T*>(const_cast<uint8_t*>(dar.data())), shape);
 }
 
 template <typename T, size_t Rank>
 DynamicArrayRef DynamicArrayRefOf(const nda::array_ref_of_rank<T, Rank>& ar) {
+  static_assert(DataTypeTraits<T>::kSupported);
   nda::shape_of_rank<Rank> ar_shape = ar.shape();
   DynamicShape dynamic_shape = MakeDynamicShape<Rank>(ar_shape);
 
@@ -412,52 +603,6 @@ DynamicShape MakeDynamicShape(const nda::shape_of_rank<Rank>& shape) {
   return DynamicShape(mins, extents, strides);
 }
 
-// ----- Explicit template declarations -----
-extern template int8_t DynamicArrayRef::At<int8_t>(
-    absl::Span<const int64_t>) const;
-extern template int16_t DynamicArrayRef::At<int16_t>(
-    absl::Span<const int64_t>) const;
-extern template int32_t DynamicArrayRef::At<int32_t>(
-    absl::Span<const int64_t>) const;
-extern template int64_t DynamicArrayRef::At<int64_t>(
-    absl::Span<const int64_t>) const;
-
-extern template uint8_t DynamicArrayRef::At<uint8_t>(
-    absl::Span<const int64_t>) const;
-extern template uint16_t DynamicArrayRef::At<uint16_t>(
-    absl::Span<const int64_t>) const;
-extern template uint32_t DynamicArrayRef::At<uint32_t>(
-    absl::Span<const int64_t>) const;
-extern template uint64_t DynamicArrayRef::At<uint64_t>(
-    absl::Span<const int64_t>) const;
-
-extern template half DynamicArrayRef::At<half>(absl::Span<const int64_t>) const;
-extern template float DynamicArrayRef::At<float>(
-    absl::Span<const int64_t>) const;
-extern template double DynamicArrayRef::At<double>(
-    absl::Span<const int64_t>) const;
-
-extern template int8_t& DynamicArrayRef::At<int8_t>(absl::Span<const int64_t>);
-extern template int16_t& DynamicArrayRef::At<int16_t>(
-    absl::Span<const int64_t>);
-extern template int32_t& DynamicArrayRef::At<int32_t>(
-    absl::Span<const int64_t>);
-extern template int64_t& DynamicArrayRef::At<int64_t>(
-    absl::Span<const int64_t>);
-
-extern template uint8_t& DynamicArrayRef::At<uint8_t>(
-    absl::Span<const int64_t>);
-extern template uint16_t& DynamicArrayRef::At<uint16_t>(
-    absl::Span<const int64_t>);
-extern template uint32_t& DynamicArrayRef::At<uint32_t>(
-    absl::Span<const int64_t>);
-extern template uint64_t& DynamicArrayRef::At<uint64_t>(
-    absl::Span<const int64_t>);
-
-extern template half& DynamicArrayRef::At<half>(absl::Span<const int64_t>);
-extern template float& DynamicArrayRef::At<float>(absl::Span<const int64_t>);
-extern template double& DynamicArrayRef::At<double>(absl::Span<const int64_t>);
-
 }  // namespace npy_array
 
 #endif  // NPY_ARRAY_DYNAMIC_ARRAY_H_
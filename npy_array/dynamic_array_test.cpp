@@ -1,5 +1,14 @@
 #include "npy_array/dynamic_array.h"
 
+#include <complex>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "absl/strings/str_cat.h"
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
 #include "npy_array/gtest_half.h"
@@ -30,6 +39,33 @@ T Pattern2(absl::Span<const int64_t> indices) {
   return result;
 }
 
+TEST(DataTypeTest, Undefined) {
+  static_assert(!DataTypeTraits<char32_t>::kSupported);
+  static_assert(DataTypeFor<char32_t>() == DataType::kUndefined);
+  static_assert(ElementSize(DataType::kUndefined) == 0);
+  static_assert(NpyTypeChar(DataType::kUndefined) == '\0');
+  static_assert(DataTypeFromNpy('f', 3) == DataType::kUndefined);
+  static_assert(DataTypeFromNpy('c', 4) == DataType::kUndefined);
+  EXPECT_EQ(DataTypeFromNpy('u', 2), DataType::kUint16);
+}
+
+TEST(DataTypeTest, Bfloat16BoolAndComplex) {
+  static_assert(ElementSize(DataType::kBfloat16) == 2);
+  static_assert(ElementSize(DataType::kBool) == 1);
+  static_assert(ElementSize(DataType::kComplex64) == 8);
+  static_assert(ElementAlignment(DataType::kComplex128) == alignof(double));
+  static_assert(DataTypeFromNpy('V', 2) == DataType::kBfloat16);
+  static_assert(DataTypeFromNpy('b', 1) == DataType::kBool);
+  static_assert(DataTypeFromNpy('c', 8) == DataType::kComplex64);
+  static_assert(DataTypeFromNpy('c', 16) == DataType::kComplex128);
+  EXPECT_EQ(absl::StrCat(DataType::kBfloat16), "kBfloat16");
+
+  DynamicArray a(DataType::kBfloat16, {3});
+  a.Set({1}, bfloat16(2.5f));
+  EXPECT_EQ(a.At<bfloat16>({1}), 2.5f);
+  EXPECT_EQ(a.At<bfloat16>({0}), 0.0f);
+}
+
 TEST(DynamicShapeTest, Scalar) {
   DynamicShape shape({});
   EXPECT_FALSE(shape.empty());
@@ -101,6 +137,72 @@ TEST(DynamicShapeTest, RankThree) {
   EXPECT_EQ(shape.stride(2), 57 * 43);
 }
 
+TEST(DynamicShapeTest, AboveInlineRank) {
+  // Ranks above kInlineRank store their dims on the heap. Copies must still be
+  // deep.
+  const std::vector<int64_t> extents(DynamicShape::kInlineRank + 2, 2);
+  DynamicShape shape(extents);
+  DynamicShape copy = shape;
+  copy.dim(0).set_extent(3);
+
+  EXPECT_EQ(shape.rank(), DynamicShape::kInlineRank + 2);
+  EXPECT_EQ(shape.extent(0), 2);
+  EXPECT_EQ(copy.extent(0), 3);
+  EXPECT_EQ(shape.NumElements(), int64_t{1} << shape.rank());
+  EXPECT_EQ(shape.stride(shape.rank() - 1), int64_t{1} << (shape.rank() - 1));
+}
+
+TEST(DynamicShapeTest, PermuteAndStep) {
+  const DynamicShape shape({5, 4, 3});
+
+  const DynamicShape permuted = shape.Permute({2, 0, 1});
+  ASSERT_EQ(permuted.rank(), 3);
+  EXPECT_EQ(permuted.extent(0), 3);
+  EXPECT_EQ(permuted.stride(0), 20);
+  EXPECT_EQ(permuted.extent(1), 5);
+  EXPECT_EQ(permuted.stride(1), 1);
+  EXPECT_EQ(permuted.extent(2), 4);
+  EXPECT_EQ(permuted.stride(2), 5);
+
+  const DynamicShape stepped = shape.Step(0, 2);
+  EXPECT_EQ(stepped.extent(0), 3);
+  EXPECT_EQ(stepped.stride(0), 2);
+  EXPECT_EQ(stepped.extent(1), 4);
+  EXPECT_EQ(stepped.stride(1), 5);
+
+  const DynamicShape sliced = shape.Slice(1);
+  ASSERT_EQ(sliced.rank(), 2);
+  EXPECT_EQ(sliced.extent(1), 3);
+  EXPECT_EQ(sliced.stride(1), 20);
+}
+
+TEST(DynamicShapeTest, Reshape) {
+  const DynamicShape shape({4, 6});
+
+  auto split = shape.Reshape({2, 2, 1, 6});
+  ASSERT_TRUE(split.ok()) << split.status();
+  ASSERT_EQ(split->rank(), 4);
+  EXPECT_EQ(split->stride(0), 1);
+  EXPECT_EQ(split->stride(1), 2);
+  EXPECT_EQ(split->stride(3), 4);
+
+  auto flat = shape.Reshape({24});
+  ASSERT_TRUE(flat.ok()) << flat.status();
+  EXPECT_EQ(flat->stride(0), 1);
+
+  // The first 3 columns of each row aren't contiguous with the next row, so
+  // only the rows can be split.
+  const DynamicShape crop = shape.Crop({0, 0}, {3, 6});
+  auto crop_split = crop.Reshape({3, 2, 3});
+  ASSERT_TRUE(crop_split.ok()) << crop_split.status();
+  EXPECT_EQ(crop_split->stride(0), 1);
+  EXPECT_EQ(crop_split->stride(1), 4);
+  EXPECT_EQ(crop_split->stride(2), 8);
+  EXPECT_FALSE(crop.Reshape({18}).ok());
+
+  EXPECT_FALSE(shape.Reshape({5, 5}).ok());
+}
+
 TEST(DynamicShapeTest, MakeDynamicShape) {
   {
     nda::shape_of_rank<0> shape;
@@ -153,6 +255,20 @@ using MyTypes =
                    uint32_t, uint64_t, half, float, double>;
 TYPED_TEST_SUITE(DynamicArrayTest, MyTypes);
 
+TYPED_TEST(DynamicArrayTest, DataTypeTraits) {
+  // The registry is usable at compile time.
+  constexpr DataType kDataType = DataTypeFor<TypeParam>();
+  static_assert(DataTypeTraits<TypeParam>::kSupported);
+  static_assert(ElementSize(kDataType) == sizeof(TypeParam));
+  static_assert(ElementAlignment(kDataType) == alignof(TypeParam));
+  static_assert(DataTypeFromNpy(NpyTypeChar(kDataType), sizeof(TypeParam)) ==
+                kDataType);
+  EXPECT_NE(kDataType, DataType::kUndefined);
+  EXPECT_TRUE(DispatchDataType(kDataType, []<typename T>() {
+    return std::is_same_v<T, TypeParam>;
+  }));
+}
+
 TYPED_TEST(DynamicArrayTest, Empty) {
   // Scalars are not empty.
   {
@@ -407,5 +523,282 @@ TYPED_TEST(DynamicArrayTest, DynamicArrayRefOf_RankThree) {
   }
 }
 
+TYPED_TEST(DynamicArrayTest, UninitializedAndAligned) {
+  DynamicArray arr(DataTypeFor<TypeParam>(), {57, 43},
+                   {.initialize = false, .alignment = 128});
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(arr.data()) % 128, 0);
+  EXPECT_EQ(arr.NumElements(), 57 * 43);
+
+  arr.Set<TypeParam>({56, 42}, TypeParam(3));
+  EXPECT_EQ(arr.At<TypeParam>({56, 42}), TypeParam(3));
+
+  DynamicArray clone = arr.Clone({.alignment = 256});
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(clone.data()) % 256, 0);
+  EXPECT_EQ(clone.At<TypeParam>({56, 42}), TypeParam(3));
+
+  // Copies, and copies on write, keep the alignment.
+  DynamicArray copy = clone;
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(copy.data()) % 256, 0);
+  DynamicArray shared = clone.Share();
+  shared.Set<TypeParam>({0, 0}, TypeParam(3));
+  EXPECT_FALSE(clone.IsShared());
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(shared.data()) % 256, 0);
+  DynamicArray crop = clone.Crop({1, 1}, {3, 2});
+  crop.Set<TypeParam>({1, 1}, TypeParam(3));
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(crop.data()) % 256, 0);
+}
+
+TYPED_TEST(DynamicArrayTest, CopiesAreDeep) {
+  DynamicArray a(DataTypeFor<TypeParam>(), {5, 4});
+  a.Set<TypeParam>({1, 2}, Pattern<TypeParam>({1, 2}));
+  // A pointer taken before the copy only ever writes to `a`.
+  TypeParam* a_data = a.data<TypeParam>();
+
+  DynamicArray b = a;
+  EXPECT_FALSE(a.IsShared());
+  EXPECT_NE(std::as_const(a).data(), std::as_const(b).data());
+  a_data[1 + 2 * 5] = Pattern2<TypeParam>({1, 2});
+  EXPECT_EQ(b.At<TypeParam>({1, 2}), Pattern<TypeParam>({1, 2}));
+
+  // Copying a view copies only its elements, and keeps its mins.
+  DynamicArray crop = a.Crop({1, 1}, {3, 2});
+  crop = DynamicArray(crop);
+  EXPECT_FALSE(a.IsShared());
+  EXPECT_EQ(crop.shape().min(0), 1);
+  EXPECT_EQ(crop.shape().stride(1), 3);
+  EXPECT_EQ(crop.At<TypeParam>({1, 2}), Pattern2<TypeParam>({1, 2}));
+}
+
+TYPED_TEST(DynamicArrayTest, ShareIsCopiedOnWrite) {
+  DynamicArray a(DataTypeFor<TypeParam>(), {5, 4});
+  a.Set<TypeParam>({1, 2}, Pattern<TypeParam>({1, 2}));
+
+  DynamicArray b = a.Share();
+  EXPECT_TRUE(a.IsShared());
+  EXPECT_EQ(std::as_const(a).data(), std::as_const(b).data());
+
+  // cref() and the implicit conversion view the shared buffer without
+  // detaching.
+  EXPECT_EQ(b.cref().data(), std::as_const(a).data());
+  EXPECT_EQ(b.cref().shape().extent(1), 4);
+  const DynamicArrayRef view = b;
+  EXPECT_EQ(view.data(), std::as_const(a).data());
+  EXPECT_TRUE(a.IsShared());
+  EXPECT_EQ(b.At<TypeParam>({1, 2}), Pattern<TypeParam>({1, 2}));
+
+  // Writing to `b` detaches it from `a`.
+  b.Set<TypeParam>({1, 2}, Pattern2<TypeParam>({1, 2}));
+  EXPECT_FALSE(a.IsShared());
+  EXPECT_FALSE(b.IsShared());
+  EXPECT_NE(std::as_const(a).data(), std::as_const(b).data());
+  EXPECT_EQ(a.At<TypeParam>({1, 2}), Pattern<TypeParam>({1, 2}));
+  EXPECT_EQ(b.At<TypeParam>({1, 2}), Pattern2<TypeParam>({1, 2}));
+
+  // Clone() copies eagerly.
+  DynamicArray c = a.Clone();
+  EXPECT_FALSE(a.IsShared());
+  EXPECT_NE(std::as_const(a).data(), std::as_const(c).data());
+  EXPECT_EQ(c.At<TypeParam>({1, 2}), Pattern<TypeParam>({1, 2}));
+}
+
+TYPED_TEST(DynamicArrayTest, CropAndSliceKeepStorageAlive) {
+  DynamicArray crop(DataTypeFor<TypeParam>(), {});
+  DynamicArray slice(DataTypeFor<TypeParam>(), {});
+  {
+    DynamicArray arr(DataTypeFor<TypeParam>(), {7, 6, 3});
+    for (int64_t c = 0; c < 3; ++c) {
+      for (int64_t y = 0; y < 6; ++y) {
+        for (int64_t x = 0; x < 7; ++x) {
+          arr.Set<TypeParam>({x, y, c}, Pattern<TypeParam>({x, y, c}));
+        }
+      }
+    }
+    crop = arr.Crop({2, 1, 0}, {4, 3, 3});
+    slice = arr.Slice(2, 1);
+    EXPECT_TRUE(arr.IsShared());
+  }
+
+  // Views keep their own coordinates.
+  ASSERT_EQ(crop.rank(), 3);
+  EXPECT_EQ(crop.shape().min(0), 2);
+  EXPECT_EQ(crop.shape().extent(0), 4);
+  for (int64_t c = 0; c < 3; ++c) {
+    for (int64_t y = 1; y < 4; ++y) {
+      for (int64_t x = 2; x < 6; ++x) {
+        EXPECT_EQ(crop.At<TypeParam>({x, y, c}),
+                  Pattern<TypeParam>({x, y, c}));
+      }
+    }
+  }
+
+  ASSERT_EQ(slice.rank(), 2);
+  for (int64_t y = 0; y < 6; ++y) {
+    for (int64_t x = 0; x < 7; ++x) {
+      EXPECT_EQ(slice.At<TypeParam>({x, y}), Pattern<TypeParam>({x, y, 1}));
+    }
+  }
+
+  // Writing to a view detaches it into a compact copy.
+  crop.Set<TypeParam>({2, 1, 0}, Pattern2<TypeParam>({2, 1, 0}));
+  EXPECT_EQ(crop.At<TypeParam>({2, 1, 0}), Pattern2<TypeParam>({2, 1, 0}));
+  EXPECT_EQ(crop.At<TypeParam>({5, 3, 2}), Pattern<TypeParam>({5, 3, 2}));
+  EXPECT_EQ(crop.shape().stride(1), 4);
+  EXPECT_EQ(slice.At<TypeParam>({2, 1}), Pattern<TypeParam>({2, 1, 1}));
+}
+
+TYPED_TEST(DynamicArrayTest, DynamicArrayRefViews) {
+  DynamicArray arr(DataTypeFor<TypeParam>(), {7, 6, 3});
+  for (int64_t c = 0; c < 3; ++c) {
+    for (int64_t y = 0; y < 6; ++y) {
+      for (int64_t x = 0; x < 7; ++x) {
+        arr.Set<TypeParam>({x, y, c}, Pattern<TypeParam>({x, y, c}));
+      }
+    }
+  }
+  const DynamicArrayRef ref = arr.ref();
+
+  const DynamicArrayRef crop = ref.Crop({2, 1, 0}, {4, 3, 3});
+  EXPECT_EQ(crop.data<TypeParam>(),
+            ref.data<TypeParam>() + ref.shape().FlatIndex({2, 1, 0}));
+  EXPECT_EQ(crop.At<TypeParam>({5, 3, 2}), Pattern<TypeParam>({5, 3, 2}));
+
+  const DynamicArrayRef slice = ref.Slice(2, 1);
+  ASSERT_EQ(slice.rank(), 2);
+  EXPECT_EQ(slice.At<TypeParam>({4, 5}), Pattern<TypeParam>({4, 5, 1}));
+
+  // (x, y, c) -> (c, x, y).
+  const DynamicArrayRef permuted = ref.Permute({2, 0, 1});
+  EXPECT_EQ(permuted.At<TypeParam>({2, 6, 4}), Pattern<TypeParam>({6, 4, 2}));
+
+  const DynamicArrayRef stepped = ref.Step(0, 3);
+  EXPECT_EQ(stepped.width(), 3);
+  EXPECT_EQ(stepped.At<TypeParam>({2, 5, 1}), Pattern<TypeParam>({6, 5, 1}));
+
+  auto reshaped = ref.Reshape({42, 3});
+  ASSERT_TRUE(reshaped.ok()) << reshaped.status();
+  EXPECT_EQ(reshaped->At<TypeParam>({7 * 4 + 3, 2}),
+            Pattern<TypeParam>({3, 4, 2}));
+  EXPECT_FALSE(ref.Crop({0, 0, 0}, {6, 6, 3}).Reshape({36, 3}).ok());
+
+  // Views alias the array's data.
+  DynamicArrayRef mutable_view = ref.Permute({1, 0, 2});
+  mutable_view.At<TypeParam>({3, 4, 0}) = Pattern2<TypeParam>({0});
+  EXPECT_EQ(arr.At<TypeParam>({4, 3, 0}), Pattern2<TypeParam>({0}));
+}
+
+TYPED_TEST(DynamicArrayTest, FromString) {
+  // A 16-byte "header" followed by a 3 x 2 array.
+  std::string buffer(16 + 6 * sizeof(TypeParam), '\0');
+  TypeParam* values = reinterpret_cast<TypeParam*>(buffer.data() + 16);
+  for (int i = 0; i < 6; ++i) {
+    values[i] = Pattern<TypeParam>({i});
+  }
+
+  absl::StatusOr<DynamicArray> arr = DynamicArray::FromString(
+      DataTypeFor<TypeParam>(), {3, 2}, std::move(buffer), /*offset=*/16);
+  ASSERT_TRUE(arr.ok()) << arr.status();
+  EXPECT_TRUE(arr->IsWritable());
+  EXPECT_EQ(arr->At<TypeParam>({2, 1}), Pattern<TypeParam>({5}));
+
+  EXPECT_FALSE(DynamicArray::FromString(DataTypeFor<TypeParam>(), {3, 2},
+                                        std::string(5, '\0'))
+                   .ok());
+}
+
+TEST(DynamicArrayFromStringTest, UndefinedDataType) {
+  EXPECT_FALSE(DynamicArray::FromString(DataType::kUndefined, {3, 2},
+                                        std::string(64, '\0'))
+                   .ok());
+}
+
+TEST(DynamicArrayFromStringTest, WrapsDataAlignedForTheElementType) {
+  // complex128 only needs the 8-byte alignment of a double, not 16 bytes.
+  std::string buffer(8 + 4 * sizeof(std::complex<double>), '\0');
+  const char* chars = buffer.data();
+  ASSERT_EQ(reinterpret_cast<uintptr_t>(chars + 8) % 8, 0);
+
+  absl::StatusOr<DynamicArray> arr = DynamicArray::FromString(
+      DataType::kComplex128, {4}, std::move(buffer), /*offset=*/8);
+  ASSERT_TRUE(arr.ok()) << arr.status();
+  EXPECT_EQ(arr->cref().data(), reinterpret_cast<const uint8_t*>(chars + 8));
+}
+
+TYPED_TEST(DynamicArrayTest, FromSharedBufferWithDeleter) {
+  bool deleted = false;
+  {
+    TypeParam* values = new TypeParam[4]();
+    std::shared_ptr<uint8_t> data(reinterpret_cast<uint8_t*>(values),
+                                  [&](uint8_t* p) {
+                                    delete[] reinterpret_cast<TypeParam*>(p);
+                                    deleted = true;
+                                  });
+    DynamicArray arr = DynamicArray::FromSharedBuffer(
+        DataTypeFor<TypeParam>(), DynamicShape({4}), std::move(data));
+    arr.Set<TypeParam>({3}, Pattern<TypeParam>({3}));
+    EXPECT_EQ(values[3], Pattern<TypeParam>({3}));
+    EXPECT_FALSE(deleted);
+  }
+  EXPECT_TRUE(deleted);
+}
+
+TYPED_TEST(DynamicArrayTest, ReadOnlyBufferIsCopiedOnWrite) {
+  const std::vector<TypeParam> values = {TypeParam(1), TypeParam(2)};
+  DynamicArray arr = DynamicArray::FromSharedBuffer(
+      DataTypeFor<TypeParam>(), DynamicShape({2}),
+      std::shared_ptr<uint8_t>(
+          std::shared_ptr<void>(),
+          reinterpret_cast<uint8_t*>(const_cast<TypeParam*>(values.data()))),
+      /*writable=*/false);
+  EXPECT_FALSE(arr.IsWritable());
+  EXPECT_EQ(std::as_const(arr).data(),
+            reinterpret_cast<const uint8_t*>(values.data()));
+  EXPECT_EQ(arr.cref().data(), reinterpret_cast<const uint8_t*>(values.data()));
+  EXPECT_FALSE(arr.IsWritable());
+
+  arr.Set<TypeParam>({0}, TypeParam(3));
+  EXPECT_TRUE(arr.IsWritable());
+  EXPECT_EQ(arr.At<TypeParam>({0}), TypeParam(3));
+  EXPECT_EQ(values[0], TypeParam(1));
+}
+
+TYPED_TEST(DynamicArrayTest, Copy_Transposed) {
+  nda::array_of_rank<TypeParam, 3> src({57, 43, 3});
+  for (auto z : src.z()) {
+    for (auto y : src.y()) {
+      for (auto x : src.x()) {
+        src(x, y, z) = Pattern<TypeParam>({x, y, z});
+      }
+    }
+  }
+
+  // Copy a planar array into an interleaved one.
+  nda::array_of_rank<TypeParam, 3> dst({3, 57, 43});
+  DynamicArrayRef dar_src = DynamicArrayRefOf<TypeParam, 3>(src.ref());
+  DynamicArrayRef dar_dst =
+      DynamicArrayRefOf<TypeParam, 3>(nda::reorder<1, 2, 0>(dst.ref()));
+  ASSERT_TRUE(Copy(dar_src, dar_dst).ok());
+
+  for (auto z : src.z()) {
+    for (auto y : src.y()) {
+      for (auto x : src.x()) {
+        EXPECT_EQ(dst(z, x, y), Pattern<TypeParam>({x, y, z}));
+      }
+    }
+  }
+}
+
+TYPED_TEST(DynamicArrayTest, Copy_Mismatch) {
+  DynamicArray a(DataTypeFor<TypeParam>(), {4, 5});
+  DynamicArray b(DataTypeFor<TypeParam>(), {5, 4});
+  DynamicArray c(DataTypeFor<TypeParam>(), {4, 5, 1});
+  DynamicArray d(DataType::kFloat32, {4, 5});
+
+  EXPECT_FALSE(Copy(a.ref(), b.ref()).ok());
+  EXPECT_FALSE(Copy(a.ref(), c.ref()).ok());
+  if constexpr (!std::is_same_v<TypeParam, float>) {
+    EXPECT_FALSE(Copy(a.ref(), d.ref()).ok());
+  }
+}
+
 }  // namespace
 }  // namespace npy_array
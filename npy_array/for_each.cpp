@@ -0,0 +1,121 @@
+#include "npy_array/for_each.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+
+#include "absl/container/inlined_vector.h"
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "npy_array/thread_pool.h"
+
+namespace npy_array {
+namespace internal {
+
+ForEachPlan PlanForEach(absl::Span<const DynamicShape* const> shapes,
+                        int64_t bytes_per_element,
+                        const ForEachOptions& options) {
+  const DynamicShape& first = *shapes[0];
+  absl::InlinedVector<ForEachLoop, DynamicShape::kInlineRank> loops;
+  for (int64_t d = 0; d < first.rank(); ++d) {
+    if (first.extent(d) == 1) {
+      continue;
+    }
+    ForEachLoop loop = {.extent = first.extent(d), .strides = {0, 0}};
+    for (size_t a = 0; a < shapes.size(); ++a) {
+      loop.strides[a] = shapes[a]->stride(d);
+    }
+    loops.push_back(loop);
+  }
+
+  // Innermost first, by the strides of the first array, then fuse loops that
+  // are contiguous with each other in every array.
+  std::stable_sort(loops.begin(), loops.end(),
+                   [](const ForEachLoop& a, const ForEachLoop& b) {
+                     return std::abs(a.strides[0]) < std::abs(b.strides[0]);
+                   });
+  ForEachPlan plan;
+  for (const ForEachLoop& loop : loops) {
+    if (!plan.loops.empty()) {
+      ForEachLoop& last = plan.loops.back();
+      if (last.extent * last.strides[0] == loop.strides[0] &&
+          last.extent * last.strides[1] == loop.strides[1]) {
+        last.extent *= loop.extent;
+        continue;
+      }
+    }
+    plan.loops.push_back(loop);
+  }
+  if (plan.loops.empty()) {
+    plan.loops.push_back({.extent = 1, .strides = {0, 0}});
+  }
+
+  const int64_t row_length = plan.loops[0].extent;
+  plan.num_rows = 1;
+  for (size_t d = 1; d < plan.loops.size(); ++d) {
+    plan.num_rows *= plan.loops[d].extent;
+  }
+  const int64_t tile_elements = std::max<int64_t>(
+      options.tile_bytes / std::max<int64_t>(bytes_per_element, 1), 1);
+  if (row_length > tile_elements) {
+    plan.row_segments = (row_length + tile_elements - 1) / tile_elements;
+    plan.segment_length =
+        (row_length + plan.row_segments - 1) / plan.row_segments;
+    plan.rows_per_tile = 1;
+    plan.num_tiles = plan.num_rows * plan.row_segments;
+  } else {
+    plan.row_segments = 1;
+    plan.segment_length = row_length;
+    plan.rows_per_tile = tile_elements / row_length;
+    plan.num_tiles =
+        (plan.num_rows + plan.rows_per_tile - 1) / plan.rows_per_tile;
+  }
+  plan.num_threads = ResolveThreads(
+      options.threading, row_length * plan.num_rows * bytes_per_element,
+      plan.num_tiles);
+  return plan;
+}
+
+void RunTiles(const ForEachPlan& plan, const ForEachOptions& options,
+              const std::function<void(int64_t)>& tile) {
+  if (plan.num_threads == 1) {
+    for (int64_t t = 0; t < plan.num_tiles; ++t) {
+      tile(t);
+    }
+    return;
+  }
+  // Threads claim tiles from a shared counter, so a thread that finishes early
+  // takes more tiles.
+  ResolveThreadPool(options.threading)
+      .ParallelFor(plan.num_tiles, plan.num_threads, tile);
+}
+
+absl::Status CheckDataType(const char* function, DataType expected,
+                           DataType actual) {
+  if (actual != expected) {
+    return absl::InvalidArgumentError(absl::StrCat(
+        function, ": expected data type ", expected, ", got ", actual, "."));
+  }
+  return absl::OkStatus();
+}
+
+absl::Status CheckSameExtents(const char* function, const DynamicShape& src,
+                              const DynamicShape& dst) {
+  if (src.rank() != dst.rank()) {
+    return absl::InvalidArgumentError(
+        absl::StrCat(function, ": rank mismatch, src is ", src.rank(),
+                     ", dst is ", dst.rank(), "."));
+  }
+  for (int64_t d = 0; d < src.rank(); ++d) {
+    if (src.extent(d) != dst.extent(d)) {
+      return absl::InvalidArgumentError(absl::StrCat(
+          function, ": extent mismatch in dimension ", d, ", src is ",
+          src.extent(d), ", dst is ", dst.extent(d), "."));
+    }
+  }
+  return absl::OkStatus();
+}
+
+}  // namespace internal
+}  // namespace npy_array
@@ -0,0 +1,229 @@
+#ifndef NPY_ARRAY_FOR_EACH_H_
+#define NPY_ARRAY_FOR_EACH_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <type_traits>
+
+#include "absl/container/inlined_vector.h"
+#include "absl/status/status.h"
+#include "absl/types/span.h"
+#include "npy_array/data_type.h"
+#include "npy_array/dynamic_array.h"
+#include "npy_array/thread_pool.h"
+
+namespace npy_array {
+
+struct ForEachOptions {
+  // Splits large iterations across threads. `min_bytes_per_thread` counts
+  // bytes summed over all arrays.
+  ThreadingOptions threading;
+
+  // The iteration space is split into tiles of about this many bytes (summed
+  // over all arrays), which threads claim one at a time, so uneven work
+  // balances itself.
+  int64_t tile_bytes = int64_t{64} << 10;  // 64 KB.
+};
+
+// Calls `f(T* run, int64_t stride, int64_t n)` for runs of elements that
+// together cover `dar` once. A run is `n` elements along the innermost loop,
+// `stride` elements apart: dimensions are ordered by stride and fused where
+// contiguous, so `stride` is 1 and runs are long for compact arrays and their
+// crops. Use this when `f` has its own vectorized inner loop.
+//
+// The iteration space is split into tiles of ForEachOptions::tile_bytes along
+// its outermost loops (and within the innermost loop if it is longer than a
+// tile), and tiles run in parallel: `f` may be called concurrently and in any
+// order. T may be const. Returns an error if the data type of `dar` is not T.
+template <typename T, typename F>
+absl::Status ParallelForEachRun(
+    DynamicArrayRef dar, F&& f,
+    const ForEachOptions& options = ForEachOptions());
+
+// Calls `f(T& x)` for each element of `dar`, as above. For read-only access,
+// use a const T.
+template <typename T, typename F>
+absl::Status ParallelForEach(DynamicArrayRef dar, F&& f,
+                             const ForEachOptions& options = ForEachOptions());
+
+// Sets each element of `dst` to `f(x)`, where x is the element of `src` at the
+// same indices (mins are ignored). The loops follow the layout of `dst`. `src`
+// and `dst` must have the same extents and may be the same array, but must not
+// otherwise overlap. Returns an error if the data types are not Src and Dst or
+// the extents differ.
+template <typename Src, typename Dst, typename F>
+absl::Status Transform(const DynamicArrayRef& src, DynamicArrayRef dst, F&& f,
+                       const ForEachOptions& options = ForEachOptions());
+
+// ----- Implementation of template functions -----
+namespace internal {
+
+// One loop of an elementwise operation over up to two arrays. Strides are in
+// elements.
+struct ForEachLoop {
+  int64_t extent;
+  int64_t strides[2];
+};
+
+// How an elementwise operation is split into tiles. A row is one run of the
+// innermost loop. A tile is either `rows_per_tile` whole rows, or, if rows are
+// longer than a tile, one of `row_segments` segments of a row.
+struct ForEachPlan {
+  // Innermost first. Never empty: a single element is one loop of extent 1.
+  absl::InlinedVector<ForEachLoop, DynamicShape::kInlineRank> loops;
+  int64_t num_rows = 0;
+  int64_t row_segments = 1;
+  int64_t segment_length = 0;
+  int64_t rows_per_tile = 1;
+  int64_t num_tiles = 0;
+  int num_threads = 1;
+};
+
+// Plans a loop over `shapes`, which must have the same extents, ordered by the
+// strides of the first. `bytes_per_element` is summed over the arrays.
+ForEachPlan PlanForEach(absl::Span<const DynamicShape* const> shapes,
+                        int64_t bytes_per_element,
+                        const ForEachOptions& options);
+
+// Calls `tile(t)` for each tile of `plan`, in parallel.
+void RunTiles(const ForEachPlan& plan, const ForEachOptions& options,
+              const std::function<void(int64_t)>& tile);
+
+absl::Status CheckDataType(const char* function, DataType expected,
+                           DataType actual);
+
+absl::Status CheckSameExtents(const char* function, const DynamicShape& src,
+                              const DynamicShape& dst);
+
+// Calls `run(offset0, offset1, n)` for each run in tile `t` of `plan`, where
+// the offsets (in elements) are of the first element of the run in each array.
+template <typename F>
+void ForEachRunInTile(const ForEachPlan& plan, int64_t t, F&& run) {
+  const ForEachLoop& inner = plan.loops[0];
+  int64_t row_begin = t * plan.rows_per_tile;
+  int64_t row_end = std::min(row_begin + plan.rows_per_tile, plan.num_rows);
+  int64_t begin = 0;
+  int64_t n = inner.extent;
+  if (plan.row_segments > 1) {
+    row_begin = t / plan.row_segments;
+    row_end = row_begin + 1;
+    begin = (t % plan.row_segments) * plan.segment_length;
+    n = std::min(plan.segment_length, inner.extent - begin);
+  }
+  for (int64_t row = row_begin; row < row_end; ++row) {
+    int64_t offset0 = begin * inner.strides[0];
+    int64_t offset1 = begin * inner.strides[1];
+    int64_t rest = row;
+    for (size_t d = 1; d < plan.loops.size(); ++d) {
+      const int64_t i = rest % plan.loops[d].extent;
+      rest /= plan.loops[d].extent;
+      offset0 += i * plan.loops[d].strides[0];
+      offset1 += i * plan.loops[d].strides[1];
+    }
+    run(offset0, offset1, n);
+  }
+}
+
+// ParallelForEachRun, with errors prefixed with `function`.
+template <typename T, typename F>
+absl::Status ForEachRun(const char* function, DynamicArrayRef dar, F&& f,
+                        const ForEachOptions& options) {
+  using U = std::remove_const_t<T>;
+  const absl::Status status =
+      CheckDataType(function, DataTypeFor<U>(), dar.data_type());
+  if (!status.ok()) {
+    return status;
+  }
+  if (dar.empty()) {
+    return absl::OkStatus();
+  }
+
+  const DynamicShape* shapes[] = {&dar.shape()};
+  const ForEachPlan plan = PlanForEach(shapes, sizeof(T), options);
+  T* base = dar.data<U>();
+  const int64_t stride = plan.loops[0].strides[0];
+  RunTiles(plan, options, [&](int64_t t) {
+    ForEachRunInTile(plan, t, [&](int64_t offset, int64_t, int64_t n) {
+      f(base + offset, stride, n);
+    });
+  });
+  return absl::OkStatus();
+}
+
+}  // namespace internal
+
+template <typename T, typename F>
+absl::Status ParallelForEachRun(DynamicArrayRef dar, F&& f,
+                                const ForEachOptions& options) {
+  return internal::ForEachRun<T>("ParallelForEachRun", dar, f, options);
+}
+
+template <typename T, typename F>
+absl::Status ParallelForEach(DynamicArrayRef dar, F&& f,
+                             const ForEachOptions& options) {
+  return internal::ForEachRun<T>(
+      "ParallelForEach", dar,
+      [&f](T* run, int64_t stride, int64_t n) {
+        // The contiguous case is separate so that it can be vectorized.
+        if (stride == 1) {
+          for (int64_t i = 0; i < n; ++i) {
+            f(run[i]);
+          }
+        } else {
+          for (int64_t i = 0; i < n; ++i) {
+            f(run[i * stride]);
+          }
+        }
+      },
+      options);
+}
+
+template <typename Src, typename Dst, typename F>
+absl::Status Transform(const DynamicArrayRef& src, DynamicArrayRef dst, F&& f,
+                       const ForEachOptions& options) {
+  absl::Status status =
+      internal::CheckDataType("Transform", DataTypeFor<Src>(), src.data_type());
+  if (status.ok()) {
+    status = internal::CheckDataType("Transform", DataTypeFor<Dst>(),
+                                     dst.data_type());
+  }
+  if (status.ok()) {
+    status = internal::CheckSameExtents("Transform", src.shape(), dst.shape());
+  }
+  if (!status.ok()) {
+    return status;
+  }
+  if (dst.empty()) {
+    return absl::OkStatus();
+  }
+
+  const DynamicShape* shapes[] = {&dst.shape(), &src.shape()};
+  const internal::ForEachPlan plan =
+      internal::PlanForEach(shapes, sizeof(Src) + sizeof(Dst), options);
+  const Src* in = src.data<Src>();
+  Dst* out = dst.data<Dst>();
+  const int64_t dst_stride = plan.loops[0].strides[0];
+  const int64_t src_stride = plan.loops[0].strides[1];
+  internal::RunTiles(plan, options, [&](int64_t t) {
+    internal::ForEachRunInTile(
+        plan, t, [&](int64_t dst_offset, int64_t src_offset, int64_t n) {
+          Dst* o = out + dst_offset;
+          const Src* i = in + src_offset;
+          if (dst_stride == 1 && src_stride == 1) {
+            for (int64_t k = 0; k < n; ++k) {
+              o[k] = f(i[k]);
+            }
+          } else {
+            for (int64_t k = 0; k < n; ++k) {
+              o[k * dst_stride] = f(i[k * src_stride]);
+            }
+          }
+        });
+  });
+  return absl::OkStatus();
+}
+
+}  // namespace npy_array
+
+#endif  // NPY_ARRAY_FOR_EACH_H_
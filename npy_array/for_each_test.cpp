@@ -0,0 +1,185 @@
+#include "npy_array/for_each.h"
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+#include "absl/status/status.h"
+#include "gtest/gtest.h"
+#include "npy_array/data_type.h"
+#include "npy_array/dynamic_array.h"
+#include "npy_array/gtest_half.h"
+#include "npy_array/half.h"
+#include "npy_array/thread_pool.h"
+
+namespace npy_array {
+namespace {
+
+template <typename T>
+class ForEachTest : public testing::Test {};
+
+using MyTypes =
+    testing::Types<int8_t, int16_t, int32_t, int64_t, uint8_t, uint16_t,
+                   uint32_t, uint64_t, half, float, double>;
+TYPED_TEST_SUITE(ForEachTest, MyTypes);
+
+TYPED_TEST(ForEachTest, VisitsEachElementOnce) {
+  DynamicArray arr(DataTypeFor<TypeParam>(), {7, 5, 3});
+  ASSERT_TRUE(ParallelForEach<TypeParam>(arr, [](TypeParam& x) {
+                x = static_cast<TypeParam>(static_cast<int>(x) + 1);
+              }).ok());
+  ASSERT_TRUE(ParallelForEach<TypeParam>(arr, [](TypeParam& x) {
+                x = static_cast<TypeParam>(static_cast<int>(x) * 3);
+              }).ok());
+  for (int64_t i = 0; i < arr.NumElements(); ++i) {
+    EXPECT_EQ(arr.data<TypeParam>()[i], static_cast<TypeParam>(3));
+  }
+}
+
+TYPED_TEST(ForEachTest, Transform) {
+  DynamicArray src(DataTypeFor<TypeParam>(), {6, 4});
+  for (int64_t i = 0; i < src.NumElements(); ++i) {
+    src.data<TypeParam>()[i] = static_cast<TypeParam>(i);
+  }
+  DynamicArray dst(DataType::kFloat64, {6, 4});
+  ASSERT_TRUE((Transform<TypeParam, double>(
+                   src, dst,
+                   [](TypeParam x) { return 0.5 * static_cast<double>(x); }))
+                  .ok());
+  for (int64_t i = 0; i < dst.NumElements(); ++i) {
+    EXPECT_EQ(dst.data<double>()[i], 0.5 * i);
+  }
+}
+
+TEST(ForEachTest, RunsAreFusedAndContiguous) {
+  DynamicArray arr(DataType::kUint8, {100, 50, 3});
+  int64_t num_runs = 0;
+  ASSERT_TRUE(ParallelForEachRun<uint8_t>(
+                  arr,
+                  [&](uint8_t* run, int64_t stride, int64_t n) {
+                    EXPECT_EQ(stride, 1);
+                    EXPECT_EQ(n, 15000);
+                    ++num_runs;
+                  })
+                  .ok());
+  EXPECT_EQ(num_runs, 1);
+
+  // A crop of x has runs of one row, contiguous.
+  DynamicArrayRef crop = arr.ref().Crop({10, 0, 0}, {80, 50, 3});
+  num_runs = 0;
+  ASSERT_TRUE(ParallelForEachRun<uint8_t>(
+                  crop,
+                  [&](uint8_t* run, int64_t stride, int64_t n) {
+                    EXPECT_EQ(stride, 1);
+                    EXPECT_EQ(n, 80);
+                    ++num_runs;
+                  })
+                  .ok());
+  EXPECT_EQ(num_runs, 150);
+
+  // A slice of x is strided.
+  num_runs = 0;
+  ASSERT_TRUE(ParallelForEachRun<uint8_t>(
+                  arr.ref().Slice(0, 5),
+                  [&](uint8_t* run, int64_t stride, int64_t n) {
+                    EXPECT_EQ(stride, 100);
+                    EXPECT_EQ(n, 150);
+                    ++num_runs;
+                  })
+                  .ok());
+  EXPECT_EQ(num_runs, 1);
+}
+
+TEST(ForEachTest, TransformFollowsDstLayout) {
+  // Transpose while converting: src is read with a stride.
+  DynamicArray src(DataType::kInt32, {5, 3});
+  for (int64_t y = 0; y < 3; ++y) {
+    for (int64_t x = 0; x < 5; ++x) {
+      src.Set<int32_t>({x, y}, static_cast<int32_t>(10 * x + y));
+    }
+  }
+  DynamicArray dst(DataType::kInt64, {3, 5});
+  DynamicArrayRef transposed = dst.ref().Permute({1, 0});
+  ASSERT_TRUE((Transform<int32_t, int64_t>(
+                   src, transposed, [](int32_t x) { return int64_t{x} * 2; }))
+                  .ok());
+  for (int64_t y = 0; y < 3; ++y) {
+    for (int64_t x = 0; x < 5; ++x) {
+      EXPECT_EQ(dst.At<int64_t>({y, x}), 2 * (10 * x + y));
+    }
+  }
+}
+
+TEST(ForEachTest, ConstArray) {
+  DynamicArray arr(DataType::kFloat32, {10, 10});
+  for (int64_t i = 0; i < arr.NumElements(); ++i) {
+    arr.data<float>()[i] = 1.0f;
+  }
+  double sum = 0.0;
+  ASSERT_TRUE(ParallelForEach<const float>(arr.ref(), [&](const float& x) {
+                sum += x;
+              }).ok());
+  EXPECT_EQ(sum, 100.0);
+}
+
+TEST(ForEachTest, MultithreadedTiles) {
+  ThreadPool pool(3);
+  const ForEachOptions options{.threading = {.max_threads = 0,
+                                             .min_bytes_per_thread = 1024,
+                                             .thread_pool = &pool},
+                               .tile_bytes = 4096};
+
+  // One long run is split into segments, and a crop into ranges of rows.
+  DynamicArray arr(DataType::kUint16, {1000, 300});
+  for (const DynamicArrayRef& view :
+       {arr.ref(), arr.ref().Crop({1, 1}, {998, 298})}) {
+    std::atomic<int64_t> count = 0;
+    ASSERT_TRUE(ParallelForEach<uint16_t>(
+                    view,
+                    [&](uint16_t& x) {
+                      ++x;
+                      ++count;
+                    },
+                    options)
+                    .ok());
+    EXPECT_EQ(count, view.NumElements());
+  }
+  EXPECT_EQ(arr.At<uint16_t>({0, 0}), 1);
+  EXPECT_EQ(arr.At<uint16_t>({500, 100}), 2);
+  EXPECT_EQ(arr.At<uint16_t>({999, 299}), 1);
+
+  DynamicArray dst(DataType::kFloat32, {1000, 300});
+  ASSERT_TRUE((Transform<uint16_t, float>(
+                   arr, dst, [](uint16_t x) { return x * 0.5f; }, options))
+                  .ok());
+  EXPECT_EQ(dst.At<float>({500, 100}), 1.0f);
+}
+
+TEST(ForEachTest, Errors) {
+  DynamicArray arr(DataType::kUint8, {4, 3});
+  const absl::Status status = ParallelForEach<float>(arr, [](float&) {});
+  EXPECT_EQ(status.code(), absl::StatusCode::kInvalidArgument);
+  EXPECT_EQ(std::string(status.message()),
+            "ParallelForEach: expected data type kFloat32, got kUint8.");
+  EXPECT_EQ(std::string(ParallelForEachRun<float>(
+                            arr, [](float*, int64_t, int64_t) {})
+                            .message()),
+            "ParallelForEachRun: expected data type kFloat32, got kUint8.");
+
+  DynamicArray wrong_extents(DataType::kUint8, {3, 4});
+  EXPECT_EQ((Transform<uint8_t, uint8_t>(arr, wrong_extents,
+                                         [](uint8_t x) { return x; }))
+                .code(),
+            absl::StatusCode::kInvalidArgument);
+
+  // Empty arrays and scalars.
+  DynamicArray empty(DataType::kUint8, {0, 3});
+  EXPECT_TRUE(ParallelForEach<uint8_t>(empty, [](uint8_t&) { FAIL(); }).ok());
+  DynamicArray scalar(DataType::kInt32, {});
+  EXPECT_TRUE(
+      ParallelForEach<int32_t>(scalar, [](int32_t& x) { x = 42; }).ok());
+  EXPECT_EQ(scalar.At<int32_t>({}), 42);
+}
+
+}  // namespace
+}  // namespace npy_array
@@ -0,0 +1,278 @@
+#include "npy_array/interleave.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+
+#include "npy_array/compile_time_loop.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define NPY_ARRAY_HAS_SHUFFLE_NETWORK 1
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define NPY_ARRAY_HAS_SHUFFLE_NETWORK 1
+#endif
+
+namespace npy_array {
+
+namespace {
+
+// Unsigned integer type with the given size in bytes.
+template <int kSize>
+struct UintOfSize;
+
+template <>
+struct UintOfSize<1> {
+  using type = uint8_t;
+};
+
+template <>
+struct UintOfSize<2> {
+  using type = uint16_t;
+};
+
+template <>
+struct UintOfSize<4> {
+  using type = uint32_t;
+};
+
+template <>
+struct UintOfSize<8> {
+  using type = uint64_t;
+};
+
+constexpr int Log2(int x) { return x <= 1 ? 0 : 1 + Log2(x / 2); }
+
+#if defined(NPY_ARRAY_HAS_SHUFFLE_NETWORK)
+
+constexpr int kVectorBytes = 16;
+
+#if defined(__SSE2__)
+
+using Vector = __m128i;
+
+Vector Load(const uint8_t* p) {
+  return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+}
+
+void Store(uint8_t* p, Vector v) {
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(p), v);
+}
+
+// Interleaves the kSize-byte lanes from the low halves of `a` and `b`.
+template <int kSize>
+Vector ZipLo(Vector a, Vector b) {
+  if constexpr (kSize == 1) {
+    return _mm_unpacklo_epi8(a, b);
+  } else if constexpr (kSize == 2) {
+    return _mm_unpacklo_epi16(a, b);
+  } else if constexpr (kSize == 4) {
+    return _mm_unpacklo_epi32(a, b);
+  } else {
+    return _mm_unpacklo_epi64(a, b);
+  }
+}
+
+// Interleaves the kSize-byte lanes from the high halves of `a` and `b`.
+template <int kSize>
+Vector ZipHi(Vector a, Vector b) {
+  if constexpr (kSize == 1) {
+    return _mm_unpackhi_epi8(a, b);
+  } else if constexpr (kSize == 2) {
+    return _mm_unpackhi_epi16(a, b);
+  } else if constexpr (kSize == 4) {
+    return _mm_unpackhi_epi32(a, b);
+  } else {
+    return _mm_unpackhi_epi64(a, b);
+  }
+}
+
+#else  // AArch64 NEON.
+
+using Vector = uint8x16_t;
+
+Vector Load(const uint8_t* p) { return vld1q_u8(p); }
+
+void Store(uint8_t* p, Vector v) { vst1q_u8(p, v); }
+
+template <int kSize>
+Vector ZipLo(Vector a, Vector b) {
+  if constexpr (kSize == 1) {
+    return vzip1q_u8(a, b);
+  } else if constexpr (kSize == 2) {
+    return vreinterpretq_u8_u16(
+        vzip1q_u16(vreinterpretq_u16_u8(a), vreinterpretq_u16_u8(b)));
+  } else if constexpr (kSize == 4) {
+    return vreinterpretq_u8_u32(
+        vzip1q_u32(vreinterpretq_u32_u8(a), vreinterpretq_u32_u8(b)));
+  } else {
+    return vreinterpretq_u8_u64(
+        vzip1q_u64(vreinterpretq_u64_u8(a), vreinterpretq_u64_u8(b)));
+  }
+}
+
+template <int kSize>
+Vector ZipHi(Vector a, Vector b) {
+  if constexpr (kSize == 1) {
+    return vzip2q_u8(a, b);
+  } else if constexpr (kSize == 2) {
+    return vreinterpretq_u8_u16(
+        vzip2q_u16(vreinterpretq_u16_u8(a), vreinterpretq_u16_u8(b)));
+  } else if constexpr (kSize == 4) {
+    return vreinterpretq_u8_u32(
+        vzip2q_u32(vreinterpretq_u32_u8(a), vreinterpretq_u32_u8(b)));
+  } else {
+    return vreinterpretq_u8_u64(
+        vzip2q_u64(vreinterpretq_u64_u8(a), vreinterpretq_u64_u8(b)));
+  }
+}
+
+#endif
+
+// Applies kRounds perfect shuffles to the stream of kSize-byte elements formed
+// by concatenating v[0], ..., v[kNumVectors - 1]. Each round riffles the first
+// half of the stream with the second half, which rotates the bits of each
+// element's index left by one.
+//
+// For a stream of kNumVectors channels with kLanes elements each:
+// - log2(kNumVectors) rounds turn planar into interleaved.
+// - log2(kLanes) rounds turn interleaved into planar.
+template <int kSize, int kNumVectors, int kRounds>
+void PerfectShuffle(Vector* v) {
+  for (int r = 0; r < kRounds; ++r) {
+    Vector w[kNumVectors];
+    for (int i = 0; i < kNumVectors / 2; ++i) {
+      w[2 * i] = ZipLo<kSize>(v[i], v[i + kNumVectors / 2]);
+      w[2 * i + 1] = ZipHi<kSize>(v[i], v[i + kNumVectors / 2]);
+    }
+    std::copy(w, w + kNumVectors, v);
+  }
+}
+
+// Returns true if there is a shuffle network for `num_channels`.
+constexpr bool HasShuffleNetwork(int num_channels) {
+  return num_channels == 2 || num_channels == 4 || num_channels == 8;
+}
+
+#endif  // NPY_ARRAY_HAS_SHUFFLE_NETWORK
+
+template <int kSize, int kChannels>
+void InterleaveImpl(const uint8_t* src, int64_t src_channel_stride,
+                    int64_t num_pixels, uint8_t* dst) {
+  int64_t p = 0;
+
+#if defined(NPY_ARRAY_HAS_SHUFFLE_NETWORK)
+  if constexpr (HasShuffleNetwork(kChannels)) {
+    constexpr int kLanes = kVectorBytes / kSize;
+    const int64_t src_channel_stride_bytes = src_channel_stride * kSize;
+    for (; p + kLanes <= num_pixels; p += kLanes) {
+      Vector v[kChannels];
+      for (int c = 0; c < kChannels; ++c) {
+        v[c] = Load(src + c * src_channel_stride_bytes + p * kSize);
+      }
+      PerfectShuffle<kSize, kChannels, Log2(kChannels)>(v);
+      for (int c = 0; c < kChannels; ++c) {
+        Store(dst + p * kChannels * kSize + c * kVectorBytes, v[c]);
+      }
+    }
+  }
+#endif
+
+  // Scalar loop for the remaining pixels, or all of them if there is no
+  // shuffle network.
+  using U = typename UintOfSize<kSize>::type;
+  const U* src_u = reinterpret_cast<const U*>(src);
+  U* dst_u = reinterpret_cast<U*>(dst);
+  for (; p < num_pixels; ++p) {
+    for (int c = 0; c < kChannels; ++c) {
+      dst_u[p * kChannels + c] = src_u[c * src_channel_stride + p];
+    }
+  }
+}
+
+template <int kSize, int kChannels>
+void DeinterleaveImpl(const uint8_t* src, int64_t num_pixels, uint8_t* dst,
+                      int64_t dst_channel_stride) {
+  int64_t p = 0;
+
+#if defined(NPY_ARRAY_HAS_SHUFFLE_NETWORK)
+  if constexpr (HasShuffleNetwork(kChannels)) {
+    constexpr int kLanes = kVectorBytes / kSize;
+    const int64_t dst_channel_stride_bytes = dst_channel_stride * kSize;
+    for (; p + kLanes <= num_pixels; p += kLanes) {
+      Vector v[kChannels];
+      for (int c = 0; c < kChannels; ++c) {
+        v[c] = Load(src + p * kChannels * kSize + c * kVectorBytes);
+      }
+      PerfectShuffle<kSize, kChannels, Log2(kLanes)>(v);
+      for (int c = 0; c < kChannels; ++c) {
+        Store(dst + c * dst_channel_stride_bytes + p * kSize, v[c]);
+      }
+    }
+  }
+#endif
+
+  using U = typename UintOfSize<kSize>::type;
+  const U* src_u = reinterpret_cast<const U*>(src);
+  U* dst_u = reinterpret_cast<U*>(dst);
+  for (; p < num_pixels; ++p) {
+    for (int c = 0; c < kChannels; ++c) {
+      dst_u[c * dst_channel_stride + p] = src_u[p * kChannels + c];
+    }
+  }
+}
+
+// Calls f.template operator()<kSize, kChannels>() for the matching
+// (element_size, num_channels) pair. Returns false if there is none.
+template <typename F>
+bool DispatchInterleaveKernel(int64_t num_channels, int64_t element_size,
+                              F&& f) {
+  bool found = false;
+  ForValues<1, 2, 4, 8>([&]<int kSize>() {
+    if (kSize != element_size) {
+      return;
+    }
+    ForValues<1, 2, 3, 4, 8>([&]<int kChannels>() {
+      if (kChannels != num_channels) {
+        return;
+      }
+      f.template operator()<kSize, kChannels>();
+      found = true;
+    });
+  });
+  return found;
+}
+
+}  // namespace
+
+bool HasInterleaveKernel(int64_t num_channels, int64_t element_size) {
+  return DispatchInterleaveKernel(num_channels, element_size,
+                                  []<int kSize, int kChannels>() {});
+}
+
+void Interleave(const void* src, int64_t src_channel_stride,
+                int64_t num_channels, int64_t num_pixels, int64_t element_size,
+                void* dst) {
+  [[maybe_unused]] const bool found = DispatchInterleaveKernel(
+      num_channels, element_size, [&]<int kSize, int kChannels>() {
+        InterleaveImpl<kSize, kChannels>(static_cast<const uint8_t*>(src),
+                                         src_channel_stride, num_pixels,
+                                         static_cast<uint8_t*>(dst));
+      });
+  assert(found);
+}
+
+void Deinterleave(const void* src, int64_t num_channels, int64_t num_pixels,
+                  int64_t element_size, void* dst, int64_t dst_channel_stride) {
+  [[maybe_unused]] const bool found = DispatchInterleaveKernel(
+      num_channels, element_size, [&]<int kSize, int kChannels>() {
+        DeinterleaveImpl<kSize, kChannels>(static_cast<const uint8_t*>(src),
+                                           num_pixels,
+                                           static_cast<uint8_t*>(dst),
+                                           dst_channel_stride);
+      });
+  assert(found);
+}
+
+}  // namespace npy_array
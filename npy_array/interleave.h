@@ -0,0 +1,45 @@
+#ifndef NPY_ARRAY_INTERLEAVE_H_
+#define NPY_ARRAY_INTERLEAVE_H_
+
+#include <cstdint>
+
+namespace npy_array {
+
+// Kernels that convert between planar and interleaved layouts for a small
+// number of channels.
+//
+// A "planar" buffer stores each channel contiguously: element (p, c) lives at
+// `c * channel_stride + p`. An "interleaved" buffer stores all channels of a
+// pixel contiguously: element (p, c) lives at `p * num_channels + c`. All
+// strides are in units of elements, not bytes.
+//
+// Kernels are selected by element size rather than by type: uint8, uint16 /
+// half, and float all share the 1, 2, and 4 byte kernels. Channel counts of 2,
+// 4, and 8 use a SIMD shuffle network on SSE2 and AArch64 NEON. Other
+// supported counts (1, 3) use a scalar loop with a compile-time channel count,
+// which compilers vectorize well.
+//
+// StridedCopy() (strided_copy.h) selects these kernels automatically.
+
+// Returns true if Interleave() and Deinterleave() support the given number of
+// channels and element size.
+bool HasInterleaveKernel(int64_t num_channels, int64_t element_size);
+
+// Copies a planar `src` into an interleaved `dst`:
+//   dst[p * num_channels + c] = src[c * src_channel_stride + p].
+//
+// HasInterleaveKernel(num_channels, element_size) must be true.
+void Interleave(const void* src, int64_t src_channel_stride,
+                int64_t num_channels, int64_t num_pixels, int64_t element_size,
+                void* dst);
+
+// Copies an interleaved `src` into a planar `dst`:
+//   dst[c * dst_channel_stride + p] = src[p * num_channels + c].
+//
+// HasInterleaveKernel(num_channels, element_size) must be true.
+void Deinterleave(const void* src, int64_t num_channels, int64_t num_pixels,
+                  int64_t element_size, void* dst, int64_t dst_channel_stride);
+
+}  // namespace npy_array
+
+#endif  // NPY_ARRAY_INTERLEAVE_H_
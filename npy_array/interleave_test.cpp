@@ -0,0 +1,82 @@
+#include "npy_array/interleave.h"
+
+#include <array>
+#include <cstdint>
+#include <numeric>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+using testing::ElementsAreArray;
+
+namespace npy_array {
+namespace {
+
+template <typename T>
+class InterleaveTest : public testing::Test {};
+
+using MyTypes = testing::Types<uint8_t, uint16_t, uint32_t, uint64_t>;
+TYPED_TEST_SUITE(InterleaveTest, MyTypes);
+
+// Pixel counts that exercise both the vector loop and the scalar tail.
+constexpr std::array<int64_t, 4> kNumPixels = {1, 16, 37, 1000};
+
+TYPED_TEST(InterleaveTest, InterleaveMatchesScalar) {
+  for (int64_t num_channels : {1, 2, 3, 4, 8}) {
+    for (int64_t num_pixels : kNumPixels) {
+      // Use some padding between planes.
+      const int64_t channel_stride = num_pixels + 5;
+      std::vector<TypeParam> planar(channel_stride * num_channels);
+      std::iota(planar.begin(), planar.end(), TypeParam(1));
+
+      std::vector<TypeParam> expected(num_pixels * num_channels);
+      for (int64_t p = 0; p < num_pixels; ++p) {
+        for (int64_t c = 0; c < num_channels; ++c) {
+          expected[p * num_channels + c] = planar[c * channel_stride + p];
+        }
+      }
+
+      ASSERT_TRUE(HasInterleaveKernel(num_channels, sizeof(TypeParam)));
+      std::vector<TypeParam> interleaved(num_pixels * num_channels);
+      Interleave(planar.data(), channel_stride, num_channels, num_pixels,
+                 sizeof(TypeParam), interleaved.data());
+      EXPECT_THAT(interleaved, ElementsAreArray(expected))
+          << "num_channels = " << num_channels
+          << ", num_pixels = " << num_pixels;
+    }
+  }
+}
+
+TYPED_TEST(InterleaveTest, DeinterleaveMatchesScalar) {
+  for (int64_t num_channels : {1, 2, 3, 4, 8}) {
+    for (int64_t num_pixels : kNumPixels) {
+      std::vector<TypeParam> interleaved(num_pixels * num_channels);
+      std::iota(interleaved.begin(), interleaved.end(), TypeParam(1));
+
+      const int64_t channel_stride = num_pixels + 3;
+      std::vector<TypeParam> expected(channel_stride * num_channels);
+      for (int64_t p = 0; p < num_pixels; ++p) {
+        for (int64_t c = 0; c < num_channels; ++c) {
+          expected[c * channel_stride + p] = interleaved[p * num_channels + c];
+        }
+      }
+
+      std::vector<TypeParam> planar(channel_stride * num_channels);
+      Deinterleave(interleaved.data(), num_channels, num_pixels,
+                   sizeof(TypeParam), planar.data(), channel_stride);
+      EXPECT_THAT(planar, ElementsAreArray(expected))
+          << "num_channels = " << num_channels
+          << ", num_pixels = " << num_pixels;
+    }
+  }
+}
+
+TEST(InterleaveTest, UnsupportedKernels) {
+  EXPECT_FALSE(HasInterleaveKernel(5, 4));
+  EXPECT_FALSE(HasInterleaveKernel(3, 3));
+  EXPECT_FALSE(HasInterleaveKernel(0, 1));
+}
+
+}  // namespace
+}  // namespace npy_array
@@ -0,0 +1,79 @@
+#include "npy_array/mapped_file.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include "absl/cleanup/cleanup.h"
+#include "absl/strings/str_cat.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define NPY_ARRAY_HAVE_MMAP 1
+#endif
+
+namespace npy_array {
+
+absl::StatusOr<std::shared_ptr<const MappedFile>> MappedFile::Open(
+    const std::filesystem::path& path) {
+#if defined(NPY_ARRAY_HAVE_MMAP)
+  const int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return absl::NotFoundError(absl::StrCat("MappedFile: unable to open ",
+                                            path.string(), ": ",
+                                            std::strerror(errno)));
+  }
+  // The mapping stays valid after the descriptor is closed.
+  absl::Cleanup close_fd([fd] { close(fd); });
+
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) != 0) {
+    return absl::InternalError(absl::StrCat("MappedFile: unable to stat ",
+                                            path.string(), ": ",
+                                            std::strerror(errno)));
+  }
+
+  const int64_t size = file_stat.st_size;
+  if (size == 0) {
+    return std::shared_ptr<const MappedFile>(new MappedFile(nullptr, 0));
+  }
+
+  void* data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (data == MAP_FAILED) {
+    return absl::InternalError(absl::StrCat("MappedFile: unable to map ",
+                                            path.string(), ": ",
+                                            std::strerror(errno)));
+  }
+  return std::shared_ptr<const MappedFile>(new MappedFile(data, size));
+#else
+  return absl::UnimplementedError(
+      "MappedFile: memory mapping is not supported on this platform.");
+#endif
+}
+
+void MappedFile::WillNeed(int64_t offset, int64_t size) const {
+#if defined(NPY_ARRAY_HAVE_MMAP)
+  offset = std::max<int64_t>(offset, 0);
+  const int64_t end = std::min(offset + size, size_);
+  if (data_ == nullptr || offset >= end) {
+    return;
+  }
+  // madvise() needs a page-aligned address. The mapping itself is aligned.
+  const int64_t page_size = sysconf(_SC_PAGESIZE);
+  const int64_t begin = offset / page_size * page_size;
+  madvise(static_cast<char*>(data_) + begin, end - begin, MADV_WILLNEED);
+#endif
+}
+
+MappedFile::~MappedFile() {
+#if defined(NPY_ARRAY_HAVE_MMAP)
+  if (data_ != nullptr) {
+    munmap(data_, size_);
+  }
+#endif
+}
+
+}  // namespace npy_array
@@ -0,0 +1,54 @@
+#ifndef NPY_ARRAY_MAPPED_FILE_H_
+#define NPY_ARRAY_MAPPED_FILE_H_
+
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <string_view>
+
+#include "absl/status/statusor.h"
+
+namespace npy_array {
+
+// A read-only memory mapping of an entire file.
+//
+// Pages are loaded lazily by the OS as they are touched, so opening a large
+// file is cheap and only the parts that are read cost I/O. Share the mapping
+// with std::shared_ptr to keep it alive for as long as any view into it (e.g.,
+// a DynamicArray) exists.
+class MappedFile {
+ public:
+  // Maps the file at `path`. Returns an error if it can't be opened or mapped.
+  static absl::StatusOr<std::shared_ptr<const MappedFile>> Open(
+      const std::filesystem::path& path);
+
+  ~MappedFile();
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  // The contents of the file. The data is page aligned. Empty files have no
+  // mapping and return an empty view.
+  std::string_view contents() const {
+    return std::string_view(static_cast<const char*>(data_), size_);
+  }
+
+  const uint8_t* data() const { return static_cast<const uint8_t*>(data_); }
+  int64_t size() const { return size_; }
+
+  // Tells the OS that the bytes [offset, offset + size) will be read soon
+  // (MADV_WILLNEED), so it can start reading them from disk in the background,
+  // e.g., before they are decompressed. This is only a hint: the range is
+  // clipped to the file, and nothing happens on platforms without madvise().
+  void WillNeed(int64_t offset, int64_t size) const;
+
+ private:
+  MappedFile(void* data, int64_t size) : data_(data), size_(size) {}
+
+  void* data_ = nullptr;
+  int64_t size_ = 0;
+};
+
+}  // namespace npy_array
+
+#endif  // NPY_ARRAY_MAPPED_FILE_H_
@@ -0,0 +1,68 @@
+#include "npy_array/mapped_file.h"
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <string>
+
+#include "absl/status/status.h"
+#include "gtest/gtest.h"
+
+namespace npy_array {
+namespace {
+
+std::filesystem::path WriteTempFile(const std::string& name,
+                                    const std::string& contents) {
+  const std::filesystem::path path =
+      std::filesystem::path(testing::TempDir()) / name;
+  std::ofstream file(path, std::ios::binary);
+  file << contents;
+  return path;
+}
+
+TEST(MappedFileTest, MapsContents) {
+  std::string contents(10000, '\0');
+  for (size_t i = 0; i < contents.size(); ++i) {
+    contents[i] = static_cast<char>(i * 7);
+  }
+  const auto path = WriteTempFile("mapped_file_test.bin", contents);
+
+  auto file = MappedFile::Open(path);
+  ASSERT_TRUE(file.ok()) << file.status();
+  EXPECT_EQ((*file)->size(), contents.size());
+  EXPECT_EQ((*file)->contents(), contents);
+  EXPECT_EQ(reinterpret_cast<uintptr_t>((*file)->data()) % 4096, 0);
+}
+
+TEST(MappedFileTest, WillNeed) {
+  const std::string contents(3 * 4096 + 100, 'x');
+  const auto path = WriteTempFile("mapped_file_test_will_need.bin", contents);
+  auto file = MappedFile::Open(path);
+  ASSERT_TRUE(file.ok()) << file.status();
+
+  // Unaligned and out-of-range hints are fine.
+  (*file)->WillNeed(5000, 100);
+  (*file)->WillNeed(0, (*file)->size());
+  (*file)->WillNeed((*file)->size() - 10, 1000);
+  (*file)->WillNeed((*file)->size() + 10, 10);
+  (*file)->WillNeed(-10, 5);
+  EXPECT_EQ((*file)->contents(), contents);
+}
+
+TEST(MappedFileTest, EmptyFile) {
+  const auto path = WriteTempFile("mapped_file_test_empty.bin", "");
+  auto file = MappedFile::Open(path);
+  ASSERT_TRUE(file.ok()) << file.status();
+  EXPECT_EQ((*file)->size(), 0);
+  EXPECT_TRUE((*file)->contents().empty());
+  (*file)->WillNeed(0, 10);
+}
+
+TEST(MappedFileTest, MissingFile) {
+  auto file = MappedFile::Open(std::filesystem::path(testing::TempDir()) /
+                               "does_not_exist.bin");
+  EXPECT_EQ(file.status().code(), absl::StatusCode::kNotFound);
+}
+
+}  // namespace
+}  // namespace npy_array
@@ -14,17 +14,20 @@
 
 #include "npy_array/npy_array.h"
 
-#include <complex>
+#include <algorithm>
 #include <cstddef>
 #include <cstdint>
 #include <regex>  // NOLINT: ok to use std::regex in third_party code.
 #include <string>
 #include <string_view>
+#include <utility>
 #include <vector>
 
 #include "absl/log/log.h"
+#include "absl/strings/ascii.h"
 #include "absl/strings/match.h"
 #include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
 #include "absl/strings/str_join.h"
 #include "absl/strings/str_split.h"
 #include "absl/strings/string_view.h"
@@ -35,12 +38,7 @@ namespace {
 
 // Returns true if this machine is little-endian.
 // Returns false if this machine is big-endian.
-bool IsLittleEndian() {
-  const int32_t x = 1;
-  const char* bytes = reinterpret_cast<const char*>(&x);
-  const char first_byte = bytes[0];
-  return (first_byte != 0);
-}
+constexpr bool IsLittleEndian() { return kNpyEndiannessChar == '<'; }
 
 // 32-bit endianness swap (big <--> little) with no dependencies.
 uint32_t SwapEndian(uint32_t host_int) {
@@ -57,92 +55,252 @@ uint16_t SwapEndian(uint16_t host_int) {
 
 }  // namespace
 
-template <>
-std::string NpyDataTypeString<bool>() {
-  return "b";
+std::string NpyShapeString(const std::vector<size_t>& shape) {
+  if (shape.empty()) {
+    return "()";
+  }
+  return "(" + absl::StrJoin(shape.begin(), shape.end(), ",") + ",)";
 }
 
-template <>
-std::string NpyDataTypeString<NpyFloat16>() {
-  return "f";
+std::string NpyHeaderLengthString(std::string_view header) {
+  std::string header_length_string(4, '\0');
+  const uint32_t header_length = header.length();
+  uint32_t* header_length_ptr =
+      reinterpret_cast<uint32_t*>(header_length_string.data());
+  // The NPY 2.0 format requires that the header length be specified as four
+  // bytes and little endian.
+  *header_length_ptr =
+      IsLittleEndian() ? header_length : SwapEndian(header_length);
+  return header_length_string;
 }
 
-template <>
-std::string NpyDataTypeString<float>() {
-  return "f";
-}
+namespace {
 
-template <>
-std::string NpyDataTypeString<double>() {
-  return "f";
-}
+// Implements NpyFullHeaderString() for the Python literal `descr_value`, e.g.,
+// "'<f4'" (quoted) or "[('x', '<f4')]".
+std::string FullHeaderString(std::string_view descr_value,
+                             std::vector<size_t> shape, bool reverse_axes) {
+  constexpr std::string_view kMagic("\x93NUMPY");
 
-template <>
-std::string NpyDataTypeString<std::complex<float>>() {
-  return "c";
-}
+  // The explicit count is required since the \x00 in the literal would be
+  // interpreted to construct a string of length 1.
+  constexpr std::string_view kVersion("\x02\x00", /*count=*/2);
+
+  // The NPY format says that:
+  // - If fortran_order = False (the default NPY ordering):
+  //   Then the data is stored with the innermost axis changing most frequently.
+  // - If fortran_order = True:
+  //   Then the data is stored with the outermost axis changing most frequently.
+  // Since `NpyDataString` always serializes data with the innermost *nda* axis
+  // changing most frequently, if we *do* reverse the axes so that in npy, the
+  // last axis is the innermost, then fortran_order is False.
+  const bool fortran_order = !reverse_axes;
+
+  if (reverse_axes) {
+    std::reverse(shape.begin(), shape.end());
+  }
 
-template <>
-std::string NpyDataTypeString<int8_t>() {
-  return "i";
+  std::string header =
+      absl::StrCat("{'descr': ", descr_value, ", ",
+                   "'fortran_order': ", fortran_order ? "True, " : "False, ",
+                   "'shape': ", NpyShapeString(shape), "}");
+
+  // The format requires the header to be padded with spaces and terminated by
+  // a newline so that the data starts at a multiple of 64 bytes. This lets
+  // readers use the data in place without copying it to an aligned buffer.
+  constexpr size_t kAlignment = 64;
+  const size_t prefix_size = kMagic.size() + kVersion.size() + 4;
+  const size_t unpadded_size = prefix_size + header.size() + 1;
+  header.append((kAlignment - unpadded_size % kAlignment) % kAlignment, ' ');
+  header.push_back('\n');
+
+  return absl::StrCat(kMagic, kVersion, NpyHeaderLengthString(header), header);
 }
 
-template <>
-std::string NpyDataTypeString<int16_t>() {
-  return "i";
+// Returns the NPY descr string of a field, e.g., "'<f4'".
+std::string FieldDescrString(char type_char, size_t word_size) {
+  return absl::StrCat("'", std::string_view(&kNpyEndiannessChar, 1),
+                      std::string_view(&type_char, 1), word_size, "'");
 }
 
-template <>
-std::string NpyDataTypeString<int32_t>() {
-  return "i";
+// Returns the numpy subarray shape literal, e.g., "(3,)" or "(2, 2)".
+std::string SubarrayShapeString(const std::vector<size_t>& shape) {
+  return shape.size() == 1 ? absl::StrCat("(", shape[0], ",)")
+                           : absl::StrCat("(", absl::StrJoin(shape, ", "), ")");
 }
 
-template <>
-std::string NpyDataTypeString<int64_t>() {
-  return "i";
-}
+}  // namespace
 
-template <>
-std::string NpyDataTypeString<uint8_t>() {
-  return "u";
+std::string NpyFullHeaderString(std::string_view descr,
+                                std::vector<size_t> shape, bool reverse_axes) {
+  return FullHeaderString(absl::StrCat("'", descr, "'"), std::move(shape),
+                          reverse_axes);
 }
 
-template <>
-std::string NpyDataTypeString<uint16_t>() {
-  return "u";
+std::string NpyStructuredHeaderString(const std::vector<NpyField>& fields,
+                                      size_t record_size,
+                                      std::vector<size_t> shape,
+                                      bool reverse_axes) {
+  std::vector<std::string> items;
+  size_t offset = 0;
+  const auto add_padding = [&](size_t end) {
+    if (end > offset) {
+      items.push_back(absl::StrCat("('', '|V", end - offset, "')"));
+    }
+  };
+  for (const NpyField& field : fields) {
+    add_padding(field.offset);
+    std::string item =
+        absl::StrCat("('", field.name, "', ",
+                     FieldDescrString(field.type_char, field.word_size));
+    size_t size = field.word_size;
+    if (!field.shape.empty()) {
+      absl::StrAppend(&item, ", ", SubarrayShapeString(field.shape));
+      for (const size_t extent : field.shape) {
+        size *= extent;
+      }
+    }
+    item.push_back(')');
+    items.push_back(std::move(item));
+    offset = field.offset + size;
+  }
+  add_padding(record_size);
+  return FullHeaderString(absl::StrCat("[", absl::StrJoin(items, ", "), "]"),
+                          std::move(shape), reverse_axes);
 }
 
-template <>
-std::string NpyDataTypeString<uint32_t>() {
-  return "u";
-}
+namespace {
 
-template <>
-std::string NpyDataTypeString<uint64_t>() {
-  return "u";
-}
+// A cursor over a structured descr, e.g., [('x', '<f4'), ('rgb', '|u1', (3,))].
+// Only the subset of Python literal syntax that numpy writes is accepted.
+class DescrParser {
+ public:
+  explicit DescrParser(std::string_view text) : text_(text) {}
 
-std::string NpyEndiannessString() { return IsLittleEndian() ? "<" : ">"; }
+  // Returns true if `c` is next, after any spaces.
+  bool Peek(char c) {
+    SkipSpaces();
+    return !text_.empty() && text_.front() == c;
+  }
 
-std::string NpyShapeString(const std::vector<size_t>& shape) {
-  if (shape.empty()) {
-    return "()";
+  // Consumes `c`, after any spaces, if it is next.
+  bool Consume(char c) {
+    if (!Peek(c)) {
+      return false;
+    }
+    text_.remove_prefix(1);
+    return true;
   }
-  return "(" + absl::StrJoin(shape.begin(), shape.end(), ",") + ",)";
+
+  // Parses a string quoted with ' or ", without escapes.
+  bool ParseString(std::string* s) {
+    const char quote = Peek('"') ? '"' : '\'';
+    if (!Consume(quote)) {
+      return false;
+    }
+    const size_t end = text_.find(quote);
+    if (end == std::string_view::npos) {
+      return false;
+    }
+    *s = std::string(text_.substr(0, end));
+    text_.remove_prefix(end + 1);
+    return true;
+  }
+
+  // Parses a tuple of sizes, e.g., (3,) or (2, 2).
+  bool ParseShape(std::vector<size_t>* shape) {
+    if (!Consume('(')) {
+      return false;
+    }
+    while (!Consume(')')) {
+      SkipSpaces();
+      size_t digits = 0;
+      while (digits < text_.size() && absl::ascii_isdigit(text_[digits])) {
+        ++digits;
+      }
+      size_t extent;
+      if (!absl::SimpleAtoi(text_.substr(0, digits), &extent)) {
+        return false;
+      }
+      shape->push_back(extent);
+      text_.remove_prefix(digits);
+      if (!Consume(',') && !Peek(')')) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+ private:
+  void SkipSpaces() {
+    while (!text_.empty() && text_.front() == ' ') {
+      text_.remove_prefix(1);
+    }
+  }
+
+  std::string_view text_;
+};
+
+// Parses a field type such as '<f4' (without quotes). Returns false if it is
+// malformed or of the wrong endianness.
+bool ParseFieldType(const std::string& type, NpyField* field) {
+  static const std::regex type_re(R"((<|>|\|)(\w)(\d+))");
+  std::smatch match;
+  if (!std::regex_match(type, match, type_re)) {
+    return false;
+  }
+  // We don't support endianness swapping at the moment.
+  if ((match[1] == "<" && !IsLittleEndian()) ||
+      (match[1] == ">" && IsLittleEndian())) {
+    return false;
+  }
+  field->type_char = match[2].str()[0];
+  return absl::SimpleAtoi(match[3].str(), &field->word_size);
 }
 
-std::string NpyHeaderLengthString(std::string_view header) {
-  std::string header_length_string(4, '\0');
-  const uint32_t header_length = header.length();
-  uint32_t* header_length_ptr =
-      reinterpret_cast<uint32_t*>(header_length_string.data());
-  // The NPY 2.0 format requires that the header length be specified as four
-  // bytes and little endian.
-  *header_length_ptr =
-      IsLittleEndian() ? header_length : SwapEndian(header_length);
-  return header_length_string;
+// Parses the list of a structured descr into `header`. Fields are laid out in
+// order, as numpy does. Nested structured fields are not supported.
+bool ParseStructuredDescr(std::string_view descr, NpyHeader* header) {
+  DescrParser parser(descr);
+  if (!parser.Consume('[')) {
+    return false;
+  }
+  size_t offset = 0;
+  while (!parser.Consume(']')) {
+    NpyField field;
+    std::string type;
+    if (!parser.Consume('(') || !parser.ParseString(&field.name) ||
+        !parser.Consume(',') || !parser.ParseString(&type) ||
+        !ParseFieldType(type, &field)) {
+      return false;
+    }
+    if (parser.Consume(',') && !parser.ParseShape(&field.shape)) {
+      return false;
+    }
+    if (!parser.Consume(')')) {
+      return false;
+    }
+    size_t size = field.word_size;
+    for (const size_t extent : field.shape) {
+      size *= extent;
+    }
+    field.offset = offset;
+    offset += size;
+    // Unnamed void fields are padding.
+    if (!field.name.empty() || field.type_char != 'V') {
+      header->fields.push_back(std::move(field));
+    }
+    if (!parser.Consume(',') && !parser.Peek(']')) {
+      return false;
+    }
+  }
+  header->type_char = 'V';
+  header->word_size = offset;
+  return !header->fields.empty();
 }
 
+}  // namespace
+
 NpyHeader ReadHeader(std::string_view src) {
   NpyHeader header;
   constexpr std::string_view kMagic("\x93NUMPY");
@@ -217,12 +375,26 @@ NpyHeader ReadHeader(std::string_view src) {
                     "header, couldn't find fortran_order.";
       return NpyHeader();
     }
-    header.fortran_order = match[1] == "True";
+    header.fortran_order = match[2] == "True";
   }
 
-  {
+  const std::regex structured_descr_re(R"('descr':\s*\[)");
+  std::smatch structured_match;
+  if (std::regex_search(header_substr, structured_match,
+                        structured_descr_re)) {
+    // A list of fields is a structured data type.
+    const size_t list_start =
+        structured_match.position(0) + structured_match.length(0) - 1;
+    if (!ParseStructuredDescr(
+            std::string_view(header_substr).substr(list_start), &header)) {
+      LOG(ERROR) << "DeserializeFromNpyString ReadHeader unable to parse "
+                    "header, couldn't parse structured type descr.";
+      return NpyHeader();
+    }
+  } else {
     // Find the "descr" - data type.
-    std::regex descr_re(R"('descr':\s*'(<|>)(\w)(\d+)')");
+    // '|' means byte order doesn't apply, e.g., for 1-byte types.
+    std::regex descr_re(R"('descr':\s*'(<|>|\|)(\w)(\d+)')");
     std::smatch match;
     if (!std::regex_search(header_substr, match, descr_re)) {
       LOG(ERROR) << "DeserializeFromNpyString ReadHeader unable to parse "
@@ -232,7 +404,7 @@ NpyHeader ReadHeader(std::string_view src) {
     const bool little_endian = match[1].str() == "<";
 
     // We don't support endianness swapping at the moment.
-    if (little_endian != IsLittleEndian()) {
+    if (match[1].str() != "|" && little_endian != IsLittleEndian()) {
       LOG(ERROR) << "DeserializeFromNpyString ReadHeader invalid header, we "
                     "don't support endianness swapping at the moment.";
       return NpyHeader();
@@ -16,18 +16,25 @@
 #define NPY_ARRAY_NPY_ARRAY_H_
 
 #include <algorithm>
+#include <array>
+#include <bit>
 #include <cstddef>
 #include <cstdint>
 #include <cstdio>
 #include <string>
 #include <string_view>
+#include <type_traits>
 #include <utility>
 #include <vector>
 
 #include "absl/log/log.h"
+#include "absl/status/status.h"
 #include "absl/strings/str_cat.h"
 #include "absl/strings/string_view.h"
 #include "array/array.h"
+#include "npy_array/data_type.h"
+#include "npy_array/strided_copy.h"
+#include "npy_array/validate.h"
 
 namespace npy_array {
 
@@ -72,22 +79,30 @@ struct NpySerializeOptions {
   //
   // If `reverse_axes` is false, then the ordering of axes is preserved.
   bool reverse_axes = true;
+
+  // Controls how the data is copied into the output string. Set
+  // `copy_options.threading.max_threads` to copy large arrays on multiple
+  // threads.
+  StridedCopyOptions copy_options;
 };
 
 // Serializes `src` to a std::string in the NPY file format
 // (https://numpy.org/devdocs/reference/generated/numpy.lib.format.html).
 //
-// DataType may be any type specialized by NpyDataTypeString(). This includes
-// all signed and unsigned fixed width types in C++ (8, 16, 32, and 64 bits), as
-// we as float (32 bits), double (64 bits), and float16 (see NpyFloat16 below).
+// DataType may be any type supported by internal::NpyDataTypeChar(). This
+// includes all signed and unsigned fixed width types in C++ (8, 16, 32, and 64
+// bits), as we as float (32 bits), double (64 bits), float16 (see NpyFloat16
+// below), bfloat16, bool, std::complex<float> and std::complex<double>.
 //
 // Caveats:
 // - Non-zero mins are not preserved since the format does not support it.
 // - If `src.empty()`, returns an empty string since the NPY format does not
 //   support empty arrays (the shape "()" refers to a scalar).
 //
+// Structured (record) data is serialized by EncodeRecordArrayToNpy() and
+// EncodeRecordsToNpy() in record_array.h.
+//
 // Future work:
-// - Structured data.
 // - Version 3.0, which uses optional utf8 strings to name structured data axes.
 template <typename DataType, typename ShapeType>
 std::string SerializeToNpyString(
@@ -108,25 +123,43 @@ struct NpyFloat16 {
 static_assert(sizeof(NpyFloat16) == 2, "sizeof(NpyFloat16) should be 2 bytes.");
 
 namespace internal {
-// Returns "<" if this machine is little-endian and ">" if this machine is
-// big-endian.
-std::string NpyEndiannessString();
+// The byte order character of NPY descr strings on this machine: '<' if it is
+// little-endian and '>' if it is big-endian.
+inline constexpr char kNpyEndiannessChar =
+    std::endian::native == std::endian::little ? '<' : '>';
 
-// Returns the single-character type string for the given DataType. See:
+// Returns the single-character type code for the given DataType. See:
 // https://numpy.org/devdocs/reference/arrays.interface.html#arrays-interface.
 //
-// This function template is explicitly specialized only for supported types.
+// Supported types are those with DataTypeTraits and NpyFloat16.
 template <typename DataType>
-std::string NpyDataTypeString();
+constexpr char NpyDataTypeChar() {
+  if constexpr (std::is_same_v<DataType, NpyFloat16>) {
+    return 'f';
+  } else {
+    static_assert(DataTypeTraits<DataType>::kSupported,
+                  "Unsupported NPY data type.");
+    return DataTypeTraits<DataType>::kNpyTypeChar;
+  }
+}
 
-// Returns the NPY "descr string" describing DataType (it is a string that can
-// be passed to the constructor of np.dtype).
-//
-// TODO(jiawen): This can be explicitly specialized too.
+// The characters of NpyDescrString<DataType>(), computed at compile time.
+template <typename DataType>
+inline constexpr std::array<char, 4> kNpyDescrChars = {
+    kNpyEndiannessChar, NpyDataTypeChar<DataType>(),
+    static_cast<char>('0' + (sizeof(DataType) < 10 ? sizeof(DataType)
+                                                   : sizeof(DataType) / 10)),
+    static_cast<char>(sizeof(DataType) < 10 ? '\0'
+                                            : '0' + sizeof(DataType) % 10)};
+
+// Returns the NPY "descr string" describing DataType, e.g., "<f4" (it is a
+// string that can be passed to the constructor of np.dtype). It doesn't
+// allocate.
 template <typename DataType>
-std::string NpyDescrString() {
-  return absl::StrCat(NpyEndiannessString(), NpyDataTypeString<DataType>(),
-                      sizeof(DataType));
+constexpr std::string_view NpyDescrString() {
+  static_assert(sizeof(DataType) < 100);
+  return std::string_view(kNpyDescrChars<DataType>.data(),
+                          sizeof(DataType) < 10 ? 3 : 4);
 }
 
 // Converts array shape to a vector.
@@ -139,6 +172,30 @@ std::vector<size_t> NpyShapeVector(ShapeType shape) {
   return dims;
 }
 
+// Returns the dims of `shape` with their compile-time attributes erased.
+template <typename ShapeType>
+std::array<nda::dim<>, ShapeType::rank()> NpyDims(const ShapeType& shape) {
+  std::array<nda::dim<>, ShapeType::rank()> dims;
+  for (size_t i = 0; i < ShapeType::rank(); ++i) {
+    dims[i] = shape.dim(i);
+  }
+  return dims;
+}
+
+// Returns true if `shape` is compact with the innermost axis changing most
+// frequently, i.e., the layout of the data in an NPY file.
+template <typename ShapeType>
+bool IsNpyCompact(const ShapeType& shape) {
+  int64_t expected_stride = 1;
+  for (size_t i = 0; i < ShapeType::rank(); ++i) {
+    if (shape.dim(i).stride() != expected_stride) {
+      return false;
+    }
+    expected_stride *= shape.dim(i).extent();
+  }
+  return true;
+}
+
 // Returns the NPY shape string for the given shape's extents.
 // - Rank 0 (scalar) --> "()".
 // - Rank 1 (vector) --> "(len,)". Trailing comma is intentional.
@@ -148,40 +205,20 @@ std::string NpyShapeString(const std::vector<size_t>& shape);
 // Encodes the length of `header` in NPY format (four bytes, little endian).
 std::string NpyHeaderLengthString(std::string_view header);
 
-// Returns the "full" NPY file header for the given DataType and ShapeType.
-// The "full header" consists of the magic 6 bytes, version number, and the
-// "NPY header" that describes the data.
+// Returns the "full" NPY file header for an array with NPY descr string
+// `descr` and extents `shape` (innermost first, as in nda). The "full header"
+// consists of the magic 6 bytes, version number, and the "NPY header" that
+// describes the data.
 //
 // This returns a header for version 2.0.
+std::string NpyFullHeaderString(std::string_view descr,
+                                std::vector<size_t> shape, bool reverse_axes);
+
+// Same as above, for the given DataType and ShapeType.
 template <typename DataType, typename ShapeType>
 std::string NpyFullHeaderString(ShapeType shape, bool reverse_axes) {
-  constexpr std::string_view kMagic("\x93NUMPY");
-
-  // The explicit count is required since the \x00 in the literal would be
-  // interpreted to construct a string of length 1.
-  constexpr std::string_view kVersion("\x02\x00", /*count=*/2);
-
-  // The NPY format says that:
-  // - If fortran_order = False (the default NPY ordering):
-  //   Then the data is stored with the innermost axis changing most frequently.
-  // - If fortran_order = True:
-  //   Then the data is stored with the outermost axis changing most frequently.
-  // Since `NpyDataString` always serializes data with the innermost *nda* axis
-  // changing most frequently, if we *do* reverse the axes so that in npy, the
-  // last axis is the innermost, then fortran_order is False.
-  const bool fortran_order = !reverse_axes;
-
-  std::vector<size_t> shape_vector = NpyShapeVector(shape);
-  if (reverse_axes) {
-    std::reverse(shape_vector.begin(), shape_vector.end());
-  }
-
-  const std::string header =
-      absl::StrCat("{'descr': ", "'", NpyDescrString<DataType>(), "'", ", ",
-                   "'fortran_order': ", fortran_order ? "True, " : "False, ",
-                   "'shape': ", NpyShapeString(shape_vector), "}");
-
-  return absl::StrCat(kMagic, kVersion, NpyHeaderLengthString(header), header);
+  return NpyFullHeaderString(NpyDescrString<DataType>(), NpyShapeVector(shape),
+                             reverse_axes);
 }
 
 // Returns a copy of `src` serialized compactly. Pedentically:
@@ -193,21 +230,27 @@ std::string NpyFullHeaderString(ShapeType shape, bool reverse_axes) {
 //   axis (the first axis in nda convention, the last axis in numpy convention)
 //   changes most frequently.
 template <typename DataType, typename ShapeType>
-std::string NpyDataString(nda::array_ref<const DataType, ShapeType> src) {
+std::string NpyDataString(
+    nda::array_ref<const DataType, ShapeType> src,
+    const StridedCopyOptions& copy_options = StridedCopyOptions()) {
   // Allocate a buffer with exactly the amount of space needed to compactly
   // store `src`.
   const size_t dst_buffer_size_bytes = src.size() * sizeof(DataType);
   std::string dst_buffer(dst_buffer_size_bytes, '\0');
 
-  // Wrap `dst_buffer` in an nda::array_ref with the same shape as `src` but
-  // compact. nda::make_compact won't remove known-at-compile-time padding, only
-  // dynamic padding. So we first promote it to a shape_of_rank<R>.
+  // Describe `dst_buffer` with the same extents as `src` but compact.
+  // nda::make_compact won't remove known-at-compile-time padding, only dynamic
+  // padding. So we first promote it to a shape_of_rank<R>.
   DataType* dst_ptr = reinterpret_cast<DataType*>(dst_buffer.data());
   const nda::shape_of_rank<ShapeType::rank()> dynamic_shape = src.shape();
-  auto dst_ref = nda::make_array_ref(dst_ptr, nda::make_compact(dynamic_shape));
+  const nda::shape_of_rank<ShapeType::rank()> dst_shape =
+      nda::make_compact(dynamic_shape);
 
-  // Now just do a copy.
-  nda::copy(src, dst_ref);
+  // StridedCopy fuses contiguous dimensions into memcpys and uses specialized
+  // kernels for planar <--> interleaved conversions, such as
+  // nda::reorder<2, 0, 1>() of a planar image.
+  StridedCopy(src.data(), NpyDims(src.shape()), dst_ptr, NpyDims(dst_shape),
+              sizeof(DataType), copy_options);
 
   return dst_buffer;
 }
@@ -222,9 +265,30 @@ std::string SerializeToNpyString(nda::array_ref<const DataType, ShapeType> src,
 
   return absl::StrCat(internal::NpyFullHeaderString<DataType>(
                           src.shape(), options.reverse_axes),
-                      internal::NpyDataString(src));
+                      internal::NpyDataString(src, options.copy_options));
 }
 
+// A named field of a structured data type, e.g., ('x', '<f4') or
+// ('rgb', '|u1', (3,)).
+struct NpyField {
+  std::string name;
+  char type_char = 'x';
+  size_t word_size = 0;
+  // The offset of the field in each record, in bytes.
+  size_t offset = 0;
+  // The shape of a subarray field, outermost first as in numpy. Empty for a
+  // scalar field.
+  std::vector<size_t> shape;
+};
+
+// Same as NpyFullHeaderString(), but for records of `record_size` bytes with
+// the given named fields, sorted by offset. Gaps between fields are written as
+// unnamed void fields, as numpy does for aligned data types.
+std::string NpyStructuredHeaderString(const std::vector<NpyField>& fields,
+                                      size_t record_size,
+                                      std::vector<size_t> shape,
+                                      bool reverse_axes);
+
 struct NpyHeader {
   // Array shape and total element count derived from it. total_element_count is
   // product of all sizes if it's a non-empty vector (representing an array of
@@ -240,6 +304,12 @@ struct NpyHeader {
   // means half float, 32 full float etc.
   size_t word_size = 0;
 
+  // The named fields of a structured data type, e.g., from the descr
+  // [('x', '<f4'), ('', '|V4'), ('t', '<f8')], sorted by offset. Unnamed
+  // padding fields are dropped. For a structured data type, type_char is 'V'
+  // and word_size is the size of a record; otherwise this is empty.
+  std::vector<NpyField> fields;
+
   // See NpyFullHeaderString above.
   bool fortran_order = false;
 
@@ -273,10 +343,26 @@ std::string SerializeToNpyString(nda::array_ref<DataType, ShapeType> src,
   return internal::SerializeToNpyString(src.cref(), options);
 }
 
-template <typename DataType, typename ShapeType,
-          typename Alloc = std::allocator<DataType>>
+namespace internal {
+
+// Returns the DataType that validates elements of type `T`, or kUndefined if
+// there is none. Validation fails for types it can't check (e.g., complex
+// types).
+template <typename T>
+constexpr npy_array::DataType ValidationDataType() {
+  if constexpr (std::is_same_v<T, NpyFloat16>) {
+    return npy_array::DataType::kFloat16;
+  } else {
+    return DataTypeFor<T>();
+  }
+}
+
+// Implements DeserializeFromNpyString(). If `validate_options` is not null,
+// the data is validated while it is copied.
+template <typename DataType, typename ShapeType, typename Alloc>
 nda::array<DataType, ShapeType, Alloc> DeserializeFromNpyString(
-    std::string_view src) {
+    std::string_view src, const StridedCopyOptions& copy_options,
+    const ValidateOptions* validate_options, ValidationStats* stats) {
   if (src.empty()) {
     LOG(ERROR) << "DeserializeFromNpyString: unable to deserialize, got an "
                   "empty string.";
@@ -300,12 +386,13 @@ nda::array<DataType, ShapeType, Alloc> DeserializeFromNpyString(
                << src.size() << ".";
     return nda::array<DataType, ShapeType, Alloc>();
   }
-  if (internal::NpyDataTypeString<DataType>()[0] != header.type_char ||
+  constexpr char kTypeChar = internal::NpyDataTypeChar<DataType>();
+  if (!header.fields.empty() || kTypeChar != header.type_char ||
       sizeof(DataType) != header.word_size) {
     LOG(ERROR) << "DeserializeFromNpyString: unable to deserialize, npy "
                   "contains data type "
                << header.type_char << header.word_size << ", while requested "
-               << internal::NpyDataTypeString<DataType>()[0] << sizeof(DataType)
+               << kTypeChar << sizeof(DataType)
                << ".";
     return nda::array<DataType, ShapeType, Alloc>();
   }
@@ -324,11 +411,75 @@ nda::array<DataType, ShapeType, Alloc> DeserializeFromNpyString(
 
   nda::array<DataType, ShapeType, Alloc> array(
       internal::ToShape<ShapeType>(header.shape));
-  src.copy(reinterpret_cast<char*>(array.data()), expected_data_size,
-           header.data_start_offset);
+  if (internal::IsNpyCompact(array.shape())) {
+    if (validate_options == nullptr) {
+      CopyBytes(src.data() + header.data_start_offset, array.data(),
+                expected_data_size, copy_options);
+      return array;
+    }
+    const absl::Status status = CopyAndValidate(
+        src.data() + header.data_start_offset, array.data(),
+        ValidationDataType<DataType>(), header.total_element_count,
+        *validate_options, stats, copy_options);
+    if (!status.ok()) {
+      LOG(ERROR) << "DeserializeFromNpyString: " << status.message();
+      return nda::array<DataType, ShapeType, Alloc>();
+    }
+    return array;
+  }
+
+  // `ShapeType` has compile-time strides that don't match the compact NPY
+  // layout (e.g., an interleaved image indexed as (x, y, c)). Copy from a
+  // compact view of `src` instead.
+  const nda::shape_of_rank<ShapeType::rank()> src_shape =
+      nda::make_compact(nda::shape_of_rank<ShapeType::rank()>(array.shape()));
+  const DataType* src_ptr =
+      reinterpret_cast<const DataType*>(src.data() + header.data_start_offset);
+  if (validate_options != nullptr) {
+    // The copy is strided, so the compact source is validated on its own.
+    const absl::Status status =
+        Validate(src_ptr, ValidationDataType<DataType>(),
+                 header.total_element_count, *validate_options, stats,
+                 copy_options);
+    if (!status.ok()) {
+      LOG(ERROR) << "DeserializeFromNpyString: " << status.message();
+      return nda::array<DataType, ShapeType, Alloc>();
+    }
+  }
+  StridedCopy(src_ptr, internal::NpyDims(src_shape), array.data(),
+              internal::NpyDims(array.shape()), sizeof(DataType),
+              copy_options);
   return array;
 }
 
+}  // namespace internal
+
+// Deserializes an NPY string into a newly allocated array. Returns an empty
+// array (and logs an error) if `src` is invalid or doesn't match `DataType` and
+// `ShapeType`. `copy_options` controls how the data is copied out of `src`.
+template <typename DataType, typename ShapeType,
+          typename Alloc = std::allocator<DataType>>
+nda::array<DataType, ShapeType, Alloc> DeserializeFromNpyString(
+    std::string_view src,
+    const StridedCopyOptions& copy_options = StridedCopyOptions()) {
+  return internal::DeserializeFromNpyString<DataType, ShapeType, Alloc>(
+      src, copy_options, /*validate_options=*/nullptr, /*stats=*/nullptr);
+}
+
+// Same as above, but also runs the checks in `validate_options` while the data
+// is copied, in the same pass (see CopyAndValidate()). Returns an empty array
+// (and logs an error) if a check fails. If `stats` is not null, it is set
+// whenever the header matches, even if a check fails.
+template <typename DataType, typename ShapeType,
+          typename Alloc = std::allocator<DataType>>
+nda::array<DataType, ShapeType, Alloc> DeserializeFromNpyString(
+    std::string_view src, const ValidateOptions& validate_options,
+    ValidationStats* stats,
+    const StridedCopyOptions& copy_options = StridedCopyOptions()) {
+  return internal::DeserializeFromNpyString<DataType, ShapeType, Alloc>(
+      src, copy_options, &validate_options, stats);
+}
+
 }  // namespace npy_array
 
 #endif  // NPY_ARRAY_NPY_ARRAY_H_
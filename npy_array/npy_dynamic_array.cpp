@@ -1,54 +1,22 @@
 #include "npy_array/npy_dynamic_array.h"
 
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "absl/container/inlined_vector.h"
+#include "absl/strings/match.h"
+#include "absl/strings/str_cat.h"
+
 namespace npy_array {
 
 namespace {
 
-// Returns corresponding DataType based on type_char and word_size.
-DataType GetDataType(char type_char, size_t word_size) {
-  switch (type_char) {
-    case 'i': {
-      if (word_size == sizeof(int8_t)) {
-        return DataType::kInt8;
-      } else if (word_size == sizeof(int16_t)) {
-        return DataType::kInt16;
-      } else if (word_size == sizeof(int32_t)) {
-        return DataType::kInt32;
-      } else if (word_size == sizeof(int64_t)) {
-        return DataType::kInt64;
-      } else {
-        return DataType::kUndefined;
-      }
-    }
-    case 'u': {
-      if (word_size == sizeof(uint8_t)) {
-        return DataType::kUint8;
-      } else if (word_size == sizeof(uint16_t)) {
-        return DataType::kUint16;
-      } else if (word_size == sizeof(uint32_t)) {
-        return DataType::kUint32;
-      } else if (word_size == sizeof(uint64_t)) {
-        return DataType::kUint64;
-      } else {
-        return DataType::kUndefined;
-      }
-    }
-    case 'f': {
-      if (word_size == sizeof(half)) {
-        return DataType::kFloat16;
-      } else if (word_size == sizeof(float)) {
-        return DataType::kFloat32;
-      } else if (word_size == sizeof(double)) {
-        return DataType::kFloat64;
-      } else {
-        return DataType::kUndefined;
-      }
-    }
-    default:
-      return DataType::kUndefined;
-  }
-}
-
 std::vector<int64_t> GetNpyExtents(
     const npy_array::internal::NpyHeader& npy_header) {
   if (npy_header.fortran_order) {
@@ -76,14 +44,77 @@ absl::Status VerifyTypeAndExtents(const DataType data_type,
   return absl::OkStatus();
 }
 
-}  // namespace
+// Returns the NPY descr string of `data_type`, e.g., "<f4", or an empty string
+// if it is undefined.
+std::string_view NpyDescr(DataType data_type) {
+  return DispatchDataType(data_type, []<typename T>() -> std::string_view {
+    if constexpr (std::is_void_v<T>) {
+      return "";
+    } else {
+      return npy_array::internal::NpyDescrString<T>();
+    }
+  });
+}
 
-absl::StatusOr<DynamicArray> DecodeDynamicArrayFromNpy(
-    std::string_view npy_data) {
+absl::StatusOr<std::string> EncodeHeader(const DynamicArrayRef& src,
+                                         const NpySerializeOptions& options) {
+  const std::string_view descr = NpyDescr(src.data_type());
+  if (descr.empty()) {
+    return absl::InvalidArgumentError("Unknown data type.");
+  }
+  std::vector<size_t> shape(src.rank());
+  for (int64_t d = 0; d < src.rank(); ++d) {
+    shape[d] = src.shape().extent(d);
+  }
+  return npy_array::internal::NpyFullHeaderString(descr, std::move(shape),
+                                                  options.reverse_axes);
+}
+
+// Returns true if the data of `shape` is compact with dimension 0 innermost,
+// i.e., laid out as in an NPY file.
+bool IsNpyCompact(const DynamicShape& shape) {
+  int64_t expected_stride = 1;
+  for (int64_t d = 0; d < shape.rank(); ++d) {
+    if (shape.extent(d) != 1 && shape.stride(d) != expected_stride) {
+      return false;
+    }
+    expected_stride *= shape.extent(d);
+  }
+  return true;
+}
+
+// Copies the elements of `src` to `dst` in NPY order.
+void EncodePayload(const DynamicArrayRef& src, uint8_t* dst,
+                   const StridedCopyOptions& copy_options) {
+  if (src.empty()) {
+    return;
+  }
+  if (IsNpyCompact(src.shape())) {
+    CopyBytes(src.data(), dst, src.TotalSizeBytes(), copy_options);
+    return;
+  }
+  absl::InlinedVector<int64_t, DynamicShape::kInlineRank> extents(src.rank());
+  for (int64_t d = 0; d < src.rank(); ++d) {
+    extents[d] = src.shape().extent(d);
+  }
+  StridedCopy(src.data(), src.shape().dims(), dst,
+              DynamicShape(extents).dims(), src.ElementSizeBytes(),
+              copy_options);
+}
+
+// Decodes `npy_data` into a copy of its payload. If `validate_options` is not
+// null, the payload is validated while it is copied.
+absl::StatusOr<DynamicArray> DecodeAndCopy(
+    std::string_view npy_data, const StridedCopyOptions& copy_options,
+    const ValidateOptions* validate_options, ValidationStats* stats) {
   auto npy_header = npy_array::internal::ReadHeader(npy_data);
   if (!npy_header.valid) {
     return absl::InvalidArgumentError("Invalid npy header");
   }
+  if (!npy_header.fields.empty()) {
+    return absl::InvalidArgumentError(
+        "Structured npy data type: use DecodeRecordArrayFromNpy().");
+  }
 
   const size_t expected_data_size =
       npy_header.total_element_count * npy_header.word_size;
@@ -98,26 +129,149 @@ absl::StatusOr<DynamicArray> DecodeDynamicArrayFromNpy(
   const std::vector<int64_t> extents = GetNpyExtents(npy_header);
 
   const DataType data_type =
-      GetDataType(npy_header.type_char, npy_header.word_size);
+      DataTypeFromNpy(npy_header.type_char, npy_header.word_size);
   const absl::Status status = VerifyTypeAndExtents(data_type, extents);
   if (!status.ok()) {
     return status;
   }
 
-  DynamicArray arr(data_type, extents);
-
-  memcpy(arr.data(), npy_data.begin() + npy_header.data_start_offset,
-         expected_data_size);
+  // Every byte is overwritten below, so skip zero-filling.
+  DynamicArray arr(data_type, extents, {.initialize = false});
 
+  const char* payload = npy_data.data() + npy_header.data_start_offset;
+  if (validate_options == nullptr) {
+    CopyBytes(payload, arr.data(), expected_data_size, copy_options);
+    return arr;
+  }
+  const absl::Status valid =
+      CopyAndValidate(payload, arr.data(), data_type, arr.NumElements(),
+                      *validate_options, stats, copy_options);
+  if (!valid.ok()) {
+    return valid;
+  }
   return arr;
 }
 
+}  // namespace
+
+absl::StatusOr<DynamicArray> DecodeDynamicArrayFromNpy(
+    std::string_view npy_data, const StridedCopyOptions& copy_options) {
+  return DecodeAndCopy(npy_data, copy_options, /*validate_options=*/nullptr,
+                       /*stats=*/nullptr);
+}
+
+absl::StatusOr<DynamicArray> DecodeDynamicArrayFromNpy(
+    std::string_view npy_data, const ValidateOptions& validate_options,
+    ValidationStats* stats, const StridedCopyOptions& copy_options) {
+  return DecodeAndCopy(npy_data, copy_options, &validate_options, stats);
+}
+
+absl::StatusOr<DynamicArray> DecodeDynamicArrayFromNpyOwned(
+    std::string&& npy_data) {
+  const absl::StatusOr<DynamicArrayRef> view =
+      MakeDynamicArrayRefOfNpy(npy_data);
+  if (!view.ok()) {
+    return view.status();
+  }
+
+  const int64_t offset =
+      view->data() - reinterpret_cast<const uint8_t*>(npy_data.data());
+  std::vector<int64_t> extents(view->rank());
+  for (int64_t d = 0; d < view->rank(); ++d) {
+    extents[d] = view->shape().extent(d);
+  }
+  return DynamicArray::FromString(view->data_type(), extents,
+                                  std::move(npy_data), offset);
+}
+
+absl::StatusOr<DynamicArray> DecodeDynamicArrayFromNpy(
+    std::shared_ptr<const MappedFile> npy_file) {
+  const std::string_view npy_data = npy_file->contents();
+  return DecodeDynamicArrayFromNpy(std::move(npy_file), npy_data);
+}
+
+absl::StatusOr<DynamicArray> DecodeDynamicArrayFromNpy(
+    std::shared_ptr<const MappedFile> file, std::string_view npy_data) {
+  const absl::StatusOr<DynamicArrayRef> view =
+      MakeDynamicArrayRefOfNpy(npy_data);
+  if (!view.ok()) {
+    return view.status();
+  }
+
+  if (reinterpret_cast<uintptr_t>(view->data()) % view->ElementSizeBytes() !=
+      0) {
+    return DecodeDynamicArrayFromNpy(npy_data);
+  }
+  // The mapping is read-only. The const_cast is safe because the array is not
+  // writable: it copies the data on its first mutable access.
+  return DynamicArray::FromSharedBuffer(
+      view->data_type(), view->shape(),
+      std::shared_ptr<uint8_t>(std::move(file),
+                               const_cast<uint8_t*>(view->data())),
+      /*writable=*/false);
+}
+
+absl::StatusOr<int64_t> NpyHeaderSize(std::string_view npy_prefix) {
+  constexpr std::string_view kMagic("\x93NUMPY");
+  if (npy_prefix.size() < kMagic.size() + 4 ||
+      !absl::StartsWith(npy_prefix, kMagic)) {
+    return absl::InvalidArgumentError("NpyHeaderSize: not an npy file.");
+  }
+  // Version 1 encodes the header length in 16 bits, versions 2 and 3 in 32.
+  const int version = npy_prefix[kMagic.size()];
+  if (version < 1 || version > 3) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("NpyHeaderSize: unsupported npy version ", version, "."));
+  }
+  const int length_size = version == 1 ? 2 : 4;
+  const int64_t preamble_size = kMagic.size() + 2 + length_size;
+  if (static_cast<int64_t>(npy_prefix.size()) < preamble_size) {
+    return absl::InvalidArgumentError("NpyHeaderSize: truncated npy preamble.");
+  }
+  int64_t header_length = 0;
+  for (int i = length_size - 1; i >= 0; --i) {
+    header_length = (header_length << 8) |
+                    static_cast<uint8_t>(npy_prefix[kMagic.size() + 2 + i]);
+  }
+  return preamble_size + header_length;
+}
+
+absl::StatusOr<NpyArrayInfo> ReadNpyArrayInfo(std::string_view npy_prefix) {
+  absl::StatusOr<int64_t> header_size = NpyHeaderSize(npy_prefix);
+  if (!header_size.ok()) {
+    return header_size.status();
+  }
+  if (*header_size > static_cast<int64_t>(npy_prefix.size())) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("ReadNpyArrayInfo: expected a header of ", *header_size,
+                     " bytes, got ", npy_prefix.size(), " bytes."));
+  }
+  const auto npy_header = npy_array::internal::ReadHeader(npy_prefix);
+  if (!npy_header.valid) {
+    return absl::InvalidArgumentError("Invalid npy header");
+  }
+
+  NpyArrayInfo info;
+  if (npy_header.fields.empty()) {
+    info.data_type =
+        DataTypeFromNpy(npy_header.type_char, npy_header.word_size);
+  }
+  info.extents = GetNpyExtents(npy_header);
+  info.fortran_order = npy_header.fortran_order;
+  info.payload_offset = npy_header.data_start_offset;
+  return info;
+}
+
 absl::StatusOr<DynamicArrayRef> MakeDynamicArrayRefOfNpy(
     std::string_view npy_data) {
   auto npy_header = npy_array::internal::ReadHeader(npy_data);
   if (!npy_header.valid) {
     return absl::InvalidArgumentError("Invalid npy header");
   }
+  if (!npy_header.fields.empty()) {
+    return absl::InvalidArgumentError(
+        "Structured npy data type: use DecodeRecordArrayFromNpy().");
+  }
 
   const size_t expected_data_size =
       npy_header.total_element_count * npy_header.word_size;
@@ -132,7 +286,7 @@ absl::StatusOr<DynamicArrayRef> MakeDynamicArrayRefOfNpy(
   const std::vector<int64_t> extents = GetNpyExtents(npy_header);
 
   const DataType data_type =
-      GetDataType(npy_header.type_char, npy_header.word_size);
+      DataTypeFromNpy(npy_header.type_char, npy_header.word_size);
   const absl::Status status = VerifyTypeAndExtents(data_type, extents);
   if (!status.ok()) {
     return status;
@@ -143,4 +297,68 @@ absl::StatusOr<DynamicArrayRef> MakeDynamicArrayRefOfNpy(
                          data_type, DynamicShape(extents));
 }
 
-}  // namespace npy_array
\ No newline at end of file
+absl::StatusOr<std::string> EncodeDynamicArrayToNpy(
+    const DynamicArrayRef& src, const NpySerializeOptions& options) {
+  absl::StatusOr<std::string> npy = EncodeHeader(src, options);
+  if (!npy.ok()) {
+    return npy.status();
+  }
+  const size_t header_size = npy->size();
+  npy->resize(header_size + src.TotalSizeBytes());
+  EncodePayload(src, reinterpret_cast<uint8_t*>(npy->data() + header_size),
+                options.copy_options);
+  return npy;
+}
+
+absl::StatusOr<int64_t> NpyEncodedSizeBytes(
+    const DynamicArrayRef& src, const NpySerializeOptions& options) {
+  const absl::StatusOr<std::string> header = EncodeHeader(src, options);
+  if (!header.ok()) {
+    return header.status();
+  }
+  return static_cast<int64_t>(header->size()) + src.TotalSizeBytes();
+}
+
+absl::StatusOr<int64_t> EncodeDynamicArrayToNpy(
+    const DynamicArrayRef& src, absl::Span<char> dst,
+    const NpySerializeOptions& options) {
+  const absl::StatusOr<std::string> header = EncodeHeader(src, options);
+  if (!header.ok()) {
+    return header.status();
+  }
+  const int64_t size_bytes =
+      static_cast<int64_t>(header->size()) + src.TotalSizeBytes();
+  if (static_cast<int64_t>(dst.size()) < size_bytes) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("Buffer too small: need ", size_bytes, " bytes, got ",
+                     dst.size(), " bytes"));
+  }
+  std::memcpy(dst.data(), header->data(), header->size());
+  EncodePayload(src, reinterpret_cast<uint8_t*>(dst.data() + header->size()),
+                options.copy_options);
+  return size_bytes;
+}
+
+absl::StatusOr<NpyEncodedParts> EncodeDynamicArrayToNpyParts(
+    const DynamicArrayRef& src, const NpySerializeOptions& options) {
+  absl::StatusOr<std::string> header = EncodeHeader(src, options);
+  if (!header.ok()) {
+    return header.status();
+  }
+  NpyEncodedParts parts;
+  parts.header = *std::move(header);
+  if (src.empty()) {
+    return parts;
+  }
+  if (IsNpyCompact(src.shape())) {
+    parts.array_payload =
+        absl::MakeConstSpan(src.data(), src.TotalSizeBytes());
+    return parts;
+  }
+  parts.payload_storage =
+      AlignedBuffer(src.TotalSizeBytes(), {.initialize = false});
+  EncodePayload(src, parts.payload_storage.data(), options.copy_options);
+  return parts;
+}
+
+}  // namespace npy_array
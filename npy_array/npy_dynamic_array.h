@@ -1,21 +1,93 @@
 #ifndef NPY_ARRAY_NPY_DYNAMIC_ARRAY_H_
 #define NPY_ARRAY_NPY_DYNAMIC_ARRAY_H_
 
+#include <cstdint>
+#include <memory>
 #include <string>
 #include <string_view>
+#include <vector>
 
 #include "absl/status/statusor.h"
+#include "absl/types/span.h"
+#include "npy_array/aligned_buffer.h"
+#include "npy_array/data_type.h"
 #include "npy_array/dynamic_array.h"
+#include "npy_array/mapped_file.h"
 #include "npy_array/npy_array.h"
+#include "npy_array/strided_copy.h"
+#include "npy_array/validate.h"
 
 namespace npy_array {
 
+// The extension of an npy file, and of each array entry of an NPZ archive.
+inline constexpr std::string_view kNpyExtension = ".npy";
+
 // Reads npy data from a string and decodes into a DynamicArray that keeps a
 // copy of the data.
 // Array shape is inferred from the npy header as is, but will be reversed if
 // the npy array is not in fortran order.
+// `copy_options` controls how the data is copied out of `npy_data`.
 absl::StatusOr<DynamicArray> DecodeDynamicArrayFromNpy(
-    std::string_view npy_data ABSL_ATTRIBUTE_LIFETIME_BOUND);
+    std::string_view npy_data ABSL_ATTRIBUTE_LIFETIME_BOUND,
+    const StridedCopyOptions& copy_options = StridedCopyOptions());
+
+// Same as above, but also runs the checks in `validate_options` while the data
+// is copied, in the same pass (see CopyAndValidate()). Returns an error if a
+// check fails. If `stats` is not null, it is set whenever the header is valid,
+// even if a check fails.
+absl::StatusOr<DynamicArray> DecodeDynamicArrayFromNpy(
+    std::string_view npy_data, const ValidateOptions& validate_options,
+    ValidationStats* stats,
+    const StridedCopyOptions& copy_options = StridedCopyOptions());
+
+// Same as DecodeDynamicArrayFromNpy(), but takes ownership of `npy_data` and
+// returns an array that points into it: the payload is not copied. E.g., pass
+// an entry moved out of the map returned by ReadZipFile(). Falls back to a copy
+// if the payload is not aligned for its data type. To validate the data, call
+// Validate() on the result.
+absl::StatusOr<DynamicArray> DecodeDynamicArrayFromNpyOwned(
+    std::string&& npy_data);
+
+// Same as DecodeDynamicArrayFromNpyOwned(), but returns an array that points
+// into a memory-mapped npy file and keeps it alive. The mapping is read-only:
+// the array copies its data on the first mutable access (see
+// DynamicArray::IsWritable()).
+absl::StatusOr<DynamicArray> DecodeDynamicArrayFromNpy(
+    std::shared_ptr<const MappedFile> npy_file);
+
+// Same as above, but decodes `npy_data`, which must lie within `file`, e.g., a
+// stored entry of a memory-mapped NPZ file.
+absl::StatusOr<DynamicArray> DecodeDynamicArrayFromNpy(
+    std::shared_ptr<const MappedFile> file, std::string_view npy_data);
+
+// The header of an npy file, as the DynamicArray it decodes to.
+struct NpyArrayInfo {
+  // DataType::kUndefined for structured data types (see
+  // DecodeRecordArrayFromNpy()) and others DynamicArray doesn't support.
+  DataType data_type = DataType::kUndefined;
+
+  // Innermost first, as in DynamicArray: reversed from the npy shape unless the
+  // array is in fortran order.
+  std::vector<int64_t> extents;
+  bool fortran_order = false;
+
+  // The size of the header, i.e., the offset of the payload.
+  int64_t payload_offset = 0;
+};
+
+// The number of bytes at the start of an npy file that NpyHeaderSize() needs.
+inline constexpr int64_t kNpyPreambleSize = 12;
+
+// Returns the size of the header of the npy file that starts with
+// `npy_prefix`, from its magic string, version and header length, which are
+// in the first kNpyPreambleSize bytes (10 for version 1). Returns an error if
+// `npy_prefix` is too short or is not the start of an npy file.
+absl::StatusOr<int64_t> NpyHeaderSize(std::string_view npy_prefix);
+
+// Parses the header of the npy file that starts with `npy_prefix`, which must
+// hold the whole header (NpyHeaderSize() bytes) but not necessarily the
+// payload, e.g., the first bytes of a compressed NPZ entry.
+absl::StatusOr<NpyArrayInfo> ReadNpyArrayInfo(std::string_view npy_prefix);
 
 // Reads npy data from a string and decodes into a DynamicArrayRef view of the
 // data.
@@ -24,6 +96,60 @@ absl::StatusOr<DynamicArray> DecodeDynamicArrayFromNpy(
 absl::StatusOr<DynamicArrayRef> MakeDynamicArrayRefOfNpy(
     std::string_view npy_data ABSL_ATTRIBUTE_LIFETIME_BOUND);
 
+// Encodes `src` in the NPY format. The header is written from the DataType and
+// DynamicShape of `src`. As in SerializeToNpyString(), the axes are reversed
+// unless `options.reverse_axes` is false, and mins are not preserved. Unlike
+// it, empty arrays are encoded (e.g., with shape (0, 3)).
+//
+// Arrays that are compact (dimension 0 innermost) are copied with a single
+// CopyBytes(); other strides, e.g. crops and permuted views, go through
+// StridedCopy(). `options.copy_options` controls both.
+//
+// Returns an error if the data type of `src` is undefined.
+absl::StatusOr<std::string> EncodeDynamicArrayToNpy(
+    const DynamicArrayRef& src,
+    const NpySerializeOptions& options = NpySerializeOptions());
+
+// Returns the size in bytes of the encoding of `src`.
+absl::StatusOr<int64_t> NpyEncodedSizeBytes(
+    const DynamicArrayRef& src,
+    const NpySerializeOptions& options = NpySerializeOptions());
+
+// Same as above, but encodes into `dst`, which must hold at least
+// NpyEncodedSizeBytes() bytes. Returns the number of bytes written.
+absl::StatusOr<int64_t> EncodeDynamicArrayToNpy(
+    const DynamicArrayRef& src, absl::Span<char> dst,
+    const NpySerializeOptions& options = NpySerializeOptions());
+
+// An NPY encoding in two parts, e.g., for a scatter/gather write with writev():
+// the file is `header` followed by `payload`.
+struct NpyEncodedParts {
+  std::string header;
+
+  // The encoded elements: `array_payload` if the encoded array is compact, and
+  // `payload_storage` otherwise. Computed on each call, so copies and moves of
+  // the parts stay valid.
+  absl::Span<const uint8_t> payload() const {
+    if (!payload_storage.empty()) {
+      return absl::MakeConstSpan(payload_storage.data(),
+                                 payload_storage.size());
+    }
+    return array_payload;
+  }
+
+  // Points into the encoded array if it is compact, so no data is copied. The
+  // array must outlive the span.
+  absl::Span<const uint8_t> array_payload;
+
+  // A copy of the elements in NPY order if the encoded array is not compact.
+  AlignedBuffer payload_storage;
+};
+
+// Same as the first overload, but returns the encoding in two parts.
+absl::StatusOr<NpyEncodedParts> EncodeDynamicArrayToNpyParts(
+    const DynamicArrayRef& src,
+    const NpySerializeOptions& options = NpySerializeOptions());
+
 }  // namespace npy_array
 
 #endif  // NPY_ARRAY_NPY_DYNAMIC_ARRAY_H_
\ No newline at end of file
@@ -0,0 +1,440 @@
+#include "npy_array/npz.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include "absl/cleanup/cleanup.h"
+#include "absl/container/flat_hash_set.h"
+#include "absl/functional/function_ref.h"
+#include "absl/strings/match.h"
+#include "absl/strings/str_cat.h"
+#include "absl/types/span.h"
+#include "npy_array/npy_dynamic_array.h"
+
+namespace npy_array {
+
+namespace {
+
+// How much of each entry CatalogNpz() decompresses at first. NPY headers are
+// usually 128 bytes; longer ones are read in a second pass.
+constexpr int64_t kCatalogPrefixSize = 256;
+
+// Returns the name of the array in the NPZ entry at `path`.
+std::string ArrayName(const std::filesystem::path& path) {
+  std::string name = path.string();
+  if (absl::EndsWith(name, kNpyExtension)) {
+    name.resize(name.size() - kNpyExtension.size());
+  }
+  return name;
+}
+
+// Adds an entry "<name>.npy" for each of `arrays` to `zip_writer`.
+absl::Status AddArrays(const std::map<std::string, DynamicArrayRef>& arrays,
+                       const SaveNpzOptions& options, ZipWriter* zip_writer) {
+  for (const auto& [name, array] : arrays) {
+    absl::StatusOr<NpyEncodedParts> npy =
+        EncodeDynamicArrayToNpyParts(array, options.npy_options);
+    if (!npy.ok()) {
+      return npy.status();
+    }
+    const absl::Span<const uint8_t> payload = npy->payload();
+    const std::string_view parts[] = {
+        npy->header,
+        std::string_view(reinterpret_cast<const char*>(payload.data()),
+                         payload.size()),
+    };
+    absl::Status status = zip_writer->AddFile(
+        absl::StrCat(name, kNpyExtension), parts, options.zip_options);
+    if (!status.ok()) {
+      return status;
+    }
+  }
+  return absl::OkStatus();
+}
+
+// Decodes the entries of `entries` that `options.filter` selects with
+// `decode`, on up to `options.threading.max_threads` threads, and returns
+// their arrays by name. If several entries have the same name, the last one
+// wins. Errors are prefixed with `caller`.
+absl::StatusOr<absl::flat_hash_map<std::string, DynamicArray>> DecodeEntries(
+    std::string_view caller, const std::vector<ZipEntry>& entries,
+    const LoadNpzOptions& options,
+    absl::FunctionRef<absl::StatusOr<DynamicArray>(const ZipEntry&)> decode) {
+  std::vector<std::pair<std::string, const ZipEntry*>> selected;
+  for (const ZipEntry& entry : entries) {
+    std::string name = ArrayName(entry.path);
+    if (!options.filter || options.filter(name)) {
+      selected.emplace_back(std::move(name), &entry);
+    }
+  }
+
+  std::vector<absl::StatusOr<DynamicArray>> arrays(selected.size());
+  const auto decode_one = [&](int64_t i) {
+    arrays[i] = decode(*selected[i].second);
+  };
+  int64_t total_bytes = 0;
+  for (const auto& [name, entry] : selected) {
+    total_bytes += entry->uncompressed_size;
+  }
+  const int num_threads = internal::ResolveThreads(
+      options.threading, total_bytes, selected.size());
+  if (num_threads == 1) {
+    for (size_t i = 0; i < selected.size(); ++i) {
+      decode_one(i);
+    }
+  } else {
+    internal::ResolveThreadPool(options.threading)
+        .ParallelFor(selected.size(), num_threads, decode_one);
+  }
+
+  absl::flat_hash_map<std::string, DynamicArray> result;
+  for (size_t i = 0; i < selected.size(); ++i) {
+    if (!arrays[i].ok()) {
+      return absl::Status(
+          arrays[i].status().code(),
+          absl::StrCat(caller, ": unable to decode ",
+                       selected[i].second->path.string(), ": ",
+                       arrays[i].status().message()));
+    }
+    result.insert_or_assign(std::move(selected[i].first),
+                            *std::move(arrays[i]));
+  }
+  return result;
+}
+
+// Returns the catalog entry of `entry` of the NPZ archive `archive`.
+absl::StatusOr<NpzEntryInfo> CatalogEntry(std::string_view archive,
+                                          const ZipEntry& entry) {
+  absl::StatusOr<std::string_view> data = ZipEntryData(archive, entry);
+  if (!data.ok()) {
+    return data.status();
+  }
+  std::string prefix(kCatalogPrefixSize, '\0');
+  absl::StatusOr<int64_t> size =
+      ReadZipEntryPrefix(archive, entry, absl::MakeSpan(prefix));
+  if (!size.ok()) {
+    return size.status();
+  }
+  prefix.resize(*size);
+  absl::StatusOr<int64_t> header_size = NpyHeaderSize(prefix);
+  if (!header_size.ok()) {
+    return header_size.status();
+  }
+  if (*header_size > *size) {
+    prefix.resize(std::min(*header_size, entry.uncompressed_size));
+    size = ReadZipEntryPrefix(archive, entry, absl::MakeSpan(prefix));
+    if (!size.ok()) {
+      return size.status();
+    }
+  }
+  absl::StatusOr<NpyArrayInfo> array = ReadNpyArrayInfo(prefix);
+  if (!array.ok()) {
+    return array.status();
+  }
+  return NpzEntryInfo{
+      .name = ArrayName(entry.path),
+      .entry = entry,
+      .data_offset = data->data() - archive.data(),
+      .array = *std::move(array),
+  };
+}
+
+// Returns the catalog of the NPZ archive `archive` with entries `entries`.
+// Errors are prefixed with `caller`.
+absl::StatusOr<std::vector<NpzEntryInfo>> CatalogEntries(
+    std::string_view caller, std::string_view archive,
+    const std::vector<ZipEntry>& entries) {
+  std::vector<NpzEntryInfo> catalog;
+  catalog.reserve(entries.size());
+  for (const ZipEntry& entry : entries) {
+    absl::StatusOr<NpzEntryInfo> info = CatalogEntry(archive, entry);
+    if (!info.ok()) {
+      return absl::Status(
+          info.status().code(),
+          absl::StrCat(caller, ": unable to read the header of ",
+                       entry.path.string(), ": ", info.status().message()));
+    }
+    catalog.push_back(*std::move(info));
+  }
+  return catalog;
+}
+
+// Appends `arrays` to the existing NPZ file at `path`.
+absl::Status AppendArrays(const std::filesystem::path& path,
+                          const std::map<std::string, DynamicArrayRef>& arrays,
+                          const SaveNpzOptions& options) {
+  absl::StatusOr<ZipWriter> zip_writer = ZipWriter::AppendToFile(path);
+  if (!zip_writer.ok()) {
+    return zip_writer.status();
+  }
+  absl::Status status = AddArrays(arrays, options, &*zip_writer);
+  if (!status.ok()) {
+    return status;
+  }
+  return std::move(*zip_writer).Close().status();
+}
+
+// Rewrites the NPZ file at `path` without the arrays `dropped` and with
+// `arrays` added. The entries that are kept are copied still compressed into a
+// temporary file next to `path`, which replaces it once complete. If
+// `must_exist` is true, every array in `dropped` must be in the file. If the
+// file has none of them, `arrays` are appended in place instead.
+absl::Status Rewrite(std::string_view caller,
+                     const std::filesystem::path& path,
+                     const absl::flat_hash_set<std::string_view>& dropped,
+                     bool must_exist,
+                     const std::map<std::string, DynamicArrayRef>& arrays,
+                     const SaveNpzOptions& options) {
+  absl::StatusOr<std::shared_ptr<const MappedFile>> file =
+      MappedFile::Open(path);
+  if (!file.ok()) {
+    return file.status();
+  }
+  absl::StatusOr<std::vector<ZipEntry>> entries =
+      ReadZipDirectory((*file)->contents());
+  if (!entries.ok()) {
+    return entries.status();
+  }
+  std::vector<ZipEntry> kept;
+  absl::flat_hash_set<std::string_view> found;
+  for (const ZipEntry& entry : *entries) {
+    const std::string name = ArrayName(entry.path);
+    const auto it = dropped.find(name);
+    if (it == dropped.end()) {
+      kept.push_back(entry);
+    } else {
+      found.insert(*it);
+    }
+  }
+  if (must_exist && found.size() != dropped.size()) {
+    for (const std::string_view name : dropped) {
+      if (!found.contains(name)) {
+        return absl::NotFoundError(absl::StrCat(
+            caller, ": ", path.string(), " has no array named ", name, "."));
+      }
+    }
+  }
+  if (kept.size() == entries->size()) {
+    return arrays.empty() ? absl::OkStatus()
+                          : AppendArrays(path, arrays, options);
+  }
+
+  const std::filesystem::path temp_path = path.string() + ".tmp";
+  absl::Cleanup remove_temp([&] {
+    std::error_code error;
+    std::filesystem::remove(temp_path, error);
+  });
+  {
+    std::ofstream temp(temp_path, std::ios::binary | std::ios::trunc);
+    absl::Status status = CopyZipEntries((*file)->contents(), kept, &temp);
+    temp.close();
+    if (status.ok() && !temp) {
+      status = absl::InternalError(absl::StrCat(
+          caller, ": unable to write ", temp_path.string(), "."));
+    }
+    if (!status.ok()) {
+      return status;
+    }
+  }
+  file->reset();
+  if (!arrays.empty()) {
+    absl::Status status = AppendArrays(temp_path, arrays, options);
+    if (!status.ok()) {
+      return status;
+    }
+  }
+  std::error_code error;
+  std::filesystem::rename(temp_path, path, error);
+  if (error) {
+    return absl::InternalError(absl::StrCat(caller, ": unable to replace ",
+                                            path.string(), ": ",
+                                            error.message()));
+  }
+  std::move(remove_temp).Cancel();
+  return absl::OkStatus();
+}
+
+}  // namespace
+
+absl::StatusOr<std::string> EncodeNpz(
+    const std::map<std::string, DynamicArrayRef>& arrays,
+    const SaveNpzOptions& options) {
+  ZipWriter zip_writer;
+  absl::Status status = AddArrays(arrays, options, &zip_writer);
+  if (!status.ok()) {
+    return status;
+  }
+  return std::move(zip_writer).Close();
+}
+
+absl::Status SaveNpz(const std::filesystem::path& path,
+                     const std::map<std::string, DynamicArrayRef>& arrays,
+                     const SaveNpzOptions& options) {
+  absl::StatusOr<ZipWriter> zip_writer = ZipWriter::OpenFile(path);
+  if (!zip_writer.ok()) {
+    return zip_writer.status();
+  }
+  absl::Status status = AddArrays(arrays, options, &*zip_writer);
+  if (!status.ok()) {
+    return status;
+  }
+  return std::move(*zip_writer).Close().status();
+}
+
+absl::Status AppendToNpz(const std::filesystem::path& path,
+                         const std::map<std::string, DynamicArrayRef>& arrays,
+                         const SaveNpzOptions& options) {
+  absl::StatusOr<NpzReader> reader = NpzReader::Open(path);
+  if (!reader.ok()) {
+    return reader.status();
+  }
+  for (const std::string& name : reader->names()) {
+    if (arrays.contains(name)) {
+      return absl::AlreadyExistsError(
+          absl::StrCat("AppendToNpz: ", path.string(),
+                       " already has an array named ", name, "."));
+    }
+  }
+  return AppendArrays(path, arrays, options);
+}
+
+absl::Status ReplaceInNpz(const std::filesystem::path& path,
+                          const std::map<std::string, DynamicArrayRef>& arrays,
+                          const SaveNpzOptions& options) {
+  absl::flat_hash_set<std::string_view> names;
+  for (const auto& [name, array] : arrays) {
+    names.insert(name);
+  }
+  return Rewrite("ReplaceInNpz", path, names, /*must_exist=*/false, arrays,
+                 options);
+}
+
+absl::Status DeleteFromNpz(const std::filesystem::path& path,
+                           absl::Span<const std::string> names) {
+  return Rewrite("DeleteFromNpz", path,
+                 absl::flat_hash_set<std::string_view>(names.begin(),
+                                                       names.end()),
+                 /*must_exist=*/true, /*arrays=*/{}, SaveNpzOptions());
+}
+
+absl::StatusOr<absl::flat_hash_map<std::string, DynamicArray>> DecodeNpz(
+    std::string_view npz_data, const LoadNpzOptions& options) {
+  absl::StatusOr<std::vector<ZipEntry>> entries = ReadZipDirectory(npz_data);
+  if (!entries.ok()) {
+    return entries.status();
+  }
+  // Each entry is inflated into the string its array then keeps.
+  return DecodeEntries(
+      "DecodeNpz", *entries, options,
+      [&](const ZipEntry& entry) -> absl::StatusOr<DynamicArray> {
+        std::string npy(entry.uncompressed_size, '\0');
+        absl::Status status =
+            ReadZipEntry(npz_data, entry, absl::MakeSpan(npy));
+        if (!status.ok()) {
+          return status;
+        }
+        return DecodeDynamicArrayFromNpyOwned(std::move(npy));
+      });
+}
+
+absl::StatusOr<std::vector<NpzEntryInfo>> CatalogNpz(
+    std::string_view npz_data) {
+  absl::StatusOr<std::vector<ZipEntry>> entries = ReadZipDirectory(npz_data);
+  if (!entries.ok()) {
+    return entries.status();
+  }
+  return CatalogEntries("CatalogNpz", npz_data, *entries);
+}
+
+NpzReader::NpzReader(std::shared_ptr<const MappedFile> file,
+                     std::vector<ZipEntry> entries)
+    : file_(std::move(file)), entries_(std::move(entries)) {
+  for (size_t i = 0; i < entries_.size(); ++i) {
+    index_.insert_or_assign(ArrayName(entries_[i].path), i);
+  }
+}
+
+absl::StatusOr<NpzReader> NpzReader::Open(const std::filesystem::path& path) {
+  absl::StatusOr<std::shared_ptr<const MappedFile>> file =
+      MappedFile::Open(path);
+  if (!file.ok()) {
+    return file.status();
+  }
+  absl::StatusOr<std::vector<ZipEntry>> entries =
+      ReadZipDirectory((*file)->contents());
+  if (!entries.ok()) {
+    return entries.status();
+  }
+  return NpzReader(*std::move(file), *std::move(entries));
+}
+
+std::vector<std::string> NpzReader::names() const {
+  std::vector<std::string> names;
+  names.reserve(entries_.size());
+  for (const ZipEntry& entry : entries_) {
+    names.push_back(ArrayName(entry.path));
+  }
+  return names;
+}
+
+absl::StatusOr<DynamicArray> NpzReader::Read(std::string_view name) const {
+  const auto it = index_.find(name);
+  if (it == index_.end()) {
+    return absl::NotFoundError(
+        absl::StrCat("NpzReader: no array named ", name, "."));
+  }
+  absl::StatusOr<DynamicArray> array = ReadEntry(entries_[it->second]);
+  if (!array.ok()) {
+    return absl::Status(array.status().code(),
+                        absl::StrCat("NpzReader: unable to decode ", name,
+                                     ": ", array.status().message()));
+  }
+  return array;
+}
+
+absl::StatusOr<std::vector<NpzEntryInfo>> NpzReader::Catalog() const {
+  return CatalogEntries("NpzReader", file_->contents(), entries_);
+}
+
+absl::StatusOr<absl::flat_hash_map<std::string, DynamicArray>>
+NpzReader::ReadAll(const LoadNpzOptions& options) const {
+  return DecodeEntries(
+      "NpzReader", entries_, options,
+      [&](const ZipEntry& entry) { return ReadEntry(entry); });
+}
+
+absl::StatusOr<DynamicArray> NpzReader::ReadEntry(const ZipEntry& entry) const {
+  absl::StatusOr<std::string_view> data =
+      ZipEntryData(file_->contents(), entry);
+  if (!data.ok()) {
+    return data.status();
+  }
+  if (entry.method == ZipMethod::kStore) {
+    return DecodeDynamicArrayFromNpy(file_, *data);
+  }
+
+  file_->WillNeed(data->data() - file_->contents().data(), data->size());
+  std::string npy(entry.uncompressed_size, '\0');
+  absl::Status status =
+      ReadZipEntry(file_->contents(), entry, absl::MakeSpan(npy));
+  if (!status.ok()) {
+    return status;
+  }
+  return DecodeDynamicArrayFromNpyOwned(std::move(npy));
+}
+
+absl::StatusOr<absl::flat_hash_map<std::string, DynamicArray>> LoadNpz(
+    const std::filesystem::path& path, const LoadNpzOptions& options) {
+  absl::StatusOr<NpzReader> reader = NpzReader::Open(path);
+  if (!reader.ok()) {
+    return reader.status();
+  }
+  return reader->ReadAll(options);
+}
+
+}  // namespace npy_array
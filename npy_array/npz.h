@@ -0,0 +1,181 @@
+#ifndef NPY_ARRAY_NPZ_H_
+#define NPY_ARRAY_NPZ_H_
+
+#include <filesystem>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/types/span.h"
+#include "npy_array/dynamic_array.h"
+#include "npy_array/mapped_file.h"
+#include "npy_array/npy_array.h"
+#include "npy_array/npy_dynamic_array.h"
+#include "npy_array/thread_pool.h"
+#include "npy_array/zip_directory.h"
+#include "npy_array/zip_writer.h"
+
+namespace npy_array {
+
+struct SaveNpzOptions {
+  // How each array is encoded. `npy_options.copy_options` also controls the
+  // copies of arrays that are not compact.
+  NpySerializeOptions npy_options;
+
+  // How each entry is compressed: ZipMethod::kStore for np.savez(), or
+  // ZipMethod::kDeflate (the default) for np.savez_compressed().
+  ZipWriter::AddFileOptions zip_options;
+};
+
+// Returns an NPZ archive with an entry "<name>.npy" for each of `arrays`, in
+// order of name, which np.load() reads back by name.
+//
+// Each entry is compressed from two parts, the NPY header and the payload. A
+// compact array's payload is read straight from its memory, so the archive is
+// the only full-size buffer; other arrays are copied compactly first.
+absl::StatusOr<std::string> EncodeNpz(
+    const std::map<std::string, DynamicArrayRef>& arrays,
+    const SaveNpzOptions& options = SaveNpzOptions());
+
+// Same as above, but writes the archive to the file at `path`. Entries are
+// compressed straight into the file (see ZipWriter::OpenFile()), so the archive
+// is never held in memory and may be larger than 4 GB.
+absl::Status SaveNpz(const std::filesystem::path& path,
+                     const std::map<std::string, DynamicArrayRef>& arrays,
+                     const SaveNpzOptions& options = SaveNpzOptions());
+
+// Adds `arrays` to the existing NPZ file at `path` in place, with
+// ZipWriter::AppendToFile(): the new entries follow the last one and only the
+// central directory is rewritten, so the arrays already in the file are neither
+// read nor rewritten. Returns an AlreadyExists error, and changes nothing, if
+// the file already has an array with one of the names: see ReplaceInNpz().
+absl::Status AppendToNpz(const std::filesystem::path& path,
+                         const std::map<std::string, DynamicArrayRef>& arrays,
+                         const SaveNpzOptions& options = SaveNpzOptions());
+
+// Replaces the arrays of the NPZ file at `path` that have the names of
+// `arrays`, and adds the others.
+//
+// If no array is replaced, this is AppendToNpz(). Otherwise, the entries that
+// are kept are copied as they are, still compressed, into a new file (see
+// CopyZipEntries()), so they are neither inflated nor deflated, and `arrays`
+// are appended to it. The new file then replaces `path`, which is unchanged if
+// anything fails. This needs room on disk for both files.
+absl::Status ReplaceInNpz(const std::filesystem::path& path,
+                          const std::map<std::string, DynamicArrayRef>& arrays,
+                          const SaveNpzOptions& options = SaveNpzOptions());
+
+// Removes the arrays `names` from the NPZ file at `path`, copying the other
+// entries as in ReplaceInNpz(). Returns a NotFound error, and changes nothing,
+// if the file has no array with one of the names.
+absl::Status DeleteFromNpz(const std::filesystem::path& path,
+                           absl::Span<const std::string> names);
+
+struct LoadNpzOptions {
+  // If set, only the arrays whose name it accepts are loaded. The other
+  // entries are not decompressed.
+  std::function<bool(std::string_view name)> filter;
+
+  // Decompresses entries in parallel, one entry per thread at a time.
+  // `min_bytes_per_thread` counts uncompressed bytes.
+  ThreadingOptions threading;
+};
+
+// Returns the arrays of the NPZ archive `npz_data` by name. As in np.load(),
+// the name of the entry "x.npy" is "x".
+//
+// Only the central directory is read up front. Each selected entry is then
+// decompressed once, into a buffer that becomes the storage of its array (see
+// DecodeDynamicArrayFromNpyOwned()), so no array is copied after it is
+// inflated. Returns an error if an entry is not a valid NPY file.
+absl::StatusOr<absl::flat_hash_map<std::string, DynamicArray>> DecodeNpz(
+    std::string_view npz_data,
+    const LoadNpzOptions& options = LoadNpzOptions());
+
+// An entry of an NPZ archive, as listed by CatalogNpz().
+struct NpzEntryInfo {
+  // As in np.load(), the name of the entry "x.npy" is "x".
+  std::string name;
+
+  // The path, compression method, sizes and CRC-32 of the entry, from the
+  // central directory.
+  ZipEntry entry;
+
+  // The offset of the entry's data in the archive, after its local header. The
+  // payload of a stored entry starts at `data_offset + array.payload_offset`.
+  int64_t data_offset = 0;
+
+  // The data type, extents, and fortran order of the array, from its header.
+  NpyArrayInfo array;
+};
+
+// Lists the arrays of the NPZ archive `npz_data`, in archive order, without
+// decompressing them. Only the central directory, the local headers and the
+// first few hundred bytes of each entry (its NPY header) are read, so this
+// takes time in the number of entries, not the size of the archive, e.g., to
+// budget memory or pick arrays before loading them. Returns an error if an
+// entry does not start with a valid NPY header.
+absl::StatusOr<std::vector<NpzEntryInfo>> CatalogNpz(std::string_view npz_data);
+
+// Reads arrays from a memory-mapped NPZ file, one at a time or all at once.
+//
+// Only the central directory is read when the file is opened. Arrays in stored
+// entries (np.savez()) point straight into the mapping, which they keep alive:
+// they are never copied unless their payload is not aligned for its data type,
+// and are read-only (see DynamicArray::IsWritable()). Compressed entries
+// (np.savez_compressed()) are inflated into a buffer of their own, after the OS
+// is asked to read their compressed bytes ahead (see MappedFile::WillNeed()).
+// Either way, memory use grows with the arrays read, not the archive.
+//
+// The CRC-32 of a stored entry is not checked, since that would read all of it.
+//
+// Thread-safe: arrays may be read from several threads at once.
+class NpzReader {
+ public:
+  // Maps the NPZ file at `path` and reads its central directory.
+  static absl::StatusOr<NpzReader> Open(const std::filesystem::path& path);
+
+  // The names of the arrays, in archive order. As in np.load(), the name of the
+  // entry "x.npy" is "x".
+  std::vector<std::string> names() const;
+
+  // Returns the array `name`, or a NotFound error if there is none. If several
+  // entries have that name, the last one wins.
+  absl::StatusOr<DynamicArray> Read(std::string_view name) const;
+
+  // Same as CatalogNpz(), for this file. Only the pages that hold the headers
+  // are read from disk.
+  absl::StatusOr<std::vector<NpzEntryInfo>> Catalog() const;
+
+  // Returns the arrays selected by `options.filter`, by name.
+  absl::StatusOr<absl::flat_hash_map<std::string, DynamicArray>> ReadAll(
+      const LoadNpzOptions& options = LoadNpzOptions()) const;
+
+ private:
+  NpzReader(std::shared_ptr<const MappedFile> file,
+            std::vector<ZipEntry> entries);
+
+  absl::StatusOr<DynamicArray> ReadEntry(const ZipEntry& entry) const;
+
+  std::shared_ptr<const MappedFile> file_;
+  std::vector<ZipEntry> entries_;
+  // The index in `entries_` of each name.
+  absl::flat_hash_map<std::string, size_t> index_;
+};
+
+// Same as DecodeNpz(), but reads the NPZ file at `path` with an NpzReader, so
+// entries that are not selected are never read from disk and stored entries
+// are not copied.
+absl::StatusOr<absl::flat_hash_map<std::string, DynamicArray>> LoadNpz(
+    const std::filesystem::path& path,
+    const LoadNpzOptions& options = LoadNpzOptions());
+
+}  // namespace npy_array
+
+#endif  // NPY_ARRAY_NPZ_H_
@@ -0,0 +1,320 @@
+#include "npy_array/npz.h"
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "gtest/gtest.h"
+#include "npy_array/data_type.h"
+#include "npy_array/dynamic_array.h"
+#include "npy_array/zip_writer.h"
+
+namespace npy_array {
+namespace {
+
+// Returns an int32 array whose elements count up in memory order.
+DynamicArray Iota(absl::Span<const int64_t> extents) {
+  DynamicArray arr(DataType::kInt32, extents);
+  for (int64_t i = 0; i < arr.NumElements(); ++i) {
+    arr.data<int32_t>()[i] = i;
+  }
+  return arr;
+}
+
+TEST(NpzTest, RoundTrip) {
+  DynamicArray a = Iota({5, 4, 3});
+  DynamicArray b(DataType::kFloat64, {7});
+  for (int64_t i = 0; i < 7; ++i) {
+    b.Set<double>({i}, i * 0.5);
+  }
+  DynamicArray empty(DataType::kUint8, {0, 3});
+  // A transposed view is copied compactly before it is compressed.
+  const DynamicArrayRef a_transposed = a.ref().Permute({1, 0, 2});
+
+  for (const ZipMethod method : {ZipMethod::kStore, ZipMethod::kDeflate}) {
+    SaveNpzOptions options;
+    options.zip_options.method = method;
+    absl::StatusOr<std::string> npz = EncodeNpz(
+        {{"a", a}, {"b", b}, {"empty", empty}, {"a_t", a_transposed}},
+        options);
+    ASSERT_TRUE(npz.ok()) << npz.status();
+
+    auto arrays = DecodeNpz(*npz);
+    ASSERT_TRUE(arrays.ok()) << arrays.status();
+    ASSERT_EQ(arrays->size(), 4);
+    const DynamicArray& read_a = arrays->at("a");
+    ASSERT_EQ(read_a.data_type(), DataType::kInt32);
+    ASSERT_EQ(read_a.rank(), 3);
+    EXPECT_EQ(read_a.shape().extent(0), 5);
+    EXPECT_EQ(read_a.shape().extent(2), 3);
+    EXPECT_EQ(read_a.At<int32_t>({4, 3, 2}), a.At<int32_t>({4, 3, 2}));
+    EXPECT_EQ(arrays->at("b").At<double>({6}), 3.0);
+    EXPECT_EQ(arrays->at("empty").NumElements(), 0);
+    const DynamicArray& read_a_t = arrays->at("a_t");
+    EXPECT_EQ(read_a_t.shape().extent(0), 4);
+    EXPECT_EQ(read_a_t.At<int32_t>({3, 1, 2}), a.At<int32_t>({1, 3, 2}));
+  }
+}
+
+TEST(NpzTest, Filter) {
+  DynamicArray a = Iota({10});
+  DynamicArray b = Iota({20});
+  absl::StatusOr<std::string> npz = EncodeNpz({{"a", a}, {"b", b}});
+  ASSERT_TRUE(npz.ok()) << npz.status();
+
+  LoadNpzOptions options;
+  options.filter = [](std::string_view name) { return name == "b"; };
+  auto arrays = DecodeNpz(*npz, options);
+  ASSERT_TRUE(arrays.ok()) << arrays.status();
+  ASSERT_EQ(arrays->size(), 1);
+  EXPECT_EQ(arrays->at("b").NumElements(), 20);
+}
+
+TEST(NpzTest, Threads) {
+  std::map<std::string, DynamicArray> storage;
+  std::map<std::string, DynamicArrayRef> arrays;
+  for (int i = 0; i < 16; ++i) {
+    const std::string name = absl::StrCat("array_", i);
+    storage.emplace(name, Iota({1000 + i}));
+    arrays.emplace(name, storage.at(name));
+  }
+  absl::StatusOr<std::string> npz = EncodeNpz(arrays);
+  ASSERT_TRUE(npz.ok()) << npz.status();
+
+  ThreadPool pool(3);
+  auto read = DecodeNpz(*npz, {.threading = {.max_threads = 4,
+                                             .min_bytes_per_thread = 1,
+                                             .thread_pool = &pool}});
+  ASSERT_TRUE(read.ok()) << read.status();
+  ASSERT_EQ(read->size(), 16);
+  for (int i = 0; i < 16; ++i) {
+    const DynamicArray& arr = read->at(absl::StrCat("array_", i));
+    ASSERT_EQ(arr.NumElements(), 1000 + i);
+    EXPECT_EQ(arr.At<int32_t>({999 + i}), 999 + i);
+  }
+}
+
+TEST(NpzTest, SaveAndLoadFile) {
+  DynamicArray a = Iota({6, 2});
+  const std::filesystem::path path =
+      std::filesystem::path(testing::TempDir()) / "npz_test.npz";
+  ASSERT_TRUE(SaveNpz(path, {{"a", a}}).ok());
+
+  auto arrays = LoadNpz(path);
+  ASSERT_TRUE(arrays.ok()) << arrays.status();
+  EXPECT_EQ(arrays->at("a").At<int32_t>({5, 1}), 11);
+
+  EXPECT_EQ(LoadNpz(path.string() + ".missing").status().code(),
+            absl::StatusCode::kNotFound);
+}
+
+TEST(NpzTest, Catalog) {
+  DynamicArray a = Iota({5, 4, 3});
+  DynamicArray b(DataType::kFloat64, {7});
+  // The header of a high-rank array is longer than the first bytes read.
+  DynamicArray high_rank(DataType::kUint16, std::vector<int64_t>(100, 1));
+
+  for (const ZipMethod method : {ZipMethod::kStore, ZipMethod::kDeflate}) {
+    SaveNpzOptions options;
+    options.zip_options.method = method;
+    absl::StatusOr<std::string> npz =
+        EncodeNpz({{"a", a}, {"b", b}, {"high_rank", high_rank}}, options);
+    ASSERT_TRUE(npz.ok()) << npz.status();
+
+    auto catalog = CatalogNpz(*npz);
+    ASSERT_TRUE(catalog.ok()) << catalog.status();
+    ASSERT_EQ(catalog->size(), 3);
+    const NpzEntryInfo& info_a = (*catalog)[0];
+    EXPECT_EQ(info_a.name, "a");
+    EXPECT_EQ(info_a.entry.path, "a.npy");
+    EXPECT_EQ(info_a.entry.method, method);
+    EXPECT_EQ(info_a.array.data_type, DataType::kInt32);
+    EXPECT_EQ(info_a.array.extents, (std::vector<int64_t>{5, 4, 3}));
+    EXPECT_FALSE(info_a.array.fortran_order);
+    EXPECT_EQ(info_a.entry.uncompressed_size,
+              info_a.array.payload_offset + a.TotalSizeBytes());
+    if (method == ZipMethod::kStore) {
+      EXPECT_EQ(npz->substr(info_a.data_offset + info_a.array.payload_offset,
+                            a.TotalSizeBytes()),
+                std::string_view(reinterpret_cast<const char*>(
+                                     a.data<int32_t>()),
+                                 a.TotalSizeBytes()));
+    }
+    EXPECT_EQ((*catalog)[1].array.data_type, DataType::kFloat64);
+    EXPECT_EQ((*catalog)[1].array.extents, (std::vector<int64_t>{7}));
+    EXPECT_EQ((*catalog)[2].array.extents.size(), 100);
+    EXPECT_GT((*catalog)[2].array.payload_offset, 256);
+  }
+
+  // Axes in their original order are written in fortran order.
+  SaveNpzOptions fortran_options;
+  fortran_options.npy_options.reverse_axes = false;
+  absl::StatusOr<std::string> fortran_npz =
+      EncodeNpz({{"a", a}}, fortran_options);
+  ASSERT_TRUE(fortran_npz.ok()) << fortran_npz.status();
+  auto fortran_catalog = CatalogNpz(*fortran_npz);
+  ASSERT_TRUE(fortran_catalog.ok()) << fortran_catalog.status();
+  EXPECT_TRUE((*fortran_catalog)[0].array.fortran_order);
+  EXPECT_EQ((*fortran_catalog)[0].array.extents,
+            (std::vector<int64_t>{5, 4, 3}));
+
+  const std::filesystem::path path =
+      std::filesystem::path(testing::TempDir()) / "npz_test_catalog.npz";
+  ASSERT_TRUE(SaveNpz(path, {{"b", b}}).ok());
+  absl::StatusOr<NpzReader> reader = NpzReader::Open(path);
+  ASSERT_TRUE(reader.ok()) << reader.status();
+  auto catalog = reader->Catalog();
+  ASSERT_TRUE(catalog.ok()) << catalog.status();
+  ASSERT_EQ(catalog->size(), 1);
+  EXPECT_EQ((*catalog)[0].name, "b");
+  EXPECT_EQ((*catalog)[0].array.data_type, DataType::kFloat64);
+}
+
+TEST(NpzTest, Reader) {
+  DynamicArray bytes(DataType::kUint8, {100, 3});
+  for (int64_t i = 0; i < bytes.NumElements(); ++i) {
+    bytes.data<uint8_t>()[i] = i % 251;
+  }
+  DynamicArray a = Iota({6, 2});
+  const std::filesystem::path path =
+      std::filesystem::path(testing::TempDir()) / "npz_test_reader.npz";
+  SaveNpzOptions options;
+  options.zip_options.method = ZipMethod::kStore;
+  ASSERT_TRUE(SaveNpz(path, {{"bytes", bytes}, {"a", a}}, options).ok());
+
+  absl::StatusOr<DynamicArray> read_bytes;
+  {
+    absl::StatusOr<NpzReader> reader = NpzReader::Open(path);
+    ASSERT_TRUE(reader.ok()) << reader.status();
+    EXPECT_EQ(reader->names(), (std::vector<std::string>{"a", "bytes"}));
+    EXPECT_EQ(reader->Read("missing").status().code(),
+              absl::StatusCode::kNotFound);
+    absl::StatusOr<DynamicArray> read_a = reader->Read("a");
+    ASSERT_TRUE(read_a.ok()) << read_a.status();
+    EXPECT_EQ(read_a->At<int32_t>({5, 1}), 11);
+    read_bytes = reader->Read("bytes");
+  }
+
+  // Stored bytes are always aligned, so the array points into the mapping,
+  // which it keeps alive after the reader is gone.
+  ASSERT_TRUE(read_bytes.ok()) << read_bytes.status();
+  EXPECT_FALSE(read_bytes->IsWritable());
+  EXPECT_EQ(read_bytes->At<uint8_t>({99, 2}), (99 + 2 * 100) % 251);
+  read_bytes->Set<uint8_t>({0, 0}, 7);
+  EXPECT_TRUE(read_bytes->IsWritable());
+  EXPECT_EQ(read_bytes->At<uint8_t>({0, 0}), 7);
+  EXPECT_EQ(read_bytes->At<uint8_t>({1, 0}), 1);
+
+  // Compressed entries are inflated into arrays of their own.
+  options.zip_options.method = ZipMethod::kDeflate;
+  ASSERT_TRUE(SaveNpz(path, {{"bytes", bytes}, {"a", a}}, options).ok());
+  absl::StatusOr<NpzReader> reader = NpzReader::Open(path);
+  ASSERT_TRUE(reader.ok()) << reader.status();
+  auto arrays = reader->ReadAll(
+      {.threading = {.max_threads = 0, .min_bytes_per_thread = 1}});
+  ASSERT_TRUE(arrays.ok()) << arrays.status();
+  ASSERT_EQ(arrays->size(), 2);
+  EXPECT_TRUE(arrays->at("bytes").IsWritable());
+  EXPECT_EQ(arrays->at("bytes").At<uint8_t>({99, 2}), (99 + 2 * 100) % 251);
+  EXPECT_EQ(arrays->at("a").At<int32_t>({5, 1}), 11);
+}
+
+// Returns the compressed bytes of the array `name` of the NPZ file at `path`.
+std::string CompressedData(const std::filesystem::path& path,
+                           std::string_view name) {
+  absl::StatusOr<NpzReader> reader = NpzReader::Open(path);
+  EXPECT_TRUE(reader.ok()) << reader.status();
+  auto catalog = reader->Catalog();
+  EXPECT_TRUE(catalog.ok()) << catalog.status();
+  std::ifstream file(path, std::ios::binary);
+  const std::string contents((std::istreambuf_iterator<char>(file)),
+                             std::istreambuf_iterator<char>());
+  for (const NpzEntryInfo& info : *catalog) {
+    if (info.name == name) {
+      return contents.substr(info.data_offset, info.entry.compressed_size);
+    }
+  }
+  ADD_FAILURE() << "no array named " << name;
+  return "";
+}
+
+TEST(NpzTest, Append) {
+  DynamicArray a = Iota({100});
+  DynamicArray b = Iota({50, 2});
+  const std::filesystem::path path =
+      std::filesystem::path(testing::TempDir()) / "npz_test_append.npz";
+  ASSERT_TRUE(SaveNpz(path, {{"a", a}}).ok());
+  const std::string compressed_a = CompressedData(path, "a");
+
+  ASSERT_TRUE(AppendToNpz(path, {{"b", b}}).ok());
+  auto arrays = LoadNpz(path);
+  ASSERT_TRUE(arrays.ok()) << arrays.status();
+  ASSERT_EQ(arrays->size(), 2);
+  EXPECT_EQ(arrays->at("a").At<int32_t>({99}), 99);
+  EXPECT_EQ(arrays->at("b").At<int32_t>({49, 1}), 99);
+  EXPECT_EQ(CompressedData(path, "a"), compressed_a);
+
+  EXPECT_EQ(AppendToNpz(path, {{"a", b}}).code(),
+            absl::StatusCode::kAlreadyExists);
+  EXPECT_EQ(AppendToNpz(path.string() + ".missing", {{"c", a}}).code(),
+            absl::StatusCode::kNotFound);
+}
+
+TEST(NpzTest, ReplaceAndDelete) {
+  DynamicArray a = Iota({100});
+  DynamicArray b = Iota({50, 2});
+  DynamicArray c = Iota({7});
+  const std::filesystem::path path =
+      std::filesystem::path(testing::TempDir()) / "npz_test_replace.npz";
+  ASSERT_TRUE(SaveNpz(path, {{"a", a}, {"b", b}, {"c", c}}).ok());
+  const std::string compressed_a = CompressedData(path, "a");
+  const std::string compressed_c = CompressedData(path, "c");
+
+  // "b" is replaced and "d" is added. The other arrays are copied as they are.
+  DynamicArray new_b = Iota({3});
+  ASSERT_TRUE(ReplaceInNpz(path, {{"b", new_b}, {"d", a}}).ok());
+  auto arrays = LoadNpz(path);
+  ASSERT_TRUE(arrays.ok()) << arrays.status();
+  ASSERT_EQ(arrays->size(), 4);
+  EXPECT_EQ(arrays->at("b").NumElements(), 3);
+  EXPECT_EQ(arrays->at("d").At<int32_t>({99}), 99);
+  EXPECT_EQ(CompressedData(path, "a"), compressed_a);
+  EXPECT_EQ(CompressedData(path, "c"), compressed_c);
+
+  ASSERT_TRUE(DeleteFromNpz(path, {"a", "d"}).ok());
+  arrays = LoadNpz(path);
+  ASSERT_TRUE(arrays.ok()) << arrays.status();
+  ASSERT_EQ(arrays->size(), 2);
+  EXPECT_EQ(arrays->at("b").At<int32_t>({2}), 2);
+  EXPECT_EQ(arrays->at("c").At<int32_t>({6}), 6);
+  EXPECT_EQ(CompressedData(path, "c"), compressed_c);
+
+  // Nothing changes if an array is missing.
+  EXPECT_EQ(DeleteFromNpz(path, {"b", "missing"}).code(),
+            absl::StatusCode::kNotFound);
+  arrays = LoadNpz(path);
+  ASSERT_TRUE(arrays.ok()) << arrays.status();
+  EXPECT_EQ(arrays->size(), 2);
+  EXPECT_FALSE(std::filesystem::exists(path.string() + ".tmp"));
+}
+
+TEST(NpzTest, InvalidEntry) {
+  ZipWriter zip_writer;
+  ASSERT_TRUE(zip_writer.AddFile("bad.npy", "not an npy file").ok());
+  absl::StatusOr<std::string> npz = std::move(zip_writer).Close();
+  ASSERT_TRUE(npz.ok());
+  EXPECT_EQ(DecodeNpz(*npz).status().code(),
+            absl::StatusCode::kInvalidArgument);
+  EXPECT_EQ(CatalogNpz(*npz).status().code(),
+            absl::StatusCode::kInvalidArgument);
+}
+
+}  // namespace
+}  // namespace npy_array
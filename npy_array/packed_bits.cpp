@@ -0,0 +1,462 @@
+#include "npy_array/packed_bits.h"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_join.h"
+#include "npy_array/npy_dynamic_array.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace npy_array {
+
+namespace {
+
+// kReverseBits[b] is `b` with its bits in reverse order. movemask puts element
+// i in bit i, while np.packbits puts it in bit 7 - i.
+constexpr std::array<uint8_t, 256> kReverseBits = [] {
+  std::array<uint8_t, 256> table = {};
+  for (int b = 0; b < 256; ++b) {
+    for (int i = 0; i < 8; ++i) {
+      table[b] |= ((b >> i) & 1) << (7 - i);
+    }
+  }
+  return table;
+}();
+
+// kUnpackedBytes[b] holds the 8 bytes (0 or 1) that byte `b` unpacks to, in
+// memory order.
+constexpr std::array<uint64_t, 256> kUnpackedBytes = [] {
+  std::array<uint64_t, 256> table = {};
+  for (int b = 0; b < 256; ++b) {
+    for (int i = 0; i < 8; ++i) {
+      const uint64_t bit = (b >> (7 - i)) & 1;
+      table[b] |= bit << (std::endian::native == std::endian::little
+                              ? 8 * i
+                              : 8 * (7 - i));
+    }
+  }
+  return table;
+}();
+
+// Packs the `n` contiguous bytes at `src` (nonzero is true) into
+// ceil(n / 8) bytes at `dst`.
+void PackRow(const uint8_t* src, int64_t n, uint8_t* dst) {
+  int64_t i = 0;
+#if defined(__AVX2__)
+  const __m256i zero32 = _mm256_setzero_si256();
+  for (; i + 32 <= n; i += 32) {
+    const __m256i v =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+    const uint32_t bits = ~static_cast<uint32_t>(
+        _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, zero32)));
+    for (int k = 0; k < 4; ++k) {
+      dst[i / 8 + k] = kReverseBits[(bits >> (8 * k)) & 0xff];
+    }
+  }
+#endif
+#if defined(__SSE2__)
+  const __m128i zero16 = _mm_setzero_si128();
+  for (; i + 16 <= n; i += 16) {
+    const __m128i v =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+    const uint32_t bits =
+        ~static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(v, zero16)));
+    dst[i / 8] = kReverseBits[bits & 0xff];
+    dst[i / 8 + 1] = kReverseBits[(bits >> 8) & 0xff];
+  }
+#endif
+  for (; i < n; i += 8) {
+    uint8_t byte = 0;
+    const int64_t count = std::min<int64_t>(8, n - i);
+    for (int64_t j = 0; j < count; ++j) {
+      byte |= static_cast<uint8_t>(src[i + j] != 0) << (7 - j);
+    }
+    dst[i / 8] = byte;
+  }
+}
+
+// Same as above, for `n` bytes `stride` bytes apart.
+void PackStridedRow(const uint8_t* src, int64_t stride, int64_t n,
+                    uint8_t* dst) {
+  for (int64_t i = 0; i < n; i += 8) {
+    uint8_t byte = 0;
+    const int64_t count = std::min<int64_t>(8, n - i);
+    for (int64_t j = 0; j < count; ++j) {
+      byte |= static_cast<uint8_t>(src[(i + j) * stride] != 0) << (7 - j);
+    }
+    dst[i / 8] = byte;
+  }
+}
+
+// Unpacks the first `n` bits at `src` into `n` bytes (0 or 1) at `dst`, which
+// are `stride` bytes apart.
+void UnpackRow(const uint8_t* src, int64_t n, uint8_t* dst, int64_t stride) {
+  if (stride == 1) {
+    int64_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+      std::memcpy(dst + i, &kUnpackedBytes[src[i / 8]], 8);
+    }
+    if (i < n) {
+      std::memcpy(dst + i, &kUnpackedBytes[src[i / 8]], n - i);
+    }
+  } else {
+    for (int64_t i = 0; i < n; ++i) {
+      dst[i * stride] = (src[i / 8] >> (7 - i % 8)) & 1;
+    }
+  }
+}
+
+// Calls `f(r, offset)` for each row `r` of `shape`, where `offset` is the
+// offset in elements of its first element.
+template <typename F>
+void ForEachRow(const DynamicShape& shape, int64_t num_rows, F&& f) {
+  const int64_t rank = shape.rank();
+  absl::InlinedVector<int64_t, DynamicShape::kInlineRank> index(rank, 0);
+  int64_t offset = 0;
+  for (int64_t r = 0; r < num_rows; ++r) {
+    f(r, offset);
+    for (int64_t d = 1; d < rank; ++d) {
+      offset += shape.stride(d);
+      if (++index[d] < shape.extent(d)) {
+        break;
+      }
+      offset -= shape.stride(d) * shape.extent(d);
+      index[d] = 0;
+    }
+  }
+}
+
+// Zeroes the padding bits at the end of each row.
+void ClearPadding(PackedBitArray& arr) {
+  const int64_t used_bits = arr.extent(0) % 8;
+  if (used_bits == 0) {
+    return;
+  }
+  const uint8_t mask = static_cast<uint8_t>(0xff << (8 - used_bits));
+  for (int64_t r = 0; r < arr.NumRows(); ++r) {
+    arr.Row(r)[arr.RowBytes() - 1] &= mask;
+  }
+}
+
+absl::Status CheckMaskDataType(const char* function, DataType data_type) {
+  if (data_type != DataType::kBool && data_type != DataType::kUint8) {
+    return absl::InvalidArgumentError(absl::StrCat(
+        function, ": expected kBool or kUint8, got ", data_type, "."));
+  }
+  return absl::OkStatus();
+}
+
+absl::Status CheckSameExtents(const char* function, absl::Span<const int64_t> a,
+                              absl::Span<const int64_t> b) {
+  if (a != b) {
+    return absl::InvalidArgumentError(
+        absl::StrCat(function, ": extent mismatch, [", absl::StrJoin(a, ", "),
+                     "] vs. [", absl::StrJoin(b, ", "), "]."));
+  }
+  return absl::OkStatus();
+}
+
+// The packed rows of `arr` as a compact uint8 array.
+DynamicArrayRef BytesOf(const PackedBitArray& arr) {
+  absl::InlinedVector<int64_t, DynamicShape::kInlineRank> extents(
+      arr.extents().begin(), arr.extents().end());
+  extents[0] = arr.RowBytes();
+  // The view is only read through by callers that take a const array.
+  return DynamicArrayRef(const_cast<uint8_t*>(arr.data()), DataType::kUint8,
+                         DynamicShape(extents));
+}
+
+// Applies `op` to `a` and `b` 64 bits at a time, and to any remaining bytes one
+// at a time, so `op` must be bitwise. Padding bits stay zero for any op that
+// maps (0, 0) to 0.
+template <typename Op>
+absl::StatusOr<PackedBitArray> Combine(const char* function,
+                                       const PackedBitArray& a,
+                                       const PackedBitArray& b, Op op) {
+  const absl::Status status =
+      CheckSameExtents(function, a.extents(), b.extents());
+  if (!status.ok()) {
+    return status;
+  }
+  PackedBitArray result(a.extents());
+  const uint8_t* pa = a.data();
+  const uint8_t* pb = b.data();
+  uint8_t* out = result.data();
+  const int64_t size = result.SizeBytes();
+  int64_t i = 0;
+  for (; i + 8 <= size; i += 8) {
+    uint64_t x;
+    uint64_t y;
+    std::memcpy(&x, pa + i, 8);
+    std::memcpy(&y, pb + i, 8);
+    const uint64_t z = op(x, y);
+    std::memcpy(out + i, &z, 8);
+  }
+  for (; i < size; ++i) {
+    out[i] = static_cast<uint8_t>(op(pa[i], pb[i]));
+  }
+  return result;
+}
+
+}  // namespace
+
+PackedBitArray::PackedBitArray(absl::Span<const int64_t> extents)
+    : extents_(extents.begin(), extents.end()) {
+  assert(!extents_.empty());
+  buffer_ = AlignedBuffer(NumRows() * RowBytes());
+}
+
+int64_t PackedBitArray::NumElements() const {
+  int64_t n = 1;
+  for (const int64_t extent : extents_) {
+    n *= extent;
+  }
+  return n;
+}
+
+int64_t PackedBitArray::NumRows() const {
+  int64_t n = 1;
+  for (int64_t d = 1; d < rank(); ++d) {
+    n *= extents_[d];
+  }
+  return n;
+}
+
+absl::StatusOr<PackedBitArray> PackBits(const DynamicArrayRef& src) {
+  absl::Status status = CheckMaskDataType("PackBits", src.data_type());
+  if (status.ok() && src.rank() == 0) {
+    status = absl::InvalidArgumentError("PackBits: rank must be at least 1.");
+  }
+  if (!status.ok()) {
+    return status;
+  }
+
+  absl::InlinedVector<int64_t, DynamicShape::kInlineRank> extents(src.rank());
+  for (int64_t d = 0; d < src.rank(); ++d) {
+    extents[d] = src.shape().extent(d);
+  }
+  PackedBitArray result(extents);
+  if (result.empty()) {
+    return result;
+  }
+
+  const uint8_t* data = src.data();
+  const int64_t width = extents[0];
+  const int64_t stride = src.shape().stride(0);
+  ForEachRow(src.shape(), result.NumRows(), [&](int64_t r, int64_t offset) {
+    if (stride == 1) {
+      PackRow(data + offset, width, result.Row(r));
+    } else {
+      PackStridedRow(data + offset, stride, width, result.Row(r));
+    }
+  });
+  return result;
+}
+
+absl::Status UnpackBits(const PackedBitArray& src, DynamicArrayRef dst) {
+  const absl::Status status = CheckMaskDataType("UnpackBits", dst.data_type());
+  if (!status.ok()) {
+    return status;
+  }
+  absl::InlinedVector<int64_t, DynamicShape::kInlineRank> dst_extents(
+      dst.rank());
+  for (int64_t d = 0; d < dst.rank(); ++d) {
+    dst_extents[d] = dst.shape().extent(d);
+  }
+  const absl::Status extents_status =
+      CheckSameExtents("UnpackBits", src.extents(), dst_extents);
+  if (!extents_status.ok()) {
+    return extents_status;
+  }
+  if (src.empty()) {
+    return absl::OkStatus();
+  }
+
+  uint8_t* data = dst.data();
+  const int64_t stride = dst.shape().stride(0);
+  ForEachRow(dst.shape(), src.NumRows(), [&](int64_t r, int64_t offset) {
+    UnpackRow(src.Row(r), src.extent(0), data + offset, stride);
+  });
+  return absl::OkStatus();
+}
+
+absl::StatusOr<DynamicArray> UnpackBits(const PackedBitArray& src,
+                                        DataType data_type) {
+  const absl::Status status = CheckMaskDataType("UnpackBits", data_type);
+  if (!status.ok()) {
+    return status;
+  }
+  DynamicArray dst(data_type, src.extents());
+  const absl::Status unpack_status = UnpackBits(src, dst.ref());
+  if (!unpack_status.ok()) {
+    return unpack_status;
+  }
+  return dst;
+}
+
+int64_t CountOnes(const PackedBitArray& src) {
+  const uint8_t* data = src.data();
+  const int64_t size = src.SizeBytes();
+  int64_t count = 0;
+  int64_t i = 0;
+  for (; i + 8 <= size; i += 8) {
+    uint64_t word;
+    std::memcpy(&word, data + i, 8);
+    count += std::popcount(word);
+  }
+  for (; i < size; ++i) {
+    count += std::popcount(data[i]);
+  }
+  return count;
+}
+
+absl::StatusOr<PackedBitArray> LogicalAnd(const PackedBitArray& a,
+                                          const PackedBitArray& b) {
+  return Combine("LogicalAnd", a, b, [](auto x, auto y) { return x & y; });
+}
+
+absl::StatusOr<PackedBitArray> LogicalOr(const PackedBitArray& a,
+                                         const PackedBitArray& b) {
+  return Combine("LogicalOr", a, b, [](auto x, auto y) { return x | y; });
+}
+
+absl::StatusOr<PackedBitArray> LogicalXor(const PackedBitArray& a,
+                                          const PackedBitArray& b) {
+  return Combine("LogicalXor", a, b, [](auto x, auto y) { return x ^ y; });
+}
+
+PackedBitArray LogicalNot(const PackedBitArray& src) {
+  PackedBitArray result(src.extents());
+  const uint8_t* in = src.data();
+  uint8_t* out = result.data();
+  const int64_t size = result.SizeBytes();
+  int64_t i = 0;
+  for (; i + 8 <= size; i += 8) {
+    uint64_t word;
+    std::memcpy(&word, in + i, 8);
+    word = ~word;
+    std::memcpy(out + i, &word, 8);
+  }
+  for (; i < size; ++i) {
+    out[i] = static_cast<uint8_t>(~in[i]);
+  }
+  ClearPadding(result);
+  return result;
+}
+
+absl::StatusOr<std::string> EncodePackedBitsToNpy(const PackedBitArray& src) {
+  return EncodeDynamicArrayToNpy(BytesOf(src));
+}
+
+absl::StatusOr<PackedBitArray> DecodePackedBitsFromNpy(std::string_view npy,
+                                                       int64_t width) {
+  absl::StatusOr<DynamicArrayRef> packed = MakeDynamicArrayRefOfNpy(npy);
+  if (!packed.ok()) {
+    return packed.status();
+  }
+  if (packed->data_type() != DataType::kUint8 || packed->rank() == 0) {
+    return absl::InvalidArgumentError(absl::StrCat(
+        "DecodePackedBitsFromNpy: expected a uint8 array of rank at least 1, "
+        "got ",
+        packed->data_type(), " of rank ", packed->rank(), "."));
+  }
+  if (width < 0 || packed->shape().extent(0) != (width + 7) / 8) {
+    return absl::InvalidArgumentError(absl::StrCat(
+        "DecodePackedBitsFromNpy: a width of ", width, " doesn't match ",
+        packed->shape().extent(0), " packed bytes per row."));
+  }
+
+  absl::InlinedVector<int64_t, DynamicShape::kInlineRank> extents(
+      packed->rank());
+  for (int64_t d = 0; d < packed->rank(); ++d) {
+    extents[d] = packed->shape().extent(d);
+  }
+  extents[0] = width;
+  PackedBitArray result(extents);
+  const absl::Status status = Copy(*packed, BytesOf(result));
+  if (!status.ok()) {
+    return status;
+  }
+  ClearPadding(result);
+  return result;
+}
+
+absl::Status AddPackedBitsToNpz(std::string_view name,
+                                const PackedBitArray& src, ZipWriter* zip) {
+  absl::StatusOr<std::string> packed = EncodePackedBitsToNpy(src);
+  if (!packed.ok()) {
+    return packed.status();
+  }
+
+  // The numpy shape lists the dimensions outermost first.
+  DynamicArray shape(DataType::kInt64, {src.rank()});
+  for (int64_t d = 0; d < src.rank(); ++d) {
+    shape.Set<int64_t>({d}, src.extent(src.rank() - 1 - d));
+  }
+  absl::StatusOr<std::string> shape_npy = EncodeDynamicArrayToNpy(shape);
+  if (!shape_npy.ok()) {
+    return shape_npy.status();
+  }
+
+  absl::Status status =
+      zip->AddFile(absl::StrCat(name, kNpyExtension), *packed);
+  if (status.ok()) {
+    status =
+        zip->AddFile(absl::StrCat(name, "_shape", kNpyExtension), *shape_npy);
+  }
+  return status;
+}
+
+absl::StatusOr<PackedBitArray> ReadPackedBitsFromNpz(
+    const absl::flat_hash_map<std::filesystem::path, std::string>& files,
+    std::string_view name) {
+  const auto packed = files.find(absl::StrCat(name, kNpyExtension));
+  const auto shape_npy =
+      files.find(absl::StrCat(name, "_shape", kNpyExtension));
+  if (packed == files.end() || shape_npy == files.end()) {
+    return absl::NotFoundError(
+        absl::StrCat("ReadPackedBitsFromNpz: no packed mask named ", name,
+                     "."));
+  }
+
+  absl::StatusOr<DynamicArray> shape =
+      DecodeDynamicArrayFromNpy(shape_npy->second);
+  if (!shape.ok()) {
+    return shape.status();
+  }
+  const int64_t rank = shape->NumElements();
+  if (shape->data_type() != DataType::kInt64 || shape->rank() != 1 ||
+      rank == 0) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("ReadPackedBitsFromNpz: invalid shape for ", name, "."));
+  }
+  const int64_t* numpy_shape = std::as_const(*shape).data<int64_t>();
+
+  absl::StatusOr<PackedBitArray> result =
+      DecodePackedBitsFromNpy(packed->second, numpy_shape[rank - 1]);
+  if (!result.ok()) {
+    return result.status();
+  }
+  std::vector<int64_t> extents(numpy_shape, numpy_shape + rank);
+  std::reverse(extents.begin(), extents.end());
+  const absl::Status status = CheckSameExtents(
+      "ReadPackedBitsFromNpz", result->extents(), extents);
+  if (!status.ok()) {
+    return status;
+  }
+  return result;
+}
+
+}  // namespace npy_array
@@ -0,0 +1,152 @@
+#ifndef NPY_ARRAY_PACKED_BITS_H_
+#define NPY_ARRAY_PACKED_BITS_H_
+
+#include <cassert>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <string_view>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/container/inlined_vector.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/types/span.h"
+#include "npy_array/aligned_buffer.h"
+#include "npy_array/data_type.h"
+#include "npy_array/dynamic_array.h"
+#include "npy_array/zip_writer.h"
+
+namespace npy_array {
+
+// A boolean array that stores one bit per element, e.g., for segmentation or
+// validity masks.
+//
+// As in DynamicArray, dimension 0 is innermost. Each row of dimension 0 is
+// packed into RowBytes() bytes, most significant bit first, and rows are
+// compact. This is the layout of np.packbits(mask, axis=-1) for the numpy
+// shape (which lists the dimensions in reverse). Padding bits at the end of
+// each row are always zero, so whole bytes can be counted and combined.
+class PackedBitArray {
+ public:
+  // An empty array of rank 1.
+  PackedBitArray() : PackedBitArray({0}) {}
+
+  // An array of the given extents, which must have rank at least 1, with every
+  // element false.
+  explicit PackedBitArray(absl::Span<const int64_t> extents);
+
+  PackedBitArray(const PackedBitArray&) = default;
+  PackedBitArray& operator=(const PackedBitArray&) = default;
+  PackedBitArray(PackedBitArray&&) = default;
+  PackedBitArray& operator=(PackedBitArray&&) = default;
+
+  absl::Span<const int64_t> extents() const { return extents_; }
+  int64_t rank() const { return extents_.size(); }
+  int64_t extent(int64_t d) const { return extents_[d]; }
+  int64_t NumElements() const;
+  bool empty() const { return NumElements() == 0; }
+
+  // The number of bytes of each row of dimension 0: ceil(extent(0) / 8).
+  int64_t RowBytes() const { return (extents_[0] + 7) / 8; }
+
+  // The number of rows: the product of the extents of dimensions 1 and up.
+  int64_t NumRows() const;
+
+  // The size of data(): NumRows() * RowBytes().
+  int64_t SizeBytes() const { return buffer_.size(); }
+
+  const uint8_t* data() const { return buffer_.data(); }
+  uint8_t* data() { return buffer_.data(); }
+
+  // The bytes of row `r`, where rows are numbered with dimension 1 innermost.
+  const uint8_t* Row(int64_t r) const { return data() + r * RowBytes(); }
+  uint8_t* Row(int64_t r) { return data() + r * RowBytes(); }
+
+  // Returns the element at the given indices. Not bounds checked.
+  bool Get(absl::Span<const int64_t> indices) const {
+    const int64_t x = indices[0];
+    return (Row(RowIndex(indices))[x / 8] >> (7 - x % 8)) & 1;
+  }
+
+  // Sets the element at the given indices. Not bounds checked.
+  void Set(absl::Span<const int64_t> indices, bool value) {
+    const int64_t x = indices[0];
+    uint8_t& byte = Row(RowIndex(indices))[x / 8];
+    const uint8_t bit = static_cast<uint8_t>(0x80 >> (x % 8));
+    byte = value ? (byte | bit) : (byte & ~bit);
+  }
+
+ private:
+  int64_t RowIndex(absl::Span<const int64_t> indices) const {
+    assert(static_cast<int64_t>(indices.size()) == rank());
+    int64_t row = 0;
+    for (int64_t d = rank() - 1; d >= 1; --d) {
+      row = row * extents_[d] + indices[d];
+    }
+    return row;
+  }
+
+  absl::InlinedVector<int64_t, DynamicShape::kInlineRank> extents_;
+  AlignedBuffer buffer_;
+};
+
+// Packs `src`, whose data type must be kBool or kUint8 (where any nonzero value
+// is true), into a PackedBitArray with the same extents. `src` may have any
+// strides. Rows that are contiguous are packed with SIMD compares and
+// movemasks, 16 or 32 elements at a time.
+absl::StatusOr<PackedBitArray> PackBits(const DynamicArrayRef& src);
+
+// Unpacks `src` into `dst`, which must have the same extents and data type
+// kBool or kUint8. Elements are set to 0 or 1.
+absl::Status UnpackBits(const PackedBitArray& src, DynamicArrayRef dst);
+
+// Returns a newly allocated compact array of `data_type` (kBool or kUint8)
+// with the elements of `src`.
+absl::StatusOr<DynamicArray> UnpackBits(const PackedBitArray& src,
+                                        DataType data_type = DataType::kBool);
+
+// Returns the number of true elements.
+int64_t CountOnes(const PackedBitArray& src);
+
+// Elementwise logical operations. The arrays must have the same extents. They
+// work a word at a time on the packed data.
+absl::StatusOr<PackedBitArray> LogicalAnd(const PackedBitArray& a,
+                                          const PackedBitArray& b);
+absl::StatusOr<PackedBitArray> LogicalOr(const PackedBitArray& a,
+                                         const PackedBitArray& b);
+absl::StatusOr<PackedBitArray> LogicalXor(const PackedBitArray& a,
+                                          const PackedBitArray& b);
+PackedBitArray LogicalNot(const PackedBitArray& src);
+
+// Encodes `src` in the NPY format as the uint8 array np.packbits(mask,
+// axis=-1) would return: its numpy shape is that of the mask, with the last
+// extent replaced by RowBytes(). The mask is recovered in numpy with
+// np.unpackbits(packed, axis=-1, count=width), where `width` is extent(0).
+absl::StatusOr<std::string> EncodePackedBitsToNpy(const PackedBitArray& src);
+
+// Decodes an encoding from EncodePackedBitsToNpy() (or of the result of
+// np.packbits(mask, axis=-1)), where `width` is the extent of dimension 0 of
+// the mask. Returns an error if the NPY data is not a uint8 array whose shape
+// matches `width`.
+absl::StatusOr<PackedBitArray> DecodePackedBitsFromNpy(std::string_view npy,
+                                                       int64_t width);
+
+// NPY does not record the width of a packed mask, so in NPZ files a mask is
+// stored as two entries: "<name>.npy", from EncodePackedBitsToNpy(), and
+// "<name>_shape.npy", the int64 numpy shape of the mask. In numpy:
+//
+//   shape = npz[name + "_shape"]
+//   mask = np.unpackbits(npz[name], axis=-1, count=shape[-1])
+absl::Status AddPackedBitsToNpz(std::string_view name,
+                                const PackedBitArray& src, ZipWriter* zip);
+
+// Reads the mask `name` written by AddPackedBitsToNpz() from the entries of
+// an NPZ file, e.g., from ReadZipFile().
+absl::StatusOr<PackedBitArray> ReadPackedBitsFromNpz(
+    const absl::flat_hash_map<std::filesystem::path, std::string>& files,
+    std::string_view name);
+
+}  // namespace npy_array
+
+#endif  // NPY_ARRAY_PACKED_BITS_H_
@@ -0,0 +1,224 @@
+#include "npy_array/packed_bits.h"
+
+#include <cstdint>
+#include <string>
+#include <utility>
+
+#include "absl/status/status.h"
+#include "gtest/gtest.h"
+#include "npy_array/data_type.h"
+#include "npy_array/dynamic_array.h"
+#include "npy_array/npy_dynamic_array.h"
+#include "npy_array/zip_reader.h"
+#include "npy_array/zip_writer.h"
+
+namespace npy_array {
+namespace {
+
+// Returns a mask of the given extents where element i (in memory order) is
+// true if i % 3 == 0 or i % 7 == 0.
+DynamicArray PatternMask(absl::Span<const int64_t> extents) {
+  DynamicArray mask(DataType::kUint8, extents);
+  for (int64_t i = 0; i < mask.NumElements(); ++i) {
+    mask.data<uint8_t>()[i] = (i % 3 == 0 || i % 7 == 0) ? 5 : 0;
+  }
+  return mask;
+}
+
+TEST(PackedBitsTest, PackMatchesNumpyLayout) {
+  // np.packbits([[1, 0, 1, 1, 0, 0, 0, 0, 1, 1]], axis=-1) is [[176, 192]].
+  DynamicArray mask(DataType::kBool, {10, 1});
+  const bool values[] = {1, 0, 1, 1, 0, 0, 0, 0, 1, 1};
+  for (int64_t x = 0; x < 10; ++x) {
+    mask.Set<bool>({x, 0}, values[x]);
+  }
+  absl::StatusOr<PackedBitArray> packed = PackBits(mask);
+  ASSERT_TRUE(packed.ok()) << packed.status();
+  EXPECT_EQ(packed->RowBytes(), 2);
+  EXPECT_EQ(packed->SizeBytes(), 2);
+  EXPECT_EQ(packed->data()[0], 176);
+  EXPECT_EQ(packed->data()[1], 192);
+  EXPECT_TRUE(packed->Get({3, 0}));
+  EXPECT_FALSE(packed->Get({4, 0}));
+  EXPECT_EQ(CountOnes(*packed), 5);
+}
+
+TEST(PackedBitsTest, RoundTrip) {
+  // Widths that exercise the vector loops and the partial last byte.
+  for (const int64_t width : {1, 8, 15, 16, 17, 33, 100}) {
+    const DynamicArray mask = PatternMask({width, 3, 2});
+    absl::StatusOr<PackedBitArray> packed = PackBits(mask);
+    ASSERT_TRUE(packed.ok()) << packed.status();
+    EXPECT_EQ(packed->NumRows(), 6);
+    EXPECT_EQ(packed->SizeBytes(), 6 * ((width + 7) / 8));
+
+    absl::StatusOr<DynamicArray> unpacked =
+        UnpackBits(*packed, DataType::kUint8);
+    ASSERT_TRUE(unpacked.ok()) << unpacked.status();
+    int64_t ones = 0;
+    for (int64_t i = 0; i < mask.NumElements(); ++i) {
+      const bool expected = mask.data<uint8_t>()[i] != 0;
+      EXPECT_EQ(unpacked->data<uint8_t>()[i], expected ? 1 : 0)
+          << "width " << width << ", element " << i;
+      ones += expected;
+    }
+    EXPECT_EQ(CountOnes(*packed), ones);
+  }
+}
+
+TEST(PackedBitsTest, StridedViews) {
+  const DynamicArray mask = PatternMask({20, 10});
+
+  // A transposed view packs each column of `mask` into a row.
+  DynamicArrayRef transposed = mask.cref().Permute({1, 0});
+  absl::StatusOr<PackedBitArray> packed = PackBits(transposed);
+  ASSERT_TRUE(packed.ok()) << packed.status();
+  EXPECT_EQ(packed->extent(0), 10);
+  EXPECT_EQ(packed->extent(1), 20);
+  for (int64_t y = 0; y < 10; ++y) {
+    for (int64_t x = 0; x < 20; ++x) {
+      EXPECT_EQ(packed->Get({y, x}), mask.At<uint8_t>({x, y}) != 0);
+    }
+  }
+
+  // Unpack into the transposed view of a new array.
+  DynamicArray dst(DataType::kUint8, {20, 10});
+  ASSERT_TRUE(UnpackBits(*packed, dst.ref().Permute({1, 0})).ok());
+  for (int64_t i = 0; i < mask.NumElements(); ++i) {
+    EXPECT_EQ(dst.data<uint8_t>()[i], mask.data<uint8_t>()[i] != 0);
+  }
+}
+
+TEST(PackedBitsTest, LogicalOps) {
+  PackedBitArray a({11, 2});
+  PackedBitArray b({11, 2});
+  a.Set({0, 0}, true);
+  a.Set({10, 1}, true);
+  b.Set({10, 1}, true);
+  b.Set({5, 0}, true);
+
+  absl::StatusOr<PackedBitArray> both = LogicalAnd(a, b);
+  ASSERT_TRUE(both.ok());
+  EXPECT_EQ(CountOnes(*both), 1);
+  EXPECT_TRUE(both->Get({10, 1}));
+
+  absl::StatusOr<PackedBitArray> either = LogicalOr(a, b);
+  ASSERT_TRUE(either.ok());
+  EXPECT_EQ(CountOnes(*either), 3);
+
+  absl::StatusOr<PackedBitArray> one = LogicalXor(a, b);
+  ASSERT_TRUE(one.ok());
+  EXPECT_EQ(CountOnes(*one), 2);
+  EXPECT_FALSE(one->Get({10, 1}));
+
+  // Padding bits stay zero, so counts are exact.
+  const PackedBitArray not_a = LogicalNot(a);
+  EXPECT_EQ(CountOnes(not_a), 22 - 2);
+  EXPECT_FALSE(not_a.Get({0, 0}));
+  EXPECT_TRUE(not_a.Get({9, 1}));
+
+  EXPECT_EQ(LogicalAnd(a, PackedBitArray({12, 2})).status().code(),
+            absl::StatusCode::kInvalidArgument);
+}
+
+TEST(PackedBitsTest, LogicalOpsOnWords) {
+  // 3 rows of 13 bytes: whole words and a tail of bytes.
+  PackedBitArray a({100, 3});
+  PackedBitArray b({100, 3});
+  for (int64_t y = 0; y < 3; ++y) {
+    for (int64_t x = 0; x < 100; ++x) {
+      a.Set({x, y}, (x + y) % 3 == 0);
+      b.Set({x, y}, (x * y) % 5 == 0);
+    }
+  }
+  absl::StatusOr<PackedBitArray> both = LogicalAnd(a, b);
+  absl::StatusOr<PackedBitArray> either = LogicalOr(a, b);
+  absl::StatusOr<PackedBitArray> one = LogicalXor(a, b);
+  ASSERT_TRUE(both.ok() && either.ok() && one.ok());
+  const PackedBitArray not_a = LogicalNot(a);
+  for (int64_t y = 0; y < 3; ++y) {
+    for (int64_t x = 0; x < 100; ++x) {
+      const bool va = a.Get({x, y});
+      const bool vb = b.Get({x, y});
+      EXPECT_EQ(both->Get({x, y}), va && vb) << x << ", " << y;
+      EXPECT_EQ(either->Get({x, y}), va || vb) << x << ", " << y;
+      EXPECT_EQ(one->Get({x, y}), va != vb) << x << ", " << y;
+      EXPECT_EQ(not_a.Get({x, y}), !va) << x << ", " << y;
+    }
+  }
+  EXPECT_EQ(CountOnes(not_a), 300 - CountOnes(a));
+}
+
+TEST(PackedBitsTest, Npy) {
+  const DynamicArray mask = PatternMask({13, 4, 3});
+  absl::StatusOr<PackedBitArray> packed = PackBits(mask);
+  ASSERT_TRUE(packed.ok());
+
+  absl::StatusOr<std::string> npy = EncodePackedBitsToNpy(*packed);
+  ASSERT_TRUE(npy.ok()) << npy.status();
+  // The numpy shape is that of np.packbits(mask, axis=-1).
+  EXPECT_NE(npy->find("'shape': (3,4,2,)"), std::string::npos) << *npy;
+
+  absl::StatusOr<PackedBitArray> decoded = DecodePackedBitsFromNpy(*npy, 13);
+  ASSERT_TRUE(decoded.ok()) << decoded.status();
+  EXPECT_EQ(decoded->extents(), packed->extents());
+  absl::StatusOr<DynamicArray> unpacked = UnpackBits(*decoded);
+  ASSERT_TRUE(unpacked.ok());
+  EXPECT_EQ(unpacked->data_type(), DataType::kBool);
+  for (int64_t i = 0; i < mask.NumElements(); ++i) {
+    EXPECT_EQ(unpacked->data<bool>()[i], mask.data<uint8_t>()[i] != 0);
+  }
+
+  EXPECT_EQ(DecodePackedBitsFromNpy(*npy, 17).status().code(),
+            absl::StatusCode::kInvalidArgument);
+  DynamicArray floats(DataType::kFloat32, {2});
+  EXPECT_EQ(DecodePackedBitsFromNpy(*EncodeDynamicArrayToNpy(floats), 2)
+                .status()
+                .code(),
+            absl::StatusCode::kInvalidArgument);
+}
+
+TEST(PackedBitsTest, Npz) {
+  const DynamicArray mask = PatternMask({9, 5});
+  absl::StatusOr<PackedBitArray> packed = PackBits(mask);
+  ASSERT_TRUE(packed.ok());
+
+  ZipWriter zip;
+  ASSERT_TRUE(AddPackedBitsToNpz("mask", *packed, &zip).ok());
+  absl::StatusOr<std::string> npz = std::move(zip).Close();
+  ASSERT_TRUE(npz.ok()) << npz.status();
+  auto files = ReadZipFile(*npz);
+  ASSERT_TRUE(files.ok()) << files.status();
+  EXPECT_TRUE(files->contains("mask.npy"));
+  EXPECT_TRUE(files->contains("mask_shape.npy"));
+
+  absl::StatusOr<PackedBitArray> read = ReadPackedBitsFromNpz(*files, "mask");
+  ASSERT_TRUE(read.ok()) << read.status();
+  EXPECT_EQ(read->extents(), packed->extents());
+  EXPECT_EQ(CountOnes(*read), CountOnes(*packed));
+  EXPECT_EQ(ReadPackedBitsFromNpz(*files, "other").status().code(),
+            absl::StatusCode::kNotFound);
+}
+
+TEST(PackedBitsTest, Errors) {
+  DynamicArray floats(DataType::kFloat32, {4});
+  EXPECT_EQ(PackBits(floats).status().code(),
+            absl::StatusCode::kInvalidArgument);
+  DynamicArray scalar(DataType::kBool, {});
+  EXPECT_EQ(PackBits(scalar).status().code(),
+            absl::StatusCode::kInvalidArgument);
+
+  PackedBitArray packed({4});
+  EXPECT_EQ(UnpackBits(packed, DataType::kInt32).status().code(),
+            absl::StatusCode::kInvalidArgument);
+
+  // Empty arrays.
+  DynamicArray empty(DataType::kBool, {0, 3});
+  absl::StatusOr<PackedBitArray> packed_empty = PackBits(empty);
+  ASSERT_TRUE(packed_empty.ok());
+  EXPECT_EQ(packed_empty->SizeBytes(), 0);
+  EXPECT_EQ(CountOnes(*packed_empty), 0);
+}
+
+}  // namespace
+}  // namespace npy_array
@@ -0,0 +1,511 @@
+#include "npy_array/quantize.h"
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "absl/container/inlined_vector.h"
+#include "absl/strings/str_cat.h"
+#include "absl/types/span.h"
+#include "npy_array/npy_dynamic_array.h"
+#include "npy_array/reduce.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace npy_array {
+
+namespace {
+
+template <typename T>
+constexpr bool kIsQuantizedType = std::is_same_v<T, uint8_t> ||
+                                  std::is_same_v<T, uint16_t> ||
+                                  std::is_same_v<T, int16_t>;
+
+bool IsQuantizedType(DataType data_type) {
+  return data_type == DataType::kUint8 || data_type == DataType::kUint16 ||
+         data_type == DataType::kInt16;
+}
+
+// Returns the range of quantized values of `data_type`.
+std::pair<float, float> QuantizedRange(DataType data_type) {
+  std::pair<float, float> range;
+  DispatchDataType(data_type, [&]<typename Q>() {
+    if constexpr (kIsQuantizedType<Q>) {
+      range = {std::numeric_limits<Q>::min(), std::numeric_limits<Q>::max()};
+    }
+  });
+  return range;
+}
+
+// Returns an error if `params` can't quantize an array of shape `shape`.
+absl::Status CheckParams(const char* function, const DynamicShape& shape,
+                         const QuantizationParams& params) {
+  if (!IsQuantizedType(params.data_type)) {
+    return absl::InvalidArgumentError(
+        absl::StrCat(function, ": can't quantize to ", params.data_type,
+                     "; use kUint8, kUint16 or kInt16."));
+  }
+  if (params.channel_dim < -1 || params.channel_dim >= shape.rank()) {
+    return absl::InvalidArgumentError(
+        absl::StrCat(function, ": invalid channel dimension ",
+                     params.channel_dim, " for rank ", shape.rank(), "."));
+  }
+  const size_t num_channels =
+      params.channel_dim < 0 ? 1 : shape.extent(params.channel_dim);
+  if (params.scale.size() != num_channels ||
+      params.offset.size() != num_channels) {
+    return absl::InvalidArgumentError(absl::StrCat(
+        function, ": expected ", num_channels, " scales and offsets, got ",
+        params.scale.size(), " and ", params.offset.size(), "."));
+  }
+  for (size_t c = 0; c < num_channels; ++c) {
+    if (params.scale[c] == 0.0f || !std::isfinite(params.scale[c]) ||
+        !std::isfinite(params.offset[c])) {
+      return absl::InvalidArgumentError(
+          absl::StrCat(function, ": invalid scale ", params.scale[c],
+                       " or offset ", params.offset[c], "."));
+    }
+  }
+  return absl::OkStatus();
+}
+
+absl::Status CheckFloat32(const char* function, DataType data_type) {
+  if (data_type != DataType::kFloat32) {
+    return absl::InvalidArgumentError(absl::StrCat(
+        function, ": expected a float32 array, got ", data_type, "."));
+  }
+  return absl::OkStatus();
+}
+
+// Calls `f(index, a_offset, b_offset)` for each row of dimension 0 of `a` and
+// `b`, which have the same extents. `index` holds the index of the row in
+// each dimension (and 0 in dimension 0); the offsets are those of its first
+// element, in elements. A scalar is one row.
+template <typename F>
+void ForEachRow(const DynamicShape& a, const DynamicShape& b, F&& f) {
+  const int64_t rank = a.rank();
+  if (a.NumElements() == 0) {
+    return;
+  }
+  absl::InlinedVector<int64_t, DynamicShape::kInlineRank> index(rank, 0);
+  const int64_t num_rows = rank == 0 ? 1 : a.NumElements() / a.extent(0);
+  int64_t a_offset = 0;
+  int64_t b_offset = 0;
+  for (int64_t r = 0; r < num_rows; ++r) {
+    f(absl::Span<const int64_t>(index), a_offset, b_offset);
+    for (int64_t d = 1; d < rank; ++d) {
+      a_offset += a.stride(d);
+      b_offset += b.stride(d);
+      if (++index[d] < a.extent(d)) {
+        break;
+      }
+      a_offset -= a.stride(d) * a.extent(d);
+      b_offset -= b.stride(d) * b.extent(d);
+      index[d] = 0;
+    }
+  }
+}
+
+#if defined(__SSE2__)
+// Narrows the 8 int32 values in `lo` and `hi`, which are in the range of Q,
+// and stores them at `dst`.
+template <typename Q>
+void Store8(__m128i lo, __m128i hi, Q* dst) {
+  if constexpr (std::is_same_v<Q, uint8_t>) {
+    const __m128i words = _mm_packs_epi32(lo, hi);
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(dst),
+                     _mm_packus_epi16(words, words));
+  } else if constexpr (std::is_same_v<Q, int16_t>) {
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), _mm_packs_epi32(lo, hi));
+  } else {
+    // SSE2 has no unsigned 32 to 16-bit pack: pack with a bias of 2^15.
+    const __m128i bias = _mm_set1_epi32(0x8000);
+    const __m128i words = _mm_packs_epi32(_mm_sub_epi32(lo, bias),
+                                          _mm_sub_epi32(hi, bias));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst),
+                     _mm_xor_si128(words, _mm_set1_epi16(-0x8000)));
+  }
+}
+#endif
+
+// Quantizes the `n` floats at `src`, `stride` elements apart, to `dst`.
+// `offset` and `inv_scale` point to `n` values if kPerElement, and to one
+// otherwise.
+template <typename Q, bool kPerElement>
+void QuantizeRow(const float* src, int64_t stride, int64_t n,
+                 const float* offset, const float* inv_scale, Q* dst) {
+  constexpr float kLo = std::numeric_limits<Q>::min();
+  constexpr float kHi = std::numeric_limits<Q>::max();
+  int64_t i = 0;
+  if (stride == 1) {
+#if defined(__AVX2__)
+    const __m256 lo8 = _mm256_set1_ps(kLo);
+    const __m256 hi8 = _mm256_set1_ps(kHi);
+    const __m256 offset8 = _mm256_set1_ps(offset[0]);
+    const __m256 inv_scale8 = _mm256_set1_ps(inv_scale[0]);
+    for (; i + 8 <= n; i += 8) {
+      const __m256 o = kPerElement ? _mm256_loadu_ps(offset + i) : offset8;
+      const __m256 s =
+          kPerElement ? _mm256_loadu_ps(inv_scale + i) : inv_scale8;
+      __m256 q = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(src + i), o), s);
+      // max() returns its second operand if either is NaN.
+      q = _mm256_min_ps(_mm256_max_ps(q, lo8), hi8);
+      // Rounds to nearest even.
+      const __m256i v = _mm256_cvtps_epi32(q);
+      Store8(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1),
+             dst + i);
+    }
+#elif defined(__SSE2__)
+    const __m128 lo4 = _mm_set1_ps(kLo);
+    const __m128 hi4 = _mm_set1_ps(kHi);
+    const __m128 offset4 = _mm_set1_ps(offset[0]);
+    const __m128 inv_scale4 = _mm_set1_ps(inv_scale[0]);
+    const auto convert4 = [&](int64_t j) {
+      const __m128 o = kPerElement ? _mm_loadu_ps(offset + j) : offset4;
+      const __m128 s = kPerElement ? _mm_loadu_ps(inv_scale + j) : inv_scale4;
+      __m128 q = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(src + j), o), s);
+      // max() returns its second operand if either is NaN.
+      q = _mm_min_ps(_mm_max_ps(q, lo4), hi4);
+      // Rounds to nearest even.
+      return _mm_cvtps_epi32(q);
+    };
+    for (; i + 8 <= n; i += 8) {
+      Store8(convert4(i), convert4(i + 4), dst + i);
+    }
+#endif
+  }
+  for (; i < n; ++i) {
+    const int64_t p = kPerElement ? i : 0;
+    float q = (src[i * stride] - offset[p]) * inv_scale[p];
+    // Written so that NaN becomes kLo, as above.
+    q = q > kLo ? q : kLo;
+    q = q < kHi ? q : kHi;
+    dst[i] = static_cast<Q>(std::nearbyint(q));
+  }
+}
+
+// Dequantizes the `n` values at `src` to `dst`, with strides in elements.
+// `scale` and `offset` point to `n` values if kPerElement, and to one
+// otherwise. The contiguous loop vectorizes.
+template <typename Q, bool kPerElement>
+void DequantizeRow(const Q* src, int64_t src_stride, int64_t n,
+                   const float* scale, const float* offset, float* dst,
+                   int64_t dst_stride) {
+  if (src_stride == 1 && dst_stride == 1) {
+    for (int64_t i = 0; i < n; ++i) {
+      const int64_t p = kPerElement ? i : 0;
+      dst[i] = static_cast<float>(src[i]) * scale[p] + offset[p];
+    }
+    return;
+  }
+  for (int64_t i = 0; i < n; ++i) {
+    const int64_t p = kPerElement ? i : 0;
+    dst[i * dst_stride] =
+        static_cast<float>(src[i * src_stride]) * scale[p] + offset[p];
+  }
+}
+
+// Returns the extents of the companion scale and offset arrays: those of
+// `shape` with every extent but that of `channel_dim` set to 1.
+std::vector<int64_t> ParamExtents(const DynamicShape& shape,
+                                  int64_t channel_dim) {
+  std::vector<int64_t> extents(shape.rank(), 1);
+  if (channel_dim >= 0) {
+    extents[channel_dim] = shape.extent(channel_dim);
+  }
+  return extents;
+}
+
+}  // namespace
+
+absl::StatusOr<QuantizationParams> ChooseQuantizationParams(
+    const DynamicArrayRef& src, DataType data_type, int64_t channel_dim) {
+  absl::Status status =
+      CheckFloat32("ChooseQuantizationParams", src.data_type());
+  if (!status.ok()) {
+    return status;
+  }
+  const int64_t num_channels =
+      channel_dim >= 0 && channel_dim < src.rank() ? src.shape().extent(
+                                                         channel_dim)
+                                                   : 1;
+  QuantizationParams params{
+      .data_type = data_type,
+      .channel_dim = channel_dim,
+      .scale = std::vector<float>(num_channels, 1.0f),
+      .offset = std::vector<float>(num_channels, 0.0f),
+  };
+  status = CheckParams("ChooseQuantizationParams", src.shape(), params);
+  if (!status.ok()) {
+    return status;
+  }
+
+  std::vector<int64_t> axes;
+  for (int64_t d = 0; d < src.rank(); ++d) {
+    if (d != channel_dim) {
+      axes.push_back(d);
+    }
+  }
+  absl::StatusOr<DynamicArray> min = Reduce(src, ReduceOp::kMin, axes);
+  if (!min.ok()) {
+    return min.status();
+  }
+  absl::StatusOr<DynamicArray> max = Reduce(src, ReduceOp::kMax, axes);
+  if (!max.ok()) {
+    return max.status();
+  }
+
+  const auto [lo, hi] = QuantizedRange(data_type);
+  for (int64_t c = 0; c < num_channels; ++c) {
+    const double min_c = std::as_const(*min).data<float>()[c];
+    const double max_c = std::as_const(*max).data<float>()[c];
+    if (!std::isfinite(min_c) || !std::isfinite(max_c)) {
+      return absl::InvalidArgumentError(
+          absl::StrCat("ChooseQuantizationParams: the range [", min_c, ", ",
+                       max_c, "] is not finite."));
+    }
+    const double scale = max_c > min_c ? (max_c - min_c) / (hi - lo) : 1.0;
+    params.scale[c] = static_cast<float>(scale);
+    params.offset[c] = static_cast<float>(min_c - lo * scale);
+  }
+  return params;
+}
+
+absl::StatusOr<DynamicArray> Quantize(const DynamicArrayRef& src,
+                                      const QuantizationParams& params) {
+  absl::Status status = CheckFloat32("Quantize", src.data_type());
+  if (status.ok()) {
+    status = CheckParams("Quantize", src.shape(), params);
+  }
+  if (!status.ok()) {
+    return status;
+  }
+
+  absl::InlinedVector<int64_t, DynamicShape::kInlineRank> extents(src.rank());
+  for (int64_t d = 0; d < src.rank(); ++d) {
+    extents[d] = src.shape().extent(d);
+  }
+  // Every element is overwritten below, so skip zero-filling.
+  DynamicArray dst(params.data_type, extents, {.initialize = false});
+
+  std::vector<float> inv_scale(params.scale.size());
+  for (size_t c = 0; c < inv_scale.size(); ++c) {
+    inv_scale[c] = 1.0f / params.scale[c];
+  }
+  const int64_t n = src.rank() > 0 ? src.shape().extent(0) : 1;
+  const int64_t stride = src.rank() > 0 ? src.shape().stride(0) : 1;
+  const float* src_data = src.data<float>();
+  DispatchDataType(params.data_type, [&]<typename Q>() {
+    if constexpr (kIsQuantizedType<Q>) {
+      Q* dst_data = dst.data<Q>();
+      ForEachRow(src.shape(), dst.shape(),
+                 [&](absl::Span<const int64_t> index, int64_t src_offset,
+                     int64_t dst_offset) {
+                   if (params.channel_dim == 0) {
+                     QuantizeRow<Q, true>(src_data + src_offset, stride, n,
+                                          params.offset.data(),
+                                          inv_scale.data(),
+                                          dst_data + dst_offset);
+                   } else {
+                     const int64_t c = params.channel_dim > 0
+                                           ? index[params.channel_dim]
+                                           : 0;
+                     QuantizeRow<Q, false>(src_data + src_offset, stride, n,
+                                           &params.offset[c], &inv_scale[c],
+                                           dst_data + dst_offset);
+                   }
+                 });
+    }
+  });
+  return dst;
+}
+
+absl::Status Dequantize(const DynamicArrayRef& src,
+                        const QuantizationParams& params,
+                        DynamicArrayRef dst) {
+  absl::Status status = CheckParams("Dequantize", src.shape(), params);
+  if (status.ok()) {
+    status = CheckFloat32("Dequantize", dst.data_type());
+  }
+  if (!status.ok()) {
+    return status;
+  }
+  if (src.data_type() != params.data_type) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("Dequantize: expected ", params.data_type, ", got ",
+                     src.data_type(), "."));
+  }
+  bool same_extents = src.rank() == dst.rank();
+  for (int64_t d = 0; same_extents && d < src.rank(); ++d) {
+    same_extents = src.shape().extent(d) == dst.shape().extent(d);
+  }
+  if (!same_extents) {
+    return absl::InvalidArgumentError("Dequantize: extent mismatch.");
+  }
+
+  const int64_t n = src.rank() > 0 ? src.shape().extent(0) : 1;
+  const int64_t src_stride = src.rank() > 0 ? src.shape().stride(0) : 1;
+  const int64_t dst_stride = dst.rank() > 0 ? dst.shape().stride(0) : 1;
+  float* dst_data = dst.data<float>();
+  DispatchDataType(params.data_type, [&]<typename Q>() {
+    if constexpr (kIsQuantizedType<Q>) {
+      const Q* src_data = src.data<Q>();
+      ForEachRow(src.shape(), dst.shape(),
+                 [&](absl::Span<const int64_t> index, int64_t src_offset,
+                     int64_t dst_offset) {
+                   if (params.channel_dim == 0) {
+                     DequantizeRow<Q, true>(src_data + src_offset, src_stride,
+                                            n, params.scale.data(),
+                                            params.offset.data(),
+                                            dst_data + dst_offset, dst_stride);
+                   } else {
+                     const int64_t c = params.channel_dim > 0
+                                           ? index[params.channel_dim]
+                                           : 0;
+                     DequantizeRow<Q, false>(
+                         src_data + src_offset, src_stride, n,
+                         &params.scale[c], &params.offset[c],
+                         dst_data + dst_offset, dst_stride);
+                   }
+                 });
+    }
+  });
+  return absl::OkStatus();
+}
+
+absl::StatusOr<DynamicArray> Dequantize(const DynamicArrayRef& src,
+                                        const QuantizationParams& params) {
+  absl::InlinedVector<int64_t, DynamicShape::kInlineRank> extents(src.rank());
+  for (int64_t d = 0; d < src.rank(); ++d) {
+    extents[d] = src.shape().extent(d);
+  }
+  // Every element is overwritten below, so skip zero-filling.
+  DynamicArray dst(DataType::kFloat32, extents, {.initialize = false});
+  const absl::Status status = Dequantize(src, params, dst.ref());
+  if (!status.ok()) {
+    return status;
+  }
+  return dst;
+}
+
+absl::Status AddQuantizedArrayToNpz(std::string_view name,
+                                    const DynamicArrayRef& src,
+                                    const QuantizationParams& params,
+                                    ZipWriter* zip,
+                                    const NpySerializeOptions& options) {
+  absl::StatusOr<DynamicArray> quantized = Quantize(src, params);
+  if (!quantized.ok()) {
+    return quantized.status();
+  }
+  absl::StatusOr<std::string> npy =
+      EncodeDynamicArrayToNpy(*quantized, options);
+  if (!npy.ok()) {
+    return npy.status();
+  }
+
+  const std::vector<int64_t> param_extents =
+      ParamExtents(src.shape(), params.channel_dim);
+  DynamicArray scale(DataType::kFloat32, param_extents);
+  DynamicArray offset(DataType::kFloat32, param_extents);
+  std::memcpy(scale.data(), params.scale.data(),
+              params.scale.size() * sizeof(float));
+  std::memcpy(offset.data(), params.offset.data(),
+              params.offset.size() * sizeof(float));
+  absl::StatusOr<std::string> scale_npy =
+      EncodeDynamicArrayToNpy(scale, options);
+  if (!scale_npy.ok()) {
+    return scale_npy.status();
+  }
+  absl::StatusOr<std::string> offset_npy =
+      EncodeDynamicArrayToNpy(offset, options);
+  if (!offset_npy.ok()) {
+    return offset_npy.status();
+  }
+
+  absl::Status status = zip->AddFile(absl::StrCat(name, kNpyExtension), *npy);
+  if (status.ok()) {
+    status =
+        zip->AddFile(absl::StrCat(name, "_scale", kNpyExtension), *scale_npy);
+  }
+  if (status.ok()) {
+    status = zip->AddFile(absl::StrCat(name, "_offset", kNpyExtension),
+                          *offset_npy);
+  }
+  return status;
+}
+
+absl::StatusOr<DynamicArray> ReadQuantizedArrayFromNpz(
+    const absl::flat_hash_map<std::filesystem::path, std::string>& files,
+    std::string_view name, QuantizationParams* params) {
+  const auto npy = files.find(absl::StrCat(name, kNpyExtension));
+  const auto scale_npy =
+      files.find(absl::StrCat(name, "_scale", kNpyExtension));
+  const auto offset_npy =
+      files.find(absl::StrCat(name, "_offset", kNpyExtension));
+  if (npy == files.end() || scale_npy == files.end() ||
+      offset_npy == files.end()) {
+    return absl::NotFoundError(absl::StrCat(
+        "ReadQuantizedArrayFromNpz: no quantized array named ", name, "."));
+  }
+
+  // The payload is only read through.
+  absl::StatusOr<DynamicArrayRef> quantized =
+      MakeDynamicArrayRefOfNpy(npy->second);
+  if (!quantized.ok()) {
+    return quantized.status();
+  }
+  absl::StatusOr<DynamicArray> scale =
+      DecodeDynamicArrayFromNpy(scale_npy->second);
+  if (!scale.ok()) {
+    return scale.status();
+  }
+  absl::StatusOr<DynamicArray> offset =
+      DecodeDynamicArrayFromNpy(offset_npy->second);
+  if (!offset.ok()) {
+    return offset.status();
+  }
+
+  // The channel dimension is the one where the parameters have more than one
+  // element.
+  QuantizationParams result_params;
+  result_params.data_type = quantized->data_type();
+  bool valid = scale->data_type() == DataType::kFloat32 &&
+               offset->data_type() == DataType::kFloat32 &&
+               scale->rank() == quantized->rank() &&
+               offset->rank() == quantized->rank();
+  for (int64_t d = 0; valid && d < quantized->rank(); ++d) {
+    if (scale->shape().extent(d) != 1) {
+      valid = result_params.channel_dim < 0 &&
+              scale->shape().extent(d) == quantized->shape().extent(d);
+      result_params.channel_dim = d;
+    }
+    valid = valid && offset->shape().extent(d) == scale->shape().extent(d);
+  }
+  if (!valid) {
+    return absl::InvalidArgumentError(absl::StrCat(
+        "ReadQuantizedArrayFromNpz: invalid scale or offset for ", name, "."));
+  }
+  const float* scale_data = std::as_const(*scale).data<float>();
+  const float* offset_data = std::as_const(*offset).data<float>();
+  result_params.scale.assign(scale_data, scale_data + scale->NumElements());
+  result_params.offset.assign(offset_data,
+                              offset_data + offset->NumElements());
+
+  absl::StatusOr<DynamicArray> result =
+      Dequantize(*quantized, result_params);
+  if (result.ok() && params != nullptr) {
+    *params = std::move(result_params);
+  }
+  return result;
+}
+
+}  // namespace npy_array
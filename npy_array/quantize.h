@@ -0,0 +1,89 @@
+#ifndef NPY_ARRAY_QUANTIZE_H_
+#define NPY_ARRAY_QUANTIZE_H_
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "npy_array/data_type.h"
+#include "npy_array/dynamic_array.h"
+#include "npy_array/npy_array.h"
+#include "npy_array/zip_writer.h"
+
+namespace npy_array {
+
+// Linear quantization of a float32 array to 8 or 16-bit integers. A quantized
+// value q stands for q * scale + offset, with a scale and offset for the whole
+// array or for each index of one dimension (e.g., per color channel).
+struct QuantizationParams {
+  // The quantized data type: kUint8, kUint16 or kInt16.
+  DataType data_type = DataType::kUint8;
+
+  // The dimension with a scale and offset per index, or -1 for a single scale
+  // and offset.
+  int64_t channel_dim = -1;
+
+  // One entry per index of `channel_dim`, or a single entry. Scales must be
+  // nonzero and finite.
+  std::vector<float> scale;
+  std::vector<float> offset;
+};
+
+// Returns parameters that map the range [min, max] of `src` (float32) onto the
+// full range of `data_type`, per index of `channel_dim` if it is not -1.
+// Returns an error if `src` is empty or has an infinite value. NaNs are
+// ignored. A constant range gets a scale of 1.
+absl::StatusOr<QuantizationParams> ChooseQuantizationParams(
+    const DynamicArrayRef& src, DataType data_type, int64_t channel_dim = -1);
+
+// Returns a compact array of `params.data_type` with the quantized values of
+// `src` (float32), which may have any strides: round((x - offset) * (1 /
+// scale)) to nearest even, saturated to the range of the data type. NaN
+// quantizes to the lowest value. Contiguous rows are quantized 8 at a time with
+// SIMD.
+//
+// The float32 reciprocal of each scale is computed once, so a value within an
+// ulp of a .5 boundary may round differently than with a true division, unless
+// the scale is a power of two.
+absl::StatusOr<DynamicArray> Quantize(const DynamicArrayRef& src,
+                                      const QuantizationParams& params);
+
+// Writes q * scale + offset for each element q of `src` to `dst`, a float32
+// array with the same extents. Either may have any strides.
+absl::Status Dequantize(const DynamicArrayRef& src,
+                        const QuantizationParams& params, DynamicArrayRef dst);
+
+// Same as above, but returns a newly allocated compact float32 array.
+absl::StatusOr<DynamicArray> Dequantize(const DynamicArrayRef& src,
+                                        const QuantizationParams& params);
+
+// Quantizes `src` with `params` and adds it to `zip` as "<name>.npy". The
+// parameters are stored in the companion entries "<name>_scale.npy" and
+// "<name>_offset.npy": float32 arrays with the rank of `src` whose extents are
+// all 1 except along the channel dimension, so that they broadcast in numpy:
+//
+//   x = npz[name] * npz[name + "_scale"] + npz[name + "_offset"]
+//
+// `options` are used for all three entries.
+absl::Status AddQuantizedArrayToNpz(
+    std::string_view name, const DynamicArrayRef& src,
+    const QuantizationParams& params, ZipWriter* zip,
+    const NpySerializeOptions& options = NpySerializeOptions());
+
+// Reads the array `name` written by AddQuantizedArrayToNpz() from the entries
+// of an NPZ file, e.g., from ReadZipFile(), and returns the dequantized
+// float32 array. The quantized payload is read in place and dequantized as it
+// is copied out, in one pass. If `params` is not null, it is set to the
+// stored parameters.
+absl::StatusOr<DynamicArray> ReadQuantizedArrayFromNpz(
+    const absl::flat_hash_map<std::filesystem::path, std::string>& files,
+    std::string_view name, QuantizationParams* params = nullptr);
+
+}  // namespace npy_array
+
+#endif  // NPY_ARRAY_QUANTIZE_H_
@@ -0,0 +1,243 @@
+#include "npy_array/quantize.h"
+
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <utility>
+
+#include "absl/status/status.h"
+#include "gtest/gtest.h"
+#include "npy_array/data_type.h"
+#include "npy_array/dynamic_array.h"
+#include "npy_array/zip_reader.h"
+#include "npy_array/zip_writer.h"
+
+namespace npy_array {
+namespace {
+
+// Returns a float32 array whose elements ramp from `lo` to `hi` in memory
+// order.
+DynamicArray Ramp(absl::Span<const int64_t> extents, float lo, float hi) {
+  DynamicArray arr(DataType::kFloat32, extents);
+  const int64_t n = arr.NumElements();
+  for (int64_t i = 0; i < n; ++i) {
+    arr.data<float>()[i] = lo + (hi - lo) * i / std::max<int64_t>(n - 1, 1);
+  }
+  return arr;
+}
+
+TEST(QuantizeTest, RoundsToNearestEvenAndSaturates) {
+  // 19 elements exercise the vector loop and the scalar tail.
+  const float values[] = {-3.0f, -0.5f, 0.5f,   1.5f,  2.5f,  254.5f, 255.0f,
+                          255.5f, 300.0f, 1e9f, -1e9f, 7.49f, 7.51f,  0.0f,
+                          std::numeric_limits<float>::quiet_NaN(),
+                          std::numeric_limits<float>::infinity(), 3.5f, 4.5f,
+                          -0.0f};
+  const uint8_t expected[] = {0, 0, 0, 2, 2, 254, 255, 255, 255, 255,
+                              0, 7, 8, 0, 0, 255, 4, 4,   0};
+  DynamicArray src(DataType::kFloat32, {19});
+  for (int64_t i = 0; i < 19; ++i) {
+    src.data<float>()[i] = values[i];
+  }
+  const QuantizationParams params{.data_type = DataType::kUint8,
+                                  .scale = {1.0f},
+                                  .offset = {0.0f}};
+  absl::StatusOr<DynamicArray> q = Quantize(src, params);
+  ASSERT_TRUE(q.ok()) << q.status();
+  ASSERT_EQ(q->data_type(), DataType::kUint8);
+  for (int64_t i = 0; i < 19; ++i) {
+    EXPECT_EQ(q->data<uint8_t>()[i], expected[i]) << "element " << i;
+  }
+}
+
+TEST(QuantizeTest, MultipliesByTheReciprocalScale) {
+  // 2.25f / 0.3f is 7.4999995f, just below the boundary, but 2.25f times the
+  // float32 reciprocal of 0.3f is exactly 7.5f, which rounds to 8. 17
+  // elements exercise the vector loop and the scalar tail.
+  DynamicArray src(DataType::kFloat32, {17});
+  for (int64_t i = 0; i < 17; ++i) {
+    src.data<float>()[i] = 2.25f;
+  }
+  const QuantizationParams params{.data_type = DataType::kUint8,
+                                  .scale = {0.3f},
+                                  .offset = {0.0f}};
+  absl::StatusOr<DynamicArray> q = Quantize(src, params);
+  ASSERT_TRUE(q.ok()) << q.status();
+  for (int64_t i = 0; i < 17; ++i) {
+    EXPECT_EQ(q->data<uint8_t>()[i], 8) << "element " << i;
+  }
+}
+
+TEST(QuantizeTest, SixteenBitTypes) {
+  const DynamicArray src = Ramp({37}, -40000.0f, 70000.0f);
+  for (const DataType data_type : {DataType::kUint16, DataType::kInt16}) {
+    const QuantizationParams params{
+        .data_type = data_type, .scale = {1.0f}, .offset = {0.0f}};
+    absl::StatusOr<DynamicArray> q = Quantize(src, params);
+    ASSERT_TRUE(q.ok());
+    for (int64_t i = 0; i < 37; ++i) {
+      const float x = src.data<float>()[i];
+      if (data_type == DataType::kUint16) {
+        EXPECT_EQ(q->data<uint16_t>()[i],
+                  std::clamp(std::nearbyint(x), 0.0f, 65535.0f))
+            << i;
+      } else {
+        EXPECT_EQ(q->data<int16_t>()[i],
+                  std::clamp(std::nearbyint(x), -32768.0f, 32767.0f))
+            << i;
+      }
+    }
+  }
+}
+
+TEST(QuantizeTest, ChooseParamsRoundTrip) {
+  const DynamicArray src = Ramp({100, 3}, -2.0f, 6.0f);
+  for (const DataType data_type :
+       {DataType::kUint8, DataType::kUint16, DataType::kInt16}) {
+    absl::StatusOr<QuantizationParams> params =
+        ChooseQuantizationParams(src, data_type);
+    ASSERT_TRUE(params.ok()) << params.status();
+    absl::StatusOr<DynamicArray> q = Quantize(src, *params);
+    ASSERT_TRUE(q.ok());
+    absl::StatusOr<DynamicArray> x = Dequantize(*q, *params);
+    ASSERT_TRUE(x.ok());
+    // Half a step, plus float rounding.
+    const float tolerance = 0.5f * params->scale[0] + 1e-5f;
+    for (int64_t i = 0; i < src.NumElements(); ++i) {
+      ASSERT_NEAR(x->data<float>()[i], src.data<float>()[i], tolerance)
+          << static_cast<int>(data_type) << " " << i;
+    }
+    // The ends of the range are exact codes.
+    EXPECT_NEAR(x->data<float>()[0], -2.0f, 1e-5f);
+    EXPECT_NEAR(x->data<float>()[299], 6.0f, 1e-5f);
+  }
+}
+
+TEST(QuantizeTest, PerChannel) {
+  // An interleaved image (c, x, y) with very different channel ranges, and
+  // its planar view (x, y, c).
+  DynamicArray image(DataType::kFloat32, {3, 20, 4});
+  for (int64_t y = 0; y < 4; ++y) {
+    for (int64_t x = 0; x < 20; ++x) {
+      image.Set<float>({0, x, y}, 0.01f * x);
+      image.Set<float>({1, x, y}, 100.0f * y);
+      image.Set<float>({2, x, y}, -5.0f + x + y);
+    }
+  }
+  const DynamicArrayRef planar = image.ref().Permute({1, 2, 0});
+  for (const auto& [view, channel_dim] :
+       {std::pair{image.ref(), int64_t{0}}, std::pair{planar, int64_t{2}}}) {
+    absl::StatusOr<QuantizationParams> params =
+        ChooseQuantizationParams(view, DataType::kUint8, channel_dim);
+    ASSERT_TRUE(params.ok()) << params.status();
+    ASSERT_EQ(params->scale.size(), 3);
+    EXPECT_NEAR(params->scale[1], 300.0f / 255, 1e-6f);
+    EXPECT_NEAR(params->offset[2], -5.0f, 1e-6f);
+
+    absl::StatusOr<DynamicArray> q = Quantize(view, *params);
+    ASSERT_TRUE(q.ok());
+    absl::StatusOr<DynamicArray> x = Dequantize(*q, *params);
+    ASSERT_TRUE(x.ok());
+    for (int64_t i = 0; i < x->NumElements(); ++i) {
+      const int64_t c = channel_dim == 0 ? i % 3 : i / 80;
+      const float expected = channel_dim == 0
+                                 ? image.data<float>()[i]
+                                 : planar.ElementPtr<float>(
+                                       {i % 20, i / 20 % 4, c})[0];
+      ASSERT_NEAR(x->data<float>()[i], expected,
+                  0.5f * params->scale[c] + 1e-5f)
+          << "channel_dim " << channel_dim << ", element " << i;
+    }
+  }
+}
+
+TEST(QuantizeTest, DequantizeIntoStridedView) {
+  const DynamicArray src = Ramp({6, 5}, 0.0f, 29.0f);
+  const QuantizationParams params{
+      .data_type = DataType::kInt16, .scale = {0.5f}, .offset = {1.0f}};
+  absl::StatusOr<DynamicArray> q = Quantize(src, params);
+  ASSERT_TRUE(q.ok());
+  DynamicArray dst(DataType::kFloat32, {5, 6});
+  ASSERT_TRUE(Dequantize(*q, params, dst.ref().Permute({1, 0})).ok());
+  for (int64_t y = 0; y < 5; ++y) {
+    for (int64_t x = 0; x < 6; ++x) {
+      EXPECT_EQ(dst.At<float>({y, x}), src.At<float>({x, y}));
+    }
+  }
+}
+
+TEST(QuantizeTest, Npz) {
+  const DynamicArray src = Ramp({3, 8, 2}, -1.0f, 1.0f);
+  absl::StatusOr<QuantizationParams> params =
+      ChooseQuantizationParams(src, DataType::kUint16, 0);
+  ASSERT_TRUE(params.ok());
+
+  ZipWriter zip;
+  ASSERT_TRUE(AddQuantizedArrayToNpz("depth", src, *params, &zip).ok());
+  absl::StatusOr<std::string> npz = std::move(zip).Close();
+  ASSERT_TRUE(npz.ok()) << npz.status();
+  auto files = ReadZipFile(*npz);
+  ASSERT_TRUE(files.ok()) << files.status();
+  EXPECT_TRUE(files->contains("depth.npy"));
+  EXPECT_NE(files->at("depth_scale.npy").find("'shape': (1,1,3,)"),
+            std::string::npos);
+
+  QuantizationParams read_params;
+  absl::StatusOr<DynamicArray> read =
+      ReadQuantizedArrayFromNpz(*files, "depth", &read_params);
+  ASSERT_TRUE(read.ok()) << read.status();
+  EXPECT_EQ(read_params.data_type, DataType::kUint16);
+  EXPECT_EQ(read_params.channel_dim, 0);
+  EXPECT_EQ(read_params.scale, params->scale);
+  EXPECT_EQ(read_params.offset, params->offset);
+  ASSERT_EQ(read->data_type(), DataType::kFloat32);
+  for (int64_t i = 0; i < src.NumElements(); ++i) {
+    EXPECT_NEAR(read->data<float>()[i], src.data<float>()[i], 1e-4f);
+  }
+  EXPECT_EQ(ReadQuantizedArrayFromNpz(*files, "other").status().code(),
+            absl::StatusCode::kNotFound);
+}
+
+TEST(QuantizeTest, Errors) {
+  const DynamicArray src = Ramp({4, 2}, 0.0f, 1.0f);
+  EXPECT_EQ(ChooseQuantizationParams(src, DataType::kInt32).status().code(),
+            absl::StatusCode::kInvalidArgument);
+  EXPECT_EQ(ChooseQuantizationParams(src, DataType::kUint8, 2).status().code(),
+            absl::StatusCode::kInvalidArgument);
+  DynamicArray ints(DataType::kInt32, {4});
+  EXPECT_EQ(ChooseQuantizationParams(ints, DataType::kUint8).status().code(),
+            absl::StatusCode::kInvalidArgument);
+  DynamicArray with_inf = Ramp({4}, 0.0f, 1.0f);
+  with_inf.data<float>()[2] = std::numeric_limits<float>::infinity();
+  EXPECT_EQ(
+      ChooseQuantizationParams(with_inf, DataType::kUint8).status().code(),
+      absl::StatusCode::kInvalidArgument);
+
+  // Wrong number of channels, and a zero scale.
+  EXPECT_EQ(Quantize(src, {.data_type = DataType::kUint8,
+                           .channel_dim = 1,
+                           .scale = {1.0f},
+                           .offset = {0.0f}})
+                .status()
+                .code(),
+            absl::StatusCode::kInvalidArgument);
+  EXPECT_EQ(Quantize(src, {.data_type = DataType::kUint8,
+                           .scale = {0.0f},
+                           .offset = {0.0f}})
+                .status()
+                .code(),
+            absl::StatusCode::kInvalidArgument);
+
+  // Dequantizing the wrong data type.
+  DynamicArray floats = Ramp({4}, 0.0f, 1.0f);
+  EXPECT_EQ(Dequantize(floats, {.data_type = DataType::kUint8,
+                             .scale = {1.0f},
+                             .offset = {0.0f}})
+                .status()
+                .code(),
+            absl::StatusCode::kInvalidArgument);
+}
+
+}  // namespace
+}  // namespace npy_array
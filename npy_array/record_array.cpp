@@ -0,0 +1,478 @@
+#include "npy_array/record_array.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "absl/container/flat_hash_set.h"
+#include "absl/container/inlined_vector.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+#include "absl/types/span.h"
+#include "npy_array/thread_pool.h"
+
+namespace npy_array {
+
+namespace {
+
+using Dims = absl::InlinedVector<nda::dim<>, DynamicShape::kInlineRank>;
+
+// Records per block of EncodeRecordsToNpy() are chosen so that a block of the
+// output stays in the L2 cache while it is gathered from every column.
+constexpr int64_t kBlockBytes = 64 << 10;
+
+// Returns the dims of `field` of every record, with strides in bytes: the
+// subarray dims followed by the record dims.
+Dims FieldByteDims(const RecordField& field, int64_t record_size,
+                   absl::Span<const int64_t> extents) {
+  Dims dims;
+  int64_t stride = ElementSize(field.data_type);
+  for (const int64_t extent : field.extents) {
+    dims.push_back(nda::dim<>(0, extent, stride));
+    stride *= extent;
+  }
+  stride = record_size;
+  for (const int64_t extent : extents) {
+    dims.push_back(nda::dim<>(0, extent, stride));
+    stride *= extent;
+  }
+  return dims;
+}
+
+// Returns the compact dims of `extents` with strides in bytes.
+Dims CompactByteDims(absl::Span<const int64_t> extents, int64_t element_size) {
+  Dims dims;
+  int64_t stride = element_size;
+  for (const int64_t extent : extents) {
+    dims.push_back(nda::dim<>(0, extent, stride));
+    stride *= extent;
+  }
+  return dims;
+}
+
+// Copies `element_size`-byte elements from `src` to `dst`, whose dims have
+// strides in bytes. If every stride is a multiple of `element_size`, this is
+// a StridedCopy() of whole elements; otherwise each element is copied as an
+// innermost dimension of bytes.
+void CopyWithByteStrides(const uint8_t* src,
+                         absl::Span<const nda::dim<>> src_dims, uint8_t* dst,
+                         absl::Span<const nda::dim<>> dst_dims,
+                         int64_t element_size,
+                         const StridedCopyOptions& options) {
+  const auto in_elements = [&](absl::Span<const nda::dim<>> dims, Dims* out) {
+    for (const nda::dim<>& dim : dims) {
+      if (dim.stride() % element_size != 0) {
+        return false;
+      }
+      out->push_back(nda::dim<>(0, dim.extent(), dim.stride() / element_size));
+    }
+    return true;
+  };
+  Dims src_elements;
+  Dims dst_elements;
+  if (in_elements(src_dims, &src_elements) &&
+      in_elements(dst_dims, &dst_elements)) {
+    StridedCopy(src, src_elements, dst, dst_elements, element_size, options);
+    return;
+  }
+  Dims src_bytes = {nda::dim<>(0, element_size, 1)};
+  src_bytes.insert(src_bytes.end(), src_dims.begin(), src_dims.end());
+  Dims dst_bytes = {nda::dim<>(0, element_size, 1)};
+  dst_bytes.insert(dst_bytes.end(), dst_dims.begin(), dst_dims.end());
+  StridedCopy(src, src_bytes, dst, dst_bytes, /*element_size=*/1, options);
+}
+
+// Returns an error if `fields` can't describe records of `record_size` bytes.
+// Sorts `fields` by offset.
+absl::Status CheckFields(int64_t record_size,
+                         std::vector<RecordField>* fields_ptr) {
+  std::vector<RecordField>& fields = *fields_ptr;
+  if (fields.empty()) {
+    return absl::InvalidArgumentError("RecordArray: no fields.");
+  }
+  absl::flat_hash_set<std::string_view> names;
+  for (const RecordField& field : fields) {
+    if (field.name.empty() ||
+        field.name.find_first_of("'\"") != std::string::npos) {
+      return absl::InvalidArgumentError(absl::StrCat(
+          "RecordArray: invalid field name \"", field.name, "\"."));
+    }
+    if (!names.insert(field.name).second) {
+      return absl::InvalidArgumentError(
+          absl::StrCat("RecordArray: duplicate field ", field.name, "."));
+    }
+    if (field.data_type == DataType::kUndefined) {
+      return absl::InvalidArgumentError(absl::StrCat(
+          "RecordArray: field ", field.name, " has an undefined data type."));
+    }
+    for (const int64_t extent : field.extents) {
+      if (extent < 0) {
+        return absl::InvalidArgumentError(absl::StrCat(
+            "RecordArray: field ", field.name, " has a negative extent."));
+      }
+    }
+    if (field.offset < 0 || field.offset + field.SizeBytes() > record_size) {
+      return absl::InvalidArgumentError(
+          absl::StrCat("RecordArray: field ", field.name,
+                       " does not fit in a record of ", record_size,
+                       " bytes."));
+    }
+  }
+  std::stable_sort(fields.begin(), fields.end(),
+                   [](const RecordField& a, const RecordField& b) {
+                     return a.offset < b.offset;
+                   });
+  for (size_t i = 1; i < fields.size(); ++i) {
+    if (fields[i - 1].offset + fields[i - 1].SizeBytes() > fields[i].offset) {
+      return absl::InvalidArgumentError(
+          absl::StrCat("RecordArray: fields ", fields[i - 1].name, " and ",
+                       fields[i].name, " overlap."));
+    }
+  }
+  return absl::OkStatus();
+}
+
+int64_t Product(absl::Span<const int64_t> extents) {
+  int64_t product = 1;
+  for (const int64_t extent : extents) {
+    product *= extent;
+  }
+  return product;
+}
+
+// Returns an error if a field of `fields` can't be written to an NPY structured
+// data type. bfloat16 would be written as 'V2', which numpy (and
+// DecodeRecordArrayFromNpy()) reads back as raw bytes.
+absl::Status CheckNpyFields(const char* function,
+                            absl::Span<const RecordField> fields) {
+  for (const RecordField& field : fields) {
+    if (field.data_type == DataType::kBfloat16) {
+      return absl::InvalidArgumentError(
+          absl::StrCat(function, ": field ", field.name,
+                       " is bfloat16, which NPY records can't describe."));
+    }
+  }
+  return absl::OkStatus();
+}
+
+// Returns the NPY header of records of `record_size` bytes with `fields` and
+// `extents`.
+std::string RecordHeader(absl::Span<const RecordField> fields,
+                         int64_t record_size,
+                         absl::Span<const int64_t> extents,
+                         bool reverse_axes) {
+  std::vector<internal::NpyField> npy_fields;
+  for (const RecordField& field : fields) {
+    npy_fields.push_back(
+        {.name = field.name,
+         .type_char = NpyTypeChar(field.data_type),
+         .word_size = ElementSize(field.data_type),
+         .offset = static_cast<size_t>(field.offset),
+         .shape = std::vector<size_t>(field.extents.rbegin(),
+                                      field.extents.rend())});
+  }
+  return internal::NpyStructuredHeaderString(
+      npy_fields, record_size, std::vector<size_t>(extents.begin(),
+                                                   extents.end()),
+      reverse_axes);
+}
+
+}  // namespace
+
+int64_t RecordField::SizeBytes() const {
+  return ElementSize(data_type) * Product(extents);
+}
+
+int64_t LayOutRecordFields(absl::Span<RecordField> fields,
+                           RecordLayout layout) {
+  int64_t offset = 0;
+  int64_t max_alignment = 1;
+  for (RecordField& field : fields) {
+    // An undefined data type has no alignment (nor size).
+    const int64_t alignment =
+        layout == RecordLayout::kAligned
+            ? std::max<int64_t>(ElementAlignment(field.data_type), 1)
+            : 1;
+    offset = (offset + alignment - 1) / alignment * alignment;
+    field.offset = offset;
+    offset += field.SizeBytes();
+    max_alignment = std::max(max_alignment, alignment);
+  }
+  return (offset + max_alignment - 1) / max_alignment * max_alignment;
+}
+
+absl::StatusOr<RecordArray> RecordArray::Create(
+    std::vector<RecordField> fields, int64_t record_size,
+    absl::Span<const int64_t> extents, const AllocationOptions& options) {
+  const absl::Status status = CheckFields(record_size, &fields);
+  if (!status.ok()) {
+    return status;
+  }
+  for (const int64_t extent : extents) {
+    if (extent < 0) {
+      return absl::InvalidArgumentError("RecordArray: negative extent.");
+    }
+  }
+  RecordArray result;
+  result.fields_ = std::move(fields);
+  result.record_size_ = record_size;
+  result.extents_.assign(extents.begin(), extents.end());
+  result.buffer_ = AlignedBuffer(Product(extents) * record_size, options);
+  return result;
+}
+
+const RecordField* RecordArray::FindField(std::string_view name) const {
+  for (const RecordField& field : fields_) {
+    if (field.name == name) {
+      return &field;
+    }
+  }
+  return nullptr;
+}
+
+int64_t RecordArray::NumRecords() const { return Product(extents_); }
+
+absl::StatusOr<DynamicArrayRef> RecordArray::Field(std::string_view name) {
+  const RecordField* field = FindField(name);
+  if (field == nullptr) {
+    return absl::NotFoundError(
+        absl::StrCat("RecordArray::Field: no field ", name, "."));
+  }
+  const int64_t element_size = ElementSize(field->data_type);
+  if (field->offset % static_cast<int64_t>(
+                          ElementAlignment(field->data_type)) != 0 ||
+      record_size_ % element_size != 0) {
+    return absl::FailedPreconditionError(absl::StrCat(
+        "RecordArray::Field: field ", name, " at offset ", field->offset,
+        " of records of ", record_size_,
+        " bytes is not aligned; use CopyField()."));
+  }
+  const Dims dims = FieldByteDims(*field, record_size_, extents_);
+  std::vector<int64_t> mins(dims.size(), 0);
+  std::vector<int64_t> field_extents;
+  std::vector<int64_t> strides;
+  for (const nda::dim<>& dim : dims) {
+    field_extents.push_back(dim.extent());
+    strides.push_back(dim.stride() / element_size);
+  }
+  return DynamicArrayRef(data() + field->offset, field->data_type,
+                         DynamicShape(mins, field_extents, strides));
+}
+
+absl::StatusOr<DynamicArray> RecordArray::CopyField(
+    std::string_view name, const StridedCopyOptions& options) const {
+  const RecordField* field = FindField(name);
+  if (field == nullptr) {
+    return absl::NotFoundError(
+        absl::StrCat("RecordArray::CopyField: no field ", name, "."));
+  }
+  std::vector<int64_t> field_extents = field->extents;
+  field_extents.insert(field_extents.end(), extents_.begin(), extents_.end());
+  // Every byte is overwritten below, so skip zero-filling.
+  DynamicArray result(field->data_type, field_extents, {.initialize = false});
+  if (result.empty()) {
+    return result;
+  }
+  const int64_t element_size = ElementSize(field->data_type);
+  CopyWithByteStrides(data() + field->offset,
+                      FieldByteDims(*field, record_size_, extents_),
+                      result.data(),
+                      CompactByteDims(field_extents, element_size),
+                      element_size, options);
+  return result;
+}
+
+absl::StatusOr<std::string> EncodeRecordArrayToNpy(
+    const RecordArray& src, const NpySerializeOptions& options) {
+  if (src.fields().empty()) {
+    return absl::InvalidArgumentError("EncodeRecordArrayToNpy: no fields.");
+  }
+  const absl::Status status =
+      CheckNpyFields("EncodeRecordArrayToNpy", src.fields());
+  if (!status.ok()) {
+    return status;
+  }
+  std::string npy = RecordHeader(src.fields(), src.record_size(),
+                                 src.extents(), options.reverse_axes);
+  const size_t header_size = npy.size();
+  npy.resize(header_size + src.SizeBytes());
+  CopyBytes(src.data(), npy.data() + header_size, src.SizeBytes(),
+            options.copy_options);
+  return npy;
+}
+
+absl::StatusOr<RecordArray> DecodeRecordArrayFromNpy(
+    std::string_view npy_data, const StridedCopyOptions& copy_options) {
+  const internal::NpyHeader header = internal::ReadHeader(npy_data);
+  if (!header.valid) {
+    return absl::InvalidArgumentError("Invalid npy header");
+  }
+  if (header.fields.empty()) {
+    return absl::InvalidArgumentError(
+        "DecodeRecordArrayFromNpy: the npy data type is not structured.");
+  }
+
+  const size_t expected_data_size =
+      header.total_element_count * header.word_size;
+  if (header.data_start_offset + expected_data_size > npy_data.size()) {
+    return absl::InvalidArgumentError(absl::StrCat(
+        "Invalid npy data size: expected at least ", expected_data_size,
+        " bytes, got ", (npy_data.size() - header.data_start_offset),
+        " bytes"));
+  }
+
+  std::vector<RecordField> fields;
+  for (const internal::NpyField& npy_field : header.fields) {
+    RecordField& field = fields.emplace_back();
+    field.name = npy_field.name;
+    field.data_type = DataTypeFromNpy(npy_field.type_char, npy_field.word_size);
+    // 'V2' is bfloat16 only as the data type of a whole array.
+    if (field.data_type == DataType::kUndefined ||
+        field.data_type == DataType::kBfloat16) {
+      return absl::InvalidArgumentError(
+          absl::StrCat("DecodeRecordArrayFromNpy: field ", field.name,
+                       " has an unsupported data type ",
+                       std::string_view(&npy_field.type_char, 1),
+                       npy_field.word_size, "."));
+    }
+    field.extents.assign(npy_field.shape.rbegin(), npy_field.shape.rend());
+    field.offset = npy_field.offset;
+  }
+
+  std::vector<int64_t> extents(header.shape.begin(), header.shape.end());
+  if (!header.fortran_order) {
+    std::reverse(extents.begin(), extents.end());
+  }
+
+  // Every byte is overwritten below, so skip zero-filling.
+  absl::StatusOr<RecordArray> records =
+      RecordArray::Create(std::move(fields), header.word_size, extents,
+                          {.initialize = false});
+  if (!records.ok()) {
+    return records.status();
+  }
+  CopyBytes(npy_data.data() + header.data_start_offset, records->data(),
+            records->SizeBytes(), copy_options);
+  return records;
+}
+
+absl::StatusOr<std::string> EncodeRecordsToNpy(
+    absl::Span<const RecordColumn> columns, RecordLayout layout,
+    const NpySerializeOptions& options) {
+  if (columns.empty()) {
+    return absl::InvalidArgumentError("EncodeRecordsToNpy: no columns.");
+  }
+
+  // The record extents are those of the first column after its subarray
+  // dimensions.
+  std::vector<int64_t> extents;
+  std::vector<RecordField> fields;
+  for (const RecordColumn& column : columns) {
+    const DynamicArrayRef& array = column.array;
+    if (column.subarray_rank < 0 || column.subarray_rank > array.rank()) {
+      return absl::InvalidArgumentError(
+          absl::StrCat("EncodeRecordsToNpy: column ", column.name,
+                       " has subarray rank ", column.subarray_rank,
+                       " but rank ", array.rank(), "."));
+    }
+    if (array.data_type() == DataType::kUndefined) {
+      return absl::InvalidArgumentError(
+          absl::StrCat("EncodeRecordsToNpy: column ", column.name,
+                       " has an undefined data type."));
+    }
+    RecordField& field = fields.emplace_back();
+    field.name = column.name;
+    field.data_type = array.data_type();
+    std::vector<int64_t> record_extents;
+    for (int64_t d = 0; d < array.rank(); ++d) {
+      (d < column.subarray_rank ? field.extents : record_extents)
+          .push_back(array.shape().extent(d));
+    }
+    if (&column == &columns.front()) {
+      extents = std::move(record_extents);
+    } else if (record_extents != extents) {
+      return absl::InvalidArgumentError(
+          absl::StrCat("EncodeRecordsToNpy: the record extents of column ",
+                       column.name, " don't match those of column ",
+                       columns.front().name, "."));
+    }
+  }
+  const int64_t record_size =
+      LayOutRecordFields(absl::MakeSpan(fields), layout);
+  // CheckFields() sorts by offset, which keeps `fields` parallel to `columns`
+  // since the offsets are increasing.
+  absl::Status status = CheckFields(record_size, &fields);
+  if (status.ok()) {
+    status = CheckNpyFields("EncodeRecordsToNpy", fields);
+  }
+  if (!status.ok()) {
+    return status;
+  }
+
+  std::string npy =
+      RecordHeader(fields, record_size, extents, options.reverse_axes);
+  const size_t header_size = npy.size();
+  const int64_t num_records = Product(extents);
+  npy.resize(header_size + num_records * record_size);
+  if (num_records == 0) {
+    return npy;
+  }
+  uint8_t* records = reinterpret_cast<uint8_t*>(npy.data() + header_size);
+
+  // Blocks are ranges of the outermost record dimension.
+  const int64_t outer = static_cast<int64_t>(extents.size()) - 1;
+  const int64_t num_slices = outer >= 0 ? extents[outer] : 1;
+  const int64_t slice_bytes = num_records / num_slices * record_size;
+  const int64_t slices_per_block =
+      std::max<int64_t>(kBlockBytes / slice_bytes, 1);
+  const int64_t num_blocks =
+      (num_slices + slices_per_block - 1) / slices_per_block;
+
+  StridedCopyOptions block_options = options.copy_options;
+  block_options.threading.max_threads = 1;
+  const auto copy_block = [&](int64_t block) {
+    const int64_t begin = block * slices_per_block;
+    const int64_t end = std::min(begin + slices_per_block, num_slices);
+    std::vector<int64_t> block_extents = extents;
+    if (outer >= 0) {
+      block_extents[outer] = end - begin;
+    }
+    uint8_t* block_records = records + begin * slice_bytes;
+    for (size_t i = 0; i < columns.size(); ++i) {
+      const DynamicArrayRef& array = columns[i].array;
+      const int64_t element_size = array.ElementSizeBytes();
+      Dims src_dims;
+      for (int64_t d = 0; d < array.rank(); ++d) {
+        src_dims.push_back(nda::dim<>(0, array.shape().extent(d),
+                                      array.shape().stride(d) * element_size));
+      }
+      const uint8_t* src = array.data();
+      if (outer >= 0) {
+        src += begin * src_dims.back().stride();
+        src_dims.back().set_extent(end - begin);
+      }
+      CopyWithByteStrides(src, src_dims, block_records + fields[i].offset,
+                          FieldByteDims(fields[i], record_size, block_extents),
+                          element_size, block_options);
+    }
+  };
+
+  const ThreadingOptions& threading = options.copy_options.threading;
+  const int num_threads = internal::ResolveThreads(
+      threading, num_records * record_size, num_blocks);
+  if (num_threads == 1) {
+    for (int64_t block = 0; block < num_blocks; ++block) {
+      copy_block(block);
+    }
+  } else {
+    internal::ResolveThreadPool(threading)
+        .ParallelFor(num_blocks, num_threads, copy_block);
+  }
+  return npy;
+}
+
+}  // namespace npy_array
@@ -0,0 +1,165 @@
+#ifndef NPY_ARRAY_RECORD_ARRAY_H_
+#define NPY_ARRAY_RECORD_ARRAY_H_
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "absl/container/inlined_vector.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/types/span.h"
+#include "npy_array/aligned_buffer.h"
+#include "npy_array/data_type.h"
+#include "npy_array/dynamic_array.h"
+#include "npy_array/npy_array.h"
+#include "npy_array/strided_copy.h"
+
+namespace npy_array {
+
+// A field of the records of a RecordArray, like a field of a numpy structured
+// data type.
+struct RecordField {
+  std::string name;
+  DataType data_type = DataType::kUndefined;
+
+  // The extents of a subarray field, with dimension 0 innermost, e.g., {3} for
+  // an xyz position. Empty for a scalar field.
+  std::vector<int64_t> extents;
+
+  // The offset of the field in each record, in bytes.
+  int64_t offset = 0;
+
+  // The size of the field in bytes.
+  int64_t SizeBytes() const;
+};
+
+// How LayOutRecordFields() places fields.
+enum class RecordLayout {
+  // Each field is aligned to the alignment of its data type, and the record
+  // size is padded to a multiple of the largest alignment, as in a C struct or
+  // numpy's align=True. Every field can then be viewed with
+  // RecordArray::Field().
+  kAligned,
+  // Fields are packed without padding, as in numpy's default.
+  kPacked,
+};
+
+// Sets the offsets of `fields` so that they are laid out in order. Returns the
+// record size in bytes.
+int64_t LayOutRecordFields(absl::Span<RecordField> fields,
+                           RecordLayout layout = RecordLayout::kAligned);
+
+// An array of records (a numpy "structured array"): every field of an element
+// is stored together, in one buffer. E.g., a point cloud with the fields x, y,
+// z, intensity and ring.
+//
+// As in DynamicArray, dimension 0 of the record extents is innermost.
+class RecordArray {
+ public:
+  // An empty array of rank 1 with no fields.
+  RecordArray() : extents_({0}) {}
+
+  // Returns a zero-filled array of records of `record_size` bytes with the
+  // given fields. Returns an error if a field is unnamed or named twice, has
+  // an undefined data type, or does not fit in the record, or if fields
+  // overlap.
+  static absl::StatusOr<RecordArray> Create(
+      std::vector<RecordField> fields, int64_t record_size,
+      absl::Span<const int64_t> extents,
+      const AllocationOptions& options = AllocationOptions());
+
+  RecordArray(const RecordArray&) = default;
+  RecordArray& operator=(const RecordArray&) = default;
+  RecordArray(RecordArray&&) = default;
+  RecordArray& operator=(RecordArray&&) = default;
+
+  absl::Span<const RecordField> fields() const { return fields_; }
+
+  // Returns the field named `name`, or nullptr if there is none.
+  const RecordField* FindField(std::string_view name) const;
+
+  int64_t record_size() const { return record_size_; }
+  absl::Span<const int64_t> extents() const { return extents_; }
+  int64_t rank() const { return extents_.size(); }
+  int64_t NumRecords() const;
+  bool empty() const { return NumRecords() == 0; }
+
+  // The size of data(): NumRecords() * record_size().
+  int64_t SizeBytes() const { return buffer_.size(); }
+
+  // The records, compact, in order.
+  const uint8_t* data() const { return buffer_.data(); }
+  uint8_t* data() { return buffer_.data(); }
+
+  // Returns a view of field `name` of every record, without copying. Its
+  // extents are the field's subarray extents, if any, followed by the record
+  // extents, and it steps over whole records. Pass it to ArrayRefOf() for an
+  // nda::array_ref.
+  //
+  // Returns NotFound if there is no such field, and FailedPrecondition if the
+  // field can't be addressed with strides in elements: its offset must be a
+  // multiple of the alignment of its data type, and the record size a
+  // multiple of its element size. Fields laid out with RecordLayout::kAligned
+  // always can; use CopyField() otherwise.
+  absl::StatusOr<DynamicArrayRef> Field(std::string_view name);
+
+  // Returns a compact copy of field `name`, with the extents described in
+  // Field(). Works for any layout.
+  absl::StatusOr<DynamicArray> CopyField(
+      std::string_view name,
+      const StridedCopyOptions& options = StridedCopyOptions()) const;
+
+ private:
+  std::vector<RecordField> fields_;
+  int64_t record_size_ = 0;
+  absl::InlinedVector<int64_t, DynamicShape::kInlineRank> extents_;
+  AlignedBuffer buffer_;
+};
+
+// Encodes `src` in the NPY format with a structured descr, e.g.,
+// [('x', '<f4'), ('y', '<f4')], which numpy loads as a structured array. As in
+// EncodeDynamicArrayToNpy(), the record axes are reversed unless
+// `options.reverse_axes` is false. Subarray extents are always reversed, since
+// numpy subarrays are C-contiguous. Returns an error for bfloat16 fields, which
+// a structured descr can only describe as raw bytes ('V2').
+absl::StatusOr<std::string> EncodeRecordArrayToNpy(
+    const RecordArray& src,
+    const NpySerializeOptions& options = NpySerializeOptions());
+
+// Decodes NPY data with a structured descr, e.g., from np.save() of a
+// structured array, into a copy. Scalar and subarray fields are supported;
+// nested structured fields are not. Returns an error if the data type is not
+// structured or a field's data type is unsupported, including 'V2', which is
+// raw bytes rather than bfloat16 in a structured descr.
+absl::StatusOr<RecordArray> DecodeRecordArrayFromNpy(
+    std::string_view npy_data,
+    const StridedCopyOptions& copy_options = StridedCopyOptions());
+
+// A named array for EncodeRecordsToNpy().
+struct RecordColumn {
+  std::string name;
+  DynamicArrayRef array;
+
+  // The number of innermost dimensions of `array` that form a subarray field,
+  // e.g., 1 for xyz positions with extents {3, n}.
+  int64_t subarray_rank = 0;
+};
+
+// Encodes `columns` as one NPY file of records, with a field per column laid
+// out by LayOutRecordFields(). The record extents (those of each array after
+// its subarray dimensions) must match. Columns may have any strides, but not
+// the bfloat16 data type, as in EncodeRecordArrayToNpy().
+//
+// The records are written in one pass: the output is filled in blocks of
+// records small enough to stay in cache, each gathered from every column.
+// `options.copy_options.threading` splits the blocks across threads.
+absl::StatusOr<std::string> EncodeRecordsToNpy(
+    absl::Span<const RecordColumn> columns,
+    RecordLayout layout = RecordLayout::kAligned,
+    const NpySerializeOptions& options = NpySerializeOptions());
+
+}  // namespace npy_array
+
+#endif  // NPY_ARRAY_RECORD_ARRAY_H_
@@ -0,0 +1,386 @@
+#include "npy_array/record_array.h"
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "gtest/gtest.h"
+#include "npy_array/data_type.h"
+#include "npy_array/dynamic_array.h"
+#include "npy_array/npy_array.h"
+#include "npy_array/npy_dynamic_array.h"
+#include "npy_array/thread_pool.h"
+
+namespace npy_array {
+namespace {
+
+// The fields of a lidar point.
+std::vector<RecordField> PointFields() {
+  return {{.name = "x", .data_type = DataType::kFloat32},
+          {.name = "y", .data_type = DataType::kFloat32},
+          {.name = "z", .data_type = DataType::kFloat32},
+          {.name = "intensity", .data_type = DataType::kUint8},
+          {.name = "ring", .data_type = DataType::kUint16}};
+}
+
+// Returns a version 1.0 NPY file with the header dict `dict`, as np.save()
+// writes it, followed by `payload`.
+std::string NumpyNpy(std::string_view dict, std::string_view payload) {
+  std::string header(dict);
+  while ((10 + header.size() + 1) % 64 != 0) {
+    header.push_back(' ');
+  }
+  header.push_back('\n');
+  const char length[2] = {static_cast<char>(header.size() & 0xff),
+                          static_cast<char>(header.size() >> 8)};
+  return absl::StrCat("\x93NUMPY\x01", std::string_view("\0", 1),
+                      std::string_view(length, 2), header, payload);
+}
+
+TEST(RecordArrayTest, LayOutRecordFields) {
+  std::vector<RecordField> fields = PointFields();
+  EXPECT_EQ(LayOutRecordFields(absl::MakeSpan(fields)), 16);
+  EXPECT_EQ(fields[3].offset, 12);
+  EXPECT_EQ(fields[4].offset, 14);
+
+  EXPECT_EQ(LayOutRecordFields(absl::MakeSpan(fields), RecordLayout::kPacked),
+            15);
+  EXPECT_EQ(fields[4].offset, 13);
+
+  // Subarrays are aligned like their elements.
+  std::vector<RecordField> subarrays = {
+      {.name = "flag", .data_type = DataType::kBool},
+      {.name = "xyz", .data_type = DataType::kFloat64, .extents = {3}}};
+  EXPECT_EQ(LayOutRecordFields(absl::MakeSpan(subarrays)), 32);
+  EXPECT_EQ(subarrays[1].offset, 8);
+}
+
+TEST(RecordArrayTest, FieldViews) {
+  std::vector<RecordField> fields = PointFields();
+  const int64_t record_size = LayOutRecordFields(absl::MakeSpan(fields));
+  absl::StatusOr<RecordArray> points =
+      RecordArray::Create(fields, record_size, {5});
+  ASSERT_TRUE(points.ok()) << points.status();
+  EXPECT_EQ(points->NumRecords(), 5);
+  EXPECT_EQ(points->SizeBytes(), 80);
+
+  absl::StatusOr<DynamicArrayRef> y = points->Field("y");
+  ASSERT_TRUE(y.ok()) << y.status();
+  EXPECT_EQ(y->data_type(), DataType::kFloat32);
+  EXPECT_EQ(y->shape().extent(0), 5);
+  EXPECT_EQ(y->shape().stride(0), 4);
+  absl::StatusOr<DynamicArrayRef> ring = points->Field("ring");
+  ASSERT_TRUE(ring.ok());
+  EXPECT_EQ(ring->shape().stride(0), 8);
+
+  // Writes through the views land in the records.
+  auto y_ref = ArrayRefOf<float, 1>(*y);
+  for (int64_t i = 0; i < 5; ++i) {
+    y_ref(i) = 0.5f * i;
+    ring->Set<uint16_t>({i}, static_cast<uint16_t>(100 + i));
+  }
+  float y3;
+  std::memcpy(&y3, points->data() + 3 * 16 + 4, sizeof(y3));
+  EXPECT_EQ(y3, 1.5f);
+  uint16_t ring4;
+  std::memcpy(&ring4, points->data() + 4 * 16 + 14, sizeof(ring4));
+  EXPECT_EQ(ring4, 104);
+
+  absl::StatusOr<DynamicArray> ring_copy = points->CopyField("ring");
+  ASSERT_TRUE(ring_copy.ok());
+  EXPECT_EQ(ring_copy->data<uint16_t>()[2], 102);
+
+  EXPECT_EQ(points->Field("w").status().code(), absl::StatusCode::kNotFound);
+  EXPECT_EQ(points->CopyField("w").status().code(),
+            absl::StatusCode::kNotFound);
+}
+
+TEST(RecordArrayTest, PackedFieldsAreCopied) {
+  std::vector<RecordField> fields = PointFields();
+  const int64_t record_size =
+      LayOutRecordFields(absl::MakeSpan(fields), RecordLayout::kPacked);
+  absl::StatusOr<RecordArray> points =
+      RecordArray::Create(fields, record_size, {3, 2});
+  ASSERT_TRUE(points.ok());
+  for (int64_t i = 0; i < 6; ++i) {
+    const float x = 1.0f + i;
+    std::memcpy(points->data() + i * 15, &x, sizeof(x));
+    points->data()[i * 15 + 12] = static_cast<uint8_t>(i);
+  }
+
+  // Records of 15 bytes can't be stepped over in floats.
+  EXPECT_EQ(points->Field("x").status().code(),
+            absl::StatusCode::kFailedPrecondition);
+  // Single bytes can.
+  absl::StatusOr<DynamicArrayRef> intensity = points->Field("intensity");
+  ASSERT_TRUE(intensity.ok());
+  EXPECT_EQ(intensity->shape().stride(1), 45);
+  EXPECT_EQ(intensity->At<uint8_t>({1, 1}), 4);
+
+  absl::StatusOr<DynamicArray> x = points->CopyField("x");
+  ASSERT_TRUE(x.ok()) << x.status();
+  EXPECT_EQ(x->shape().extent(0), 3);
+  EXPECT_EQ(x->shape().extent(1), 2);
+  for (int64_t i = 0; i < 6; ++i) {
+    EXPECT_EQ(x->data<float>()[i], 1.0f + i);
+  }
+}
+
+TEST(RecordArrayTest, SubarrayField) {
+  std::vector<RecordField> fields = {
+      {.name = "xyz", .data_type = DataType::kFloat32, .extents = {3}},
+      {.name = "t", .data_type = DataType::kFloat64}};
+  const int64_t record_size = LayOutRecordFields(absl::MakeSpan(fields));
+  EXPECT_EQ(record_size, 24);
+  absl::StatusOr<RecordArray> points =
+      RecordArray::Create(fields, record_size, {4});
+  ASSERT_TRUE(points.ok());
+
+  absl::StatusOr<DynamicArrayRef> xyz = points->Field("xyz");
+  ASSERT_TRUE(xyz.ok());
+  ASSERT_EQ(xyz->rank(), 2);
+  EXPECT_EQ(xyz->shape().extent(0), 3);
+  EXPECT_EQ(xyz->shape().stride(0), 1);
+  EXPECT_EQ(xyz->shape().extent(1), 4);
+  EXPECT_EQ(xyz->shape().stride(1), 6);
+  xyz->Set<float>({2, 1}, 7.0f);
+  float z1;
+  std::memcpy(&z1, points->data() + 24 + 8, sizeof(z1));
+  EXPECT_EQ(z1, 7.0f);
+}
+
+TEST(RecordArrayTest, NpyRoundTrip) {
+  std::vector<RecordField> fields = PointFields();
+  fields.push_back(
+      {.name = "rgb", .data_type = DataType::kUint8, .extents = {3}});
+  const int64_t record_size = LayOutRecordFields(absl::MakeSpan(fields));
+  absl::StatusOr<RecordArray> points =
+      RecordArray::Create(fields, record_size, {4, 3});
+  ASSERT_TRUE(points.ok());
+  for (int64_t i = 0; i < points->SizeBytes(); ++i) {
+    points->data()[i] = static_cast<uint8_t>(i * 7);
+  }
+
+  absl::StatusOr<std::string> npy = EncodeRecordArrayToNpy(*points);
+  ASSERT_TRUE(npy.ok()) << npy.status();
+  EXPECT_NE(npy->find("'descr': [('x', '<f4'), ('y', '<f4'), ('z', '<f4'), "
+                      "('intensity', '<u1'), ('', '|V1'), ('ring', '<u2'), "
+                      "('rgb', '<u1', (3,)), ('', '|V1')]"),
+            std::string::npos)
+      << *npy;
+  EXPECT_NE(npy->find("'shape': (3,4,)"), std::string::npos);
+
+  absl::StatusOr<RecordArray> decoded = DecodeRecordArrayFromNpy(*npy);
+  ASSERT_TRUE(decoded.ok()) << decoded.status();
+  EXPECT_EQ(decoded->record_size(), record_size);
+  EXPECT_EQ(decoded->extents(), points->extents());
+  ASSERT_EQ(decoded->fields().size(), fields.size());
+  for (size_t i = 0; i < fields.size(); ++i) {
+    EXPECT_EQ(decoded->fields()[i].name, fields[i].name);
+    EXPECT_EQ(decoded->fields()[i].data_type, fields[i].data_type);
+    EXPECT_EQ(decoded->fields()[i].extents, fields[i].extents);
+    EXPECT_EQ(decoded->fields()[i].offset, fields[i].offset);
+  }
+  EXPECT_EQ(std::memcmp(decoded->data(), points->data(), points->SizeBytes()),
+            0);
+
+  // Plain arrays are not records, and records are not plain arrays.
+  DynamicArray plain(DataType::kFloat32, {4});
+  EXPECT_EQ(DecodeRecordArrayFromNpy(*EncodeDynamicArrayToNpy(plain))
+                .status()
+                .code(),
+            absl::StatusCode::kInvalidArgument);
+  EXPECT_EQ(DecodeDynamicArrayFromNpy(*npy).status().code(),
+            absl::StatusCode::kInvalidArgument);
+  EXPECT_EQ(MakeDynamicArrayRefOfNpy(*npy).status().code(),
+            absl::StatusCode::kInvalidArgument);
+  EXPECT_TRUE((DeserializeFromNpyString<uint8_t, nda::shape_of_rank<2>>(*npy)
+                   .empty()));
+}
+
+TEST(RecordArrayTest, DecodesNumpyHeaders) {
+  // np.save() of np.zeros(2, np.dtype([('x', '<f4'), ('i', 'u1'),
+  // ('p', '<f8')], align=True)), with x = [1, 2].
+  std::string payload(32, '\0');
+  const float x[2] = {1.0f, 2.0f};
+  std::memcpy(payload.data(), &x[0], 4);
+  std::memcpy(payload.data() + 16, &x[1], 4);
+  absl::StatusOr<RecordArray> aligned = DecodeRecordArrayFromNpy(NumpyNpy(
+      "{'descr': [('x', '<f4'), ('i', '|u1'), ('', '|V3'), ('p', '<f8')], "
+      "'fortran_order': False, 'shape': (2,), }",
+      payload));
+  ASSERT_TRUE(aligned.ok()) << aligned.status();
+  EXPECT_EQ(aligned->record_size(), 16);
+  ASSERT_EQ(aligned->fields().size(), 3);
+  EXPECT_EQ(aligned->fields()[2].name, "p");
+  EXPECT_EQ(aligned->fields()[2].offset, 8);
+  absl::StatusOr<DynamicArrayRef> x_view = aligned->Field("x");
+  ASSERT_TRUE(x_view.ok());
+  EXPECT_EQ(x_view->At<float>({1}), 2.0f);
+
+  // Subarrays are C-contiguous in numpy, so their extents are reversed.
+  absl::StatusOr<RecordArray> subarrays = DecodeRecordArrayFromNpy(NumpyNpy(
+      "{'descr': [(\"xyz\", '<f4', (3,)), ('m', '<i2', (2, 4))], "
+      "'fortran_order': False, 'shape': (5, 1), }",
+      std::string(5 * 28, '\0')));
+  ASSERT_TRUE(subarrays.ok()) << subarrays.status();
+  EXPECT_EQ(subarrays->record_size(), 28);
+  EXPECT_EQ(subarrays->extents(), (std::vector<int64_t>{1, 5}));
+  EXPECT_EQ(subarrays->fields()[0].extents, std::vector<int64_t>{3});
+  EXPECT_EQ(subarrays->fields()[1].extents, (std::vector<int64_t>{4, 2}));
+  EXPECT_EQ(subarrays->fields()[1].offset, 12);
+
+  // Nested records and unsupported types are errors.
+  EXPECT_FALSE(DecodeRecordArrayFromNpy(
+                   NumpyNpy("{'descr': [('p', [('x', '<f4')])], "
+                            "'fortran_order': False, 'shape': (1,), }",
+                            std::string(4, '\0')))
+                   .ok());
+  EXPECT_FALSE(DecodeRecordArrayFromNpy(
+                   NumpyNpy("{'descr': [('s', '<U4')], "
+                            "'fortran_order': False, 'shape': (1,), }",
+                            std::string(16, '\0')))
+                   .ok());
+}
+
+TEST(RecordArrayTest, VoidFieldsAreNotBfloat16) {
+  // '|V2' is bfloat16 for a whole array, but two raw bytes in a record.
+  absl::StatusOr<RecordArray> decoded = DecodeRecordArrayFromNpy(
+      NumpyNpy("{'descr': [('x', '<f4'), ('b', '|V2')], "
+               "'fortran_order': False, 'shape': (1,), }",
+               std::string(6, '\0')));
+  EXPECT_EQ(decoded.status().code(), absl::StatusCode::kInvalidArgument);
+
+  // So bfloat16 fields can't be written.
+  DynamicArray b(DataType::kBfloat16, {4});
+  EXPECT_EQ(EncodeRecordsToNpy({{.name = "b", .array = b.ref()}})
+                .status()
+                .code(),
+            absl::StatusCode::kInvalidArgument);
+  absl::StatusOr<RecordArray> records = RecordArray::Create(
+      {{.name = "b", .data_type = DataType::kBfloat16}}, 2, {4});
+  ASSERT_TRUE(records.ok()) << records.status();
+  EXPECT_EQ(EncodeRecordArrayToNpy(*records).status().code(),
+            absl::StatusCode::kInvalidArgument);
+}
+
+TEST(RecordArrayTest, EncodeRecordsToNpy) {
+  constexpr int64_t kNumPoints = 10000;
+  DynamicArray xyz(DataType::kFloat32, {kNumPoints, 3});
+  DynamicArray intensity(DataType::kUint8, {kNumPoints});
+  DynamicArray ring(DataType::kUint16, {kNumPoints});
+  for (int64_t i = 0; i < kNumPoints; ++i) {
+    for (int64_t c = 0; c < 3; ++c) {
+      xyz.Set<float>({i, c}, static_cast<float>(3 * i + c));
+    }
+    intensity.Set<uint8_t>({i}, static_cast<uint8_t>(i));
+    ring.Set<uint16_t>({i}, static_cast<uint16_t>(i % 64));
+  }
+
+  ThreadPool pool(3);
+  for (const int max_threads : {1, 0}) {
+    NpySerializeOptions options;
+    options.copy_options = {.threading = {.max_threads = max_threads,
+                                          .min_bytes_per_thread = 4096,
+                                          .thread_pool = &pool}};
+    // Planar x, y and z are scalar fields; the transposed planes a subarray.
+    const std::vector<RecordColumn> columns = {
+        {.name = "x", .array = xyz.ref().Slice(1, 0)},
+        {.name = "y", .array = xyz.ref().Slice(1, 1)},
+        {.name = "z", .array = xyz.ref().Slice(1, 2)},
+        {.name = "intensity", .array = intensity.ref()},
+        {.name = "ring", .array = ring.ref()},
+        {.name = "xyz",
+         .array = xyz.ref().Permute({1, 0}),
+         .subarray_rank = 1}};
+    absl::StatusOr<std::string> npy =
+        EncodeRecordsToNpy(columns, RecordLayout::kAligned, options);
+    ASSERT_TRUE(npy.ok()) << npy.status();
+
+    absl::StatusOr<RecordArray> points = DecodeRecordArrayFromNpy(*npy);
+    ASSERT_TRUE(points.ok()) << points.status();
+    EXPECT_EQ(points->record_size(), 28);
+    EXPECT_EQ(points->NumRecords(), kNumPoints);
+    absl::StatusOr<DynamicArrayRef> z = points->Field("z");
+    absl::StatusOr<DynamicArrayRef> ring_view = points->Field("ring");
+    absl::StatusOr<DynamicArrayRef> xyz_view = points->Field("xyz");
+    ASSERT_TRUE(z.ok() && ring_view.ok() && xyz_view.ok());
+    for (int64_t i = 0; i < kNumPoints; ++i) {
+      ASSERT_EQ(z->At<float>({i}), 3 * i + 2) << i;
+      ASSERT_EQ(ring_view->At<uint16_t>({i}), i % 64) << i;
+      ASSERT_EQ(xyz_view->At<float>({1, i}), 3 * i + 1) << i;
+    }
+
+    // Packed records match.
+    absl::StatusOr<std::string> packed =
+        EncodeRecordsToNpy(columns, RecordLayout::kPacked, options);
+    ASSERT_TRUE(packed.ok());
+    absl::StatusOr<RecordArray> packed_points =
+        DecodeRecordArrayFromNpy(*packed);
+    ASSERT_TRUE(packed_points.ok());
+    EXPECT_EQ(packed_points->record_size(), 27);
+    absl::StatusOr<DynamicArray> packed_xyz = packed_points->CopyField("xyz");
+    ASSERT_TRUE(packed_xyz.ok());
+    for (int64_t i = 0; i < 3 * kNumPoints; ++i) {
+      ASSERT_EQ(packed_xyz->data<float>()[i], i);
+    }
+  }
+}
+
+TEST(RecordArrayTest, Errors) {
+  const std::vector<int64_t> extents = {4};
+  EXPECT_EQ(RecordArray::Create({}, 4, extents).status().code(),
+            absl::StatusCode::kInvalidArgument);
+  EXPECT_EQ(RecordArray::Create({{.name = "a", .data_type = DataType::kInt32},
+                                 {.name = "a",
+                                  .data_type = DataType::kInt32,
+                                  .offset = 4}},
+                                8, extents)
+                .status()
+                .code(),
+            absl::StatusCode::kInvalidArgument);
+  EXPECT_EQ(RecordArray::Create({{.name = "a", .data_type = DataType::kInt32},
+                                 {.name = "b",
+                                  .data_type = DataType::kInt32,
+                                  .offset = 2}},
+                                8, extents)
+                .status()
+                .code(),
+            absl::StatusCode::kInvalidArgument);
+  EXPECT_EQ(RecordArray::Create({{.name = "a",
+                                  .data_type = DataType::kInt32,
+                                  .offset = 2}},
+                                4, extents)
+                .status()
+                .code(),
+            absl::StatusCode::kInvalidArgument);
+  EXPECT_EQ(
+      RecordArray::Create({{.name = "it's", .data_type = DataType::kInt32}}, 4,
+                          extents)
+          .status()
+          .code(),
+      absl::StatusCode::kInvalidArgument);
+
+  DynamicArray a(DataType::kFloat32, {4});
+  DynamicArray b(DataType::kFloat32, {5});
+  EXPECT_EQ(EncodeRecordsToNpy({{.name = "a", .array = a.ref()},
+                                {.name = "b", .array = b.ref()}})
+                .status()
+                .code(),
+            absl::StatusCode::kInvalidArgument);
+  EXPECT_EQ(EncodeRecordsToNpy({}).status().code(),
+            absl::StatusCode::kInvalidArgument);
+  const DynamicArrayRef undefined(nullptr, DataType::kUndefined,
+                                  DynamicShape({4}));
+  EXPECT_EQ(EncodeRecordsToNpy({{.name = "a", .array = a.ref()},
+                                {.name = "u", .array = undefined}})
+                .status()
+                .code(),
+            absl::StatusCode::kInvalidArgument);
+}
+
+}  // namespace
+}  // namespace npy_array
@@ -0,0 +1,620 @@
+#include "npy_array/reduce.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "absl/container/inlined_vector.h"
+#include "absl/strings/str_cat.h"
+#include "npy_array/aligned_buffer.h"
+#include "npy_array/bfloat16.h"
+#include "npy_array/compile_time_loop.h"
+#include "npy_array/half.h"
+
+namespace npy_array {
+
+namespace {
+
+// Values are loaded and reduced in blocks of this many elements.
+constexpr int64_t kBlockSize = 256;
+
+// The number of independent partial sums in a block, which the compiler maps to
+// SIMD lanes. They are combined pairwise.
+constexpr int kLanes = 8;
+
+constexpr double kNaN = std::numeric_limits<double>::quiet_NaN();
+constexpr double kInf = std::numeric_limits<double>::infinity();
+
+// Loads `n` elements starting at `data` (`stride` is in elements) into `out`.
+using LoadBlockFn = void (*)(const uint8_t* data, int64_t stride, int64_t n,
+                             double* out);
+
+template <typename T>
+void LoadBlock(const uint8_t* data, int64_t stride, int64_t n, double* out) {
+  const T* typed = reinterpret_cast<const T*>(data);
+  if (stride == 1) {
+    for (int64_t i = 0; i < n; ++i) {
+      out[i] = static_cast<double>(typed[i]);
+    }
+  } else {
+    for (int64_t i = 0; i < n; ++i) {
+      out[i] = static_cast<double>(typed[i * stride]);
+    }
+  }
+}
+
+LoadBlockFn GetLoadBlockFn(DataType data_type) {
+  LoadBlockFn load = nullptr;
+  ForTypes<int8_t, int16_t, int32_t, int64_t, uint8_t, uint16_t, uint32_t,
+           uint64_t, half, float, double, bfloat16, bool>([&]<typename T>() {
+    if (data_type == DataTypeFor<T>()) {
+      load = &LoadBlock<T>;
+    }
+  });
+  return load;
+}
+
+double SumBlock(const double* v, int64_t n) {
+  double lanes[kLanes] = {};
+  int64_t i = 0;
+  for (; i + kLanes <= n; i += kLanes) {
+    for (int l = 0; l < kLanes; ++l) {
+      lanes[l] += v[i + l];
+    }
+  }
+  for (; i < n; ++i) {
+    lanes[i % kLanes] += v[i];
+  }
+  for (int width = kLanes / 2; width > 0; width /= 2) {
+    for (int l = 0; l < width; ++l) {
+      lanes[l] += lanes[l + width];
+    }
+  }
+  return lanes[0];
+}
+
+double SumSquaredDeviations(const double* v, int64_t n, double mean) {
+  double lanes[kLanes] = {};
+  int64_t i = 0;
+  for (; i + kLanes <= n; i += kLanes) {
+    for (int l = 0; l < kLanes; ++l) {
+      const double d = v[i + l] - mean;
+      lanes[l] += d * d;
+    }
+  }
+  for (; i < n; ++i) {
+    const double d = v[i] - mean;
+    lanes[i % kLanes] += d * d;
+  }
+  for (int width = kLanes / 2; width > 0; width /= 2) {
+    for (int l = 0; l < width; ++l) {
+      lanes[l] += lanes[l + width];
+    }
+  }
+  return lanes[0];
+}
+
+// Accumulates the statistics of values in blocks. Blocks must be added (and
+// accumulators merged) in index order, so that ties in min and max resolve to
+// the first index.
+class StatsAccumulator {
+ public:
+  // Adds `n` <= kBlockSize values, the first of which has flat index
+  // `first_index`.
+  void AddBlock(const double* v, int64_t n, int64_t first_index) {
+    int64_t nans = 0;
+    for (int64_t i = 0; i < n; ++i) {
+      nans += v[i] != v[i];
+    }
+    if (nans == 0) {
+      AddValues(v, /*positions=*/nullptr, n, first_index);
+      return;
+    }
+
+    nan_count_ += nans;
+    double values[kBlockSize];
+    int32_t positions[kBlockSize];
+    int64_t m = 0;
+    for (int64_t i = 0; i < n; ++i) {
+      if (v[i] == v[i]) {
+        values[m] = v[i];
+        positions[m] = static_cast<int32_t>(i);
+        ++m;
+      }
+    }
+    if (m > 0) {
+      AddValues(values, positions, m, first_index);
+    }
+  }
+
+  // Merges the statistics of values that come after this accumulator's.
+  void Merge(const StatsAccumulator& other) {
+    nan_count_ += other.nan_count_;
+    inf_count_ += other.inf_count_;
+    if (other.count_ == 0) {
+      return;
+    }
+    if (count_ == 0 || other.min_ < min_) {
+      min_ = other.min_;
+      argmin_ = other.argmin_;
+    }
+    if (count_ == 0 || other.max_ > max_) {
+      max_ = other.max_;
+      argmax_ = other.argmax_;
+    }
+    AddToSum(other.sum_);
+    compensation_ += other.compensation_;
+    MergeMoments(other.count_, other.mean_, other.m2_);
+    count_ += other.count_;
+  }
+
+  int64_t count() const { return count_; }
+  int64_t nan_count() const { return nan_count_; }
+  int64_t inf_count() const { return inf_count_; }
+  double min() const { return count_ > 0 ? min_ : kNaN; }  // NOLINT
+  double max() const { return count_ > 0 ? max_ : kNaN; }  // NOLINT
+  int64_t argmin() const { return argmin_; }
+  int64_t argmax() const { return argmax_; }
+  double sum() const {
+    return std::isfinite(sum_) ? sum_ + compensation_ : sum_;
+  }
+  double mean() const { return count_ > 0 ? mean_ : kNaN; }
+  double variance() const { return count_ > 0 ? m2_ / count_ : kNaN; }
+
+ private:
+  // Adds `n` non-NaN values. `positions`, if not null, are their positions in
+  // the block.
+  void AddValues(const double* v, const int32_t* positions, int64_t n,
+                 int64_t first_index) {
+    int64_t infs = 0;
+    for (int64_t i = 0; i < n; ++i) {
+      infs += std::abs(v[i]) == kInf;
+    }
+    inf_count_ += infs;
+
+    int64_t min_i = 0;
+    int64_t max_i = 0;
+    for (int64_t i = 1; i < n; ++i) {
+      if (v[i] < v[min_i]) {
+        min_i = i;
+      }
+      if (v[i] > v[max_i]) {
+        max_i = i;
+      }
+    }
+    if (count_ == 0 || v[min_i] < min_) {
+      min_ = v[min_i];
+      argmin_ = first_index + (positions ? positions[min_i] : min_i);
+    }
+    if (count_ == 0 || v[max_i] > max_) {
+      max_ = v[max_i];
+      argmax_ = first_index + (positions ? positions[max_i] : max_i);
+    }
+
+    const double block_sum = SumBlock(v, n);
+    const double block_mean = block_sum / n;
+    AddToSum(block_sum);
+    MergeMoments(n, block_mean, SumSquaredDeviations(v, n, block_mean));
+    count_ += n;
+  }
+
+  // Kahan-Babuska (Neumaier) summation, which also handles addends larger than
+  // the running sum. Non-finite sums are left uncompensated.
+  void AddToSum(double x) {
+    const double t = sum_ + x;
+    if (std::isfinite(t)) {
+      if (std::abs(sum_) >= std::abs(x)) {
+        compensation_ += (sum_ - t) + x;
+      } else {
+        compensation_ += (x - t) + sum_;
+      }
+    }
+    sum_ = t;
+  }
+
+  // Merges the mean and sum of squared deviations of `n` other values (Chan et
+  // al.). Doesn't update `count_`.
+  void MergeMoments(int64_t n, double mean, double m2) {
+    if (count_ == 0) {
+      mean_ = mean;
+      m2_ = m2;
+      return;
+    }
+    const double total = static_cast<double>(count_ + n);
+    const double delta = mean - mean_;
+    mean_ += delta * n / total;
+    m2_ += m2 + delta * delta * (static_cast<double>(count_) * n / total);
+  }
+
+  int64_t count_ = 0;
+  int64_t nan_count_ = 0;
+  int64_t inf_count_ = 0;
+  double min_ = 0.0;
+  double max_ = 0.0;
+  int64_t argmin_ = -1;
+  int64_t argmax_ = -1;
+  double sum_ = 0.0;
+  double compensation_ = 0.0;
+  double mean_ = 0.0;
+  double m2_ = 0.0;
+};
+
+class HistogramAccumulator {
+ public:
+  HistogramAccumulator(int64_t num_bins, double lo, double hi)
+      : lo_(lo), hi_(hi), scale_(num_bins / (hi - lo)), bins_(num_bins, 0) {}
+
+  void AddBlock(const double* v, int64_t n, int64_t /*first_index*/) {
+    const int64_t last_bin = static_cast<int64_t>(bins_.size()) - 1;
+    for (int64_t i = 0; i < n; ++i) {
+      // Also false for NaN.
+      if (v[i] >= lo_ && v[i] <= hi_) {
+        const int64_t bin = static_cast<int64_t>((v[i] - lo_) * scale_);
+        ++bins_[std::min(bin, last_bin)];
+      }
+    }
+  }
+
+  void Merge(const HistogramAccumulator& other) {
+    for (size_t b = 0; b < bins_.size(); ++b) {
+      bins_[b] += other.bins_[b];
+    }
+  }
+
+  std::vector<int64_t>& bins() { return bins_; }
+
+ private:
+  double lo_;
+  double hi_;
+  double scale_;
+  std::vector<int64_t> bins_;
+};
+
+// One loop over the source. Strides are in elements.
+struct ReduceDim {
+  int64_t extent;
+  int64_t stride;
+};
+
+using ReduceDims = absl::InlinedVector<ReduceDim, 8>;
+
+// Sets `fused` to the loops over `dims` in index order (dimension 0 innermost),
+// after dropping extent-1 dimensions and fusing adjacent dimensions that are
+// contiguous with each other. Unlike a copy, loops are not reordered: the
+// position in the fused loops is the flat index in index order. Returns false
+// if there are no elements.
+bool PlanReduceDims(absl::Span<const nda::dim<>> dims, ReduceDims& fused) {
+  fused.clear();
+  for (const nda::dim<>& dim : dims) {
+    if (dim.extent() <= 0) {
+      return false;
+    }
+    if (dim.extent() == 1) {
+      continue;
+    }
+    if (!fused.empty() &&
+        fused.back().stride * fused.back().extent == dim.stride()) {
+      fused.back().extent *= dim.extent();
+      continue;
+    }
+    fused.push_back({.extent = dim.extent(), .stride = dim.stride()});
+  }
+  if (fused.empty()) {
+    fused.push_back({.extent = 1, .stride = 1});
+  }
+  return true;
+}
+
+// Streams every element of `src` in index order through a copy of `init`, in
+// blocks of up to kBlockSize values loaded by `load`. Large arrays are split
+// into ranges of rows (or of the only row) that are accumulated in parallel
+// and merged in order.
+template <typename Accumulator>
+Accumulator Accumulate(const DynamicArrayRef& src, LoadBlockFn load,
+                       const Accumulator& init, const ReduceOptions& options) {
+  ReduceDims dims;
+  if (!PlanReduceDims(src.shape().dims(), dims)) {
+    return init;
+  }
+
+  const uint8_t* data = src.data();
+  const int64_t element_size = src.ElementSizeBytes();
+  const ReduceDim& inner = dims[0];
+  int64_t num_rows = 1;
+  for (size_t d = 1; d < dims.size(); ++d) {
+    num_rows *= dims[d].extent;
+  }
+
+  // Accumulates `n` elements of the innermost loop starting at `row_data`.
+  auto accumulate_run = [&](const uint8_t* row_data, int64_t n,
+                            int64_t first_index, Accumulator& acc) {
+    double block[kBlockSize];
+    for (int64_t b = 0; b < n; b += kBlockSize) {
+      const int64_t m = std::min(kBlockSize, n - b);
+      load(row_data + b * inner.stride * element_size, inner.stride, m, block);
+      acc.AddBlock(block, m, first_index + b);
+    }
+  };
+
+  // Accumulates rows [begin, end), walking the outer loops like an odometer.
+  auto accumulate_rows = [&](int64_t begin, int64_t end, Accumulator& acc) {
+    const size_t outer_rank = dims.size() - 1;
+    absl::InlinedVector<int64_t, 8> index(outer_rank);
+    int64_t offset = 0;
+    int64_t row = begin;
+    for (size_t d = 0; d < outer_rank; ++d) {
+      index[d] = row % dims[d + 1].extent;
+      row /= dims[d + 1].extent;
+      offset += index[d] * dims[d + 1].stride;
+    }
+
+    for (int64_t r = begin; r < end; ++r) {
+      accumulate_run(data + offset * element_size, inner.extent,
+                     r * inner.extent, acc);
+      for (size_t d = 0; d < outer_rank; ++d) {
+        const ReduceDim& dim = dims[d + 1];
+        offset += dim.stride;
+        if (++index[d] < dim.extent) {
+          break;
+        }
+        offset -= dim.stride * dim.extent;
+        index[d] = 0;
+      }
+    }
+  };
+
+  const int64_t total_bytes = num_rows * inner.extent * element_size;
+  const int64_t num_blocks = (inner.extent + kBlockSize - 1) / kBlockSize;
+  const int num_threads = internal::ResolveThreads(
+      options.threading, total_bytes, num_rows == 1 ? num_blocks : num_rows);
+  if (num_threads == 1) {
+    Accumulator acc = init;
+    accumulate_rows(0, num_rows, acc);
+    return acc;
+  }
+
+  std::vector<Accumulator> partials(num_threads, init);
+  internal::ResolveThreadPool(options.threading).ParallelFor(
+      num_threads, num_threads, [&](int64_t t) {
+        if (num_rows == 1) {
+          // Split the only row at block boundaries.
+          const int64_t begin = num_blocks * t / num_threads * kBlockSize;
+          const int64_t end = std::min(
+              num_blocks * (t + 1) / num_threads * kBlockSize, inner.extent);
+          accumulate_run(data + begin * inner.stride * element_size,
+                         end - begin, begin, partials[t]);
+        } else {
+          accumulate_rows(num_rows * t / num_threads,
+                          num_rows * (t + 1) / num_threads, partials[t]);
+        }
+      });
+
+  Accumulator result = std::move(partials[0]);
+  for (int t = 1; t < num_threads; ++t) {
+    result.Merge(partials[t]);
+  }
+  return result;
+}
+
+// Returns the indices (including mins) of the element at `flat_index` in index
+// order.
+std::vector<int64_t> IndicesOf(const DynamicShape& shape, int64_t flat_index) {
+  std::vector<int64_t> indices(shape.rank());
+  for (int64_t d = 0; d < shape.rank(); ++d) {
+    indices[d] = shape.min(d) + flat_index % shape.extent(d);
+    flat_index /= shape.extent(d);
+  }
+  return indices;
+}
+
+// Returns a compact array of `data_type` with the given mins and extents.
+DynamicArray AllocateUninitialized(DataType data_type,
+                                   absl::Span<const int64_t> mins,
+                                   absl::Span<const int64_t> extents) {
+  const DynamicShape shape = DynamicShape(extents).Crop(mins, extents);
+  auto buffer = std::make_shared<AlignedBuffer>(
+      shape.NumElements() * ElementSize(data_type),
+      AllocationOptions{.initialize = false});
+  return DynamicArray::FromSharedBuffer(
+      data_type, shape, std::shared_ptr<uint8_t>(buffer, buffer->data()));
+}
+
+}  // namespace
+
+absl::StatusOr<ArrayStats> ComputeStats(const DynamicArrayRef& src,
+                                        const ReduceOptions& options) {
+  const LoadBlockFn load = GetLoadBlockFn(src.data_type());
+  if (load == nullptr) {
+    return absl::InvalidArgumentError(absl::StrCat(
+        "ComputeStats: unsupported data type ", src.data_type(), "."));
+  }
+
+  const StatsAccumulator acc =
+      Accumulate(src, load, StatsAccumulator(), options);
+  ArrayStats stats;
+  stats.count = acc.count();
+  stats.nan_count = acc.nan_count();
+  stats.inf_count = acc.inf_count();
+  stats.min = acc.min();
+  stats.max = acc.max();
+  if (acc.count() > 0) {
+    stats.argmin = IndicesOf(src.shape(), acc.argmin());
+    stats.argmax = IndicesOf(src.shape(), acc.argmax());
+  }
+  stats.sum = acc.sum();
+  stats.mean = acc.mean();
+  stats.variance = acc.variance();
+  return stats;
+}
+
+absl::StatusOr<DynamicArray> Reduce(const DynamicArrayRef& src, ReduceOp op,
+                                    absl::Span<const int64_t> axes,
+                                    const ReduceOptions& options) {
+  const LoadBlockFn load = GetLoadBlockFn(src.data_type());
+  if (load == nullptr) {
+    return absl::InvalidArgumentError(absl::StrCat(
+        "Reduce: unsupported data type ", src.data_type(), "."));
+  }
+
+  absl::InlinedVector<bool, DynamicShape::kInlineRank> reduced(src.rank(),
+                                                              false);
+  for (const int64_t axis : axes) {
+    if (axis < 0 || axis >= src.rank() || reduced[axis]) {
+      return absl::InvalidArgumentError(absl::StrCat(
+          "Reduce: invalid or repeated axis ", axis, " for rank ", src.rank(),
+          "."));
+    }
+    reduced[axis] = true;
+  }
+
+  // Split the dims of `src` into those that are kept (the output) and those
+  // that are reduced. Each output element reduces a view of the reduced dims.
+  absl::InlinedVector<int64_t, DynamicShape::kInlineRank> kept_mins;
+  absl::InlinedVector<int64_t, DynamicShape::kInlineRank> kept_extents;
+  absl::InlinedVector<int64_t, DynamicShape::kInlineRank> kept_strides;
+  absl::InlinedVector<int64_t, DynamicShape::kInlineRank> reduced_mins;
+  absl::InlinedVector<int64_t, DynamicShape::kInlineRank> reduced_extents;
+  absl::InlinedVector<int64_t, DynamicShape::kInlineRank> reduced_strides;
+  for (int64_t d = 0; d < src.rank(); ++d) {
+    const nda::dim<>& dim = src.shape().dim(d);
+    if (reduced[d]) {
+      reduced_mins.push_back(dim.min());
+      reduced_extents.push_back(dim.extent());
+      reduced_strides.push_back(dim.stride());
+    } else {
+      kept_mins.push_back(dim.min());
+      kept_extents.push_back(dim.extent());
+      kept_strides.push_back(dim.stride());
+    }
+  }
+  const DynamicShape reduced_shape(reduced_mins, reduced_extents,
+                                   reduced_strides);
+
+  const bool keeps_type = op == ReduceOp::kMin || op == ReduceOp::kMax;
+  DynamicArray dst = AllocateUninitialized(
+      keeps_type ? src.data_type() : DataType::kFloat64, kept_mins,
+      kept_extents);
+  const int64_t num_outputs = dst.NumElements();
+  if (num_outputs == 0) {
+    return dst;
+  }
+
+  const int64_t element_size = src.ElementSizeBytes();
+  const int64_t dst_element_size = dst.ElementSizeBytes();
+  uint8_t* dst_data = dst.data();
+
+  auto reduce_one = [&](int64_t o,
+                        const ReduceOptions& inner_options) -> absl::Status {
+    int64_t offset = 0;
+    int64_t rest = o;
+    for (size_t d = 0; d < kept_extents.size(); ++d) {
+      offset += (rest % kept_extents[d]) * kept_strides[d];
+      rest /= kept_extents[d];
+    }
+    const uint8_t* data = src.data() + offset * element_size;
+    const DynamicArrayRef view(const_cast<uint8_t*>(data), src.data_type(),
+                               reduced_shape);
+    const StatsAccumulator acc =
+        Accumulate(view, load, StatsAccumulator(), inner_options);
+
+    uint8_t* out = dst_data + o * dst_element_size;
+    double value = 0.0;
+    switch (op) {
+      case ReduceOp::kMin:
+      case ReduceOp::kMax: {
+        if (view.empty()) {
+          return absl::InvalidArgumentError(
+              "Reduce: can't compute the min or max of no elements.");
+        }
+        // Copy the element itself so that the result is exact. If every
+        // element is NaN, the result is the first one.
+        int64_t element_offset = 0;
+        if (acc.count() > 0) {
+          const std::vector<int64_t> indices = IndicesOf(
+              reduced_shape, op == ReduceOp::kMin ? acc.argmin()
+                                                  : acc.argmax());
+          element_offset = reduced_shape.FlatIndex(indices);
+        }
+        std::memcpy(out, data + element_offset * element_size, element_size);
+        return absl::OkStatus();
+      }
+      case ReduceOp::kSum:
+        value = acc.sum();
+        break;
+      case ReduceOp::kMean:
+        value = acc.mean();
+        break;
+      case ReduceOp::kVariance:
+        value = acc.variance();
+        break;
+    }
+    std::memcpy(out, &value, sizeof(value));
+    return absl::OkStatus();
+  };
+
+  // Parallelize over outputs if there are enough of them. Otherwise, reduce
+  // each output in parallel.
+  const int64_t total_bytes = src.NumElements() * element_size;
+  const int num_threads =
+      internal::ResolveThreads(options.threading, total_bytes, num_outputs);
+  if (num_threads > 1 &&
+      num_threads ==
+          internal::ResolveThreads(options.threading, total_bytes,
+                                   std::numeric_limits<int64_t>::max())) {
+    ReduceOptions serial_options = options;
+    serial_options.threading.max_threads = 1;
+    std::vector<absl::Status> statuses(num_threads);
+    internal::ResolveThreadPool(options.threading).ParallelFor(
+        num_threads, num_threads, [&](int64_t t) {
+          const int64_t begin = num_outputs * t / num_threads;
+          const int64_t end = num_outputs * (t + 1) / num_threads;
+          for (int64_t o = begin; o < end && statuses[t].ok(); ++o) {
+            statuses[t] = reduce_one(o, serial_options);
+          }
+        });
+    for (const absl::Status& status : statuses) {
+      if (!status.ok()) {
+        return status;
+      }
+    }
+  } else {
+    for (int64_t o = 0; o < num_outputs; ++o) {
+      const absl::Status status = reduce_one(o, options);
+      if (!status.ok()) {
+        return status;
+      }
+    }
+  }
+  return dst;
+}
+
+absl::StatusOr<std::vector<int64_t>> Histogram(const DynamicArrayRef& src,
+                                               int64_t num_bins, double lo,
+                                               double hi,
+                                               const ReduceOptions& options) {
+  const LoadBlockFn load = GetLoadBlockFn(src.data_type());
+  if (load == nullptr) {
+    return absl::InvalidArgumentError(absl::StrCat(
+        "Histogram: unsupported data type ", src.data_type(), "."));
+  }
+  if (num_bins <= 0) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("Histogram: num_bins must be positive, got ", num_bins,
+                     "."));
+  }
+  if (!(lo < hi) || !std::isfinite(lo) || !std::isfinite(hi)) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("Histogram: invalid range [", lo, ", ", hi, "]."));
+  }
+
+  HistogramAccumulator acc =
+      Accumulate(src, load, HistogramAccumulator(num_bins, lo, hi), options);
+  return std::move(acc.bins());
+}
+
+}  // namespace npy_array
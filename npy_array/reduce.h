@@ -0,0 +1,107 @@
+#ifndef NPY_ARRAY_REDUCE_H_
+#define NPY_ARRAY_REDUCE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/types/span.h"
+#include "array/array.h"
+#include "npy_array/data_type.h"
+#include "npy_array/dynamic_array.h"
+#include "npy_array/thread_pool.h"
+
+namespace npy_array {
+
+struct ReduceOptions {
+  // Splits large reductions across threads. `min_bytes_per_thread` counts
+  // source bytes.
+  ThreadingOptions threading;
+};
+
+// Summary statistics of an array.
+//
+// NaN values are counted in `nan_count` and otherwise ignored, like numpy's
+// nanmin(), nansum(), etc. Infinities are included. Values are accumulated in
+// double: sums use blocked (pairwise) summation with Kahan compensation between
+// blocks, and the variance is merged from per-block moments (Chan et al.), so
+// results are accurate even for large float arrays. They are deterministic for
+// a given number of threads.
+struct ArrayStats {
+  // The number of non-NaN elements.
+  int64_t count = 0;
+  int64_t nan_count = 0;
+  int64_t inf_count = 0;
+
+  // NaN if `count` is 0. Note that int64 and uint64 values beyond 2^53 are
+  // rounded; use `argmin` and `argmax` to read them exactly.
+  double min = 0.0;
+  double max = 0.0;
+
+  // The indices (including mins) of the first minimum and maximum in index
+  // order (dimension 0 fastest). Empty if `count` is 0.
+  std::vector<int64_t> argmin;
+  std::vector<int64_t> argmax;
+
+  double sum = 0.0;
+  // NaN if `count` is 0.
+  double mean = 0.0;
+  // The population variance (numpy's ddof = 0). NaN if `count` is 0.
+  double variance = 0.0;
+};
+
+// Computes ArrayStats over all elements of `src` in a single pass. Returns an
+// error if the data type is undefined or complex.
+absl::StatusOr<ArrayStats> ComputeStats(
+    const DynamicArrayRef& src, const ReduceOptions& options = ReduceOptions());
+
+// Same as above, for a statically typed array.
+template <typename T, size_t Rank>
+absl::StatusOr<ArrayStats> ComputeStats(
+    const nda::array_ref_of_rank<T, Rank>& src,
+    const ReduceOptions& options = ReduceOptions());
+
+enum class ReduceOp {
+  kMin,
+  kMax,
+  kSum,
+  kMean,
+  kVariance,
+};
+
+// Reduces `src` along each dimension in `axes`, which must be distinct and in
+// [0, rank()). Returns a compact array of the remaining dimensions, with their
+// mins preserved, e.g., reducing an (x, y, c) image with ReduceOp::kMean along
+// {0, 1} returns the mean of each channel.
+//
+// kMin and kMax return exact values in the data type of `src` and return an
+// error if an output is reduced over no elements. The other ops return
+// kFloat64. NaN values are ignored, as in ArrayStats.
+absl::StatusOr<DynamicArray> Reduce(
+    const DynamicArrayRef& src, ReduceOp op, absl::Span<const int64_t> axes,
+    const ReduceOptions& options = ReduceOptions());
+
+// Counts the elements of `src` in `num_bins` equal-width bins spanning
+// [lo, hi]. As in numpy.histogram(), every bin is half-open except the last,
+// which includes `hi`. Values outside [lo, hi] and NaN are not counted.
+absl::StatusOr<std::vector<int64_t>> Histogram(
+    const DynamicArrayRef& src, int64_t num_bins, double lo, double hi,
+    const ReduceOptions& options = ReduceOptions());
+
+// ----- Implementation of template functions -----
+template <typename T, size_t Rank>
+absl::StatusOr<ArrayStats> ComputeStats(
+    const nda::array_ref_of_rank<T, Rank>& src, const ReduceOptions& options) {
+  using U = std::remove_const_t<T>;
+  // The view is only read through.
+  const nda::array_ref_of_rank<U, Rank> view(const_cast<U*>(src.base()),
+                                             src.shape());
+  return ComputeStats(DynamicArrayRefOf<U, Rank>(view), options);
+}
+
+}  // namespace npy_array
+
+#endif  // NPY_ARRAY_REDUCE_H_
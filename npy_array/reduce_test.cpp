@@ -0,0 +1,222 @@
+#include "npy_array/reduce.h"
+
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "array/array.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "npy_array/data_type.h"
+#include "npy_array/dynamic_array.h"
+#include "npy_array/gtest_half.h"
+#include "npy_array/half.h"
+#include "npy_array/thread_pool.h"
+
+using testing::ElementsAre;
+using testing::IsEmpty;
+
+namespace npy_array {
+namespace {
+
+template <typename T>
+class ReduceTest : public testing::Test {};
+
+using MyTypes =
+    testing::Types<int8_t, int16_t, int32_t, int64_t, uint8_t, uint16_t,
+                   uint32_t, uint64_t, half, float, double>;
+TYPED_TEST_SUITE(ReduceTest, MyTypes);
+
+TYPED_TEST(ReduceTest, ComputeStats) {
+  // Values in [0, 50), with the maximum at (3, 2) and the minimum at (1, 0).
+  DynamicArray arr(DataTypeFor<TypeParam>(), {5, 4});
+  double sum = 0.0;
+  for (int64_t y = 0; y < 4; ++y) {
+    for (int64_t x = 0; x < 5; ++x) {
+      const int64_t value = (x == 1 && y == 0) ? 0 : 10 + (x + 5 * y) % 30;
+      arr.Set<TypeParam>({x, y}, static_cast<TypeParam>(value));
+      sum += value;
+    }
+  }
+  arr.Set<TypeParam>({3, 2}, static_cast<TypeParam>(49));
+  sum += 49 - (10 + (3 + 10) % 30);
+
+  absl::StatusOr<ArrayStats> stats = ComputeStats(arr);
+  ASSERT_TRUE(stats.ok()) << stats.status();
+  EXPECT_EQ(stats->count, 20);
+  EXPECT_EQ(stats->nan_count, 0);
+  EXPECT_EQ(stats->inf_count, 0);
+  EXPECT_EQ(stats->min, 0.0);
+  EXPECT_EQ(stats->max, 49.0);
+  EXPECT_THAT(stats->argmin, ElementsAre(1, 0));
+  EXPECT_THAT(stats->argmax, ElementsAre(3, 2));
+  EXPECT_EQ(stats->sum, sum);
+  EXPECT_DOUBLE_EQ(stats->mean, sum / 20);
+
+  double m2 = 0.0;
+  for (int64_t y = 0; y < 4; ++y) {
+    for (int64_t x = 0; x < 5; ++x) {
+      const double d =
+          static_cast<double>(arr.At<TypeParam>({x, y})) - sum / 20;
+      m2 += d * d;
+    }
+  }
+  EXPECT_NEAR(stats->variance, m2 / 20, 1e-9);
+}
+
+TYPED_TEST(ReduceTest, ReduceAlongAxes) {
+  // An (x, y, c) image where channel c is filled with c + 1.
+  DynamicArray arr(DataTypeFor<TypeParam>(), {6, 5, 3});
+  for (int64_t c = 0; c < 3; ++c) {
+    for (int64_t y = 0; y < 5; ++y) {
+      for (int64_t x = 0; x < 6; ++x) {
+        arr.Set<TypeParam>({x, y, c},
+                           static_cast<TypeParam>(c + 1 + (x == y)));
+      }
+    }
+  }
+
+  absl::StatusOr<DynamicArray> means = Reduce(arr, ReduceOp::kMean, {0, 1});
+  ASSERT_TRUE(means.ok()) << means.status();
+  ASSERT_EQ(means->rank(), 1);
+  ASSERT_EQ(means->data_type(), DataType::kFloat64);
+  for (int64_t c = 0; c < 3; ++c) {
+    EXPECT_DOUBLE_EQ(means->At<double>({c}), c + 1 + 5.0 / 30);
+  }
+
+  absl::StatusOr<DynamicArray> maxes = Reduce(arr, ReduceOp::kMax, {2});
+  ASSERT_TRUE(maxes.ok()) << maxes.status();
+  ASSERT_EQ(maxes->data_type(), DataTypeFor<TypeParam>());
+  EXPECT_EQ(maxes->At<TypeParam>({2, 2}), static_cast<TypeParam>(4));
+  EXPECT_EQ(maxes->At<TypeParam>({2, 3}), static_cast<TypeParam>(3));
+
+  absl::StatusOr<DynamicArray> sums = Reduce(arr, ReduceOp::kSum, {0});
+  ASSERT_TRUE(sums.ok()) << sums.status();
+  EXPECT_EQ(sums->At<double>({1, 2}), 6 * 3 + 1);
+}
+
+TEST(ReduceTest, NanAndInf) {
+  DynamicArray arr(DataType::kFloat32, {6});
+  const float nan = std::numeric_limits<float>::quiet_NaN();
+  const float inf = std::numeric_limits<float>::infinity();
+  const float values[] = {nan, 2.0f, -inf, 4.0f, nan, 2.0f};
+  for (int i = 0; i < 6; ++i) {
+    arr.Set<float>({i}, values[i]);
+  }
+
+  absl::StatusOr<ArrayStats> stats = ComputeStats(arr);
+  ASSERT_TRUE(stats.ok()) << stats.status();
+  EXPECT_EQ(stats->count, 4);
+  EXPECT_EQ(stats->nan_count, 2);
+  EXPECT_EQ(stats->inf_count, 1);
+  EXPECT_EQ(stats->min, -inf);
+  EXPECT_EQ(stats->max, 4.0);
+  EXPECT_THAT(stats->argmin, ElementsAre(2));
+  EXPECT_THAT(stats->argmax, ElementsAre(3));
+  EXPECT_EQ(stats->sum, -inf);
+
+  DynamicArray all_nan(DataType::kFloat64, {3});
+  for (int i = 0; i < 3; ++i) {
+    all_nan.Set<double>({i}, std::numeric_limits<double>::quiet_NaN());
+  }
+  stats = ComputeStats(all_nan);
+  ASSERT_TRUE(stats.ok()) << stats.status();
+  EXPECT_EQ(stats->count, 0);
+  EXPECT_TRUE(std::isnan(stats->min));
+  EXPECT_TRUE(std::isnan(stats->mean));
+  EXPECT_THAT(stats->argmax, IsEmpty());
+  EXPECT_EQ(stats->sum, 0.0);
+}
+
+TEST(ReduceTest, AccurateSums) {
+  // Naive float accumulation of 0.1 drifts badly after ~10^7 additions.
+  const int64_t n = int64_t{1} << 24;
+  DynamicArray arr(DataType::kFloat32, {n});
+  for (int64_t i = 0; i < n; ++i) {
+    arr.data<float>()[i] = 0.1f;
+  }
+  absl::StatusOr<ArrayStats> stats = ComputeStats(arr);
+  ASSERT_TRUE(stats.ok()) << stats.status();
+  EXPECT_DOUBLE_EQ(stats->sum, n * static_cast<double>(0.1f));
+  EXPECT_NEAR(stats->variance, 0.0, 1e-20);
+}
+
+TEST(ReduceTest, MultithreadedMatchesSerial) {
+  ThreadPool pool(3);
+  const ReduceOptions threaded{.threading = {
+      .max_threads = 0, .min_bytes_per_thread = 4096, .thread_pool = &pool}};
+
+  DynamicArray arr(DataType::kUint16, {300, 200});
+  for (int64_t i = 0; i < arr.NumElements(); ++i) {
+    arr.data<uint16_t>()[i] = static_cast<uint16_t>((i * 7919) % 1000);
+  }
+  arr.data<uint16_t>()[12345] = 5000;
+
+  const DynamicArrayRef full = arr.ref();
+  for (const DynamicArrayRef& src : {full, full.Crop({1, 1}, {298, 198})}) {
+    absl::StatusOr<ArrayStats> serial = ComputeStats(src);
+    absl::StatusOr<ArrayStats> parallel = ComputeStats(src, threaded);
+    ASSERT_TRUE(serial.ok()) << serial.status();
+    ASSERT_TRUE(parallel.ok()) << parallel.status();
+    EXPECT_EQ(parallel->count, serial->count);
+    EXPECT_EQ(parallel->min, serial->min);
+    EXPECT_EQ(parallel->argmin, serial->argmin);
+    EXPECT_EQ(parallel->argmax, serial->argmax);
+    EXPECT_THAT(parallel->argmax, ElementsAre(12345 % 300, 12345 / 300));
+    EXPECT_EQ(parallel->sum, serial->sum);
+    EXPECT_NEAR(parallel->variance, serial->variance, 1e-9);
+
+    absl::StatusOr<DynamicArray> row_max =
+        Reduce(src, ReduceOp::kMax, {0}, threaded);
+    ASSERT_TRUE(row_max.ok()) << row_max.status();
+    EXPECT_EQ(row_max->At<uint16_t>({12345 / 300}), 5000);
+  }
+}
+
+TEST(ReduceTest, Histogram) {
+  DynamicArray arr(DataType::kFloat64, {7});
+  const double values[] = {0.0, 0.5, 0.99, 1.0, 2.0, -0.1,
+                           std::numeric_limits<double>::quiet_NaN()};
+  for (int i = 0; i < 7; ++i) {
+    arr.Set<double>({i}, values[i]);
+  }
+  absl::StatusOr<std::vector<int64_t>> bins = Histogram(arr, 4, 0.0, 2.0);
+  ASSERT_TRUE(bins.ok()) << bins.status();
+  EXPECT_THAT(*bins, ElementsAre(1, 2, 1, 1));
+
+  EXPECT_EQ(Histogram(arr, 0, 0.0, 1.0).status().code(),
+            absl::StatusCode::kInvalidArgument);
+  EXPECT_EQ(Histogram(arr, 4, 1.0, 1.0).status().code(),
+            absl::StatusCode::kInvalidArgument);
+}
+
+TEST(ReduceTest, StaticArray) {
+  nda::array_of_rank<int32_t, 2> arr({4, 3});
+  arr.for_each_value([i = 0](int32_t& x) mutable { x = i++; });
+  // Like ArrayRefOf(), T and Rank can't be deduced.
+  absl::StatusOr<ArrayStats> stats =
+      ComputeStats<const int32_t, 2>(arr.cref());
+  ASSERT_TRUE(stats.ok()) << stats.status();
+  EXPECT_EQ(stats->sum, 66);
+  EXPECT_THAT(stats->argmax, ElementsAre(3, 2));
+}
+
+TEST(ReduceTest, Errors) {
+  DynamicArray arr(DataType::kInt32, {4, 3});
+  EXPECT_EQ(Reduce(arr, ReduceOp::kSum, {2}).status().code(),
+            absl::StatusCode::kInvalidArgument);
+  EXPECT_EQ(Reduce(arr, ReduceOp::kSum, {0, 0}).status().code(),
+            absl::StatusCode::kInvalidArgument);
+
+  DynamicArray empty(DataType::kInt32, {0, 3});
+  EXPECT_EQ(Reduce(empty, ReduceOp::kMin, {0}).status().code(),
+            absl::StatusCode::kInvalidArgument);
+  absl::StatusOr<DynamicArray> sums = Reduce(empty, ReduceOp::kSum, {0});
+  ASSERT_TRUE(sums.ok()) << sums.status();
+  EXPECT_EQ(sums->At<double>({1}), 0.0);
+}
+
+}  // namespace
+}  // namespace npy_array
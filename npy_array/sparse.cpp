@@ -0,0 +1,555 @@
+#include "npy_array/sparse.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "absl/strings/str_cat.h"
+#include "absl/types/span.h"
+#include "npy_array/npy_array.h"
+#include "npy_array/npy_dynamic_array.h"
+
+namespace npy_array {
+
+namespace {
+
+// Rows are scanned for nonzero bytes in blocks of this size.
+constexpr int64_t kScanBlockBytes = 32;
+
+template <typename T>
+bool IsNonzero(T value) {
+  if constexpr (std::is_same_v<T, bool>) {
+    return value;
+  } else {
+    return value != T{};
+  }
+}
+
+// Adds `value` to `*dst`, or ors it for bool.
+template <typename T>
+void Accumulate(T value, T* dst) {
+  if constexpr (std::is_same_v<T, bool>) {
+    *dst = *dst || value;
+  } else {
+    *dst = static_cast<T>(*dst + value);
+  }
+}
+
+bool AllZeroBytes(const uint8_t* data, int64_t size) {
+  uint64_t bits = 0;
+  for (int64_t i = 0; i + 8 <= size; i += 8) {
+    uint64_t word;
+    std::memcpy(&word, data + i, 8);
+    bits |= word;
+  }
+  for (int64_t i = size & ~int64_t{7}; i < size; ++i) {
+    bits |= data[i];
+  }
+  return bits == 0;
+}
+
+// Returns an error unless `dense` is a rank 2 array of a defined data type.
+absl::Status CheckDense(const char* function, const DynamicArrayRef& dense) {
+  if (dense.data_type() == DataType::kUndefined) {
+    return absl::InvalidArgumentError(
+        absl::StrCat(function, ": undefined data type."));
+  }
+  if (dense.rank() != 2) {
+    return absl::InvalidArgumentError(absl::StrCat(
+        function, ": expected a rank 2 array, got rank ", dense.rank(), "."));
+  }
+  return absl::OkStatus();
+}
+
+// Returns the CSR matrix of the nonzero elements of `dense`.
+template <typename T>
+SparseMatrix DenseToCsr(const DynamicArrayRef& dense) {
+  const int64_t num_cols = dense.shape().extent(0);
+  const int64_t num_rows = dense.shape().extent(1);
+  const int64_t col_stride = dense.shape().stride(0);
+  const int64_t row_stride = dense.shape().stride(1);
+  const T* base = dense.data<T>();
+
+  // bool is stored as bytes, since std::vector<bool> packs bits.
+  using Stored = std::conditional_t<std::is_same_v<T, bool>, uint8_t, T>;
+  std::vector<Stored> values;
+
+  SparseMatrix result;
+  result.format = SparseFormat::kCsr;
+  result.num_rows = num_rows;
+  result.num_cols = num_cols;
+  result.indptr.reserve(num_rows + 1);
+  result.indptr.push_back(0);
+  constexpr int64_t kBlock = std::max<int64_t>(kScanBlockBytes / sizeof(T), 1);
+  for (int64_t r = 0; r < num_rows; ++r) {
+    const T* row = base + r * row_stride;
+    int64_t c = 0;
+    if (col_stride == 1) {
+      // Whole blocks of zero bytes hold only zeros, whatever the data type.
+      for (; c + kBlock <= num_cols; c += kBlock) {
+        if (AllZeroBytes(reinterpret_cast<const uint8_t*>(row + c),
+                         kBlock * sizeof(T))) {
+          continue;
+        }
+        for (int64_t i = c; i < c + kBlock; ++i) {
+          if (IsNonzero(row[i])) {
+            result.indices.push_back(i);
+            values.push_back(row[i]);
+          }
+        }
+      }
+    }
+    for (; c < num_cols; ++c) {
+      const T value = row[c * col_stride];
+      if (IsNonzero(value)) {
+        result.indices.push_back(c);
+        values.push_back(value);
+      }
+    }
+    result.indptr.push_back(result.indices.size());
+  }
+
+  const int64_t nnz = values.size();
+  result.data = DynamicArray(dense.data_type(), {nnz});
+  if (nnz > 0) {
+    std::memcpy(result.data.data(), values.data(), nnz * sizeof(T));
+  }
+  return result;
+}
+
+// Returns the offsets of the values of each of `num_groups` groups once
+// `group` (the group of each value) is sorted, with nnz appended.
+std::vector<int64_t> GroupOffsets(int64_t num_groups,
+                                  absl::Span<const int64_t> group) {
+  std::vector<int64_t> offsets(num_groups + 1, 0);
+  for (const int64_t g : group) {
+    ++offsets[g + 1];
+  }
+  for (int64_t g = 0; g < num_groups; ++g) {
+    offsets[g + 1] += offsets[g];
+  }
+  return offsets;
+}
+
+// Sets `dst->indptr`, `dst->indices` and `dst->data` to the values of `data`
+// grouped by `major` with a stable counting sort, with `minor` as the index of
+// each value in its group.
+void Compress(int64_t num_major, absl::Span<const int64_t> major,
+              absl::Span<const int64_t> minor, const DynamicArray& data,
+              SparseMatrix* dst) {
+  const int64_t nnz = major.size();
+  dst->indptr = GroupOffsets(num_major, major);
+  dst->indices.resize(nnz);
+  dst->data = DynamicArray(data.data_type(), {nnz});
+  DispatchDataType(data.data_type(), [&]<typename T>() {
+    if constexpr (!std::is_void_v<T>) {
+      const T* src_values = data.data<T>();
+      T* dst_values = dst->data.data<T>();
+      std::vector<int64_t> next(dst->indptr.begin(), dst->indptr.end() - 1);
+      for (int64_t i = 0; i < nnz; ++i) {
+        const int64_t j = next[major[i]]++;
+        dst->indices[j] = minor[i];
+        dst_values[j] = src_values[i];
+      }
+    }
+  });
+}
+
+// Returns the group of each value of a compressed matrix, from `indptr`.
+std::vector<int64_t> ExpandIndptr(absl::Span<const int64_t> indptr) {
+  std::vector<int64_t> group(indptr.empty() ? 0 : indptr.back());
+  for (size_t g = 0; g + 1 < indptr.size(); ++g) {
+    std::fill(group.begin() + indptr[g], group.begin() + indptr[g + 1], g);
+  }
+  return group;
+}
+
+// Returns an error unless every index of `indices` is in [0, limit).
+absl::Status CheckIndices(const char* name, absl::Span<const int64_t> indices,
+                          int64_t limit) {
+  for (const int64_t index : indices) {
+    if (index < 0 || index >= limit) {
+      return absl::InvalidArgumentError(
+          absl::StrCat("SparseMatrix: ", name, " index ", index,
+                       " is out of range [0, ", limit, ")."));
+    }
+  }
+  return absl::OkStatus();
+}
+
+// Returns an error unless `indices` has `nnz` entries.
+absl::Status CheckSize(const char* name, absl::Span<const int64_t> indices,
+                       int64_t nnz) {
+  if (static_cast<int64_t>(indices.size()) != nnz) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("SparseMatrix: expected ", nnz, " ", name,
+                     " indices, got ", indices.size(), "."));
+  }
+  return absl::OkStatus();
+}
+
+// Returns the npy encoding of `indices`, as int32 if `use_int32`.
+absl::StatusOr<std::string> EncodeIndices(absl::Span<const int64_t> indices,
+                                          bool use_int32) {
+  const int64_t size = indices.size();
+  DynamicArray array(use_int32 ? DataType::kInt32 : DataType::kInt64, {size});
+  if (use_int32) {
+    std::copy(indices.begin(), indices.end(), array.data<int32_t>());
+  } else {
+    std::copy(indices.begin(), indices.end(), array.data<int64_t>());
+  }
+  return EncodeDynamicArrayToNpy(array);
+}
+
+// Decodes a rank 1 int32 or int64 npy array to int64 indices.
+absl::StatusOr<std::vector<int64_t>> DecodeIndices(
+    std::string_view npy_data) {
+  absl::StatusOr<DynamicArrayRef> array = MakeDynamicArrayRefOfNpy(npy_data);
+  if (!array.ok()) {
+    return array.status();
+  }
+  if (array->rank() != 1 || (array->data_type() != DataType::kInt32 &&
+                             array->data_type() != DataType::kInt64)) {
+    return absl::InvalidArgumentError(
+        "ReadSparseMatrixFromNpz: expected a rank 1 int32 or int64 index "
+        "array.");
+  }
+  std::vector<int64_t> indices(array->NumElements());
+  if (array->data_type() == DataType::kInt32) {
+    const int32_t* src = std::as_const(*array).data<int32_t>();
+    std::copy(src, src + indices.size(), indices.begin());
+  } else {
+    std::memcpy(indices.data(), std::as_const(*array).data(),
+                indices.size() * sizeof(int64_t));
+  }
+  return indices;
+}
+
+// Decodes the format name of scipy's "format.npy": a 0-d bytes ('|S3') or
+// unicode ('<U3') array.
+absl::StatusOr<SparseFormat> DecodeFormat(std::string_view npy_data) {
+  const internal::NpyHeader header = internal::ReadHeader(npy_data);
+  const size_t char_size = header.type_char == 'U' ? 4 : 1;
+  const bool valid = header.valid && header.total_element_count == 1 &&
+                     (header.type_char == 'S' || header.type_char == 'U') &&
+                     npy_data.size() - header.data_start_offset >=
+                         header.word_size * char_size;
+  std::string name;
+  for (size_t i = 0; valid && i < header.word_size; ++i) {
+    // Unicode characters are little-endian UTF-32; format names are ASCII.
+    const char c = npy_data[header.data_start_offset + i * char_size];
+    if (c == '\0') {
+      break;
+    }
+    name.push_back(c);
+  }
+  for (const SparseFormat format :
+       {SparseFormat::kCsr, SparseFormat::kCsc, SparseFormat::kCoo}) {
+    if (valid && name == SparseFormatName(format)) {
+      return format;
+    }
+  }
+  return absl::InvalidArgumentError(absl::StrCat(
+      "ReadSparseMatrixFromNpz: unsupported sparse format '", name, "'."));
+}
+
+}  // namespace
+
+std::string_view SparseFormatName(SparseFormat format) {
+  switch (format) {
+    case SparseFormat::kCsr:
+      return "csr";
+    case SparseFormat::kCsc:
+      return "csc";
+    case SparseFormat::kCoo:
+      return "coo";
+  }
+  return "";
+}
+
+absl::Status SparseMatrix::Validate() const {
+  if (num_rows < 0 || num_cols < 0) {
+    return absl::InvalidArgumentError(absl::StrCat(
+        "SparseMatrix: invalid shape (", num_rows, ", ", num_cols, ")."));
+  }
+  if (data.rank() != 1 || data.data_type() == DataType::kUndefined) {
+    return absl::InvalidArgumentError(
+        "SparseMatrix: data must be a rank 1 array of a defined data type.");
+  }
+  if (format == SparseFormat::kCoo) {
+    absl::Status status = CheckSize("row", row, nnz());
+    if (status.ok()) {
+      status = CheckSize("col", col, nnz());
+    }
+    if (status.ok()) {
+      status = CheckIndices("row", row, num_rows);
+    }
+    if (status.ok()) {
+      status = CheckIndices("col", col, num_cols);
+    }
+    return status;
+  }
+
+  const bool csr = format == SparseFormat::kCsr;
+  const int64_t num_major = csr ? num_rows : num_cols;
+  if (static_cast<int64_t>(indptr.size()) != num_major + 1 ||
+      indptr.front() != 0 || indptr.back() != nnz()) {
+    return absl::InvalidArgumentError(absl::StrCat(
+        "SparseMatrix: indptr must have ", num_major + 1,
+        " entries, from 0 to nnz (", nnz(), ")."));
+  }
+  for (int64_t i = 0; i < num_major; ++i) {
+    if (indptr[i] > indptr[i + 1]) {
+      return absl::InvalidArgumentError(
+          "SparseMatrix: indptr must be nondecreasing.");
+    }
+  }
+  const char* index_name = csr ? "column" : "row";
+  absl::Status status = CheckSize(index_name, indices, nnz());
+  if (status.ok()) {
+    status = CheckIndices(index_name, indices, csr ? num_cols : num_rows);
+  }
+  return status;
+}
+
+absl::StatusOr<SparseMatrix> DenseToSparse(const DynamicArrayRef& dense,
+                                           SparseFormat format) {
+  absl::Status status = CheckDense("DenseToSparse", dense);
+  if (!status.ok()) {
+    return status;
+  }
+  SparseMatrix csr;
+  DispatchDataType(dense.data_type(), [&]<typename T>() {
+    if constexpr (!std::is_void_v<T>) {
+      csr = DenseToCsr<T>(dense);
+    }
+  });
+  if (format == SparseFormat::kCsr) {
+    return csr;
+  }
+  return ConvertSparseFormat(csr, format);
+}
+
+absl::StatusOr<SparseMatrix> ConvertSparseFormat(const SparseMatrix& src,
+                                                 SparseFormat format) {
+  absl::Status status = src.Validate();
+  if (!status.ok()) {
+    return status;
+  }
+  if (format == src.format) {
+    return src;
+  }
+
+  // Every conversion goes through the row and column of each value.
+  std::vector<int64_t> row_storage;
+  std::vector<int64_t> col_storage;
+  absl::Span<const int64_t> row = src.row;
+  absl::Span<const int64_t> col = src.col;
+  if (src.format == SparseFormat::kCsr) {
+    row_storage = ExpandIndptr(src.indptr);
+    row = row_storage;
+    col = src.indices;
+  } else if (src.format == SparseFormat::kCsc) {
+    col_storage = ExpandIndptr(src.indptr);
+    col = col_storage;
+    row = src.indices;
+  }
+
+  SparseMatrix result;
+  result.format = format;
+  result.num_rows = src.num_rows;
+  result.num_cols = src.num_cols;
+  switch (format) {
+    case SparseFormat::kCsr:
+      Compress(src.num_rows, row, col, src.data, &result);
+      break;
+    case SparseFormat::kCsc:
+      Compress(src.num_cols, col, row, src.data, &result);
+      break;
+    case SparseFormat::kCoo:
+      result.data = src.data;
+      result.row.assign(row.begin(), row.end());
+      result.col.assign(col.begin(), col.end());
+      break;
+  }
+  return result;
+}
+
+absl::Status SparseToDense(const SparseMatrix& src, DynamicArrayRef dense) {
+  absl::Status status = CheckDense("SparseToDense", dense);
+  if (status.ok()) {
+    status = src.Validate();
+  }
+  if (!status.ok()) {
+    return status;
+  }
+  if (dense.data_type() != src.data.data_type() ||
+      dense.shape().extent(0) != src.num_cols ||
+      dense.shape().extent(1) != src.num_rows) {
+    return absl::InvalidArgumentError(absl::StrCat(
+        "SparseToDense: expected a ", src.data.data_type(),
+        " array with extents {", src.num_cols, ", ", src.num_rows, "}."));
+  }
+
+  const int64_t col_stride = dense.shape().stride(0);
+  const int64_t row_stride = dense.shape().stride(1);
+  DispatchDataType(dense.data_type(), [&]<typename T>() {
+    if constexpr (!std::is_void_v<T>) {
+      T* base = dense.data<T>();
+      for (int64_t r = 0; r < src.num_rows; ++r) {
+        T* row = base + r * row_stride;
+        if (col_stride == 1) {
+          std::fill(row, row + src.num_cols, T{});
+        } else {
+          for (int64_t c = 0; c < src.num_cols; ++c) {
+            row[c * col_stride] = T{};
+          }
+        }
+      }
+
+      const T* values = src.data.data<T>();
+      auto add = [&](int64_t r, int64_t c, T value) {
+        Accumulate(value, base + r * row_stride + c * col_stride);
+      };
+      if (src.format == SparseFormat::kCoo) {
+        for (int64_t i = 0; i < src.nnz(); ++i) {
+          add(src.row[i], src.col[i], values[i]);
+        }
+        return;
+      }
+      const bool csr = src.format == SparseFormat::kCsr;
+      for (size_t major = 0; major + 1 < src.indptr.size(); ++major) {
+        for (int64_t i = src.indptr[major]; i < src.indptr[major + 1]; ++i) {
+          if (csr) {
+            add(major, src.indices[i], values[i]);
+          } else {
+            add(src.indices[i], major, values[i]);
+          }
+        }
+      }
+    }
+  });
+  return absl::OkStatus();
+}
+
+absl::StatusOr<DynamicArray> SparseToDense(const SparseMatrix& src) {
+  DynamicArray dense(src.data.data_type(), {src.num_cols, src.num_rows});
+  absl::Status status = SparseToDense(src, dense);
+  if (!status.ok()) {
+    return status;
+  }
+  return dense;
+}
+
+absl::Status AddSparseMatrixToNpz(const SparseMatrix& src, ZipWriter* zip) {
+  absl::Status status = src.Validate();
+  if (!status.ok()) {
+    return status;
+  }
+
+  // As scipy's get_index_dtype(): int32 unless an index or nnz overflows it.
+  constexpr int64_t kInt32Max = std::numeric_limits<int32_t>::max();
+  const bool use_int32 = src.num_rows <= kInt32Max &&
+                         src.num_cols <= kInt32Max && src.nnz() <= kInt32Max;
+  std::vector<std::pair<std::string, absl::StatusOr<std::string>>> entries;
+  if (src.format == SparseFormat::kCoo) {
+    entries.emplace_back("row.npy", EncodeIndices(src.row, use_int32));
+    entries.emplace_back("col.npy", EncodeIndices(src.col, use_int32));
+  } else {
+    entries.emplace_back("indices.npy", EncodeIndices(src.indices, use_int32));
+    entries.emplace_back("indptr.npy", EncodeIndices(src.indptr, use_int32));
+  }
+
+  // The format is a 0-d bytes array, as np.array(b"csr").
+  const std::string_view format_name = SparseFormatName(src.format);
+  entries.emplace_back(
+      "format.npy",
+      absl::StrCat(internal::NpyFullHeaderString(
+                       absl::StrCat("|S", format_name.size()), {},
+                       /*reverse_axes=*/true),
+                   format_name));
+
+  // The numpy shape, (num_rows, num_cols), always as int64.
+  DynamicArray shape(DataType::kInt64, {2});
+  shape.data<int64_t>()[0] = src.num_rows;
+  shape.data<int64_t>()[1] = src.num_cols;
+  entries.emplace_back("shape.npy", EncodeDynamicArrayToNpy(shape));
+  entries.emplace_back("data.npy", EncodeDynamicArrayToNpy(src.data));
+
+  for (const auto& [path, npy] : entries) {
+    if (!npy.ok()) {
+      return npy.status();
+    }
+    status = zip->AddFile(path, *npy);
+    if (!status.ok()) {
+      return status;
+    }
+  }
+  return absl::OkStatus();
+}
+
+absl::StatusOr<SparseMatrix> ReadSparseMatrixFromNpz(
+    const absl::flat_hash_map<std::filesystem::path, std::string>& files) {
+  const auto format_npy = files.find("format.npy");
+  const auto shape_npy = files.find("shape.npy");
+  const auto data_npy = files.find("data.npy");
+  if (format_npy == files.end() || shape_npy == files.end() ||
+      data_npy == files.end()) {
+    return absl::NotFoundError(
+        "ReadSparseMatrixFromNpz: missing format, shape or data entry.");
+  }
+
+  absl::StatusOr<SparseFormat> format = DecodeFormat(format_npy->second);
+  if (!format.ok()) {
+    return format.status();
+  }
+  absl::StatusOr<std::vector<int64_t>> shape = DecodeIndices(shape_npy->second);
+  if (!shape.ok()) {
+    return shape.status();
+  }
+  if (shape->size() != 2) {
+    return absl::InvalidArgumentError(
+        "ReadSparseMatrixFromNpz: expected a 2-D shape.");
+  }
+  absl::StatusOr<DynamicArray> data =
+      DecodeDynamicArrayFromNpy(data_npy->second);
+  if (!data.ok()) {
+    return data.status();
+  }
+
+  SparseMatrix result;
+  result.format = *format;
+  result.num_rows = (*shape)[0];
+  result.num_cols = (*shape)[1];
+  result.data = *std::move(data);
+  const bool coo = result.format == SparseFormat::kCoo;
+  const std::pair<const char*, std::vector<int64_t>*> index_entries[] = {
+      {coo ? "row.npy" : "indices.npy", coo ? &result.row : &result.indices},
+      {coo ? "col.npy" : "indptr.npy", coo ? &result.col : &result.indptr},
+  };
+  for (const auto& [path, indices] : index_entries) {
+    const auto npy = files.find(path);
+    if (npy == files.end()) {
+      return absl::NotFoundError(
+          absl::StrCat("ReadSparseMatrixFromNpz: missing entry ", path, "."));
+    }
+    absl::StatusOr<std::vector<int64_t>> decoded = DecodeIndices(npy->second);
+    if (!decoded.ok()) {
+      return decoded.status();
+    }
+    *indices = *std::move(decoded);
+  }
+
+  absl::Status status = result.Validate();
+  if (!status.ok()) {
+    return status;
+  }
+  return result;
+}
+
+}  // namespace npy_array
@@ -0,0 +1,104 @@
+#ifndef NPY_ARRAY_SPARSE_H_
+#define NPY_ARRAY_SPARSE_H_
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "npy_array/data_type.h"
+#include "npy_array/dynamic_array.h"
+#include "npy_array/zip_writer.h"
+
+namespace npy_array {
+
+// The storage formats of scipy.sparse that SparseMatrix supports.
+enum class SparseFormat {
+  // Compressed sparse rows: the values of each row are stored together.
+  kCsr,
+  // Compressed sparse columns: the values of each column are stored together.
+  kCsc,
+  // Coordinates: a row and column index per value, in any order.
+  kCoo,
+};
+
+// Returns the scipy name of `format`: "csr", "csc" or "coo".
+std::string_view SparseFormatName(SparseFormat format);
+
+// A 2-D sparse matrix in one of the layouts of scipy.sparse.
+//
+// The shape is the numpy shape (num_rows, num_cols). The dense array with the
+// same values has extents {num_cols, num_rows}: as everywhere in this library,
+// dimension 0 is innermost, so that rows are contiguous.
+struct SparseMatrix {
+  SparseFormat format = SparseFormat::kCsr;
+  int64_t num_rows = 0;
+  int64_t num_cols = 0;
+
+  // The stored values: a rank 1 array of nnz() elements of any data type.
+  DynamicArray data = DynamicArray(DataType::kFloat64, {0});
+
+  // kCsr and kCsc: the column (kCsr) or row (kCsc) of each value, and the
+  // offsets in `data` where each row (kCsr) or column (kCsc) starts, followed
+  // by nnz().
+  std::vector<int64_t> indices;
+  std::vector<int64_t> indptr;
+
+  // kCoo: the row and column of each value.
+  std::vector<int64_t> row;
+  std::vector<int64_t> col;
+
+  int64_t nnz() const { return data.NumElements(); }
+
+  // Returns an error if the index arrays don't match the format, the shape or
+  // nnz(), or hold an index out of range. Indices need not be sorted, and may
+  // repeat.
+  absl::Status Validate() const;
+};
+
+// Returns the nonzero elements of `dense`, a rank 2 array with extents
+// {num_cols, num_rows} and any strides, in `format`. Indices are sorted within
+// each row or column. NaNs are nonzero; negative zeros are not.
+//
+// Rows are scanned a block of bytes at a time, and blocks with no set bit are
+// skipped, so mostly-zero rows cost little more than reading them. kCsc is
+// built by transposing the kCsr result rather than by walking the columns.
+absl::StatusOr<SparseMatrix> DenseToSparse(
+    const DynamicArrayRef& dense, SparseFormat format = SparseFormat::kCsr);
+
+// Returns `src` converted to `format`, in O(nnz + num_rows + num_cols) time.
+// Values that share a row (kCsr) or column (kCsc) keep their relative order,
+// so a kCsc result from a kCsr matrix has sorted indices. Duplicates are kept.
+absl::StatusOr<SparseMatrix> ConvertSparseFormat(const SparseMatrix& src,
+                                                 SparseFormat format);
+
+// Writes the values of `src` to `dense`, a rank 2 array with extents
+// {src.num_cols, src.num_rows}, the data type of `src.data` and any strides.
+// Elements without a value are set to zero, and duplicate values are summed,
+// as in scipy's toarray().
+absl::Status SparseToDense(const SparseMatrix& src, DynamicArrayRef dense);
+
+// Same as above, but returns a newly allocated compact array.
+absl::StatusOr<DynamicArray> SparseToDense(const SparseMatrix& src);
+
+// Adds `src` to `zip` with the entries of scipy.sparse.save_npz(): "data.npy",
+// "format.npy" and "shape.npy", plus "indices.npy" and "indptr.npy" (kCsr,
+// kCsc) or "row.npy" and "col.npy" (kCoo). Index arrays are written as int32
+// when every index and nnz() fit, as scipy does, and as int64 otherwise. A zip
+// with nothing else in it loads with scipy.sparse.load_npz().
+absl::Status AddSparseMatrixToNpz(const SparseMatrix& src, ZipWriter* zip);
+
+// Reads a sparse matrix from the entries of an NPZ file written by
+// AddSparseMatrixToNpz() or scipy.sparse.save_npz(), e.g., from ReadZipFile().
+// Index arrays may be int32 or int64. Returns an error if an entry is missing,
+// the format is not csr, csc or coo, or the matrix fails Validate().
+absl::StatusOr<SparseMatrix> ReadSparseMatrixFromNpz(
+    const absl::flat_hash_map<std::filesystem::path, std::string>& files);
+
+}  // namespace npy_array
+
+#endif  // NPY_ARRAY_SPARSE_H_
@@ -0,0 +1,224 @@
+#include "npy_array/sparse.h"
+
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "npy_array/data_type.h"
+#include "npy_array/dynamic_array.h"
+#include "npy_array/zip_reader.h"
+#include "npy_array/zip_writer.h"
+
+namespace npy_array {
+namespace {
+
+using ::testing::ElementsAre;
+
+// Returns a float32 matrix with extents {num_cols, num_rows} where element
+// (r, c) is r * 100 + c + 1 if (r + 2 * c) % 5 == 0, and 0 otherwise.
+DynamicArray SparsePattern(int64_t num_rows, int64_t num_cols) {
+  DynamicArray dense(DataType::kFloat32, {num_cols, num_rows});
+  for (int64_t r = 0; r < num_rows; ++r) {
+    for (int64_t c = 0; c < num_cols; ++c) {
+      dense.Set<float>({c, r}, (r + 2 * c) % 5 == 0 ? r * 100 + c + 1 : 0);
+    }
+  }
+  return dense;
+}
+
+void ExpectEqual(const DynamicArray& a, const DynamicArray& b) {
+  ASSERT_EQ(a.data_type(), b.data_type());
+  ASSERT_EQ(a.shape().extent(0), b.shape().extent(0));
+  ASSERT_EQ(a.shape().extent(1), b.shape().extent(1));
+  for (int64_t r = 0; r < a.shape().extent(1); ++r) {
+    for (int64_t c = 0; c < a.shape().extent(0); ++c) {
+      EXPECT_EQ(a.At<float>({c, r}), b.At<float>({c, r}))
+          << "at row " << r << ", column " << c;
+    }
+  }
+}
+
+TEST(SparseTest, DenseToCsr) {
+  // [[0, 1, 0, 2],
+  //  [0, 0, 0, 0],
+  //  [3, 0, -0, nan]]
+  DynamicArray dense(DataType::kFloat32, {4, 3});
+  dense.Set<float>({1, 0}, 1);
+  dense.Set<float>({3, 0}, 2);
+  dense.Set<float>({0, 2}, 3);
+  dense.Set<float>({2, 2}, -0.0f);
+  dense.Set<float>({3, 2}, std::numeric_limits<float>::quiet_NaN());
+
+  absl::StatusOr<SparseMatrix> csr = DenseToSparse(dense);
+  ASSERT_TRUE(csr.ok()) << csr.status();
+  EXPECT_EQ(csr->num_rows, 3);
+  EXPECT_EQ(csr->num_cols, 4);
+  EXPECT_THAT(csr->indptr, ElementsAre(0, 2, 2, 4));
+  EXPECT_THAT(csr->indices, ElementsAre(1, 3, 0, 3));
+  ASSERT_EQ(csr->nnz(), 4);
+  EXPECT_EQ(csr->data.At<float>({0}), 1);
+  EXPECT_EQ(csr->data.At<float>({2}), 3);
+  EXPECT_TRUE(std::isnan(csr->data.At<float>({3})));
+}
+
+TEST(SparseTest, DenseRoundTripsThroughEveryFormat) {
+  // Wide enough for whole blocks of zero bytes to be skipped.
+  const DynamicArray dense = SparsePattern(7, 37);
+  for (const SparseFormat format :
+       {SparseFormat::kCsr, SparseFormat::kCsc, SparseFormat::kCoo}) {
+    absl::StatusOr<SparseMatrix> sparse = DenseToSparse(dense, format);
+    ASSERT_TRUE(sparse.ok()) << sparse.status();
+    EXPECT_EQ(sparse->format, format);
+    EXPECT_TRUE(sparse->Validate().ok());
+
+    absl::StatusOr<DynamicArray> round_trip = SparseToDense(*sparse);
+    ASSERT_TRUE(round_trip.ok()) << round_trip.status();
+    ExpectEqual(*round_trip, dense);
+  }
+
+  // CSC is sorted by row within each column.
+  absl::StatusOr<SparseMatrix> csc = DenseToSparse(dense, SparseFormat::kCsc);
+  ASSERT_TRUE(csc.ok());
+  for (int64_t c = 0; c < csc->num_cols; ++c) {
+    for (int64_t i = csc->indptr[c] + 1; i < csc->indptr[c + 1]; ++i) {
+      EXPECT_LT(csc->indices[i - 1], csc->indices[i]);
+    }
+  }
+}
+
+TEST(SparseTest, StridedDense) {
+  const DynamicArray dense = SparsePattern(6, 5);
+
+  // The CSR matrix of the transpose has the arrays of the CSC matrix.
+  DynamicArray copy = dense;
+  absl::StatusOr<SparseMatrix> sparse =
+      DenseToSparse(copy.ref().Permute({1, 0}));
+  ASSERT_TRUE(sparse.ok()) << sparse.status();
+  EXPECT_EQ(sparse->num_rows, 5);
+  EXPECT_EQ(sparse->num_cols, 6);
+
+  DynamicArray dst(DataType::kFloat32, {5, 6});
+  ASSERT_TRUE(SparseToDense(*sparse, dst.ref().Permute({1, 0})).ok());
+  ExpectEqual(dst, dense);
+
+  sparse->format = SparseFormat::kCsc;
+  std::swap(sparse->num_rows, sparse->num_cols);
+  absl::StatusOr<DynamicArray> csc_dense = SparseToDense(*sparse);
+  ASSERT_TRUE(csc_dense.ok()) << csc_dense.status();
+  ExpectEqual(*csc_dense, dense);
+}
+
+TEST(SparseTest, CooDuplicatesAreSummed) {
+  SparseMatrix coo;
+  coo.format = SparseFormat::kCoo;
+  coo.num_rows = 2;
+  coo.num_cols = 2;
+  coo.data = DynamicArray(DataType::kInt32, {3});
+  coo.data.Set<int32_t>({0}, 5);
+  coo.data.Set<int32_t>({1}, 7);
+  coo.data.Set<int32_t>({2}, 1);
+  coo.row = {1, 0, 1};
+  coo.col = {0, 1, 0};
+
+  absl::StatusOr<DynamicArray> dense = SparseToDense(coo);
+  ASSERT_TRUE(dense.ok()) << dense.status();
+  EXPECT_EQ(dense->At<int32_t>({0, 0}), 0);
+  EXPECT_EQ(dense->At<int32_t>({1, 0}), 7);
+  EXPECT_EQ(dense->At<int32_t>({0, 1}), 6);
+
+  // Duplicates are kept, in order, by conversion.
+  absl::StatusOr<SparseMatrix> csr =
+      ConvertSparseFormat(coo, SparseFormat::kCsr);
+  ASSERT_TRUE(csr.ok()) << csr.status();
+  EXPECT_THAT(csr->indptr, ElementsAre(0, 1, 3));
+  EXPECT_THAT(csr->indices, ElementsAre(1, 0, 0));
+  EXPECT_EQ(csr->data.At<int32_t>({1}), 5);
+  EXPECT_EQ(csr->data.At<int32_t>({2}), 1);
+}
+
+TEST(SparseTest, Validate) {
+  SparseMatrix csr;
+  csr.num_rows = 2;
+  csr.num_cols = 3;
+  csr.data = DynamicArray(DataType::kFloat64, {2});
+  csr.indptr = {0, 1, 2};
+  csr.indices = {2, 0};
+  EXPECT_TRUE(csr.Validate().ok());
+
+  csr.indices = {3, 0};
+  EXPECT_EQ(csr.Validate().code(), absl::StatusCode::kInvalidArgument);
+  csr.indices = {2, 0};
+  csr.indptr = {0, 2, 1};
+  EXPECT_EQ(csr.Validate().code(), absl::StatusCode::kInvalidArgument);
+  csr.indptr = {0, 2};
+  EXPECT_EQ(csr.Validate().code(), absl::StatusCode::kInvalidArgument);
+}
+
+TEST(SparseTest, NpzRoundTrip) {
+  const DynamicArray dense = SparsePattern(9, 11);
+  for (const SparseFormat format :
+       {SparseFormat::kCsr, SparseFormat::kCsc, SparseFormat::kCoo}) {
+    absl::StatusOr<SparseMatrix> sparse = DenseToSparse(dense, format);
+    ASSERT_TRUE(sparse.ok()) << sparse.status();
+
+    ZipWriter zip;
+    ASSERT_TRUE(AddSparseMatrixToNpz(*sparse, &zip).ok());
+    absl::StatusOr<std::string> npz = std::move(zip).Close();
+    ASSERT_TRUE(npz.ok()) << npz.status();
+
+    auto files = ReadZipFile(*npz);
+    ASSERT_TRUE(files.ok()) << files.status();
+    EXPECT_TRUE(files->contains("format.npy"));
+    EXPECT_TRUE(files->contains("shape.npy"));
+    EXPECT_TRUE(files->contains(format == SparseFormat::kCoo ? "row.npy"
+                                                             : "indptr.npy"));
+
+    absl::StatusOr<SparseMatrix> read = ReadSparseMatrixFromNpz(*files);
+    ASSERT_TRUE(read.ok()) << read.status();
+    EXPECT_EQ(read->format, format);
+    EXPECT_EQ(read->indices, sparse->indices);
+    EXPECT_EQ(read->indptr, sparse->indptr);
+    EXPECT_EQ(read->row, sparse->row);
+    EXPECT_EQ(read->col, sparse->col);
+    absl::StatusOr<DynamicArray> read_dense = SparseToDense(*read);
+    ASSERT_TRUE(read_dense.ok()) << read_dense.status();
+    ExpectEqual(*read_dense, dense);
+  }
+}
+
+TEST(SparseTest, ReadErrors) {
+  absl::flat_hash_map<std::filesystem::path, std::string> files;
+  EXPECT_EQ(ReadSparseMatrixFromNpz(files).status().code(),
+            absl::StatusCode::kNotFound);
+
+  absl::StatusOr<SparseMatrix> sparse = DenseToSparse(SparsePattern(3, 3));
+  ASSERT_TRUE(sparse.ok());
+  ZipWriter zip;
+  ASSERT_TRUE(AddSparseMatrixToNpz(*sparse, &zip).ok());
+  absl::StatusOr<std::string> npz = std::move(zip).Close();
+  ASSERT_TRUE(npz.ok());
+  auto read_files = ReadZipFile(*npz);
+  ASSERT_TRUE(read_files.ok());
+  files = *std::move(read_files);
+
+  // A format scipy has but SparseMatrix doesn't.
+  std::string format = files["format.npy"];
+  format.replace(format.size() - 3, 3, "bsr");
+  std::swap(files["format.npy"], format);
+  EXPECT_EQ(ReadSparseMatrixFromNpz(files).status().code(),
+            absl::StatusCode::kInvalidArgument);
+  std::swap(files["format.npy"], format);
+
+  files.erase("indptr.npy");
+  EXPECT_EQ(ReadSparseMatrixFromNpz(files).status().code(),
+            absl::StatusCode::kNotFound);
+}
+
+}  // namespace
+}  // namespace npy_array
@@ -0,0 +1,411 @@
+#include "npy_array/strided_copy.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#include "absl/container/inlined_vector.h"
+#include "npy_array/compile_time_loop.h"
+#include "npy_array/interleave.h"
+#include "npy_array/thread_pool.h"
+
+#if defined(__linux__)
+#include <unistd.h>
+#endif
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace npy_array {
+
+namespace {
+
+// One loop of a copy. Unlike nda::dim, strides are in bytes.
+struct CopyDim {
+  int64_t extent;
+  int64_t src_stride;
+  int64_t dst_stride;
+};
+
+using CopyDims = absl::InlinedVector<CopyDim, 8>;
+
+// Sets `fused` to the loops of a copy, innermost first, after dropping extent-1
+// dimensions, sorting by destination stride and fusing contiguous dimensions.
+// Returns false if the copy has no elements.
+bool PlanCopyDims(absl::Span<const nda::dim<>> src_dims,
+                  absl::Span<const nda::dim<>> dst_dims, int64_t element_size,
+                  CopyDims& fused) {
+  assert(src_dims.size() == dst_dims.size());
+
+  CopyDims dims;
+  for (size_t d = 0; d < src_dims.size(); ++d) {
+    assert(src_dims[d].extent() == dst_dims[d].extent());
+    const int64_t extent = dst_dims[d].extent();
+    if (extent <= 0) {
+      return false;
+    }
+    if (extent == 1) {
+      continue;
+    }
+    dims.push_back({.extent = extent,
+                    .src_stride = src_dims[d].stride() * element_size,
+                    .dst_stride = dst_dims[d].stride() * element_size});
+  }
+
+  std::stable_sort(dims.begin(), dims.end(),
+                   [](const CopyDim& a, const CopyDim& b) {
+                     const int64_t a_dst = std::abs(a.dst_stride);
+                     const int64_t b_dst = std::abs(b.dst_stride);
+                     if (a_dst != b_dst) {
+                       return a_dst < b_dst;
+                     }
+                     return std::abs(a.src_stride) < std::abs(b.src_stride);
+                   });
+
+  fused.clear();
+  for (const CopyDim& dim : dims) {
+    if (!fused.empty()) {
+      CopyDim& last = fused.back();
+      if (last.extent * last.src_stride == dim.src_stride &&
+          last.extent * last.dst_stride == dim.dst_stride) {
+        last.extent *= dim.extent;
+        continue;
+      }
+    }
+    fused.push_back(dim);
+  }
+  return true;
+}
+
+// The kernel that runs the innermost one or two loops of a copy.
+enum class InnerKernel {
+  kElement,       // A single element (the copy has rank 0 after fusion).
+  kContiguous,    // A memcpy of the innermost loop.
+  kInterleave,    // Planar to interleaved: loops are (channels, pixels).
+  kDeinterleave,  // Interleaved to planar: loops are (pixels, channels).
+  kStrided,       // A strided loop over the innermost loop.
+};
+
+InnerKernel ChooseInnerKernel(const CopyDims& dims, int64_t element_size) {
+  if (dims.empty()) {
+    return InnerKernel::kElement;
+  }
+
+  const CopyDim& inner = dims[0];
+  if (inner.src_stride == element_size && inner.dst_stride == element_size) {
+    return InnerKernel::kContiguous;
+  }
+
+  if (dims.size() >= 2 && inner.dst_stride == element_size) {
+    const CopyDim& outer = dims[1];
+    if (outer.src_stride == element_size &&
+        outer.dst_stride == inner.extent * element_size &&
+        HasInterleaveKernel(inner.extent, element_size)) {
+      return InnerKernel::kInterleave;
+    }
+    if (outer.src_stride == element_size &&
+        inner.src_stride == outer.extent * element_size &&
+        HasInterleaveKernel(outer.extent, element_size)) {
+      return InnerKernel::kDeinterleave;
+    }
+  }
+
+  return InnerKernel::kStrided;
+}
+
+int InnerRank(InnerKernel kernel) {
+  switch (kernel) {
+    case InnerKernel::kElement:
+      return 0;
+    case InnerKernel::kContiguous:
+    case InnerKernel::kStrided:
+      return 1;
+    case InnerKernel::kInterleave:
+    case InnerKernel::kDeinterleave:
+      return 2;
+  }
+  return 1;
+}
+
+// Copies `n` kSize-byte elements with the given byte strides. Fixed-size
+// memcpys compile to single loads and stores, and the loop vectorizes when
+// either stride is kSize.
+template <int kSize>
+void CopyStridedElements(const uint8_t* src, int64_t src_stride, uint8_t* dst,
+                         int64_t dst_stride, int64_t n) {
+  if (dst_stride == kSize) {
+    for (int64_t i = 0; i < n; ++i) {
+      std::memcpy(dst + i * kSize, src + i * src_stride, kSize);
+    }
+  } else if (src_stride == kSize) {
+    for (int64_t i = 0; i < n; ++i) {
+      std::memcpy(dst + i * dst_stride, src + i * kSize, kSize);
+    }
+  } else {
+    for (int64_t i = 0; i < n; ++i) {
+      std::memcpy(dst + i * dst_stride, src + i * src_stride, kSize);
+    }
+  }
+}
+
+void CopyStridedElements(const uint8_t* src, int64_t src_stride, uint8_t* dst,
+                         int64_t dst_stride, int64_t n, int64_t element_size) {
+  bool done = false;
+  ForValues<1, 2, 4, 8, 16>([&]<int kSize>() {
+    if (kSize == element_size) {
+      CopyStridedElements<kSize>(src, src_stride, dst, dst_stride, n);
+      done = true;
+    }
+  });
+  if (!done) {
+    for (int64_t i = 0; i < n; ++i) {
+      std::memcpy(dst + i * dst_stride, src + i * src_stride, element_size);
+    }
+  }
+}
+
+// Multithreaded contiguous copies are split at multiples of this many bytes in
+// `dst` so that no two threads write to the same page.
+constexpr int64_t kPageSize = 4096;
+
+// Returns the size of the last-level cache, or a conservative guess if it
+// can't be queried.
+int64_t LastLevelCacheSizeBytes() {
+  static const int64_t size_bytes = [] {
+#if defined(__linux__) && defined(_SC_LEVEL3_CACHE_SIZE)
+    for (int name : {_SC_LEVEL3_CACHE_SIZE, _SC_LEVEL2_CACHE_SIZE}) {
+      const long bytes = sysconf(name);
+      if (bytes > 0) {
+        return static_cast<int64_t>(bytes);
+      }
+    }
+#endif
+    return int64_t{32} << 20;  // 32 MB.
+  }();
+  return size_bytes;
+}
+
+}  // namespace
+
+bool UseNonTemporalStores(const StridedCopyOptions& options,
+                          int64_t total_bytes) {
+  const int64_t min_bytes = options.non_temporal_min_bytes < 0
+                                ? LastLevelCacheSizeBytes()
+                                : options.non_temporal_min_bytes;
+  return total_bytes >= min_bytes;
+}
+
+namespace {
+
+// Copies `n` bytes using non-temporal stores where the target supports them.
+// The stores are weakly ordered: call StoreFence() before other threads read
+// `dst`.
+void CopyNonTemporal(const uint8_t* src, uint8_t* dst, int64_t n) {
+#if defined(__SSE2__)
+  // Streaming stores require 16-byte aligned destinations.
+  const int64_t head =
+      std::min<int64_t>(n, -reinterpret_cast<uintptr_t>(dst) & 15);
+  std::memcpy(dst, src, head);
+  src += head;
+  dst += head;
+  n -= head;
+
+  int64_t i = 0;
+  for (; i + 64 <= n; i += 64) {
+    const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+    const __m128i b =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i + 16));
+    const __m128i c =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i + 32));
+    const __m128i d =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i + 48));
+    _mm_stream_si128(reinterpret_cast<__m128i*>(dst + i), a);
+    _mm_stream_si128(reinterpret_cast<__m128i*>(dst + i + 16), b);
+    _mm_stream_si128(reinterpret_cast<__m128i*>(dst + i + 32), c);
+    _mm_stream_si128(reinterpret_cast<__m128i*>(dst + i + 48), d);
+  }
+  for (; i + 16 <= n; i += 16) {
+    _mm_stream_si128(
+        reinterpret_cast<__m128i*>(dst + i),
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i)));
+  }
+  std::memcpy(dst + i, src + i, n - i);
+#else
+  std::memcpy(dst, src, n);
+#endif
+}
+
+void StoreFence() {
+#if defined(__SSE2__)
+  _mm_sfence();
+#endif
+}
+
+// Copies a contiguous run of bytes. Runs shorter than a cache line aren't worth
+// streaming.
+void CopyContiguous(const uint8_t* src, uint8_t* dst, int64_t n,
+                    bool non_temporal) {
+  if (non_temporal && n >= 64) {
+    CopyNonTemporal(src, dst, n);
+  } else {
+    std::memcpy(dst, src, n);
+  }
+}
+
+// Runs the copy described by `dims` (as planned by PlanCopyDims) on the
+// calling thread.
+void CopySerial(const uint8_t* src, uint8_t* dst, const CopyDims& dims,
+                int64_t element_size, bool non_temporal) {
+  const InnerKernel kernel = ChooseInnerKernel(dims, element_size);
+  const size_t inner_rank = InnerRank(kernel);
+
+  auto copy_inner = [&](const uint8_t* s, uint8_t* d) {
+    switch (kernel) {
+      case InnerKernel::kElement:
+        std::memcpy(d, s, element_size);
+        break;
+      case InnerKernel::kContiguous:
+        CopyContiguous(s, d, dims[0].extent * element_size, non_temporal);
+        break;
+      case InnerKernel::kInterleave:
+        Interleave(s, dims[0].src_stride / element_size, dims[0].extent,
+                   dims[1].extent, element_size, d);
+        break;
+      case InnerKernel::kDeinterleave:
+        Deinterleave(s, dims[1].extent, dims[0].extent, element_size, d,
+                     dims[1].dst_stride / element_size);
+        break;
+      case InnerKernel::kStrided:
+        CopyStridedElements(s, dims[0].src_stride, d, dims[0].dst_stride,
+                            dims[0].extent, element_size);
+        break;
+    }
+  };
+
+  // Walk the outer loops like an odometer.
+  const size_t outer_rank = dims.size() - inner_rank;
+  absl::InlinedVector<int64_t, 8> index(outer_rank, 0);
+  while (true) {
+    copy_inner(src, dst);
+
+    size_t d = 0;
+    for (; d < outer_rank; ++d) {
+      const CopyDim& dim = dims[inner_rank + d];
+      src += dim.src_stride;
+      dst += dim.dst_stride;
+      if (++index[d] < dim.extent) {
+        break;
+      }
+      src -= dim.src_stride * dim.extent;
+      dst -= dim.dst_stride * dim.extent;
+      index[d] = 0;
+    }
+    if (d == outer_rank) {
+      break;
+    }
+  }
+
+  if (non_temporal) {
+    StoreFence();
+  }
+}
+
+}  // namespace
+
+void CopyBytes(const void* src, void* dst, int64_t size_bytes,
+               const StridedCopyOptions& options) {
+  if (size_bytes <= 0) {
+    return;
+  }
+  const uint8_t* src_bytes = static_cast<const uint8_t*>(src);
+  uint8_t* dst_bytes = static_cast<uint8_t*>(dst);
+  const bool non_temporal = UseNonTemporalStores(options, size_bytes);
+
+  const int num_threads = internal::ResolveThreads(
+      options.threading, size_bytes, size_bytes / kPageSize + 1);
+  if (num_threads == 1) {
+    CopyContiguous(src_bytes, dst_bytes, size_bytes, non_temporal);
+    if (non_temporal) {
+      StoreFence();
+    }
+    return;
+  }
+
+  // Split `dst` at page boundaries. Chunk t covers [Boundary(t),
+  // Boundary(t + 1)), where the first and last boundaries are the ends of the
+  // buffer.
+  const uintptr_t dst_address = reinterpret_cast<uintptr_t>(dst_bytes);
+  auto boundary = [&](int64_t t) -> int64_t {
+    if (t == 0) {
+      return 0;
+    }
+    if (t == num_threads) {
+      return size_bytes;
+    }
+    const uintptr_t split = dst_address + size_bytes * t / num_threads;
+    const uintptr_t aligned = (split + kPageSize - 1) & ~uintptr_t{kPageSize - 1};
+    return std::min<int64_t>(aligned - dst_address, size_bytes);
+  };
+  internal::ResolveThreadPool(options.threading).ParallelFor(
+      num_threads, num_threads, [&](int64_t t) {
+        const int64_t begin = boundary(t);
+        const int64_t end = boundary(t + 1);
+        CopyContiguous(src_bytes + begin, dst_bytes + begin, end - begin,
+                       non_temporal);
+        if (non_temporal) {
+          StoreFence();
+        }
+      });
+}
+
+void StridedCopy(const void* src, absl::Span<const nda::dim<>> src_dims,
+                 void* dst, absl::Span<const nda::dim<>> dst_dims,
+                 int64_t element_size, const StridedCopyOptions& options) {
+  CopyDims dims;
+  if (!PlanCopyDims(src_dims, dst_dims, element_size, dims)) {
+    return;
+  }
+
+  int64_t total_bytes = element_size;
+  for (const CopyDim& dim : dims) {
+    total_bytes *= dim.extent;
+  }
+
+  // After fusion, a copy between two compact buffers is a single contiguous
+  // loop.
+  if (dims.size() == 1 &&
+      ChooseInnerKernel(dims, element_size) == InnerKernel::kContiguous) {
+    CopyBytes(src, dst, total_bytes, options);
+    return;
+  }
+
+  const uint8_t* src_bytes = static_cast<const uint8_t*>(src);
+  uint8_t* dst_bytes = static_cast<uint8_t*>(dst);
+  const bool non_temporal = UseNonTemporalStores(options, total_bytes);
+
+  const int64_t outer_extent = dims.empty() ? 1 : dims.back().extent;
+  const int num_threads =
+      internal::ResolveThreads(options.threading, total_bytes, outer_extent);
+  if (num_threads == 1) {
+    CopySerial(src_bytes, dst_bytes, dims, element_size, non_temporal);
+    return;
+  }
+
+  // Split the outermost loop into `num_threads` contiguous ranges. Each range
+  // is the same copy with a shorter outermost loop.
+  internal::ResolveThreadPool(options.threading).ParallelFor(
+      num_threads, num_threads, [&](int64_t t) {
+        const int64_t begin = outer_extent * t / num_threads;
+        const int64_t end = outer_extent * (t + 1) / num_threads;
+        CopyDims range_dims = dims;
+        range_dims.back().extent = end - begin;
+        CopySerial(src_bytes + begin * dims.back().src_stride,
+                   dst_bytes + begin * dims.back().dst_stride, range_dims,
+                   element_size, non_temporal);
+      });
+}
+
+}  // namespace npy_array
@@ -0,0 +1,89 @@
+#ifndef NPY_ARRAY_STRIDED_COPY_H_
+#define NPY_ARRAY_STRIDED_COPY_H_
+
+#include <array>
+#include <cstdint>
+#include <type_traits>
+
+#include "absl/types/span.h"
+#include "array/array.h"
+#include "npy_array/thread_pool.h"
+
+namespace npy_array {
+
+struct StridedCopyOptions {
+  // Splits large copies across threads. `min_bytes_per_thread` counts bytes
+  // copied, and defaults to 8 MB.
+  ThreadingOptions threading = {.min_bytes_per_thread = int64_t{8} << 20};
+
+  // Copies that write at least this many bytes use non-temporal (streaming)
+  // stores for their contiguous runs, which bypass the cache: the output would
+  // evict itself from the cache before it is read back anyway. -1 means the
+  // size of the last-level cache. Use INT64_MAX to disable.
+  int64_t non_temporal_min_bytes = -1;
+};
+
+// Copies an n-dimensional array of `element_size`-byte elements from `src` to
+// `dst`.
+//
+// `src` and `dst` point to the element at the min of their respective dims.
+// `src_dims` and `dst_dims` must have the same rank and extents. Mins are
+// ignored and strides are in elements (they may be zero or negative for `src`).
+// `src` and `dst` must not overlap.
+//
+// The copy is planned before any data is touched:
+// - Dimensions of extent 1 are dropped.
+// - Loops are ordered by destination stride, innermost first, so writes are as
+//   sequential as possible.
+// - Adjacent dimensions that are contiguous with each other in both `src` and
+//   `dst` are fused into one.
+// - The innermost loop is a memcpy if it is contiguous in both, a planar <-->
+//   interleaved kernel if the two innermost loops are channels and pixels (see
+//   interleave.h), or a strided loop specialized for the element size.
+// - Large copies are split across threads: a fully contiguous copy is split
+//   into page-aligned chunks of `dst`, anything else along its outermost loop.
+void StridedCopy(const void* src, absl::Span<const nda::dim<>> src_dims,
+                 void* dst, absl::Span<const nda::dim<>> dst_dims,
+                 int64_t element_size,
+                 const StridedCopyOptions& options = StridedCopyOptions());
+
+// Copies `size_bytes` bytes from `src` to `dst`, like std::memcpy, but with the
+// threading and non-temporal stores of StridedCopy().
+void CopyBytes(const void* src, void* dst, int64_t size_bytes,
+               const StridedCopyOptions& options = StridedCopyOptions());
+
+// Returns true if a copy that writes `total_bytes` bytes uses non-temporal
+// stores under `options`.
+bool UseNonTemporalStores(const StridedCopyOptions& options,
+                          int64_t total_bytes);
+
+// Copies `src` to `dst`, which must have the same extents. Equivalent to
+// nda::copy(src, dst), but uses StridedCopy() above.
+template <typename SrcT, typename SrcShape, typename DstT, typename DstShape>
+void StridedCopy(const nda::array_ref<SrcT, SrcShape>& src,
+                 const nda::array_ref<DstT, DstShape>& dst,
+                 const StridedCopyOptions& options = StridedCopyOptions());
+
+// ----- Implementation of template functions -----
+template <typename SrcT, typename SrcShape, typename DstT, typename DstShape>
+void StridedCopy(const nda::array_ref<SrcT, SrcShape>& src,
+                 const nda::array_ref<DstT, DstShape>& dst,
+                 const StridedCopyOptions& options) {
+  static_assert(std::is_same_v<std::remove_const_t<SrcT>, DstT>,
+                "StridedCopy requires matching element types.");
+  static_assert(SrcShape::rank() == DstShape::rank(),
+                "StridedCopy requires matching ranks.");
+
+  std::array<nda::dim<>, SrcShape::rank()> src_dims;
+  std::array<nda::dim<>, DstShape::rank()> dst_dims;
+  for (size_t d = 0; d < SrcShape::rank(); ++d) {
+    src_dims[d] = src.shape().dim(d);
+    dst_dims[d] = dst.shape().dim(d);
+  }
+  StridedCopy(src.data(), src_dims, dst.data(), dst_dims, sizeof(DstT),
+              options);
+}
+
+}  // namespace npy_array
+
+#endif  // NPY_ARRAY_STRIDED_COPY_H_
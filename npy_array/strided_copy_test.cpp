@@ -0,0 +1,235 @@
+#include "npy_array/strided_copy.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <numeric>
+#include <vector>
+
+#include "array/array.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+using testing::ElementsAreArray;
+
+namespace npy_array {
+namespace {
+
+// Fills `array` with 1, 2, 3, ... in index order.
+template <typename T, typename Shape>
+void FillSequential(const nda::array_ref<T, Shape>& array) {
+  int value = 1;
+  array.for_each_value([&](T& v) { v = static_cast<T>(value++); });
+}
+
+template <typename T>
+class StridedCopyTest : public testing::Test {};
+
+using MyTypes = testing::Types<uint8_t, uint16_t, float, double>;
+TYPED_TEST_SUITE(StridedCopyTest, MyTypes);
+
+TYPED_TEST(StridedCopyTest, Compact) {
+  nda::array_of_rank<TypeParam, 3> src({17, 5, 3});
+  FillSequential(src.ref());
+  nda::array_of_rank<TypeParam, 3> dst({17, 5, 3});
+
+  StridedCopy(src.cref(), dst.ref());
+  EXPECT_EQ(std::memcmp(src.data(), dst.data(), src.size() * sizeof(TypeParam)),
+            0);
+}
+
+TYPED_TEST(StridedCopyTest, Transpose) {
+  nda::array_of_rank<TypeParam, 3> src({7, 11, 5});
+  FillSequential(src.ref());
+  nda::array_of_rank<TypeParam, 3> dst({5, 7, 11});
+
+  StridedCopy(nda::reorder<2, 0, 1>(src.cref()), dst.ref());
+  for (auto z : src.z()) {
+    for (auto y : src.y()) {
+      for (auto x : src.x()) {
+        EXPECT_EQ(dst(z, x, y), src(x, y, z));
+      }
+    }
+  }
+}
+
+TYPED_TEST(StridedCopyTest, PlanarToInterleaved) {
+  for (int channels : {1, 2, 3, 4, 5, 8}) {
+    nda::array_of_rank<TypeParam, 3> planar({37, 9, channels});
+    FillSequential(planar.ref());
+    nda::array_of_rank<TypeParam, 3> interleaved({channels, 37, 9});
+
+    StridedCopy(nda::reorder<2, 0, 1>(planar.cref()), interleaved.ref());
+    for (auto c : planar.z()) {
+      for (auto y : planar.y()) {
+        for (auto x : planar.x()) {
+          EXPECT_EQ(interleaved(c, x, y), planar(x, y, c))
+              << "channels = " << channels;
+        }
+      }
+    }
+  }
+}
+
+TYPED_TEST(StridedCopyTest, InterleavedToPlanar) {
+  for (int channels : {1, 2, 3, 4, 5, 8}) {
+    nda::array_of_rank<TypeParam, 3> interleaved({channels, 23, 6});
+    FillSequential(interleaved.ref());
+    nda::array_of_rank<TypeParam, 3> planar({23, 6, channels});
+
+    StridedCopy(interleaved.cref(), nda::reorder<2, 0, 1>(planar.ref()));
+    for (auto c : planar.z()) {
+      for (auto y : planar.y()) {
+        for (auto x : planar.x()) {
+          EXPECT_EQ(planar(x, y, c), interleaved(c, x, y))
+              << "channels = " << channels;
+        }
+      }
+    }
+  }
+}
+
+TYPED_TEST(StridedCopyTest, PaddedSource) {
+  // A crop of a larger array: rows are contiguous but not adjacent.
+  nda::array_of_rank<TypeParam, 2> big({40, 10});
+  FillSequential(big.ref());
+  nda::shape_of_rank<2> crop_shape(nda::dim<>(3, 30, 1), nda::dim<>(2, 6, 40));
+  const auto src = nda::make_array_ref(big.cref().base(), crop_shape);
+
+  nda::array_of_rank<TypeParam, 2> dst({30, 6});
+  StridedCopy(src, dst.ref());
+  for (auto y : dst.y()) {
+    for (auto x : dst.x()) {
+      EXPECT_EQ(dst(x, y), big(x + 3, y + 2));
+    }
+  }
+}
+
+TYPED_TEST(StridedCopyTest, NegativeAndZeroStrides) {
+  std::vector<TypeParam> src(13);
+  std::iota(src.begin(), src.end(), TypeParam(1));
+
+  // Reverse `src` along x and broadcast it along y.
+  const std::array<nda::dim<>, 2> src_dims = {nda::dim<>(0, 13, -1),
+                                              nda::dim<>(0, 4, 0)};
+  const std::array<nda::dim<>, 2> dst_dims = {nda::dim<>(0, 13, 1),
+                                              nda::dim<>(0, 4, 13)};
+  std::vector<TypeParam> dst(13 * 4);
+  StridedCopy(&src.back(), src_dims, dst.data(), dst_dims, sizeof(TypeParam));
+
+  std::vector<TypeParam> expected;
+  for (int y = 0; y < 4; ++y) {
+    expected.insert(expected.end(), src.rbegin(), src.rend());
+  }
+  EXPECT_THAT(dst, ElementsAreArray(expected));
+}
+
+TYPED_TEST(StridedCopyTest, MultipleThreads) {
+  nda::array_of_rank<TypeParam, 3> src({64, 33, 3});
+  FillSequential(src.ref());
+
+  for (int max_threads : {2, 3, 8}) {
+    nda::array_of_rank<TypeParam, 3> dst({3, 64, 33});
+    StridedCopy(nda::reorder<2, 0, 1>(src.cref()), dst.ref(),
+                StridedCopyOptions{.threading = {.max_threads = max_threads,
+                                                 .min_bytes_per_thread = 1}});
+    for (auto z : src.z()) {
+      for (auto y : src.y()) {
+        for (auto x : src.x()) {
+          EXPECT_EQ(dst(z, x, y), src(x, y, z))
+              << "max_threads = " << max_threads;
+        }
+      }
+    }
+  }
+}
+
+TYPED_TEST(StridedCopyTest, NonTemporalStores) {
+  nda::array_of_rank<TypeParam, 3> src({67, 41, 3});
+  FillSequential(src.ref());
+
+  // Force non-temporal stores for both the contiguous and the strided paths.
+  const StridedCopyOptions options = {.non_temporal_min_bytes = 0};
+  nda::array_of_rank<TypeParam, 3> compact({67, 41, 3});
+  StridedCopy(src.cref(), compact.ref(), options);
+  EXPECT_EQ(
+      std::memcmp(src.data(), compact.data(), src.size() * sizeof(TypeParam)),
+      0);
+
+  nda::array_of_rank<TypeParam, 3> cropped({60, 41, 3});
+  const nda::shape_of_rank<3> crop_shape(
+      nda::dim<>(0, 60, 1), nda::dim<>(0, 41, 67), nda::dim<>(0, 3, 67 * 41));
+  const auto src_crop = nda::make_array_ref(src.data() + 3, crop_shape);
+  StridedCopy(src_crop, cropped.ref(), options);
+  for (auto z : cropped.z()) {
+    for (auto y : cropped.y()) {
+      for (auto x : cropped.x()) {
+        EXPECT_EQ(cropped(x, y, z), src(x + 3, y, z));
+      }
+    }
+  }
+}
+
+TEST(StridedCopyTest, CopyBytes) {
+  std::vector<uint8_t> src(3 * 4096 + 123);
+  std::iota(src.begin(), src.end(), uint8_t{0});
+
+  ThreadPool pool(3);
+  for (int64_t non_temporal_min_bytes : {int64_t{0}, INT64_MAX}) {
+    for (int max_threads : {1, 2, 4}) {
+      // Copy into a misaligned destination so that chunks don't start at page
+      // boundaries of `dst`.
+      std::vector<uint8_t> dst(src.size() + 7, 0);
+      CopyBytes(src.data(), dst.data() + 7, src.size(),
+                {.threading = {.max_threads = max_threads,
+                               .min_bytes_per_thread = 1000,
+                               .thread_pool = &pool},
+                 .non_temporal_min_bytes = non_temporal_min_bytes});
+      EXPECT_TRUE(std::equal(src.begin(), src.end(), dst.begin() + 7))
+          << "max_threads = " << max_threads;
+    }
+  }
+}
+
+TEST(StridedCopyTest, ScalarAndEmpty) {
+  const double src = 42.0;
+  double dst = 0.0;
+  StridedCopy(&src, {}, &dst, {}, sizeof(double));
+  EXPECT_EQ(dst, 42.0);
+
+  // An empty copy doesn't touch memory.
+  const std::array<nda::dim<>, 2> dims = {nda::dim<>(0, 0, 1),
+                                          nda::dim<>(0, 5, 0)};
+  StridedCopy(nullptr, dims, nullptr, dims, sizeof(double));
+}
+
+TEST(StridedCopyTest, UnusualElementSizes) {
+  // 3-byte and 16-byte elements use the generic and 16-byte kernels.
+  for (int64_t element_size : {3, 16}) {
+    const int64_t width = 9;
+    const int64_t height = 4;
+    std::vector<uint8_t> src(width * height * element_size);
+    std::iota(src.begin(), src.end(), uint8_t{0});
+
+    // Transpose.
+    const std::array<nda::dim<>, 2> src_dims = {nda::dim<>(0, width, 1),
+                                                nda::dim<>(0, height, width)};
+    const std::array<nda::dim<>, 2> dst_dims = {nda::dim<>(0, width, height),
+                                                nda::dim<>(0, height, 1)};
+    std::vector<uint8_t> dst(src.size());
+    StridedCopy(src.data(), src_dims, dst.data(), dst_dims, element_size);
+
+    for (int64_t y = 0; y < height; ++y) {
+      for (int64_t x = 0; x < width; ++x) {
+        EXPECT_EQ(std::memcmp(&dst[(x * height + y) * element_size],
+                              &src[(y * width + x) * element_size],
+                              element_size),
+                  0);
+      }
+    }
+  }
+}
+
+}  // namespace
+}  // namespace npy_array
@@ -0,0 +1,136 @@
+#include "npy_array/thread_pool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <utility>
+
+namespace npy_array {
+
+ThreadPool::ThreadPool(int num_workers) {
+  workers_.reserve(std::max(num_workers, 0));
+  for (int i = 0; i < num_workers; ++i) {
+    workers_.emplace_back([this] { WorkerLoop(); });
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  work_available_.notify_all();
+  for (std::thread& worker : workers_) {
+    worker.join();
+  }
+}
+
+ThreadPool& ThreadPool::Default() {
+  static ThreadPool* pool = [] {
+    const int num_threads =
+        std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+    return new ThreadPool(num_threads - 1);
+  }();
+  return *pool;
+}
+
+void ThreadPool::WorkerLoop() {
+  while (true) {
+    std::function<void()> task;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      work_available_.wait(lock, [this] { return stopping_ || !queue_.empty(); });
+      if (queue_.empty()) {
+        return;
+      }
+      task = std::move(queue_.front());
+      queue_.pop_front();
+    }
+    task();
+  }
+}
+
+void ThreadPool::ParallelFor(int64_t n, int max_parallelism,
+                             const std::function<void(int64_t)>& f) {
+  if (n <= 0) {
+    return;
+  }
+  const int64_t num_helpers =
+      std::min<int64_t>({n, max_parallelism, num_workers() + 1}) - 1;
+  if (num_helpers <= 0) {
+    for (int64_t i = 0; i < n; ++i) {
+      f(i);
+    }
+    return;
+  }
+
+  // Helpers and the calling thread claim indices from a shared counter. Helpers
+  // that start after all indices are claimed exit immediately, so `state` is
+  // shared with them rather than living on this stack frame.
+  struct State {
+    std::atomic<int64_t> next{0};
+    std::mutex mutex;
+    std::condition_variable all_done;
+    int64_t num_done = 0;
+  };
+  auto state = std::make_shared<State>();
+
+  auto run = [state, n, &f] {
+    int64_t num_run = 0;
+    for (int64_t i = state->next++; i < n; i = state->next++) {
+      f(i);
+      ++num_run;
+    }
+    if (num_run > 0) {
+      std::lock_guard<std::mutex> lock(state->mutex);
+      state->num_done += num_run;
+      if (state->num_done == n) {
+        state->all_done.notify_all();
+      }
+    }
+  };
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (int64_t i = 0; i < num_helpers; ++i) {
+      queue_.push_back(run);
+    }
+  }
+  work_available_.notify_all();
+
+  run();
+
+  std::unique_lock<std::mutex> lock(state->mutex);
+  state->all_done.wait(lock, [&] { return state->num_done == n; });
+}
+
+namespace internal {
+
+ThreadPool& ResolveThreadPool(const ThreadingOptions& options) {
+  return options.thread_pool != nullptr ? *options.thread_pool
+                                        : ThreadPool::Default();
+}
+
+int ResolveThreads(const ThreadingOptions& options, int64_t total_bytes,
+                   int64_t max_chunks) {
+  if (options.max_threads == 1) {
+    return 1;
+  }
+  const int64_t min_bytes = std::max<int64_t>(options.min_bytes_per_thread, 1);
+  // Small operations don't touch the pool, so they never start the default
+  // one.
+  if (total_bytes < 2 * min_bytes) {
+    return 1;
+  }
+  const int64_t pool_threads = ResolveThreadPool(options).num_workers() + 1;
+  const int64_t max_threads = options.max_threads <= 0
+                                  ? pool_threads
+                                  : std::min<int64_t>(options.max_threads,
+                                                      pool_threads);
+  return static_cast<int>(std::clamp<int64_t>(
+      std::min(total_bytes / min_bytes, max_chunks), 1, max_threads));
+}
+
+}  // namespace internal
+
+}  // namespace npy_array
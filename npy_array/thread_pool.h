@@ -0,0 +1,90 @@
+#ifndef NPY_ARRAY_THREAD_POOL_H_
+#define NPY_ARRAY_THREAD_POOL_H_
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace npy_array {
+
+// A fixed-size pool of worker threads for data-parallel loops.
+//
+// The pool is meant for coarse-grained work such as splitting a large copy into
+// a handful of chunks, not for fine-grained tasks.
+class ThreadPool {
+ public:
+  // Starts `num_workers` worker threads. `num_workers` may be zero, in which
+  // case all work runs on the calling thread.
+  explicit ThreadPool(int num_workers);
+
+  // Waits for queued work to finish and joins all workers.
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  // Returns a process-wide pool with one worker per hardware thread, minus one
+  // for the calling thread. It is created on first use and never destroyed.
+  static ThreadPool& Default();
+
+  int num_workers() const { return static_cast<int>(workers_.size()); }
+
+  // Calls `f(i)` for each i in [0, n), using up to `max_parallelism` threads
+  // including the calling thread, and returns when all calls have finished.
+  // Calls may run in any order and concurrently with each other.
+  //
+  // The calling thread participates, so ParallelFor may be called from a
+  // worker of the same pool without deadlocking.
+  void ParallelFor(int64_t n, int max_parallelism,
+                   const std::function<void(int64_t)>& f);
+
+ private:
+  void WorkerLoop();
+
+  std::mutex mutex_;
+  std::condition_variable work_available_;
+  std::deque<std::function<void()>> queue_;
+  bool stopping_ = false;
+  std::vector<std::thread> workers_;
+};
+
+// How a data-parallel operation is split across a ThreadPool.
+// StridedCopyOptions, ConvertOptions, ReduceOptions, ForEachOptions and
+// LoadNpzOptions each hold one, and say which bytes `min_bytes_per_thread`
+// counts.
+struct ThreadingOptions {
+  // The maximum number of threads used for one operation, including the
+  // calling thread. 1 means the operation runs on the calling thread. 0 means
+  // use every thread in `thread_pool`.
+  int max_threads = 1;
+
+  // Each thread processes at least this many bytes. Operations on fewer than
+  // twice as many run on the calling thread regardless of `max_threads`, and
+  // never start ThreadPool::Default().
+  int64_t min_bytes_per_thread = int64_t{1} << 20;  // 1 MB.
+
+  // The pool that runs multithreaded operations. nullptr means
+  // ThreadPool::Default().
+  ThreadPool* thread_pool = nullptr;
+};
+
+namespace internal {
+
+// Returns `options.thread_pool`, or ThreadPool::Default() if it is nullptr.
+ThreadPool& ResolveThreadPool(const ThreadingOptions& options);
+
+// Returns the number of threads, including the calling thread, to use for an
+// operation on `total_bytes` that can be split into at most `max_chunks`
+// pieces. The result is at least 1 and at most the size of the pool.
+int ResolveThreads(const ThreadingOptions& options, int64_t total_bytes,
+                   int64_t max_chunks);
+
+}  // namespace internal
+
+}  // namespace npy_array
+
+#endif  // NPY_ARRAY_THREAD_POOL_H_
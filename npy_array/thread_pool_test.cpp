@@ -0,0 +1,80 @@
+#include "npy_array/thread_pool.h"
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+using testing::Each;
+
+namespace npy_array {
+namespace {
+
+TEST(ThreadPoolTest, ParallelForVisitsEachIndexOnce) {
+  ThreadPool pool(3);
+  EXPECT_EQ(pool.num_workers(), 3);
+
+  for (int max_parallelism : {1, 2, 4, 100}) {
+    std::vector<std::atomic<int>> counts(1000);
+    pool.ParallelFor(counts.size(), max_parallelism,
+                     [&](int64_t i) { ++counts[i]; });
+    for (const std::atomic<int>& count : counts) {
+      EXPECT_EQ(count.load(), 1) << "max_parallelism = " << max_parallelism;
+    }
+  }
+}
+
+TEST(ThreadPoolTest, NoWorkers) {
+  ThreadPool pool(0);
+  std::vector<int> values(10, 0);
+  pool.ParallelFor(values.size(), 4, [&](int64_t i) { values[i] = 1; });
+  EXPECT_THAT(values, Each(1));
+}
+
+TEST(ThreadPoolTest, Nested) {
+  ThreadPool pool(2);
+  std::atomic<int> count = 0;
+  pool.ParallelFor(4, 4, [&](int64_t) {
+    pool.ParallelFor(8, 4, [&](int64_t) { ++count; });
+  });
+  EXPECT_EQ(count.load(), 32);
+}
+
+TEST(ThreadPoolTest, Default) {
+  EXPECT_EQ(&ThreadPool::Default(), &ThreadPool::Default());
+  std::atomic<int> count = 0;
+  ThreadPool::Default().ParallelFor(16, 0x7fffffff, [&](int64_t) { ++count; });
+  EXPECT_EQ(count.load(), 16);
+}
+
+TEST(ThreadPoolTest, ResolveThreads) {
+  ThreadPool pool(3);
+  const ThreadingOptions options{
+      .max_threads = 0, .min_bytes_per_thread = 100, .thread_pool = &pool};
+  EXPECT_EQ(&internal::ResolveThreadPool(options), &pool);
+
+  // Under twice the minimum runs on the calling thread.
+  EXPECT_EQ(internal::ResolveThreads(options, 199, 100), 1);
+  EXPECT_EQ(internal::ResolveThreads(options, 200, 100), 2);
+  // Limited by the pool, the chunks, and `max_threads`.
+  EXPECT_EQ(internal::ResolveThreads(options, 10000, 100), 4);
+  EXPECT_EQ(internal::ResolveThreads(options, 10000, 3), 3);
+  EXPECT_EQ(internal::ResolveThreads({.max_threads = 2,
+                                      .min_bytes_per_thread = 100,
+                                      .thread_pool = &pool},
+                                     10000, 100),
+            2);
+  EXPECT_EQ(internal::ResolveThreads({.max_threads = 1}, int64_t{1} << 40, 100),
+            1);
+  // A non-positive minimum is treated as 1 byte.
+  EXPECT_EQ(internal::ResolveThreads({.max_threads = 0,
+                                      .min_bytes_per_thread = 0,
+                                      .thread_pool = &pool},
+                                     2, 100),
+            2);
+}
+
+}  // namespace
+}  // namespace npy_array
@@ -0,0 +1,271 @@
+#include "npy_array/validate.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "absl/strings/str_cat.h"
+#include "npy_array/bfloat16.h"
+#include "npy_array/compile_time_loop.h"
+#include "npy_array/half.h"
+#include "npy_array/thread_pool.h"
+
+namespace npy_array {
+
+namespace {
+
+// Data is copied and checked in blocks of this many bytes, which fit in the L1
+// cache. It is a multiple of every element size and of the checksum word size.
+constexpr int64_t kBlockBytes = 16 << 10;
+
+constexpr double kNaN = std::numeric_limits<double>::quiet_NaN();
+constexpr double kInf = std::numeric_limits<double>::infinity();
+
+// Partial results of a range of blocks. `min` and `max` start out empty
+// (+inf and -inf).
+struct PartialStats {
+  int64_t nan_count = 0;
+  int64_t inf_count = 0;
+  int64_t out_of_range_count = 0;
+  double min = kInf;
+  double max = -kInf;
+  uint64_t checksum_sum = 0;
+};
+
+// Checks `n` elements at `data` against [lo, hi] and accumulates into `stats`.
+using ScanBlockFn = void (*)(const uint8_t* data, int64_t n, double lo,
+                             double hi, PartialStats& stats);
+
+template <typename T>
+void ScanBlock(const uint8_t* data, int64_t n, double lo, double hi,
+               PartialStats& stats) {
+  const T* typed = reinterpret_cast<const T*>(data);
+  if constexpr (std::is_integral_v<T>) {
+    // Integers can't be NaN or infinite, and the block range is computed
+    // without branches. Out of range values are only counted if the block
+    // range shows there are some.
+    T block_min = typed[0];
+    T block_max = typed[0];
+    for (int64_t i = 1; i < n; ++i) {
+      block_min = std::min(block_min, typed[i]);
+      block_max = std::max(block_max, typed[i]);
+    }
+    stats.min = std::min(stats.min, static_cast<double>(block_min));
+    stats.max = std::max(stats.max, static_cast<double>(block_max));
+    if (static_cast<double>(block_min) < lo ||
+        static_cast<double>(block_max) > hi) {
+      for (int64_t i = 0; i < n; ++i) {
+        const double x = static_cast<double>(typed[i]);
+        stats.out_of_range_count += (x < lo) | (x > hi);
+      }
+    }
+  } else {
+    // 16-bit floats are checked as float.
+    using F = std::conditional_t<sizeof(T) == 2, float, T>;
+    constexpr F kTypeInf = std::numeric_limits<F>::infinity();
+    F block_min = kTypeInf;
+    F block_max = -kTypeInf;
+    int64_t nan_count = 0;
+    int64_t inf_count = 0;
+    for (int64_t i = 0; i < n; ++i) {
+      const F x = static_cast<F>(typed[i]);
+      nan_count += x != x;
+      inf_count += std::abs(x) == kTypeInf;
+      // Comparisons with NaN are false, so NaN never becomes the min or max.
+      block_min = x < block_min ? x : block_min;
+      block_max = x > block_max ? x : block_max;
+    }
+    stats.nan_count += nan_count;
+    stats.inf_count += inf_count;
+    stats.min = std::min(stats.min, static_cast<double>(block_min));
+    stats.max = std::max(stats.max, static_cast<double>(block_max));
+    if (static_cast<double>(block_min) < lo ||
+        static_cast<double>(block_max) > hi) {
+      for (int64_t i = 0; i < n; ++i) {
+        const double x = static_cast<double>(static_cast<F>(typed[i]));
+        stats.out_of_range_count += (x < lo) | (x > hi);
+      }
+    }
+  }
+}
+
+ScanBlockFn GetScanBlockFn(DataType data_type) {
+  ScanBlockFn scan = nullptr;
+  ForTypes<int8_t, int16_t, int32_t, int64_t, uint8_t, uint16_t, uint32_t,
+           uint64_t, half, float, double, bfloat16, bool>([&]<typename T>() {
+    if (data_type == DataTypeFor<T>()) {
+      scan = &ScanBlock<T>;
+    }
+  });
+  return scan;
+}
+
+// The splitmix64 finalizer.
+uint64_t Mix(uint64_t x) {
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111eb;
+  return x ^ (x >> 31);
+}
+
+// Returns the sum of the mixed 8-byte words of `size_bytes` bytes at `data`,
+// the first of which is word `first_word` of the payload. A partial last word
+// is zero-padded.
+uint64_t SumMixedWords(const uint8_t* data, int64_t size_bytes,
+                       int64_t first_word) {
+  constexpr uint64_t kGolden = 0x9e3779b97f4a7c15;
+  const int64_t num_words = size_bytes / 8;
+  uint64_t sum = 0;
+  for (int64_t w = 0; w < num_words; ++w) {
+    uint64_t word;
+    std::memcpy(&word, data + 8 * w, 8);
+    sum += Mix(word + static_cast<uint64_t>(first_word + w) * kGolden);
+  }
+  if (size_bytes % 8 != 0) {
+    uint64_t word = 0;
+    std::memcpy(&word, data + 8 * num_words, size_bytes % 8);
+    sum += Mix(word + static_cast<uint64_t>(first_word + num_words) * kGolden);
+  }
+  return sum;
+}
+
+uint64_t FinishChecksum(uint64_t sum, int64_t size_bytes) {
+  return Mix(sum ^ static_cast<uint64_t>(size_bytes));
+}
+
+// Validates `src` and, if `dst` is not null, copies it to `dst`.
+absl::Status CopyAndValidateImpl(const uint8_t* src, uint8_t* dst,
+                                 DataType data_type, int64_t num_elements,
+                                 const ValidateOptions& options,
+                                 ValidationStats* stats,
+                                 const StridedCopyOptions& copy_options) {
+  const ScanBlockFn scan = GetScanBlockFn(data_type);
+  if (scan == nullptr) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("Can't validate data of type ", data_type, "."));
+  }
+  if (num_elements < 0) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("Invalid number of elements: ", num_elements, "."));
+  }
+
+  const int64_t element_size = ElementSize(data_type);
+  const int64_t size_bytes = num_elements * element_size;
+  const double lo = options.min_value.value_or(-kInf);
+  const double hi = options.max_value.value_or(kInf);
+
+  // Each block is copied on its own, so the non-temporal decision is made once
+  // for the whole copy.
+  const StridedCopyOptions block_options{
+      .threading = {.max_threads = 1},
+      .non_temporal_min_bytes = UseNonTemporalStores(copy_options, size_bytes)
+                                    ? 0
+                                    : std::numeric_limits<int64_t>::max()};
+
+  auto process_blocks = [&](int64_t begin, int64_t end, PartialStats& partial) {
+    for (int64_t block = begin; block < end; ++block) {
+      const int64_t offset = block * kBlockBytes;
+      const int64_t n = std::min(kBlockBytes, size_bytes - offset);
+      if (dst != nullptr) {
+        CopyBytes(src + offset, dst + offset, n, block_options);
+      }
+      // The block was just read by the copy, so it is checked from the cache.
+      scan(src + offset, n / element_size, lo, hi, partial);
+      if (options.compute_checksum) {
+        partial.checksum_sum += SumMixedWords(src + offset, n, offset / 8);
+      }
+    }
+  };
+
+  const int64_t num_blocks = (size_bytes + kBlockBytes - 1) / kBlockBytes;
+  const int num_threads =
+      internal::ResolveThreads(copy_options.threading, size_bytes, num_blocks);
+  std::vector<PartialStats> partials(num_threads);
+  if (num_threads == 1) {
+    process_blocks(0, num_blocks, partials[0]);
+  } else {
+    internal::ResolveThreadPool(copy_options.threading)
+        .ParallelFor(num_threads, num_threads, [&](int64_t t) {
+          process_blocks(num_blocks * t / num_threads,
+                         num_blocks * (t + 1) / num_threads, partials[t]);
+        });
+  }
+
+  PartialStats total;
+  for (const PartialStats& partial : partials) {
+    total.nan_count += partial.nan_count;
+    total.inf_count += partial.inf_count;
+    total.out_of_range_count += partial.out_of_range_count;
+    total.min = std::min(total.min, partial.min);
+    total.max = std::max(total.max, partial.max);
+    total.checksum_sum += partial.checksum_sum;
+  }
+
+  ValidationStats result;
+  result.num_elements = num_elements;
+  result.nan_count = total.nan_count;
+  result.inf_count = total.inf_count;
+  result.out_of_range_count = total.out_of_range_count;
+  const bool empty = num_elements == total.nan_count;
+  result.min = empty ? kNaN : total.min;
+  result.max = empty ? kNaN : total.max;
+  if (options.compute_checksum) {
+    result.checksum = FinishChecksum(total.checksum_sum, size_bytes);
+  }
+  absl::Status status = CheckValidationStats(result, options);
+  if (stats != nullptr) {
+    *stats = std::move(result);
+  }
+  return status;
+}
+
+}  // namespace
+
+absl::Status CheckValidationStats(const ValidationStats& stats,
+                                  const ValidateOptions& options) {
+  if (options.require_finite && (stats.nan_count > 0 || stats.inf_count > 0)) {
+    return absl::InvalidArgumentError(absl::StrCat(
+        "Expected finite values, found ", stats.nan_count, " NaN and ",
+        stats.inf_count, " infinite values in ", stats.num_elements,
+        " elements."));
+  }
+  if (stats.out_of_range_count > 0) {
+    return absl::InvalidArgumentError(absl::StrCat(
+        "Found ", stats.out_of_range_count, " values outside [",
+        options.min_value.value_or(-kInf), ", ",
+        options.max_value.value_or(kInf), "]; the values are in [", stats.min,
+        ", ", stats.max, "]."));
+  }
+  return absl::OkStatus();
+}
+
+absl::Status CopyAndValidate(const void* src, void* dst, DataType data_type,
+                             int64_t num_elements,
+                             const ValidateOptions& options,
+                             ValidationStats* stats,
+                             const StridedCopyOptions& copy_options) {
+  return CopyAndValidateImpl(static_cast<const uint8_t*>(src),
+                             static_cast<uint8_t*>(dst), data_type,
+                             num_elements, options, stats, copy_options);
+}
+
+absl::Status Validate(const void* data, DataType data_type,
+                      int64_t num_elements, const ValidateOptions& options,
+                      ValidationStats* stats,
+                      const StridedCopyOptions& copy_options) {
+  return CopyAndValidateImpl(static_cast<const uint8_t*>(data), nullptr,
+                             data_type, num_elements, options, stats,
+                             copy_options);
+}
+
+uint64_t PayloadChecksum(const void* data, int64_t size_bytes) {
+  return FinishChecksum(
+      SumMixedWords(static_cast<const uint8_t*>(data), size_bytes, 0),
+      size_bytes);
+}
+
+}  // namespace npy_array
@@ -0,0 +1,79 @@
+#ifndef NPY_ARRAY_VALIDATE_H_
+#define NPY_ARRAY_VALIDATE_H_
+
+#include <cstdint>
+#include <optional>
+
+#include "absl/status/status.h"
+#include "npy_array/data_type.h"
+#include "npy_array/strided_copy.h"
+
+namespace npy_array {
+
+// Checks to run over array data, e.g., while it is deserialized.
+struct ValidateOptions {
+  // Fail if any floating point value is NaN or infinite.
+  bool require_finite = false;
+
+  // Fail if any non-NaN value is outside [min_value, max_value]. Values are
+  // compared as doubles, so int64 and uint64 bounds beyond 2^53 are rounded.
+  std::optional<double> min_value;
+  std::optional<double> max_value;
+
+  // Compute ValidationStats::checksum.
+  bool compute_checksum = false;
+};
+
+// What a validation pass found. Filled in even if a check fails.
+struct ValidationStats {
+  int64_t num_elements = 0;
+  int64_t nan_count = 0;
+  int64_t inf_count = 0;
+
+  // The number of non-NaN values outside [min_value, max_value]. Only counted
+  // if a bound is set.
+  int64_t out_of_range_count = 0;
+
+  // The range of the non-NaN values. NaN if there are none.
+  double min = 0.0;
+  double max = 0.0;
+
+  // PayloadChecksum() of the data, if ValidateOptions::compute_checksum.
+  std::optional<uint64_t> checksum;
+};
+
+// Returns an InvalidArgument error describing the first check in `options`
+// that `stats` fails, or OK.
+absl::Status CheckValidationStats(const ValidationStats& stats,
+                                  const ValidateOptions& options);
+
+// Copies `num_elements` compact elements of `data_type` from `src` to `dst`,
+// like CopyBytes(), and validates them in the same pass: the data is copied in
+// cache-sized blocks and each block is checked right after it is read, so
+// validating costs little more than the copy of a memory-bound array.
+// `copy_options` controls threading and non-temporal stores, as in
+// CopyBytes(). Sets `*stats` if `stats` is not null, then returns
+// CheckValidationStats().
+absl::Status CopyAndValidate(const void* src, void* dst, DataType data_type,
+                             int64_t num_elements,
+                             const ValidateOptions& options,
+                             ValidationStats* stats,
+                             const StridedCopyOptions& copy_options =
+                                 StridedCopyOptions());
+
+// Same as above without the copy, e.g., for data that is used in place.
+absl::Status Validate(const void* data, DataType data_type,
+                      int64_t num_elements, const ValidateOptions& options,
+                      ValidationStats* stats,
+                      const StridedCopyOptions& copy_options =
+                          StridedCopyOptions());
+
+// A fast 64-bit checksum of `size_bytes` bytes, for detecting corruption (it is
+// not a cryptographic hash). It is a sum of independently mixed, position-keyed
+// 8-byte words, so it is computed in parallel and is the same for any number of
+// threads.
+uint64_t PayloadChecksum(const void* data, int64_t size_bytes);
+
+}  // namespace npy_array
+
+#endif  // NPY_ARRAY_VALIDATE_H_
@@ -0,0 +1,181 @@
+#include "npy_array/validate.h"
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <utility>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "gtest/gtest.h"
+#include "npy_array/data_type.h"
+#include "npy_array/gtest_half.h"
+#include "npy_array/half.h"
+#include "npy_array/strided_copy.h"
+#include "npy_array/thread_pool.h"
+
+namespace npy_array {
+namespace {
+
+template <typename T>
+class ValidateTest : public testing::Test {};
+
+using MyTypes =
+    testing::Types<int8_t, int16_t, int32_t, int64_t, uint8_t, uint16_t,
+                   uint32_t, uint64_t, half, float, double>;
+TYPED_TEST_SUITE(ValidateTest, MyTypes);
+
+TYPED_TEST(ValidateTest, CopiesAndComputesRange) {
+  // More than one block, with the extremes in different blocks.
+  std::vector<TypeParam> src(20000);
+  for (size_t i = 0; i < src.size(); ++i) {
+    src[i] = static_cast<TypeParam>(10 + i % 50);
+  }
+  src[3] = static_cast<TypeParam>(2);
+  src[19000] = static_cast<TypeParam>(100);
+
+  std::vector<TypeParam> dst(src.size());
+  ValidationStats stats;
+  const absl::Status status =
+      CopyAndValidate(src.data(), dst.data(), DataTypeFor<TypeParam>(),
+                      src.size(), {.require_finite = true}, &stats);
+  ASSERT_TRUE(status.ok()) << status;
+  EXPECT_EQ(dst, src);
+  EXPECT_EQ(stats.num_elements, 20000);
+  EXPECT_EQ(stats.nan_count, 0);
+  EXPECT_EQ(stats.inf_count, 0);
+  EXPECT_EQ(stats.out_of_range_count, 0);
+  EXPECT_EQ(stats.min, 2.0);
+  EXPECT_EQ(stats.max, 100.0);
+  EXPECT_FALSE(stats.checksum.has_value());
+}
+
+TYPED_TEST(ValidateTest, Range) {
+  std::vector<TypeParam> data(100);
+  for (size_t i = 0; i < data.size(); ++i) {
+    data[i] = static_cast<TypeParam>(i);
+  }
+
+  ValidationStats stats;
+  EXPECT_TRUE(Validate(data.data(), DataTypeFor<TypeParam>(), data.size(),
+                       {.min_value = 0, .max_value = 99}, &stats)
+                  .ok());
+  EXPECT_EQ(stats.out_of_range_count, 0);
+
+  const absl::Status status =
+      Validate(data.data(), DataTypeFor<TypeParam>(), data.size(),
+               {.min_value = 5, .max_value = 89.5}, &stats);
+  EXPECT_EQ(status.code(), absl::StatusCode::kInvalidArgument);
+  EXPECT_EQ(stats.out_of_range_count, 5 + 10);
+  EXPECT_EQ(stats.min, 0.0);
+  EXPECT_EQ(stats.max, 99.0);
+}
+
+TEST(ValidateTest, NanAndInf) {
+  const float nan = std::numeric_limits<float>::quiet_NaN();
+  const float inf = std::numeric_limits<float>::infinity();
+  const std::vector<float> src = {1.0f, nan, -inf, 4.0f, nan, 2.0f};
+  std::vector<float> dst(src.size());
+
+  // Without require_finite, non-finite values are only counted.
+  ValidationStats stats;
+  EXPECT_TRUE(CopyAndValidate(src.data(), dst.data(), DataType::kFloat32,
+                              src.size(), {}, &stats)
+                  .ok());
+  EXPECT_EQ(stats.nan_count, 2);
+  EXPECT_EQ(stats.inf_count, 1);
+  EXPECT_EQ(stats.min, -inf);
+  EXPECT_EQ(stats.max, 4.0);
+  EXPECT_EQ(std::memcmp(dst.data(), src.data(), 6 * sizeof(float)), 0);
+
+  EXPECT_EQ(CopyAndValidate(src.data(), dst.data(), DataType::kFloat32,
+                            src.size(), {.require_finite = true}, &stats)
+                .code(),
+            absl::StatusCode::kInvalidArgument);
+
+  // -inf is out of range, NaN is not.
+  EXPECT_FALSE(Validate(src.data(), DataType::kFloat32, src.size(),
+                        {.min_value = 0.0}, &stats)
+                   .ok());
+  EXPECT_EQ(stats.out_of_range_count, 1);
+
+  const std::vector<half> all_nan(3, half(nan));
+  EXPECT_TRUE(
+      Validate(all_nan.data(), DataType::kFloat16, 3, {}, &stats).ok());
+  EXPECT_EQ(stats.nan_count, 3);
+  EXPECT_TRUE(std::isnan(stats.min));
+  EXPECT_TRUE(std::isnan(stats.max));
+}
+
+TEST(ValidateTest, Checksum) {
+  std::vector<uint8_t> data(100003);
+  for (size_t i = 0; i < data.size(); ++i) {
+    data[i] = static_cast<uint8_t>(i * 7919 % 251);
+  }
+  const uint64_t expected = PayloadChecksum(data.data(), data.size());
+
+  ValidationStats stats;
+  ASSERT_TRUE(Validate(data.data(), DataType::kUint8, data.size(),
+                       {.compute_checksum = true}, &stats)
+                  .ok());
+  EXPECT_EQ(stats.checksum, expected);
+
+  // The checksum depends on the order of the data, and on its size.
+  std::swap(data[10], data[20000]);
+  EXPECT_NE(PayloadChecksum(data.data(), data.size()), expected);
+  std::swap(data[10], data[20000]);
+  EXPECT_NE(PayloadChecksum(data.data(), data.size() - 1), expected);
+}
+
+TEST(ValidateTest, MultithreadedMatchesSerial) {
+  ThreadPool pool(3);
+  const StridedCopyOptions threaded{.threading = {.max_threads = 0,
+                                                  .min_bytes_per_thread = 4096,
+                                                  .thread_pool = &pool},
+                                    .non_temporal_min_bytes = 0};
+  std::vector<int16_t> src(300000);
+  for (size_t i = 0; i < src.size(); ++i) {
+    src[i] = static_cast<int16_t>(i * 31 % 2000 - 1000);
+  }
+  src[123457] = 5000;
+
+  const ValidateOptions options{
+      .min_value = -1000, .max_value = 1000, .compute_checksum = true};
+  ValidationStats serial;
+  ValidationStats parallel;
+  std::vector<int16_t> dst(src.size());
+  EXPECT_FALSE(Validate(src.data(), DataType::kInt16, src.size(), options,
+                        &serial)
+                   .ok());
+  EXPECT_FALSE(CopyAndValidate(src.data(), dst.data(), DataType::kInt16,
+                               src.size(), options, &parallel, threaded)
+                   .ok());
+  EXPECT_EQ(dst, src);
+  EXPECT_EQ(parallel.out_of_range_count, 1);
+  EXPECT_EQ(parallel.out_of_range_count, serial.out_of_range_count);
+  EXPECT_EQ(parallel.min, serial.min);
+  EXPECT_EQ(parallel.max, 5000.0);
+  EXPECT_EQ(parallel.checksum, serial.checksum);
+  EXPECT_EQ(parallel.checksum,
+            PayloadChecksum(src.data(), src.size() * sizeof(int16_t)));
+}
+
+TEST(ValidateTest, Errors) {
+  const int32_t data[2] = {};
+  EXPECT_EQ(Validate(data, DataType::kUndefined, 2, {}, nullptr).code(),
+            absl::StatusCode::kInvalidArgument);
+  EXPECT_EQ(Validate(data, DataType::kInt32, -1, {}, nullptr).code(),
+            absl::StatusCode::kInvalidArgument);
+
+  // Empty data is valid.
+  ValidationStats stats;
+  EXPECT_TRUE(Validate(data, DataType::kInt32, 0, {.require_finite = true},
+                       &stats)
+                  .ok());
+  EXPECT_EQ(stats.num_elements, 0);
+  EXPECT_TRUE(std::isnan(stats.min));
+}
+
+}  // namespace
+}  // namespace npy_array
@@ -0,0 +1,71 @@
+#ifndef NPY_ARRAY_VISIT_H_
+#define NPY_ARRAY_VISIT_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "array/array.h"
+#include "npy_array/compile_time_loop.h"
+#include "npy_array/data_type.h"
+#include "npy_array/dynamic_array.h"
+#include "npy_array/half.h"
+
+namespace npy_array {
+
+// Ranks up to and including this are supported by Visit() by default. Each rank
+// instantiates the visitor once per data type, so keep this small.
+inline constexpr size_t kMaxVisitRank = 6;
+
+// Calls `f` with a statically typed view of `dar`, dispatching once on its data
+// type and rank. `f` must be callable with every
+// nda::array_ref_of_rank<T, Rank>, where T is one of the integer types, half,
+// float or double, and Rank <= MaxRank. Typically, `f` is a generic lambda:
+//
+//   absl::Status status = Visit(dar, [&](auto ar) {
+//     using T = typename decltype(ar)::value_type;
+//     ar.for_each_value([](T& x) { x = x * 2; });
+//   });
+//
+// Inside `f`, element access and loops compile to fully specialized (and
+// vectorizable) code, unlike DynamicArrayRef::At<T>().
+//
+// Returns an error if `dar` has any other data type (e.g., bfloat16, which has
+// no arithmetic of its own) or its rank exceeds MaxRank.
+template <size_t MaxRank = kMaxVisitRank, typename F>
+absl::Status Visit(const DynamicArrayRef& dar, F&& f);
+
+// ----- Implementation of template functions -----
+template <size_t MaxRank, typename F>
+absl::Status Visit(const DynamicArrayRef& dar, F&& f) {
+  if (dar.rank() < 0 || dar.rank() > static_cast<int64_t>(MaxRank)) {
+    return absl::InvalidArgumentError(absl::StrCat(
+        "Visit: rank ", dar.rank(), " exceeds the maximum of ", MaxRank, "."));
+  }
+
+  bool visited = false;
+  ForTypes<int8_t, int16_t, int32_t, int64_t, uint8_t, uint16_t, uint32_t,
+           uint64_t, half, float, double>([&]<typename T>() {
+    if (visited || dar.data_type() != DataTypeFor<T>()) {
+      return;
+    }
+    visited = true;
+    ForRange<size_t{0}, MaxRank + 1>([&]<size_t Rank>() {
+      if (static_cast<size_t>(dar.rank()) == Rank) {
+        f(ArrayRefOf<T, Rank>(dar));
+      }
+    });
+  });
+
+  if (!visited) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("Visit: unsupported data type ", dar.data_type(), "."));
+  }
+  return absl::OkStatus();
+}
+
+}  // namespace npy_array
+
+#endif  // NPY_ARRAY_VISIT_H_
@@ -0,0 +1,78 @@
+#include "npy_array/visit.h"
+
+#include <cstdint>
+#include <type_traits>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "gtest/gtest.h"
+#include "npy_array/dynamic_array.h"
+#include "npy_array/gtest_half.h"
+
+namespace npy_array {
+namespace {
+
+template <typename T>
+class VisitTest : public testing::Test {};
+
+using MyTypes =
+    testing::Types<int8_t, int16_t, int32_t, int64_t, uint8_t, uint16_t,
+                   uint32_t, uint64_t, half, float, double>;
+TYPED_TEST_SUITE(VisitTest, MyTypes);
+
+TYPED_TEST(VisitTest, DispatchesOnTypeAndRank) {
+  for (int rank = 0; rank <= 4; ++rank) {
+    const std::vector<int64_t> extents(rank, 3);
+    DynamicArray arr(DataTypeFor<TypeParam>(), extents);
+
+    int num_calls = 0;
+    const absl::Status status = Visit(arr.ref(), [&](auto ar) {
+      using ArrayRef = decltype(ar);
+      static_assert(!std::is_const_v<typename ArrayRef::value_type>);
+      EXPECT_TRUE((std::is_same_v<typename ArrayRef::value_type, TypeParam>));
+      EXPECT_EQ(ArrayRef::rank(), rank);
+      EXPECT_EQ(ar.size(), arr.NumElements());
+      ar.for_each_value([](auto& x) { x = TypeParam(2); });
+      ++num_calls;
+    });
+    ASSERT_TRUE(status.ok()) << status;
+    EXPECT_EQ(num_calls, 1);
+
+    // Writes through the view are visible in `arr`.
+    const std::vector<int64_t> last(rank, 2);
+    EXPECT_EQ(arr.At<TypeParam>(last), TypeParam(2));
+  }
+}
+
+TYPED_TEST(VisitTest, ConstDynamicArray) {
+  DynamicArray arr(DataTypeFor<TypeParam>(), {4, 5});
+  arr.Set<TypeParam>({3, 4}, TypeParam(7));
+  const DynamicArray shared = arr.Share();
+
+  double sum = 0.0;
+  const absl::Status status = Visit(shared, [&](auto ar) {
+    ar.for_each_value([&](const auto& x) { sum += static_cast<double>(x); });
+  });
+  ASSERT_TRUE(status.ok()) << status;
+  EXPECT_EQ(sum, 7.0);
+
+  // Visiting a const array doesn't copy the shared buffer.
+  EXPECT_TRUE(arr.IsShared());
+}
+
+TEST(VisitTest, RankTooHigh) {
+  DynamicArray arr(DataType::kFloat32, {1, 1, 1});
+  const absl::Status status =
+      Visit</*MaxRank=*/2>(arr.ref(), [](auto ar) {});
+  EXPECT_EQ(status.code(), absl::StatusCode::kInvalidArgument);
+}
+
+TEST(VisitTest, UndefinedDataType) {
+  uint8_t data = 0;
+  DynamicArrayRef dar(&data, DataType::kUndefined, DynamicShape({}));
+  const absl::Status status = Visit(dar, [](auto ar) {});
+  EXPECT_EQ(status.code(), absl::StatusCode::kInvalidArgument);
+}
+
+}  // namespace
+}  // namespace npy_array
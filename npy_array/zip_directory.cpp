@@ -0,0 +1,530 @@
+#include "npy_array/zip_directory.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <ostream>
+#include <string>
+#include <utility>
+
+#include "absl/cleanup/cleanup.h"
+#include "absl/strings/str_cat.h"
+#include "third_party/zlib-ng/zlib.h"
+
+namespace npy_array {
+
+namespace {
+
+// Record signatures and fixed sizes, from the .ZIP File Format Specification
+// (APPNOTE.TXT).
+constexpr uint32_t kLocalHeaderSignature = 0x04034b50;
+constexpr uint32_t kCentralHeaderSignature = 0x02014b50;
+constexpr uint32_t kEndOfCentralDirectorySignature = 0x06054b50;
+constexpr uint32_t kZip64EndOfCentralDirectorySignature = 0x06064b50;
+constexpr uint32_t kZip64LocatorSignature = 0x07064b50;
+constexpr uint32_t kDataDescriptorSignature = 0x08074b50;
+constexpr int64_t kLocalHeaderSize = 30;
+constexpr int64_t kCentralHeaderSize = 46;
+constexpr int64_t kEndOfCentralDirectorySize = 22;
+constexpr int64_t kZip64EndOfCentralDirectorySize = 56;
+constexpr int64_t kZip64LocatorSize = 20;
+constexpr int64_t kMaxCommentSize = 0xffff;
+
+// The extra field with the 64-bit sizes and offset of a ZIP64 entry.
+constexpr uint16_t kZip64ExtraFieldId = 0x0001;
+
+// A 32-bit size or offset with this value is stored in the ZIP64 extra field.
+constexpr uint32_t kZip64Marker = 0xffffffff;
+
+constexpr uint16_t kMethodStore = 0;
+constexpr uint16_t kMethodDeflate = 8;
+constexpr uint16_t kFlagEncrypted = 1;
+constexpr uint16_t kFlagDataDescriptor = 1 << 3;
+
+// The version needed to extract ZIP64 records (4.5).
+constexpr uint16_t kZip64Version = 45;
+
+// zlib counts bytes in 32 bits, so large buffers are processed in chunks of
+// this size.
+constexpr int64_t kMaxZlibChunk = int64_t{1} << 30;
+
+// Returns the little-endian integer of `size` bytes at `p`.
+uint64_t LoadLittleEndian(const char* p, int size) {
+  uint64_t value = 0;
+  for (int i = size - 1; i >= 0; --i) {
+    value = (value << 8) | static_cast<uint8_t>(p[i]);
+  }
+  return value;
+}
+
+void AppendLittleEndian(uint64_t value, int size, std::string* dst) {
+  for (int i = 0; i < size; ++i) {
+    dst->push_back(static_cast<char>(value >> (8 * i)));
+  }
+}
+
+// Returns true if `size` bytes at `offset` are within `archive`.
+bool InBounds(std::string_view archive, uint64_t offset, uint64_t size) {
+  return offset <= archive.size() && size <= archive.size() - offset;
+}
+
+absl::Status Malformed(std::string_view what) {
+  return absl::InvalidArgumentError(
+      absl::StrCat("ReadZipDirectory: malformed zip archive, ", what, "."));
+}
+
+// The location of the central directory.
+struct CentralDirectory {
+  uint64_t num_entries = 0;
+  uint64_t size = 0;
+  uint64_t offset = 0;
+};
+
+absl::StatusOr<CentralDirectory> FindCentralDirectory(
+    std::string_view archive) {
+  // The end of central directory record is last, followed by a comment of up
+  // to 64 KB.
+  const int64_t size = archive.size();
+  int64_t end = size - kEndOfCentralDirectorySize;
+  const int64_t min_end = std::max<int64_t>(
+      0, size - kEndOfCentralDirectorySize - kMaxCommentSize);
+  for (; end >= min_end; --end) {
+    const char* p = archive.data() + end;
+    const int64_t comment_size = LoadLittleEndian(p + 20, 2);
+    if (LoadLittleEndian(p, 4) == kEndOfCentralDirectorySignature &&
+        end + kEndOfCentralDirectorySize + comment_size <= size) {
+      break;
+    }
+  }
+  if (end < min_end) {
+    return Malformed("no end of central directory record");
+  }
+
+  const char* p = archive.data() + end;
+  uint64_t disk = LoadLittleEndian(p + 4, 2);
+  uint64_t directory_disk = LoadLittleEndian(p + 6, 2);
+  CentralDirectory directory{
+      .num_entries = LoadLittleEndian(p + 10, 2),
+      .size = LoadLittleEndian(p + 12, 4),
+      .offset = LoadLittleEndian(p + 16, 4),
+  };
+
+  // A ZIP64 archive has a locator right before the record, which points to a
+  // ZIP64 end of central directory record with 64-bit values.
+  if (end >= kZip64LocatorSize &&
+      LoadLittleEndian(p - kZip64LocatorSize, 4) == kZip64LocatorSignature) {
+    const uint64_t zip64_end =
+        LoadLittleEndian(p - kZip64LocatorSize + 8, 8);
+    if (!InBounds(archive, zip64_end, kZip64EndOfCentralDirectorySize) ||
+        LoadLittleEndian(archive.data() + zip64_end, 4) !=
+            kZip64EndOfCentralDirectorySignature) {
+      return Malformed("invalid ZIP64 end of central directory record");
+    }
+    const char* q = archive.data() + zip64_end;
+    disk = LoadLittleEndian(q + 16, 4);
+    directory_disk = LoadLittleEndian(q + 20, 4);
+    directory.num_entries = LoadLittleEndian(q + 32, 8);
+    directory.size = LoadLittleEndian(q + 40, 8);
+    directory.offset = LoadLittleEndian(q + 48, 8);
+  }
+
+  if (disk != 0 || directory_disk != 0) {
+    return absl::UnimplementedError(
+        "ReadZipDirectory: multi-disk zip archives are not supported.");
+  }
+  if (!InBounds(archive, directory.offset, directory.size)) {
+    return Malformed("central directory out of bounds");
+  }
+  return directory;
+}
+
+// Replaces the 32-bit values of `entry` marked as ZIP64 with those of the
+// ZIP64 extra field in `extra`.
+absl::Status ReadZip64ExtraField(std::string_view extra, bool uncompressed,
+                                 bool compressed, bool offset,
+                                 ZipEntry* entry) {
+  while (extra.size() >= 4) {
+    const uint64_t id = LoadLittleEndian(extra.data(), 2);
+    const uint64_t size = LoadLittleEndian(extra.data() + 2, 2);
+    if (size > extra.size() - 4) {
+      break;
+    }
+    if (id == kZip64ExtraFieldId) {
+      // Only the marked values are present, in this order.
+      std::string_view values = extra.substr(4, size);
+      for (const auto& [marked, value] :
+           {std::pair(uncompressed, &entry->uncompressed_size),
+            std::pair(compressed, &entry->compressed_size),
+            std::pair(offset, &entry->local_header_offset)}) {
+        if (!marked) {
+          continue;
+        }
+        if (values.size() < 8) {
+          return Malformed("truncated ZIP64 extra field");
+        }
+        *value = LoadLittleEndian(values.data(), 8);
+        values.remove_prefix(8);
+      }
+      return absl::OkStatus();
+    }
+    extra.remove_prefix(4 + size);
+  }
+  if (uncompressed || compressed || offset) {
+    return Malformed("missing ZIP64 extra field");
+  }
+  return absl::OkStatus();
+}
+
+// Returns true if `extra` has a ZIP64 extra field.
+bool HasZip64ExtraField(std::string_view extra) {
+  while (extra.size() >= 4) {
+    const uint64_t size = LoadLittleEndian(extra.data() + 2, 2);
+    if (LoadLittleEndian(extra.data(), 2) == kZip64ExtraFieldId) {
+      return true;
+    }
+    if (size > extra.size() - 4) {
+      break;
+    }
+    extra.remove_prefix(4 + size);
+  }
+  return false;
+}
+
+// Returns the bytes of `entry` in `archive`, from its local header to the end
+// of its data descriptor, if any.
+absl::StatusOr<std::string_view> LocalRecord(std::string_view archive,
+                                             const ZipEntry& entry) {
+  absl::StatusOr<std::string_view> data = ZipEntryData(archive, entry);
+  if (!data.ok()) {
+    return data.status();
+  }
+  const char* p = archive.data() + entry.local_header_offset;
+  uint64_t end = data->data() + data->size() - archive.data();
+  if ((LoadLittleEndian(p + 6, 2) & kFlagDataDescriptor) != 0) {
+    // A CRC-32 and two sizes, which are 64-bit in ZIP64 entries, optionally
+    // preceded by a signature.
+    const uint64_t name_size = LoadLittleEndian(p + 26, 2);
+    const uint64_t extra_size = LoadLittleEndian(p + 28, 2);
+    const bool zip64 = HasZip64ExtraField(std::string_view(
+        p + kLocalHeaderSize + name_size, extra_size));
+    uint64_t descriptor_size = zip64 ? 20 : 12;
+    if (InBounds(archive, end, 4) &&
+        LoadLittleEndian(archive.data() + end, 4) == kDataDescriptorSignature) {
+      descriptor_size += 4;
+    }
+    if (!InBounds(archive, end, descriptor_size)) {
+      return absl::InvalidArgumentError(
+          absl::StrCat("CopyZipEntries: data descriptor of ",
+                       entry.path.string(), " is out of bounds."));
+    }
+    end += descriptor_size;
+  }
+  return archive.substr(entry.local_header_offset,
+                        end - entry.local_header_offset);
+}
+
+// Appends to `directory` the central directory header of the entry whose local
+// header `local_header` is now at `offset`.
+void AppendCentralHeader(const ZipEntry& entry, std::string_view local_header,
+                         uint64_t offset, std::string* directory) {
+  const char* p = local_header.data();
+  const uint64_t name_size = LoadLittleEndian(p + 26, 2);
+  const bool zip64_uncompressed = entry.uncompressed_size >= kZip64Marker;
+  const bool zip64_compressed = entry.compressed_size >= kZip64Marker;
+  const bool zip64_offset = offset >= kZip64Marker;
+  const int zip64_extra_size =
+      8 * (zip64_uncompressed + zip64_compressed + zip64_offset);
+
+  AppendLittleEndian(kCentralHeaderSignature, 4, directory);
+  AppendLittleEndian(kZip64Version, 2, directory);  // Version made by.
+  // Version needed, flags, method, time and date, as in the local header.
+  directory->append(p + 4, 10);
+  AppendLittleEndian(entry.crc32, 4, directory);
+  AppendLittleEndian(zip64_compressed ? kZip64Marker : entry.compressed_size,
+                     4, directory);
+  AppendLittleEndian(
+      zip64_uncompressed ? kZip64Marker : entry.uncompressed_size, 4,
+      directory);
+  AppendLittleEndian(name_size, 2, directory);
+  AppendLittleEndian(zip64_extra_size == 0 ? 0 : 4 + zip64_extra_size, 2,
+                     directory);
+  AppendLittleEndian(0, 2, directory);  // Comment size.
+  AppendLittleEndian(0, 2, directory);  // Disk.
+  AppendLittleEndian(0, 2, directory);  // Internal attributes.
+  AppendLittleEndian(0, 4, directory);  // External attributes.
+  AppendLittleEndian(zip64_offset ? kZip64Marker : offset, 4, directory);
+  directory->append(p + kLocalHeaderSize, name_size);
+  if (zip64_extra_size != 0) {
+    AppendLittleEndian(kZip64ExtraFieldId, 2, directory);
+    AppendLittleEndian(zip64_extra_size, 2, directory);
+    if (zip64_uncompressed) {
+      AppendLittleEndian(entry.uncompressed_size, 8, directory);
+    }
+    if (zip64_compressed) {
+      AppendLittleEndian(entry.compressed_size, 8, directory);
+    }
+    if (zip64_offset) {
+      AppendLittleEndian(offset, 8, directory);
+    }
+  }
+}
+
+// Inflates the raw DEFLATE data `in` of `entry` into `dst`. If `to_end` is
+// true, `dst` must hold exactly the whole stream; otherwise, inflating stops
+// once `dst` is full. Errors are prefixed with `caller`.
+absl::Status Inflate(std::string_view caller, const ZipEntry& entry,
+                     std::string_view in, absl::Span<char> dst, bool to_end) {
+  z_stream stream = {};
+  if (inflateInit2(&stream, -MAX_WBITS) != Z_OK) {
+    return absl::InternalError(absl::StrCat(caller, ": inflateInit2 failed."));
+  }
+  absl::Cleanup cleanup_stream([&] { inflateEnd(&stream); });
+
+  absl::Span<char> out = dst;
+  // zlib rejects a null output pointer, even with no room. An empty `out` may
+  // have one, so point at a dummy byte instead.
+  char no_output;
+  stream.next_out = reinterpret_cast<Bytef*>(&no_output);
+  int err = Z_OK;
+  while (err == Z_OK && (to_end || stream.avail_out != 0 || !out.empty())) {
+    if (stream.avail_in == 0) {
+      const int64_t n = std::min<int64_t>(in.size(), kMaxZlibChunk);
+      stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(in.data()));
+      stream.avail_in = n;
+      in.remove_prefix(n);
+    }
+    if (stream.avail_out == 0 && !out.empty()) {
+      const int64_t n = std::min<int64_t>(out.size(), kMaxZlibChunk);
+      stream.next_out = reinterpret_cast<Bytef*>(out.data());
+      stream.avail_out = n;
+      out.remove_prefix(n);
+    } else if (stream.avail_out == 0) {
+      stream.next_out = reinterpret_cast<Bytef*>(&no_output);
+    }
+    err = inflate(&stream, Z_NO_FLUSH);
+  }
+  // Z_BUF_ERROR means the input ended, or the output filled up, before the
+  // end of the DEFLATE stream.
+  if ((to_end && err != Z_STREAM_END) || stream.avail_out != 0 ||
+      !out.empty()) {
+    return absl::InvalidArgumentError(
+        absl::StrCat(caller, ": failed to inflate ", entry.path.string(),
+                     ", zlib error ", err, "."));
+  }
+  return absl::OkStatus();
+}
+
+}  // namespace
+
+absl::StatusOr<std::vector<ZipEntry>> ReadZipDirectory(
+    std::string_view archive) {
+  absl::StatusOr<CentralDirectory> directory = FindCentralDirectory(archive);
+  if (!directory.ok()) {
+    return directory.status();
+  }
+
+  std::vector<ZipEntry> entries;
+  // Each entry takes at least kCentralHeaderSize bytes, which bounds the
+  // reservation for a corrupt count.
+  entries.reserve(std::min<uint64_t>(directory->num_entries,
+                                     directory->size / kCentralHeaderSize));
+  std::string_view records = archive.substr(directory->offset, directory->size);
+  for (uint64_t i = 0; i < directory->num_entries; ++i) {
+    const char* p = records.data();
+    if (records.size() < kCentralHeaderSize ||
+        LoadLittleEndian(p, 4) != kCentralHeaderSignature) {
+      return Malformed("invalid central directory header");
+    }
+    const uint64_t flags = LoadLittleEndian(p + 8, 2);
+    const uint64_t method = LoadLittleEndian(p + 10, 2);
+    const uint64_t name_size = LoadLittleEndian(p + 28, 2);
+    const uint64_t extra_size = LoadLittleEndian(p + 30, 2);
+    const uint64_t comment_size = LoadLittleEndian(p + 32, 2);
+    const uint64_t record_size =
+        kCentralHeaderSize + name_size + extra_size + comment_size;
+    if (records.size() < record_size) {
+      return Malformed("truncated central directory header");
+    }
+
+    ZipEntry entry;
+    entry.path = std::filesystem::path(
+        std::string(records.substr(kCentralHeaderSize, name_size)));
+    if ((flags & kFlagEncrypted) != 0) {
+      return absl::UnimplementedError(absl::StrCat(
+          "ReadZipDirectory: ", entry.path.string(), " is encrypted."));
+    }
+    if (method != kMethodStore && method != kMethodDeflate) {
+      return absl::UnimplementedError(
+          absl::StrCat("ReadZipDirectory: ", entry.path.string(),
+                       " uses unsupported compression method ", method, "."));
+    }
+    entry.method =
+        method == kMethodStore ? ZipMethod::kStore : ZipMethod::kDeflate;
+    entry.crc32 = LoadLittleEndian(p + 16, 4);
+    entry.compressed_size = LoadLittleEndian(p + 20, 4);
+    entry.uncompressed_size = LoadLittleEndian(p + 24, 4);
+    entry.local_header_offset = LoadLittleEndian(p + 42, 4);
+    absl::Status status = ReadZip64ExtraField(
+        records.substr(kCentralHeaderSize + name_size, extra_size),
+        entry.uncompressed_size == kZip64Marker,
+        entry.compressed_size == kZip64Marker,
+        entry.local_header_offset == kZip64Marker, &entry);
+    if (!status.ok()) {
+      return status;
+    }
+    if (entry.compressed_size < 0 || entry.uncompressed_size < 0 ||
+        entry.local_header_offset < 0) {
+      return Malformed("entry size or offset out of range");
+    }
+    entries.push_back(std::move(entry));
+    records.remove_prefix(record_size);
+  }
+  return entries;
+}
+
+absl::StatusOr<std::string_view> ZipEntryData(std::string_view archive,
+                                              const ZipEntry& entry) {
+  const uint64_t offset = entry.local_header_offset;
+  if (!InBounds(archive, offset, kLocalHeaderSize) ||
+      LoadLittleEndian(archive.data() + offset, 4) != kLocalHeaderSignature) {
+    return absl::InvalidArgumentError(absl::StrCat(
+        "ZipEntryData: invalid local header for ", entry.path.string(), "."));
+  }
+  // The local header may have a different extra field than the central
+  // directory, so its own sizes are used.
+  const char* p = archive.data() + offset;
+  const uint64_t data_offset = offset + kLocalHeaderSize +
+                               LoadLittleEndian(p + 26, 2) +
+                               LoadLittleEndian(p + 28, 2);
+  if (!InBounds(archive, data_offset, entry.compressed_size)) {
+    return absl::InvalidArgumentError(absl::StrCat(
+        "ZipEntryData: data of ", entry.path.string(), " is out of bounds."));
+  }
+  return archive.substr(data_offset, entry.compressed_size);
+}
+
+absl::Status ReadZipEntry(std::string_view archive, const ZipEntry& entry,
+                          absl::Span<char> dst) {
+  if (static_cast<int64_t>(dst.size()) != entry.uncompressed_size) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("ReadZipEntry: expected a buffer of ",
+                     entry.uncompressed_size, " bytes, got ", dst.size(), "."));
+  }
+  absl::StatusOr<std::string_view> data = ZipEntryData(archive, entry);
+  if (!data.ok()) {
+    return data.status();
+  }
+
+  if (entry.method == ZipMethod::kStore) {
+    if (data->size() != dst.size()) {
+      return absl::InvalidArgumentError(absl::StrCat(
+          "ReadZipEntry: stored entry ", entry.path.string(),
+          " has different compressed and uncompressed sizes."));
+    }
+    std::memcpy(dst.data(), data->data(), dst.size());
+  } else {
+    absl::Status status = Inflate("ReadZipEntry", entry, *data, dst,
+                                  /*to_end=*/true);
+    if (!status.ok()) {
+      return status;
+    }
+  }
+
+  uLong crc = crc32(0, Z_NULL, 0);
+  for (int64_t i = 0; i < static_cast<int64_t>(dst.size());
+       i += kMaxZlibChunk) {
+    const int64_t n = std::min<int64_t>(dst.size() - i, kMaxZlibChunk);
+    crc = crc32(crc, reinterpret_cast<const Bytef*>(dst.data() + i), n);
+  }
+  if (crc != entry.crc32) {
+    return absl::DataLossError(absl::StrCat(
+        "ReadZipEntry: CRC-32 mismatch for ", entry.path.string(), "."));
+  }
+  return absl::OkStatus();
+}
+
+absl::StatusOr<int64_t> ReadZipEntryPrefix(std::string_view archive,
+                                           const ZipEntry& entry,
+                                           absl::Span<char> dst) {
+  dst = dst.first(std::min<int64_t>(dst.size(), entry.uncompressed_size));
+  absl::StatusOr<std::string_view> data = ZipEntryData(archive, entry);
+  if (!data.ok()) {
+    return data.status();
+  }
+
+  if (entry.method == ZipMethod::kStore) {
+    if (data->size() < dst.size()) {
+      return absl::InvalidArgumentError(
+          absl::StrCat("ReadZipEntryPrefix: stored entry ",
+                       entry.path.string(), " is truncated."));
+    }
+    std::memcpy(dst.data(), data->data(), dst.size());
+  } else if (!dst.empty()) {
+    absl::Status status = Inflate("ReadZipEntryPrefix", entry, *data, dst,
+                                  /*to_end=*/false);
+    if (!status.ok()) {
+      return status;
+    }
+  }
+  return dst.size();
+}
+
+absl::Status CopyZipEntries(std::string_view archive,
+                            absl::Span<const ZipEntry> entries,
+                            std::ostream* dst) {
+  std::string directory;
+  uint64_t offset = 0;
+  for (const ZipEntry& entry : entries) {
+    absl::StatusOr<std::string_view> record = LocalRecord(archive, entry);
+    if (!record.ok()) {
+      return record.status();
+    }
+    AppendCentralHeader(entry, *record, offset, &directory);
+    dst->write(record->data(), record->size());
+    offset += record->size();
+  }
+
+  // The ZIP64 end of central directory record and its locator precede the end
+  // of central directory record if any of its fields overflows.
+  const uint64_t num_entries = entries.size();
+  const bool zip64 = num_entries >= 0xffff ||
+                     directory.size() >= kZip64Marker || offset >= kZip64Marker;
+  std::string end;
+  if (zip64) {
+    const uint64_t zip64_end_offset = offset + directory.size();
+    AppendLittleEndian(kZip64EndOfCentralDirectorySignature, 4, &end);
+    // The size of the rest of the record.
+    AppendLittleEndian(kZip64EndOfCentralDirectorySize - 12, 8, &end);
+    AppendLittleEndian(kZip64Version, 2, &end);  // Version made by.
+    AppendLittleEndian(kZip64Version, 2, &end);  // Version needed.
+    AppendLittleEndian(0, 4, &end);              // Disk.
+    AppendLittleEndian(0, 4, &end);              // Central directory disk.
+    AppendLittleEndian(num_entries, 8, &end);    // Entries on this disk.
+    AppendLittleEndian(num_entries, 8, &end);
+    AppendLittleEndian(directory.size(), 8, &end);
+    AppendLittleEndian(offset, 8, &end);
+
+    AppendLittleEndian(kZip64LocatorSignature, 4, &end);
+    AppendLittleEndian(0, 4, &end);  // Disk of the ZIP64 record.
+    AppendLittleEndian(zip64_end_offset, 8, &end);
+    AppendLittleEndian(1, 4, &end);  // Number of disks.
+  }
+  AppendLittleEndian(kEndOfCentralDirectorySignature, 4, &end);
+  AppendLittleEndian(0, 2, &end);  // Disk.
+  AppendLittleEndian(0, 2, &end);  // Central directory disk.
+  AppendLittleEndian(std::min<uint64_t>(num_entries, 0xffff), 2, &end);
+  AppendLittleEndian(std::min<uint64_t>(num_entries, 0xffff), 2, &end);
+  AppendLittleEndian(std::min<uint64_t>(directory.size(), kZip64Marker), 4,
+                     &end);
+  AppendLittleEndian(std::min<uint64_t>(offset, kZip64Marker), 4, &end);
+  AppendLittleEndian(0, 2, &end);  // Comment size.
+
+  dst->write(directory.data(), directory.size());
+  dst->write(end.data(), end.size());
+  if (!*dst) {
+    return absl::InternalError("CopyZipEntries: unable to write the archive.");
+  }
+  return absl::OkStatus();
+}
+
+}  // namespace npy_array
@@ -0,0 +1,68 @@
+#ifndef NPY_ARRAY_ZIP_DIRECTORY_H_
+#define NPY_ARRAY_ZIP_DIRECTORY_H_
+
+#include <cstdint>
+#include <filesystem>
+#include <ostream>
+#include <string_view>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/types/span.h"
+#include "npy_array/zip_writer.h"
+
+namespace npy_array {
+
+// An entry of a zip archive, as listed in its central directory.
+struct ZipEntry {
+  std::filesystem::path path;
+  ZipMethod method = ZipMethod::kStore;
+  uint32_t crc32 = 0;
+  int64_t compressed_size = 0;
+  int64_t uncompressed_size = 0;
+
+  // The offset of the entry's local header in the archive.
+  int64_t local_header_offset = 0;
+};
+
+// Lists the entries of the zip archive `archive` from its central directory,
+// in order, without reading or decompressing any entry. ZIP64 archives and
+// entries are supported. Returns an error if the archive is malformed, spans
+// several disks, or has an encrypted entry or one compressed with a method
+// other than STORE or DEFLATE.
+absl::StatusOr<std::vector<ZipEntry>> ReadZipDirectory(
+    std::string_view archive);
+
+// Returns the compressed bytes of `entry` within `archive`, found from its
+// local header.
+absl::StatusOr<std::string_view> ZipEntryData(std::string_view archive,
+                                              const ZipEntry& entry);
+
+// Decompresses `entry` of `archive` into `dst`, which must hold exactly
+// `entry.uncompressed_size` bytes, and checks its CRC-32. DEFLATE entries are
+// inflated straight into `dst` with no intermediate buffer.
+absl::Status ReadZipEntry(std::string_view archive, const ZipEntry& entry,
+                          absl::Span<char> dst);
+
+// Decompresses only the first bytes of `entry` of `archive` into `dst`, e.g.,
+// to read a file header without inflating the rest. Returns the number of bytes
+// written, which is less than `dst.size()` only if the entry is smaller. The
+// CRC-32 is not checked, since it covers the whole entry.
+absl::StatusOr<int64_t> ReadZipEntryPrefix(std::string_view archive,
+                                           const ZipEntry& entry,
+                                           absl::Span<char> dst);
+
+// Writes to `dst` a zip archive of `entries` of `archive`, in order, e.g., the
+// ones of ReadZipDirectory() to keep. Each entry is copied as it is: its local
+// header, compressed data and data descriptor, so nothing is inflated or
+// deflated. Only the central directory is new; it has ZIP64 records where
+// sizes, offsets or the number of entries need them. Offsets are counted from
+// the first byte written, so `dst` should be at the start of a file.
+absl::Status CopyZipEntries(std::string_view archive,
+                            absl::Span<const ZipEntry> entries,
+                            std::ostream* dst);
+
+}  // namespace npy_array
+
+#endif  // NPY_ARRAY_ZIP_DIRECTORY_H_
@@ -0,0 +1,493 @@
+#include "npy_array/zip_directory.h"
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/status/status_matchers.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "npy_array/mapped_file.h"
+#include "npy_array/zip_writer.h"
+
+using ::absl_testing::IsOk;
+using ::absl_testing::IsOkAndHolds;
+using ::absl_testing::StatusIs;
+using ::testing::IsEmpty;
+
+namespace npy_array {
+namespace {
+
+void AppendLittleEndian(uint64_t value, int size, std::string* dst) {
+  for (int i = 0; i < size; ++i) {
+    dst->push_back(static_cast<char>(value >> (8 * i)));
+  }
+}
+
+// Returns the local header of a stored entry of `size` bytes whose sizes are in
+// a ZIP64 extra field, as written by tools that always use ZIP64.
+std::string Zip64LocalHeader(std::string_view name, uint64_t size,
+                             uint32_t crc32) {
+  std::string archive;
+  AppendLittleEndian(0x04034b50, 4, &archive);
+  AppendLittleEndian(45, 2, &archive);  // Version needed: ZIP64.
+  AppendLittleEndian(0, 2, &archive);   // Flags.
+  AppendLittleEndian(0, 2, &archive);   // STORE.
+  AppendLittleEndian(0, 4, &archive);   // Time and date.
+  AppendLittleEndian(crc32, 4, &archive);
+  AppendLittleEndian(0xffffffff, 4, &archive);
+  AppendLittleEndian(0xffffffff, 4, &archive);
+  AppendLittleEndian(name.size(), 2, &archive);
+  AppendLittleEndian(20, 2, &archive);
+  archive += name;
+  AppendLittleEndian(0x0001, 2, &archive);
+  AppendLittleEndian(16, 2, &archive);
+  AppendLittleEndian(size, 8, &archive);
+  AppendLittleEndian(size, 8, &archive);
+  return archive;
+}
+
+// Returns the end of a ZIP64 archive whose central directory, at
+// `directory_offset`, lists the one entry of Zip64LocalHeader() at offset 0.
+std::string Zip64CentralDirectory(std::string_view name, uint64_t size,
+                                  uint32_t crc32, uint64_t directory_offset) {
+  std::string archive;
+  AppendLittleEndian(0x02014b50, 4, &archive);
+  AppendLittleEndian(45, 2, &archive);  // Version made by.
+  AppendLittleEndian(45, 2, &archive);  // Version needed.
+  AppendLittleEndian(0, 2, &archive);
+  AppendLittleEndian(0, 2, &archive);
+  AppendLittleEndian(0, 4, &archive);
+  AppendLittleEndian(crc32, 4, &archive);
+  AppendLittleEndian(0xffffffff, 4, &archive);
+  AppendLittleEndian(0xffffffff, 4, &archive);
+  AppendLittleEndian(name.size(), 2, &archive);
+  AppendLittleEndian(28, 2, &archive);  // Extra field size.
+  AppendLittleEndian(0, 2, &archive);   // Comment size.
+  AppendLittleEndian(0, 2, &archive);   // Disk.
+  AppendLittleEndian(0, 2, &archive);   // Internal attributes.
+  AppendLittleEndian(0, 4, &archive);   // External attributes.
+  AppendLittleEndian(0xffffffff, 4, &archive);
+  archive += name;
+  AppendLittleEndian(0x0001, 2, &archive);
+  AppendLittleEndian(24, 2, &archive);
+  AppendLittleEndian(size, 8, &archive);
+  AppendLittleEndian(size, 8, &archive);
+  AppendLittleEndian(0, 8, &archive);
+  const uint64_t directory_size = archive.size();
+
+  const uint64_t zip64_end_offset = directory_offset + archive.size();
+  AppendLittleEndian(0x06064b50, 4, &archive);
+  AppendLittleEndian(44, 8, &archive);  // Size of the rest of the record.
+  AppendLittleEndian(45, 2, &archive);
+  AppendLittleEndian(45, 2, &archive);
+  AppendLittleEndian(0, 4, &archive);
+  AppendLittleEndian(0, 4, &archive);
+  AppendLittleEndian(1, 8, &archive);
+  AppendLittleEndian(1, 8, &archive);
+  AppendLittleEndian(directory_size, 8, &archive);
+  AppendLittleEndian(directory_offset, 8, &archive);
+
+  AppendLittleEndian(0x07064b50, 4, &archive);
+  AppendLittleEndian(0, 4, &archive);
+  AppendLittleEndian(zip64_end_offset, 8, &archive);
+  AppendLittleEndian(1, 4, &archive);
+
+  AppendLittleEndian(0x06054b50, 4, &archive);
+  AppendLittleEndian(0, 2, &archive);
+  AppendLittleEndian(0, 2, &archive);
+  AppendLittleEndian(0xffff, 2, &archive);
+  AppendLittleEndian(0xffff, 2, &archive);
+  AppendLittleEndian(0xffffffff, 4, &archive);
+  AppendLittleEndian(0xffffffff, 4, &archive);
+  AppendLittleEndian(0, 2, &archive);
+  return archive;
+}
+
+// Returns a ZIP64 archive with one stored entry.
+std::string Zip64Archive(std::string_view name, std::string_view data,
+                         uint32_t crc32) {
+  std::string archive = Zip64LocalHeader(name, data.size(), crc32);
+  archive += data;
+  archive += Zip64CentralDirectory(name, data.size(), crc32, archive.size());
+  return archive;
+}
+
+// Writes to `path` a ZIP64 archive with one stored entry of `size` bytes, all
+// zero but for `tail` at the end, as a sparse file: the zeros are a hole, so
+// the archive can be larger than 4 GB without writing gigabytes. Returns the
+// size of the entry's local header.
+uint64_t WriteSparseArchive(const std::filesystem::path& path,
+                            std::string_view name, uint64_t size,
+                            std::string_view tail) {
+  const std::string header = Zip64LocalHeader(name, size, 0);
+  std::ofstream file(path, std::ios::binary | std::ios::trunc);
+  file << header;
+  file.seekp(header.size() + size - tail.size());
+  file << tail;
+  file << Zip64CentralDirectory(name, size, 0, header.size() + size);
+  EXPECT_TRUE(file.good());
+  return header.size();
+}
+
+// A file buffer that writes only the first and last kKeep bytes of a large
+// write and seeks over the rest, which leaves a hole that reads as zeros. This
+// copies sparse data into a sparse file without touching the hole.
+class SparseFileBuf : public std::filebuf {
+ public:
+  static constexpr std::streamsize kKeep = 1 << 16;
+
+ protected:
+  std::streamsize xsputn(const char* s, std::streamsize n) override {
+    if (n <= 2 * kKeep) {
+      return std::filebuf::xsputn(s, n);
+    }
+    if (std::filebuf::xsputn(s, kKeep) != kKeep ||
+        pubseekoff(n - 2 * kKeep, std::ios::cur, std::ios::out) ==
+            pos_type(off_type(-1)) ||
+        std::filebuf::xsputn(s + n - kKeep, kKeep) != kKeep) {
+      return 0;
+    }
+    return n;
+  }
+};
+
+TEST(ZipDirectoryTest, ListsAndReadsEntries) {
+  const std::string a(100000, 'a');
+  const std::string b = "hello, world";
+  ZipWriter zip_writer;
+  ASSERT_THAT(zip_writer.AddFile("a.npy", a), IsOk());
+  ASSERT_THAT(zip_writer.AddFile("dir/b.txt", b,
+                                 ZipWriter::AddFileOptions{
+                                     .method = ZipMethod::kStore,
+                                 }),
+              IsOk());
+  absl::StatusOr<std::string> archive = std::move(zip_writer).Close();
+  ASSERT_THAT(archive, IsOk());
+
+  absl::StatusOr<std::vector<ZipEntry>> entries = ReadZipDirectory(*archive);
+  ASSERT_THAT(entries, IsOk());
+  ASSERT_EQ(entries->size(), 2);
+  const ZipEntry& entry_a = (*entries)[0];
+  const ZipEntry& entry_b = (*entries)[1];
+  EXPECT_EQ(entry_a.path, "a.npy");
+  EXPECT_EQ(entry_a.method, ZipMethod::kDeflate);
+  EXPECT_EQ(entry_a.uncompressed_size, a.size());
+  EXPECT_LT(entry_a.compressed_size, a.size());
+  EXPECT_EQ(entry_b.path, "dir/b.txt");
+  EXPECT_EQ(entry_b.method, ZipMethod::kStore);
+  EXPECT_EQ(entry_b.compressed_size, b.size());
+
+  // Stored data is read in place.
+  absl::StatusOr<std::string_view> data_b = ZipEntryData(*archive, entry_b);
+  ASSERT_THAT(data_b, IsOk());
+  EXPECT_EQ(*data_b, b);
+  EXPECT_GE(data_b->data(), archive->data());
+  EXPECT_LE(data_b->data() + data_b->size(), archive->data() + archive->size());
+
+  std::string read_a(a.size(), '\0');
+  EXPECT_THAT(ReadZipEntry(*archive, entry_a, absl::MakeSpan(read_a)), IsOk());
+  EXPECT_EQ(read_a, a);
+  std::string read_b(b.size(), '\0');
+  EXPECT_THAT(ReadZipEntry(*archive, entry_b, absl::MakeSpan(read_b)), IsOk());
+  EXPECT_EQ(read_b, b);
+
+  // Only the start of an entry is decompressed, up to its size.
+  std::string prefix(10, '\0');
+  EXPECT_THAT(ReadZipEntryPrefix(*archive, entry_a, absl::MakeSpan(prefix)),
+              IsOkAndHolds(10));
+  EXPECT_EQ(prefix, a.substr(0, 10));
+  std::string larger(100, '\0');
+  EXPECT_THAT(ReadZipEntryPrefix(*archive, entry_b, absl::MakeSpan(larger)),
+              IsOkAndHolds(b.size()));
+  EXPECT_EQ(larger.substr(0, b.size()), b);
+}
+
+TEST(ZipDirectoryTest, EmptyArchive) {
+  ZipWriter zip_writer;
+  absl::StatusOr<std::string> archive = std::move(zip_writer).Close();
+  ASSERT_THAT(archive, IsOk());
+  absl::StatusOr<std::vector<ZipEntry>> entries = ReadZipDirectory(*archive);
+  ASSERT_THAT(entries, IsOk());
+  EXPECT_TRUE(entries->empty());
+}
+
+TEST(ZipDirectoryTest, EmptyDeflatedEntry) {
+  ZipWriter zip_writer;
+  ASSERT_THAT(zip_writer.AddFile("empty.npy", ""), IsOk());
+  absl::StatusOr<std::string> archive = std::move(zip_writer).Close();
+  ASSERT_THAT(archive, IsOk());
+  absl::StatusOr<std::vector<ZipEntry>> entries = ReadZipDirectory(*archive);
+  ASSERT_THAT(entries, IsOk());
+  ASSERT_EQ(entries->size(), 1);
+  EXPECT_EQ((*entries)[0].method, ZipMethod::kDeflate);
+  EXPECT_EQ((*entries)[0].uncompressed_size, 0);
+
+  // An empty span has a null data pointer, which zlib must not see.
+  EXPECT_THAT(ReadZipEntry(*archive, (*entries)[0], absl::Span<char>()),
+              IsOk());
+  std::string prefix(10, 'x');
+  EXPECT_THAT(
+      ReadZipEntryPrefix(*archive, (*entries)[0], absl::MakeSpan(prefix)),
+      IsOkAndHolds(0));
+}
+
+TEST(ZipDirectoryTest, Zip64) {
+  // CRC-32 of "zip64".
+  const std::string archive = Zip64Archive("big.npy", "zip64", 0xcf37ba6a);
+  absl::StatusOr<std::vector<ZipEntry>> entries = ReadZipDirectory(archive);
+  ASSERT_THAT(entries, IsOk());
+  ASSERT_EQ(entries->size(), 1);
+  EXPECT_EQ((*entries)[0].path, "big.npy");
+  EXPECT_EQ((*entries)[0].uncompressed_size, 5);
+  EXPECT_EQ((*entries)[0].compressed_size, 5);
+  EXPECT_EQ((*entries)[0].local_header_offset, 0);
+
+  std::string data(5, '\0');
+  EXPECT_THAT(ReadZipEntry(archive, (*entries)[0], absl::MakeSpan(data)),
+              IsOk());
+  EXPECT_EQ(data, "zip64");
+}
+
+TEST(ZipDirectoryTest, EntryLargerThan4GB) {
+  // A sparse file holds an entry just past the 4 GB boundary, so the test
+  // neither writes nor reads gigabytes.
+  constexpr uint64_t kSize = (uint64_t{1} << 32) + 4096;
+  const std::string_view kTail = "tail";
+  const std::filesystem::path path =
+      std::filesystem::path(testing::TempDir()) / "zip_directory_test_4gb.zip";
+  const uint64_t header_size =
+      WriteSparseArchive(path, "large.npy", kSize, kTail);
+
+  absl::StatusOr<std::shared_ptr<const MappedFile>> file =
+      MappedFile::Open(path);
+  ASSERT_THAT(file, IsOk());
+  const std::string_view archive = (*file)->contents();
+  EXPECT_GT(archive.size(), kSize);
+
+  absl::StatusOr<std::vector<ZipEntry>> entries = ReadZipDirectory(archive);
+  ASSERT_THAT(entries, IsOk());
+  ASSERT_EQ(entries->size(), 1);
+  EXPECT_EQ((*entries)[0].uncompressed_size, kSize);
+  EXPECT_EQ((*entries)[0].compressed_size, kSize);
+
+  absl::StatusOr<std::string_view> data = ZipEntryData(archive, (*entries)[0]);
+  ASSERT_THAT(data, IsOk());
+  EXPECT_EQ(data->size(), kSize);
+  EXPECT_EQ(data->data() - archive.data(), header_size);
+  EXPECT_EQ(data->substr(kSize - kTail.size()), kTail);
+
+  file->reset();
+  std::filesystem::remove(path);
+}
+
+TEST(ZipDirectoryTest, CopyEntriesPast4GB) {
+  // Copying the entry of a sparse archive twice puts the second copy past the
+  // 4 GB boundary, so its offset and that of the central directory need ZIP64
+  // records.
+  constexpr uint64_t kSize = (uint64_t{1} << 32) + 4096;
+  const std::string_view kTail = "tail";
+  const std::filesystem::path dir(testing::TempDir());
+  const std::filesystem::path path = dir / "zip_directory_test_src_4gb.zip";
+  const std::filesystem::path copy_path =
+      dir / "zip_directory_test_copy_8gb.zip";
+  const uint64_t header_size =
+      WriteSparseArchive(path, "large.npy", kSize, kTail);
+
+  absl::StatusOr<std::shared_ptr<const MappedFile>> file =
+      MappedFile::Open(path);
+  ASSERT_THAT(file, IsOk());
+  absl::StatusOr<std::vector<ZipEntry>> entries =
+      ReadZipDirectory((*file)->contents());
+  ASSERT_THAT(entries, IsOk());
+  ASSERT_EQ(entries->size(), 1);
+  {
+    SparseFileBuf buf;
+    ASSERT_NE(buf.open(copy_path,
+                       std::ios::out | std::ios::binary | std::ios::trunc),
+              nullptr);
+    std::ostream copy(&buf);
+    const ZipEntry kept[] = {(*entries)[0], (*entries)[0]};
+    ASSERT_THAT(CopyZipEntries((*file)->contents(), kept, &copy), IsOk());
+    ASSERT_NE(buf.close(), nullptr);
+  }
+  file->reset();
+  std::filesystem::remove(path);
+
+  absl::StatusOr<std::shared_ptr<const MappedFile>> copy_file =
+      MappedFile::Open(copy_path);
+  ASSERT_THAT(copy_file, IsOk());
+  const std::string_view copied = (*copy_file)->contents();
+  absl::StatusOr<std::vector<ZipEntry>> copied_entries =
+      ReadZipDirectory(copied);
+  ASSERT_THAT(copied_entries, IsOk());
+  ASSERT_EQ(copied_entries->size(), 2);
+  EXPECT_EQ((*copied_entries)[0].local_header_offset, 0);
+  EXPECT_EQ((*copied_entries)[1].local_header_offset, header_size + kSize);
+  EXPECT_GT((*copied_entries)[1].local_header_offset, uint64_t{0xffffffff});
+  for (const ZipEntry& entry : *copied_entries) {
+    EXPECT_EQ(entry.path, "large.npy");
+    EXPECT_EQ(entry.compressed_size, kSize);
+    EXPECT_EQ(entry.uncompressed_size, kSize);
+    absl::StatusOr<std::string_view> data = ZipEntryData(copied, entry);
+    ASSERT_THAT(data, IsOk());
+    EXPECT_EQ(data->size(), kSize);
+    EXPECT_EQ(data->substr(kSize - kTail.size()), kTail);
+  }
+
+  copy_file->reset();
+  std::filesystem::remove(copy_path);
+}
+
+TEST(ZipDirectoryTest, WriteEntryLargerThan4GB) {
+  // The entry is read from a sparse file and deflated, so neither the input
+  // nor the archive takes gigabytes on disk. Its sizes only fit in ZIP64 extra
+  // fields.
+  constexpr uint64_t kSize = (uint64_t{1} << 32) + 4096;
+  const std::string_view kTail = "tail";
+  const std::filesystem::path dir(testing::TempDir());
+  const std::filesystem::path input_path = dir / "zip_directory_test_4gb.bin";
+  const std::filesystem::path path = dir / "zip_directory_test_write_4gb.zip";
+  {
+    std::ofstream input(input_path, std::ios::binary | std::ios::trunc);
+    input.seekp(kSize - kTail.size());
+    input << kTail;
+    ASSERT_TRUE(input.good());
+  }
+  absl::StatusOr<std::shared_ptr<const MappedFile>> input =
+      MappedFile::Open(input_path);
+  ASSERT_THAT(input, IsOk());
+  ASSERT_EQ((*input)->size(), kSize);
+
+  {
+    absl::StatusOr<ZipWriter> zip_writer = ZipWriter::OpenFile(path);
+    ASSERT_THAT(zip_writer, IsOk());
+    ASSERT_THAT(zip_writer->AddFile("large.npy", (*input)->contents(),
+                                    ZipWriter::AddFileOptions{.level = 1}),
+                IsOk());
+    ASSERT_THAT(zip_writer->AddFile("small.npy", "small"), IsOk());
+    ASSERT_THAT(std::move(*zip_writer).Close(), IsOk());
+  }
+  input->reset();
+  std::filesystem::remove(input_path);
+
+  absl::StatusOr<std::shared_ptr<const MappedFile>> file =
+      MappedFile::Open(path);
+  ASSERT_THAT(file, IsOk());
+  const std::string_view archive = (*file)->contents();
+  EXPECT_LT(archive.size(), kSize / 100);
+  absl::StatusOr<std::vector<ZipEntry>> entries = ReadZipDirectory(archive);
+  ASSERT_THAT(entries, IsOk());
+  ASSERT_EQ(entries->size(), 2);
+  const ZipEntry& large = (*entries)[0];
+  EXPECT_EQ(large.path, "large.npy");
+  EXPECT_EQ(large.method, ZipMethod::kDeflate);
+  EXPECT_EQ(large.uncompressed_size, kSize);
+  EXPECT_LT(large.compressed_size, kSize);
+  std::string prefix(16, 'x');
+  EXPECT_THAT(ReadZipEntryPrefix(archive, large, absl::MakeSpan(prefix)),
+              IsOkAndHolds(16));
+  EXPECT_EQ(prefix, std::string(16, '\0'));
+
+  // The entry after the ZIP64 one is found and intact.
+  const ZipEntry& small = (*entries)[1];
+  EXPECT_EQ(small.path, "small.npy");
+  std::string data(small.uncompressed_size, '\0');
+  EXPECT_THAT(ReadZipEntry(archive, small, absl::MakeSpan(data)), IsOk());
+  EXPECT_EQ(data, "small");
+
+  file->reset();
+  std::filesystem::remove(path);
+}
+
+TEST(ZipDirectoryTest, CopyEntries) {
+  ZipWriter zip_writer;
+  ASSERT_THAT(zip_writer.AddFile("a.npy", std::string(1000, 'a')), IsOk());
+  ASSERT_THAT(zip_writer.AddFile("b.npy", "b"), IsOk());
+  ASSERT_THAT(zip_writer.AddFile("c.npy", std::string(1000, 'c'),
+                                 ZipWriter::AddFileOptions{
+                                     .method = ZipMethod::kStore,
+                                 }),
+              IsOk());
+  absl::StatusOr<std::string> archive = std::move(zip_writer).Close();
+  ASSERT_THAT(archive, IsOk());
+  absl::StatusOr<std::vector<ZipEntry>> entries = ReadZipDirectory(*archive);
+  ASSERT_THAT(entries, IsOk());
+  ASSERT_EQ(entries->size(), 3);
+
+  std::ostringstream copy;
+  const ZipEntry kept[] = {(*entries)[2], (*entries)[0]};
+  ASSERT_THAT(CopyZipEntries(*archive, kept, &copy), IsOk());
+  const std::string copied = copy.str();
+  absl::StatusOr<std::vector<ZipEntry>> copied_entries =
+      ReadZipDirectory(copied);
+  ASSERT_THAT(copied_entries, IsOk());
+  ASSERT_EQ(copied_entries->size(), 2);
+  for (int i = 0; i < 2; ++i) {
+    const ZipEntry& entry = (*copied_entries)[i];
+    EXPECT_EQ(entry.path, kept[i].path);
+    EXPECT_EQ(entry.method, kept[i].method);
+    EXPECT_EQ(entry.crc32, kept[i].crc32);
+    // The compressed data is copied as it is.
+    EXPECT_EQ(ZipEntryData(copied, entry).value(),
+              ZipEntryData(*archive, kept[i]).value());
+    std::string data(entry.uncompressed_size, '\0');
+    EXPECT_THAT(ReadZipEntry(copied, entry, absl::MakeSpan(data)), IsOk());
+  }
+  EXPECT_EQ((*copied_entries)[0].local_header_offset, 0);
+
+  // Local ZIP64 extra fields are kept.
+  const std::string zip64 = Zip64Archive("big.npy", "zip64", 0xcf37ba6a);
+  entries = ReadZipDirectory(zip64);
+  ASSERT_THAT(entries, IsOk());
+  std::ostringstream zip64_copy;
+  ASSERT_THAT(CopyZipEntries(zip64, *entries, &zip64_copy), IsOk());
+  const std::string zip64_copied = zip64_copy.str();
+  copied_entries = ReadZipDirectory(zip64_copied);
+  ASSERT_THAT(copied_entries, IsOk());
+  ASSERT_EQ(copied_entries->size(), 1);
+  std::string data(5, '\0');
+  EXPECT_THAT(
+      ReadZipEntry(zip64_copied, (*copied_entries)[0], absl::MakeSpan(data)),
+      IsOk());
+  EXPECT_EQ(data, "zip64");
+
+  // An archive with no entries is valid too.
+  std::ostringstream empty;
+  ASSERT_THAT(CopyZipEntries(*archive, {}, &empty), IsOk());
+  EXPECT_THAT(ReadZipDirectory(empty.str()), IsOkAndHolds(IsEmpty()));
+}
+
+TEST(ZipDirectoryTest, Errors) {
+  EXPECT_THAT(ReadZipDirectory("not a zip archive"),
+              StatusIs(absl::StatusCode::kInvalidArgument));
+
+  const std::string archive = Zip64Archive("big.npy", "zip64", 0x12345678);
+  absl::StatusOr<std::vector<ZipEntry>> entries = ReadZipDirectory(archive);
+  ASSERT_THAT(entries, IsOk());
+  std::string data(5, '\0');
+  EXPECT_THAT(ReadZipEntry(archive, (*entries)[0], absl::MakeSpan(data)),
+              StatusIs(absl::StatusCode::kDataLoss));
+  EXPECT_THAT(
+      ReadZipEntry(archive, (*entries)[0], absl::MakeSpan(data).first(4)),
+      StatusIs(absl::StatusCode::kInvalidArgument));
+
+  // Offsets no longer point at the records.
+  EXPECT_THAT(ReadZipDirectory(std::string_view(archive).substr(10)),
+              StatusIs(absl::StatusCode::kInvalidArgument));
+
+  ZipEntry past_end = (*entries)[0];
+  past_end.compressed_size = archive.size();
+  EXPECT_THAT(ZipEntryData(archive, past_end),
+              StatusIs(absl::StatusCode::kInvalidArgument));
+}
+
+}  // namespace
+}  // namespace npy_array
@@ -3,6 +3,7 @@
 
 #include <filesystem>
 #include <string>
+#include <string_view>
 
 #include "absl/container/flat_hash_map.h"
 #include "absl/status/statusor.h"
@@ -18,12 +19,12 @@ namespace npy_array {
 // In this case, the last entry wins.
 // - If any part of the reading process fails, returns an error instead of
 // partially read data.
+// - ZIP64 archives and entries larger than 4 GB are supported. To read only
+// some entries, or to read stored entries in place, use ReadZipDirectory() and
+// ReadZipEntry() instead.
 absl::StatusOr<absl::flat_hash_map<std::filesystem::path, std::string>>
 ReadZipFile(std::string_view data);
 
-// TODO(jiawen): Add a streaming API if we ever need one. At the granularity of
-// files is fine.
-
 }  // namespace npy_array
 
 #endif  // NPY_ARRAY_ZIP_READER_H_
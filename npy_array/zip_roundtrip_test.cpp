@@ -1,4 +1,8 @@
+#include <filesystem>
+#include <fstream>
+#include <iterator>
 #include <string>
+#include <string_view>
 
 #include "absl/status/status_matchers.h"
 #include "absl/strings/str_cat.h"
@@ -13,6 +17,7 @@ using ::testing::Eq;
 using ::testing::Gt;
 using ::testing::IsEmpty;
 using ::testing::Lt;
+using ::testing::Not;
 using ::testing::SizeIs;
 
 namespace npy_array {
@@ -114,5 +119,30 @@ TEST(ZipRoundtripTest, CanWriteMultipleFiles_LastOneWins) {
   EXPECT_THAT(maybe_contents->at("world.txt"), Eq("world2"));
 }
 
+TEST(ZipRoundtripTest, CanWriteToFile) {
+  const std::filesystem::path path =
+      std::filesystem::path(testing::TempDir()) / "zip_roundtrip_test.zip";
+  absl::StatusOr<ZipWriter> zip_writer = ZipWriter::OpenFile(path);
+  ASSERT_THAT(zip_writer, IsOk());
+  EXPECT_THAT(zip_writer->AddFile("hello.txt", "hello"), IsOk());
+  const std::string_view parts[] = {"wor", "ld"};
+  EXPECT_THAT(zip_writer->AddFile("world.txt", parts, {}), IsOk());
+  // The archive is in the file, not in memory.
+  EXPECT_THAT(std::move(*zip_writer).Close(), IsOkAndHolds(IsEmpty()));
+
+  std::ifstream file(path, std::ios::binary);
+  const std::string data((std::istreambuf_iterator<char>(file)),
+                         std::istreambuf_iterator<char>());
+  absl::StatusOr<absl::flat_hash_map<std::filesystem::path, std::string>>
+      maybe_contents = ReadZipFile(data);
+  ASSERT_THAT(maybe_contents, IsOk());
+  EXPECT_THAT(*maybe_contents, SizeIs(2));
+  EXPECT_THAT(maybe_contents->at("hello.txt"), Eq("hello"));
+  EXPECT_THAT(maybe_contents->at("world.txt"), Eq("world"));
+
+  EXPECT_THAT(ZipWriter::OpenFile(path / "not_a_directory" / "a.zip"),
+              Not(IsOk()));
+}
+
 }  // namespace
 }  // namespace npy_array
@@ -1,5 +1,7 @@
 #include "npy_array/zip_writer.h"
 
+#include <algorithm>
+#include <cstdint>
 #include <utility>
 
 #include "absl/log/check.h"
@@ -12,6 +14,50 @@
 
 namespace npy_array {
 
+namespace {
+
+// The most bytes passed to one call of minizip-ng, which takes 32-bit lengths.
+constexpr int64_t kMaxWriteChunk = int64_t{1} << 30;
+
+// Entries at least this large always get ZIP64 extra fields. minizip-ng
+// decides on ZIP64 when it writes the local header, before the compressed size
+// is known, and DEFLATE can make incompressible data slightly larger.
+constexpr int64_t kZip64Threshold = int64_t{1} << 31;
+
+// Returns the entry info for a file at `path` added with `options`. `path` must
+// outlive the result.
+mz_zip_file FileInfo(const std::filesystem::path& path,
+                     const ZipWriter::AddFileOptions& options) {
+  mz_zip_file file_info = {};
+  file_info.filename = path.c_str();
+  file_info.compression_method = (options.method == ZipMethod::kStore)
+                                     ? MZ_COMPRESS_METHOD_STORE
+                                     : MZ_COMPRESS_METHOD_DEFLATE;
+  file_info.flag = MZ_ZIP_FLAG_UTF8;  // Filenames are UTF-8.
+  return file_info;
+}
+
+// Returns a minizip-ng writer of the zip file at `path`, which is created, or
+// appended to if `append` is true.
+absl::StatusOr<void*> OpenZipWriter(const std::filesystem::path& path,
+                                    bool append) {
+  void* zip_writer = mz_zip_writer_create();
+  if (zip_writer == nullptr) {
+    return absl::InternalError("mz_zip_writer_create failed");
+  }
+  const int32_t err = mz_zip_writer_open_file(zip_writer, path.c_str(),
+                                              /*disk_size=*/0, append);
+  if (err != MZ_OK) {
+    mz_zip_writer_delete(&zip_writer);
+    return absl::InternalError(
+        absl::StrCat("mz_zip_writer_open_file failed for ", path.string(),
+                     ", err = ", err));
+  }
+  return zip_writer;
+}
+
+}  // namespace
+
 ZipWriter::ZipWriter(size_t memory_grow_size)
     : mem_stream_(mz_stream_mem_create()), zip_writer_(mz_zip_writer_create()) {
   CHECK_NE(mem_stream_, nullptr);
@@ -29,6 +75,27 @@ ZipWriter::ZipWriter(size_t memory_grow_size)
   CHECK_EQ(err, MZ_OK);
 }
 
+ZipWriter::ZipWriter(void* mem_stream, void* zip_writer)
+    : mem_stream_(mem_stream), zip_writer_(zip_writer) {}
+
+absl::StatusOr<ZipWriter> ZipWriter::OpenFile(
+    const std::filesystem::path& path) {
+  absl::StatusOr<void*> zip_writer = OpenZipWriter(path, /*append=*/false);
+  if (!zip_writer.ok()) {
+    return zip_writer.status();
+  }
+  return ZipWriter(/*mem_stream=*/nullptr, *zip_writer);
+}
+
+absl::StatusOr<ZipWriter> ZipWriter::AppendToFile(
+    const std::filesystem::path& path) {
+  absl::StatusOr<void*> zip_writer = OpenZipWriter(path, /*append=*/true);
+  if (!zip_writer.ok()) {
+    return zip_writer.status();
+  }
+  return ZipWriter(/*mem_stream=*/nullptr, *zip_writer);
+}
+
 ZipWriter::ZipWriter(ZipWriter&& other) { *this = std::move(other); }
 
 ZipWriter& ZipWriter::operator=(ZipWriter&& other) {
@@ -52,6 +119,12 @@ absl::Status ZipWriter::AddFile(const std::filesystem::path& path,
 absl::Status ZipWriter::AddFile(const std::filesystem::path& path,
                                 std::string_view data,
                                 const AddFileOptions& options) {
+  return AddFile(path, absl::MakeConstSpan(&data, 1), options);
+}
+
+absl::Status ZipWriter::AddFile(const std::filesystem::path& path,
+                                absl::Span<const std::string_view> parts,
+                                const AddFileOptions& options) {
   // The compression method (STORE vs DEFLATE) must be stored in `file_info`. We
   // can call `mz_zip_writer_set_compress_method` but `file_info` has
   // precedence.
@@ -60,18 +133,40 @@ absl::Status ZipWriter::AddFile(const std::filesystem::path& path,
   // `mz_zip_writer_set_compress_level` to set it.
   mz_zip_writer_set_compress_level(zip_writer_, options.level);
 
-  mz_zip_file file_info = {};
-  file_info.filename = path.c_str();
-  file_info.compression_method = (options.method == ZipMethod::kStore)
-                                     ? MZ_COMPRESS_METHOD_STORE
-                                     : MZ_COMPRESS_METHOD_DEFLATE;
-  file_info.flag = MZ_ZIP_FLAG_UTF8;  // Filenames are UTF-8.
+  int64_t size = 0;
+  for (const std::string_view part : parts) {
+    size += part.size();
+  }
+  mz_zip_file file_info = FileInfo(path, options);
+  file_info.uncompressed_size = size;
+  file_info.zip64 = size >= kZip64Threshold ? MZ_ZIP64_FORCE : MZ_ZIP64_AUTO;
+  int32_t err = mz_zip_writer_entry_open(zip_writer_, &file_info);
+  if (err != MZ_OK) {
+    return absl::InternalError(
+        absl::StrCat("mz_zip_writer_entry_open failed, err = ", err));
+  }
+
+  for (const std::string_view part : parts) {
+    for (int64_t i = 0; i < static_cast<int64_t>(part.size());
+         i += kMaxWriteChunk) {
+      const int32_t length = static_cast<int32_t>(
+          std::min<int64_t>(part.size() - i, kMaxWriteChunk));
+      const int32_t written =
+          mz_zip_writer_entry_write(zip_writer_, part.data() + i, length);
+      if (written != length) {
+        [[maybe_unused]] const int32_t _ =
+            mz_zip_writer_entry_close(zip_writer_);
+        return absl::InternalError(
+            absl::StrCat("mz_zip_writer_entry_write failed, written = ",
+                         written, ", length = ", length));
+      }
+    }
+  }
 
-  const int32_t err = mz_zip_writer_add_buffer(
-      zip_writer_, const_cast<char*>(data.data()), data.size(), &file_info);
+  err = mz_zip_writer_entry_close(zip_writer_);
   if (err != MZ_OK) {
     return absl::InternalError(
-        absl::StrCat("mz_zip_writer_add_buffer failed, err = ", err));
+        absl::StrCat("mz_zip_writer_entry_close failed, err = ", err));
   }
 
   return absl::OkStatus();
@@ -90,9 +185,6 @@ absl::Status ZipWriter::Close(std::string* compressed_data) {
   if (zip_writer_ == nullptr) {
     return absl::InternalError("zip file is already closed");
   }
-  if (mem_stream_ == nullptr) {
-    return absl::InternalError("zip file is already closed");
-  }
 
   int32_t err;
 
@@ -103,6 +195,14 @@ absl::Status ZipWriter::Close(std::string* compressed_data) {
   }
   mz_zip_writer_delete(&zip_writer_);
 
+  // A ZipWriter of a file has already written everything to its file.
+  if (mem_stream_ == nullptr) {
+    if (compressed_data != nullptr) {
+      compressed_data->clear();
+    }
+    return absl::OkStatus();
+  }
+
   err = mz_stream_close(mem_stream_);
   if (err != MZ_OK) {
     return absl::InternalError(
@@ -113,8 +213,12 @@ absl::Status ZipWriter::Close(std::string* compressed_data) {
   // TODO(jiawen): Ideally, the memory stream would be backed directly by the
   // std::string.
   if (compressed_data != nullptr) {
-    int32_t length;
+    int32_t length = 0;
     mz_stream_mem_get_buffer_length(mem_stream_, &length);
+    if (length < 0) {
+      return absl::InternalError(absl::StrCat(
+          "mz_stream_mem_get_buffer_length failed, length = ", length));
+    }
 
     *compressed_data = std::string(length, '\0');
     err = mz_stream_mem_seek(mem_stream_, 0, /*origin=*/MZ_SEEK_SET);
@@ -8,6 +8,7 @@
 
 #include "absl/status/status.h"
 #include "absl/status/statusor.h"
+#include "absl/types/span.h"
 
 namespace npy_array {
 
@@ -38,7 +39,25 @@ class ZipWriter {
   };
 
   // Opens a new ZipWriter that buffers compressed data into memory.
+  //
+  // minizip-ng's memory stream uses 32-bit lengths, so an archive buffered in
+  // memory is limited to 2 GB. Use OpenFile() for larger archives.
   explicit ZipWriter(size_t memory_grow_size = kDefaultMemoryGrowSize);
+
+  // Opens a new ZipWriter that streams compressed data to a new file at `path`,
+  // replacing any existing file. The archive is never held in memory, so it and
+  // its entries can be larger than 4 GB, in which case ZIP64 records are
+  // written.
+  static absl::StatusOr<ZipWriter> OpenFile(const std::filesystem::path& path);
+
+  // Opens the existing zip file at `path` to add files to it. New entries are
+  // written after the last entry, over the old central directory, and the
+  // central directory is rewritten on Close(). Existing entries are neither
+  // read nor moved. Adding a path that is already in the archive makes a
+  // second entry with the same path.
+  static absl::StatusOr<ZipWriter> AppendToFile(
+      const std::filesystem::path& path);
+
   ZipWriter(ZipWriter&& other);
   ZipWriter& operator=(ZipWriter&& other);
   ~ZipWriter();
@@ -53,13 +72,32 @@ class ZipWriter {
   absl::Status AddFile(const std::filesystem::path& path, std::string_view data,
                        const AddFileOptions& options);
 
+  // Adds the concatenation of `parts` to the zip file at `path`. The parts are
+  // compressed one after the other, so they need not be joined into one buffer
+  // first, e.g., an NPY header and a payload that points into an array.
+  //
+  // Sizes are 64-bit: parts are fed to minizip-ng in pieces of at most 1 GB,
+  // and entries of 2 GB or more always get ZIP64 extra fields, so that their
+  // compressed size can exceed 4 GB too.
+  //
+  // Does nothing if this ZipWriter is already closed.
+  absl::Status AddFile(const std::filesystem::path& path,
+                       absl::Span<const std::string_view> parts,
+                       const AddFileOptions& options);
+
   // Explicitly closes this ZipWriter and returns the compressed data. It can
   // only be used in an rvalue context, e.g.,:
   //
   // absl::StatusOr<std::string> maybe_data = std::move(zip_writer).Close();
+  //
+  // For a ZipWriter from OpenFile() or AppendToFile(), this finishes the file
+  // and returns an empty string.
   absl::StatusOr<std::string> Close() &&;
 
  private:
+  ZipWriter(void* mem_stream, void* zip_writer);
+
+  // Null if this ZipWriter writes to a file.
   void* mem_stream_ = nullptr;
   void* zip_writer_ = nullptr;
 
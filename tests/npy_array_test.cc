@@ -21,10 +21,12 @@
 #include <limits>
 #include <random>
 #include <string>
+#include <string_view>
 
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
 #include "array/array.h"
+#include "npy_array/validate.h"
 
 namespace npy_array {
 namespace {
@@ -118,4 +120,128 @@ TEST(Npy, NpyLoadRoundtrip) {
   }
 }
 
+// Returns an array filled with 0, 1, 2, ... in memory order (wrapping around
+// for small types).
+template <typename T, size_t Rank>
+auto SequentialArray(nda::shape_of_rank<Rank> size) {
+  nda::array_of_rank<T, Rank> array(size);
+  int value = 0;
+  array.for_each_value([&](T& v) { v = static_cast<T>(value++); });
+  return array;
+}
+
+template <typename T>
+void VerifyReorderedPlanarImage(int channels) {
+  const auto planar = SequentialArray<T, 3>({37, 11, channels});
+
+  // Serializing the (c, x, y) view of a planar image should produce the same
+  // bytes as serializing a compact interleaved copy.
+  nda::array_of_rank<T, 3> interleaved({channels, 37, 11});
+  for (auto y : planar.y()) {
+    for (auto x : planar.x()) {
+      for (auto c : planar.z()) {
+        interleaved(c, x, y) = planar(x, y, c);
+      }
+    }
+  }
+
+  EXPECT_EQ(SerializeToNpyString(nda::reorder<2, 0, 1>(planar.cref())),
+            SerializeToNpyString(interleaved.cref()))
+      << "channels = " << channels;
+}
+
+TEST(Npy, SerializeReorderedPlanarImage) {
+  for (int channels : {1, 2, 3, 4, 8}) {
+    VerifyReorderedPlanarImage<uint8_t>(channels);
+    VerifyReorderedPlanarImage<uint16_t>(channels);
+    VerifyReorderedPlanarImage<float>(channels);
+    VerifyReorderedPlanarImage<double>(channels);
+  }
+}
+
+TEST(Npy, DeserializeIntoInterleavedShape) {
+  // An interleaved image indexed as (x, y, c): c has a compile-time stride of
+  // 1, so the array is not compact in the NPY sense.
+  using InterleavedShape =
+      nda::shape<nda::strided_dim<3>, nda::dim<>, nda::dense_dim<0, 3>>;
+
+  const auto planar = SequentialArray<uint8_t, 3>({19, 7, 3});
+  const std::string s = SerializeToNpyString(planar.cref());
+
+  const auto interleaved =
+      DeserializeFromNpyString<uint8_t, InterleavedShape>(s);
+  ASSERT_EQ(interleaved.width(), 19);
+  ASSERT_EQ(interleaved.height(), 7);
+  for (auto y : planar.y()) {
+    for (auto x : planar.x()) {
+      for (auto c : planar.z()) {
+        EXPECT_EQ(interleaved(x, y, c), planar(x, y, c));
+      }
+    }
+  }
+}
+
+TEST(Npy, FortranOrderRoundTrip) {
+  const auto arr = SequentialArray<float, 3>({5, 4, 3});
+  NpySerializeOptions options;
+  options.reverse_axes = false;
+  const std::string s = SerializeToNpyString(arr.cref(), options);
+  EXPECT_NE(s.find("'fortran_order': True"), std::string::npos);
+  EXPECT_NE(s.find("'shape': (5,4,3,)"), std::string::npos);
+
+  const auto decoded =
+      DeserializeFromNpyString<float, nda::shape_of_rank<3>>(s);
+  VerifyTwoImagesAreSame(arr, decoded);
+}
+
+TEST(Npy, MultithreadedRoundTrip) {
+  const StridedCopyOptions copy_options = {
+      .threading = {.max_threads = 4, .min_bytes_per_thread = 1024},
+      .non_temporal_min_bytes = 0};
+  const auto planar = SequentialArray<float, 3>({97, 61, 3});
+
+  NpySerializeOptions serialize_options;
+  serialize_options.copy_options = copy_options;
+  const std::string interleaved_npy = SerializeToNpyString(
+      nda::reorder<2, 0, 1>(planar.cref()), serialize_options);
+  EXPECT_EQ(interleaved_npy,
+            SerializeToNpyString(nda::reorder<2, 0, 1>(planar.cref())));
+
+  const std::string planar_npy =
+      SerializeToNpyString(planar.cref(), serialize_options);
+  const auto deserialized =
+      DeserializeFromNpyString<float, nda::shape_of_rank<3>>(planar_npy,
+                                                            copy_options);
+  VerifyTwoImagesAreSame(planar, deserialized);
+}
+
+TEST(Npy, DescrString) {
+  constexpr std::string_view kFloat = internal::NpyDescrString<float>();
+  EXPECT_EQ(kFloat.substr(1), "f4");
+  EXPECT_EQ(internal::NpyDescrString<uint8_t>().substr(1), "u1");
+  EXPECT_EQ(internal::NpyDescrString<NpyFloat16>().substr(1), "f2");
+  EXPECT_EQ(internal::NpyDescrString<bool>().substr(1), "b1");
+  EXPECT_EQ(internal::NpyDescrString<std::complex<float>>().substr(1), "c8");
+  EXPECT_EQ(kFloat[0], internal::kNpyEndiannessChar);
+}
+
+TEST(Npy, DeserializeAndValidate) {
+  auto arr = SequentialArray<uint16_t, 2>({37, 11});
+  arr(5, 6) = 1000;
+  const std::string s = SerializeToNpyString(arr.cref());
+
+  ValidationStats stats;
+  const auto valid = DeserializeFromNpyString<uint16_t, nda::shape_of_rank<2>>(
+      s, ValidateOptions{.max_value = 1000}, &stats);
+  VerifyTwoImagesAreSame(arr, valid);
+  EXPECT_EQ(stats.max, 1000.0);
+  EXPECT_EQ(stats.out_of_range_count, 0);
+
+  const auto invalid =
+      DeserializeFromNpyString<uint16_t, nda::shape_of_rank<2>>(
+          s, ValidateOptions{.max_value = 999}, &stats);
+  EXPECT_EQ(invalid.size(), 0);
+  EXPECT_EQ(stats.out_of_range_count, 1);
+}
+
 }  // namespace npy_array
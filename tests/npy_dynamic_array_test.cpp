@@ -1,9 +1,22 @@
 #include "npy_array/npy_dynamic_array.h"
 
+#include <complex>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "absl/strings/str_cat.h"
+#include "absl/types/span.h"
 #include "array/array.h"
 #include "gtest/gtest.h"
 #include "npy_array/gtest_half.h"
+#include "npy_array/mapped_file.h"
 #include "npy_array/npy_array.h"
+#include "npy_array/validate.h"
 #include "npy_array/zip_reader.h"
 
 namespace npy_array {
@@ -107,5 +120,275 @@ TYPED_TEST(NpyDynamicArrayTest, ReadDynamicArrayRefFromNpz) {
   TestReadFromNpz<TypeParam, DynamicArrayRef>();
 }
 
+// Returns a float array of extents (5, 4, 3) with values 0, 1, 2, ... and its
+// npy serialization.
+std::string SequentialNpy() {
+  nda::array_of_rank<float, 3> arr({5, 4, 3});
+  float value = 0.0f;
+  arr.for_each_value([&](float& v) { v = value++; });
+  return SerializeToNpyString(arr.cref());
+}
+
+void ExpectSequential(const DynamicArray& arr) {
+  ASSERT_EQ(arr.data_type(), DataType::kFloat32);
+  ASSERT_EQ(arr.rank(), 3);
+  EXPECT_EQ(arr.width(), 5);
+  EXPECT_EQ(arr.channels(), 3);
+  EXPECT_EQ(arr.At<float>({0, 0, 0}), 0.0f);
+  EXPECT_EQ(arr.At<float>({4, 3, 2}), 59.0f);
+}
+
+TEST(NpyDynamicArrayTest, DecodeTakesOwnershipOfString) {
+  std::string npy = SequentialNpy();
+  const char* npy_begin = npy.data();
+  const char* npy_end = npy.data() + npy.size();
+
+  absl::StatusOr<DynamicArray> arr =
+      DecodeDynamicArrayFromNpyOwned(std::move(npy));
+  ASSERT_TRUE(arr.ok()) << arr.status();
+  ExpectSequential(*arr);
+
+  // The payload was not copied.
+  const char* data = reinterpret_cast<const char*>(std::as_const(*arr).data());
+  EXPECT_GE(data, npy_begin);
+  EXPECT_LT(data, npy_end);
+}
+
+TEST(NpyDynamicArrayTest, DecodeAndValidate) {
+  const std::string npy = SequentialNpy();
+
+  ValidationStats stats;
+  absl::StatusOr<DynamicArray> arr = DecodeDynamicArrayFromNpy(
+      npy, {.require_finite = true, .compute_checksum = true}, &stats);
+  ASSERT_TRUE(arr.ok()) << arr.status();
+  ExpectSequential(*arr);
+  EXPECT_EQ(stats.num_elements, 60);
+  EXPECT_EQ(stats.min, 0.0);
+  EXPECT_EQ(stats.max, 59.0);
+  EXPECT_EQ(stats.checksum,
+            PayloadChecksum(std::as_const(*arr).data(), 60 * sizeof(float)));
+
+  arr = DecodeDynamicArrayFromNpy(npy, {.max_value = 50.0}, &stats);
+  EXPECT_EQ(arr.status().code(), absl::StatusCode::kInvalidArgument);
+  EXPECT_EQ(stats.out_of_range_count, 9);
+}
+
+TEST(NpyDynamicArrayTest, DecodeMappedFile) {
+  const std::string npy = SequentialNpy();
+  const std::filesystem::path path =
+      std::filesystem::path(testing::TempDir()) / "decode_mapped_file.npy";
+  std::ofstream(path, std::ios::binary) << npy;
+
+  absl::StatusOr<std::shared_ptr<const MappedFile>> file =
+      MappedFile::Open(path);
+  ASSERT_TRUE(file.ok()) << file.status();
+  const uint8_t* file_begin = (*file)->data();
+
+  absl::StatusOr<DynamicArray> arr = DecodeDynamicArrayFromNpy(*file);
+  ASSERT_TRUE(arr.ok()) << arr.status();
+  ExpectSequential(*arr);
+  EXPECT_FALSE(arr->IsWritable());
+  EXPECT_GE(std::as_const(*arr).data(), file_begin);
+  EXPECT_LT(std::as_const(*arr).data(), file_begin + (*file)->size());
+
+  // Writing copies the data out of the read-only mapping.
+  arr->Set<float>({0, 0, 0}, 42.0f);
+  EXPECT_TRUE(arr->IsWritable());
+  EXPECT_EQ(arr->At<float>({0, 0, 0}), 42.0f);
+  EXPECT_EQ((*file)->contents(), npy);
+}
+
+TEST(NpyDynamicArrayTest, EncodeMatchesSerializeToNpyString) {
+  nda::array_of_rank<float, 3> arr({5, 4, 3});
+  float value = 0.0f;
+  arr.for_each_value([&](float& v) { v = value++; });
+
+  DynamicArrayRef dar(reinterpret_cast<uint8_t*>(arr.data()),
+                      DataType::kFloat32, DynamicShape({5, 4, 3}));
+  for (bool reverse_axes : {true, false}) {
+    const NpySerializeOptions options = {.reverse_axes = reverse_axes};
+    absl::StatusOr<std::string> npy = EncodeDynamicArrayToNpy(dar, options);
+    ASSERT_TRUE(npy.ok()) << npy.status();
+    EXPECT_EQ(*npy, SerializeToNpyString(arr.cref(), options));
+  }
+
+  absl::StatusOr<DynamicArray> decoded =
+      DecodeDynamicArrayFromNpy(*EncodeDynamicArrayToNpy(dar));
+  ASSERT_TRUE(decoded.ok()) << decoded.status();
+  ExpectSequential(*decoded);
+}
+
+TEST(NpyDynamicArrayTest, DecodeFortranOrder) {
+  nda::array_of_rank<float, 3> arr({5, 4, 3});
+  float value = 0.0f;
+  arr.for_each_value([&](float& v) { v = value++; });
+
+  // With reverse_axes = false the header has fortran_order: True, and the
+  // extents come back in the order they were written.
+  const std::string npy =
+      SerializeToNpyString(arr.cref(), {.reverse_axes = false});
+  ASSERT_NE(npy.find("'fortran_order': True"), std::string::npos);
+  absl::StatusOr<DynamicArray> decoded = DecodeDynamicArrayFromNpy(npy);
+  ASSERT_TRUE(decoded.ok()) << decoded.status();
+  ExpectSequential(*decoded);
+  EXPECT_EQ(decoded->height(), 4);
+}
+
+TEST(NpyDynamicArrayTest, EncodeStridedViews) {
+  DynamicArray arr(DataType::kInt16, {6, 5, 3});
+  for (int64_t i = 0; i < arr.NumElements(); ++i) {
+    arr.data<int16_t>()[i] = static_cast<int16_t>(i);
+  }
+  // An interleaved crop, with non-zero mins.
+  const DynamicArrayRef view =
+      arr.ref().Crop({1, 2, 0}, {4, 3, 3}).Permute({2, 0, 1});
+
+  absl::StatusOr<std::string> npy = EncodeDynamicArrayToNpy(view);
+  ASSERT_TRUE(npy.ok()) << npy.status();
+  absl::StatusOr<DynamicArray> decoded = DecodeDynamicArrayFromNpy(*npy);
+  ASSERT_TRUE(decoded.ok()) << decoded.status();
+  ASSERT_EQ(decoded->rank(), 3);
+  EXPECT_EQ(decoded->shape().extent(0), 3);
+  EXPECT_EQ(decoded->shape().min(1), 0);
+  for (int64_t y = 0; y < 3; ++y) {
+    for (int64_t x = 0; x < 4; ++x) {
+      for (int64_t c = 0; c < 3; ++c) {
+        EXPECT_EQ(decoded->At<int16_t>({c, x, y}),
+                  arr.At<int16_t>({x + 1, y + 2, c}));
+      }
+    }
+  }
+
+  // Into a caller buffer, and in two parts.
+  absl::StatusOr<int64_t> size = NpyEncodedSizeBytes(view);
+  ASSERT_TRUE(size.ok()) << size.status();
+  EXPECT_EQ(*size, npy->size());
+  std::string buffer(*size + 10, 'x');
+  absl::StatusOr<int64_t> written =
+      EncodeDynamicArrayToNpy(view, absl::MakeSpan(buffer));
+  ASSERT_TRUE(written.ok()) << written.status();
+  EXPECT_EQ(*written, *size);
+  EXPECT_EQ(buffer.substr(0, *size), *npy);
+  EXPECT_EQ(EncodeDynamicArrayToNpy(view, absl::MakeSpan(buffer.data(), 100))
+                .status()
+                .code(),
+            absl::StatusCode::kInvalidArgument);
+
+  absl::StatusOr<NpyEncodedParts> parts = EncodeDynamicArrayToNpyParts(view);
+  ASSERT_TRUE(parts.ok()) << parts.status();
+  EXPECT_EQ(absl::StrCat(parts->header,
+                         std::string_view(reinterpret_cast<const char*>(
+                                              parts->payload().data()),
+                                          parts->payload().size())),
+            *npy);
+
+  // A copy reads from its own storage.
+  const NpyEncodedParts copy = *parts;
+  parts->payload_storage = AlignedBuffer();
+  EXPECT_EQ(copy.payload().data(), copy.payload_storage.data());
+  EXPECT_EQ(std::string_view(reinterpret_cast<const char*>(
+                                 copy.payload().data()),
+                             copy.payload().size()),
+            npy->substr(copy.header.size()));
+}
+
+TEST(NpyDynamicArrayTest, EncodeCompactPartsWithoutCopy) {
+  DynamicArray arr(DataType::kUint8, {8, 4});
+  const DynamicArrayRef ref = arr.ref();
+  absl::StatusOr<NpyEncodedParts> parts = EncodeDynamicArrayToNpyParts(ref);
+  ASSERT_TRUE(parts.ok()) << parts.status();
+  EXPECT_EQ(parts->payload().data(), ref.data());
+  EXPECT_EQ(parts->payload().size(), 32);
+  EXPECT_TRUE(parts->payload_storage.empty());
+  EXPECT_EQ(parts->header.size() % 64, 0);
+
+  // Mins only move the data pointer: a crop of the outermost axis is still
+  // compact.
+  for (int64_t i = 0; i < arr.NumElements(); ++i) {
+    arr.data<uint8_t>()[i] = static_cast<uint8_t>(i);
+  }
+  const DynamicArrayRef rows = arr.ref().Crop({0, 1}, {8, 2});
+  parts = EncodeDynamicArrayToNpyParts(rows);
+  ASSERT_TRUE(parts.ok()) << parts.status();
+  EXPECT_EQ(parts->payload().data(), arr.data<uint8_t>() + 8);
+  EXPECT_EQ(parts->payload().size(), 16);
+  EXPECT_TRUE(parts->payload_storage.empty());
+
+  absl::StatusOr<DynamicArray> decoded =
+      DecodeDynamicArrayFromNpy(*EncodeDynamicArrayToNpy(rows));
+  ASSERT_TRUE(decoded.ok()) << decoded.status();
+  EXPECT_EQ(decoded->shape().min(1), 0);
+  EXPECT_EQ(decoded->At<uint8_t>({0, 0}), 8);
+  EXPECT_EQ(decoded->At<uint8_t>({7, 1}), 23);
+}
+
+TEST(NpyDynamicArrayTest, Bfloat16BoolAndComplex) {
+  // ml_dtypes saves bfloat16 as raw 2-byte data.
+  DynamicArray bf16(DataType::kBfloat16, {3, 2});
+  bf16.Set<bfloat16>({2, 1}, bfloat16(-1.5f));
+  DynamicArray b(DataType::kBool, {4});
+  b.Set<bool>({1}, true);
+  DynamicArray c(DataType::kComplex128, {2});
+  c.Set<std::complex<double>>({1}, {1.0, -2.0});
+
+  for (const auto& [arr, descr] :
+       {std::pair<const DynamicArray&, std::string>{bf16, "<V2"},
+        {b, "<b1"},
+        {c, "<c16"}}) {
+    absl::StatusOr<std::string> npy = EncodeDynamicArrayToNpy(arr);
+    ASSERT_TRUE(npy.ok()) << npy.status();
+    EXPECT_NE(npy->find(absl::StrCat("'descr': '", descr, "'")),
+              std::string::npos)
+        << *npy;
+    absl::StatusOr<DynamicArray> decoded = DecodeDynamicArrayFromNpy(*npy);
+    ASSERT_TRUE(decoded.ok()) << decoded.status();
+    EXPECT_EQ(decoded->data_type(), arr.data_type());
+    EXPECT_EQ(decoded->NumElements(), arr.NumElements());
+  }
+
+  absl::StatusOr<DynamicArray> decoded =
+      DecodeDynamicArrayFromNpy(*EncodeDynamicArrayToNpy(bf16));
+  ASSERT_TRUE(decoded.ok()) << decoded.status();
+  EXPECT_EQ(decoded->At<bfloat16>({2, 1}), -1.5f);
+  decoded = DecodeDynamicArrayFromNpy(*EncodeDynamicArrayToNpy(c));
+  ASSERT_TRUE(decoded.ok()) << decoded.status();
+  EXPECT_EQ(decoded->At<std::complex<double>>({1}),
+            std::complex<double>(1.0, -2.0));
+
+  // numpy writes '|' for types without a byte order.
+  std::string npy = *EncodeDynamicArrayToNpy(b);
+  npy.replace(npy.find("<b1"), 1, "|");
+  decoded = DecodeDynamicArrayFromNpy(npy);
+  ASSERT_TRUE(decoded.ok()) << decoded.status();
+  EXPECT_EQ(decoded->data_type(), DataType::kBool);
+  EXPECT_EQ(decoded->At<bool>({1}), true);
+}
+
+TEST(NpyDynamicArrayTest, EncodeEmptyAndScalar) {
+  DynamicArray empty(DataType::kFloat64, {0, 3});
+  absl::StatusOr<std::string> npy = EncodeDynamicArrayToNpy(empty);
+  ASSERT_TRUE(npy.ok()) << npy.status();
+  absl::StatusOr<DynamicArray> decoded = DecodeDynamicArrayFromNpy(*npy);
+  ASSERT_TRUE(decoded.ok()) << decoded.status();
+  EXPECT_EQ(decoded->shape().extent(0), 0);
+  EXPECT_EQ(decoded->shape().extent(1), 3);
+
+  DynamicArray scalar(DataType::kUint32, {});
+  scalar.Set<uint32_t>({}, 7);
+  npy = EncodeDynamicArrayToNpy(scalar);
+  ASSERT_TRUE(npy.ok()) << npy.status();
+  decoded = DecodeDynamicArrayFromNpy(*npy);
+  ASSERT_TRUE(decoded.ok()) << decoded.status();
+  EXPECT_EQ(decoded->rank(), 0);
+  EXPECT_EQ(decoded->At<uint32_t>({}), 7);
+
+  uint8_t data = 0;
+  EXPECT_EQ(EncodeDynamicArrayToNpy(
+                DynamicArrayRef(&data, DataType::kUndefined, DynamicShape({1})))
+                .status()
+                .code(),
+            absl::StatusCode::kInvalidArgument);
+}
+
 }  // namespace
 }  // namespace npy_array